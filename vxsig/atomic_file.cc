@@ -0,0 +1,49 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "vxsig/atomic_file.h"
+
+#include <cstdio>
+#include <fstream>
+#include <string>
+
+#include "absl/strings/str_cat.h"
+
+namespace security::vxsig {
+
+absl::Status WriteFileAtomically(absl::string_view filename,
+                                 absl::Span<const absl::string_view> parts) {
+  const std::string filename_str(filename);
+  const std::string temp_filename = absl::StrCat(filename, ".tmp");
+  {
+    std::ofstream file(temp_filename,
+                       std::ios_base::binary | std::ios_base::trunc);
+    for (const auto& part : parts) {
+      file.write(part.data(), part.size());
+    }
+    if (!file) {
+      std::remove(temp_filename.c_str());
+      return absl::InternalError(absl::StrCat("cannot write ", temp_filename));
+    }
+  }
+  // Replaces an existing file in a single step.
+  if (std::rename(temp_filename.c_str(), filename_str.c_str()) != 0) {
+    std::remove(temp_filename.c_str());
+    return absl::InternalError(absl::StrCat("cannot write ", filename));
+  }
+  return absl::OkStatus();
+}
+
+}  // namespace security::vxsig
@@ -0,0 +1,35 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// Writing files so that concurrent readers never see them partially written.
+
+#ifndef VXSIG_ATOMIC_FILE_H_
+#define VXSIG_ATOMIC_FILE_H_
+
+#include "absl/status/status.h"
+#include "absl/strings/string_view.h"
+#include "absl/types/span.h"
+
+namespace security::vxsig {
+
+// Writes the concatenation of the specified parts to a temporary file next to
+// filename and renames it to filename. Readers see either the previous
+// contents of the file or all of the new ones.
+absl::Status WriteFileAtomically(absl::string_view filename,
+                                 absl::Span<const absl::string_view> parts);
+
+}  // namespace security::vxsig
+
+#endif  // VXSIG_ATOMIC_FILE_H_
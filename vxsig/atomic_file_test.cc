@@ -0,0 +1,64 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "vxsig/atomic_file.h"
+
+#include <cstdlib>
+#include <string>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "third_party/zynamics/binexport/util/filesystem.h"
+#include "third_party/zynamics/binexport/util/status_matchers.h"
+#include "vxsig/mapped_file.h"
+
+using not_absl::IsOk;
+using testing::Eq;
+using testing::IsFalse;
+using testing::Not;
+
+namespace security::vxsig {
+namespace {
+
+std::string ReadTestFile(const std::string& filename) {
+  auto mapped_or = MappedFile::Open(filename);
+  EXPECT_THAT(mapped_or.status(), IsOk());
+  return mapped_or.ok() ? std::string(mapped_or.ValueOrDie()->data()) : "";
+}
+
+TEST(AtomicFileTest, WritesParts) {
+  const std::string filename = JoinPath(getenv("TEST_TMPDIR"), "atomic_parts");
+  ASSERT_THAT(WriteFileAtomically(filename, {"vx", "", "sig"}), IsOk());
+  EXPECT_THAT(ReadTestFile(filename), Eq("vxsig"));
+  EXPECT_THAT(FileExists(filename + ".tmp"), IsFalse());
+}
+
+TEST(AtomicFileTest, ReplacesExistingFile) {
+  const std::string filename =
+      JoinPath(getenv("TEST_TMPDIR"), "atomic_replace");
+  ASSERT_THAT(WriteFileAtomically(filename, {"old contents"}), IsOk());
+  ASSERT_THAT(WriteFileAtomically(filename, {"new"}), IsOk());
+  EXPECT_THAT(ReadTestFile(filename), Eq("new"));
+}
+
+TEST(AtomicFileTest, MissingDirectory) {
+  EXPECT_THAT(
+      WriteFileAtomically(
+          JoinPath(getenv("TEST_TMPDIR"), "does_not_exist", "file"), {"x"}),
+      Not(IsOk()));
+}
+
+}  // namespace
+}  // namespace security::vxsig
@@ -0,0 +1,32 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "vxsig/benchmark_util.h"
+
+#include <cstdlib>
+
+#include "third_party/zynamics/binexport/util/filesystem.h"
+
+namespace security::vxsig {
+
+std::string BenchmarkDataPath(absl::string_view filename) {
+  const char* test_srcdir = getenv("TEST_SRCDIR");
+  if (test_srcdir) {
+    return JoinPath(test_srcdir, "com_google_vxsig/vxsig/testdata", filename);
+  }
+  return JoinPath("vxsig/testdata", filename);
+}
+
+}  // namespace security::vxsig
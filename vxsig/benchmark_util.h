@@ -0,0 +1,99 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// Synthetic inputs for the benchmarks of the signature pipeline and access to
+// the test data that the end-to-end benchmarks run on.
+
+#ifndef VXSIG_BENCHMARK_UTIL_H_
+#define VXSIG_BENCHMARK_UTIL_H_
+
+#include <random>
+#include <string>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+
+namespace security::vxsig {
+
+// Returns a sequence of size elements drawn uniformly from the alphabet
+// [0, alphabet_size).
+template <typename T>
+std::vector<T> RandomSequence(int size, int alphabet_size, std::mt19937* rng) {
+  std::uniform_int_distribution<int> value(0, alphabet_size - 1);
+  std::vector<T> result(size);
+  for (auto& element : result) {
+    element = static_cast<T>(value(*rng));
+  }
+  return result;
+}
+
+// Returns a mutated copy of base. Each element is kept with probability
+// similarity. Otherwise, it is replaced, deleted or preceded by an inserted
+// element with equal probability. The result is thus about as long as base
+// and, for similarity close to 1, shares a long common subsequence with it.
+template <typename T>
+std::vector<T> MutateSequence(const std::vector<T>& base, double similarity,
+                              int alphabet_size, std::mt19937* rng) {
+  std::uniform_real_distribution<double> keep(0, 1);
+  std::uniform_int_distribution<int> mutation(0, 2);
+  std::uniform_int_distribution<int> value(0, alphabet_size - 1);
+  std::vector<T> result;
+  result.reserve(base.size() + base.size() / 8);
+  for (const auto& element : base) {
+    if (keep(*rng) < similarity) {
+      result.push_back(element);
+      continue;
+    }
+    switch (mutation(*rng)) {
+      case 0:  // Replace
+        result.push_back(static_cast<T>(value(*rng)));
+        break;
+      case 1:  // Delete
+        break;
+      default:  // Insert
+        result.push_back(static_cast<T>(value(*rng)));
+        result.push_back(element);
+        break;
+    }
+  }
+  return result;
+}
+
+// Returns num_sequences mutations of a common random sequence of the
+// specified size, see MutateSequence(). This mimics the sequences of related
+// binaries along a match chain.
+template <typename T>
+std::vector<std::vector<T>> RelatedSequences(int num_sequences, int size,
+                                             int alphabet_size,
+                                             double similarity,
+                                             std::mt19937* rng) {
+  const auto base = RandomSequence<T>(size, alphabet_size, rng);
+  std::vector<std::vector<T>> result;
+  result.reserve(num_sequences);
+  for (int i = 0; i < num_sequences; ++i) {
+    result.push_back(MutateSequence(base, similarity, alphabet_size, rng));
+  }
+  return result;
+}
+
+// Returns the path of a file in vxsig/testdata. Uses TEST_SRCDIR if set, so
+// that the benchmarks also work when run as tests. Otherwise, the path is
+// relative to the runfiles directory, which is the working directory of
+// "bazel run".
+std::string BenchmarkDataPath(absl::string_view filename);
+
+}  // namespace security::vxsig
+
+#endif  // VXSIG_BENCHMARK_UTIL_H_
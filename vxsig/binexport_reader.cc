@@ -17,15 +17,18 @@
 #include "base/logging.h"
 
 #include <cstddef>
-#include <fstream>
+#include <limits>
 #include <memory>
 
+#include "absl/hash/internal/city.h"
 #include "absl/memory/memory.h"
 #include "absl/strings/match.h"
 #include "absl/strings/str_cat.h"
 #include "absl/strings/string_view.h"
+#include "google/protobuf/arena.h"
 #include "third_party/zynamics/binexport/binexport.h"
 #include "third_party/zynamics/binexport/util/status_macros.h"
+#include "vxsig/mapped_file.h"
 #include "vxsig/types.h"
 
 using security::binexport::GetInstructionAddress;
@@ -35,8 +38,18 @@ namespace {
 
 enum { kNoMdIndex = -1 };
 
+void AppendIfRendering(std::string* output, absl::string_view value) {
+  if (output) {
+    output->append(value.data(), value.size());
+  }
+}
+
 // TODO(cblichmann): Use BinExport's variant of this code
+// Renders the expression tree at index into output and collects immediates
+// along the way. If output is nullptr, only the immediates are collected.
+// Size prefixes equal to implicit_size_prefix are not rendered.
 void RenderExpression(const BinExport2& proto,
+                      absl::string_view implicit_size_prefix,
                       const BinExport2::Operand& operand, int index,
                       ImmediateSize immediate_size, std::string* output,
                       Immediates* immediates) {
@@ -55,42 +68,39 @@ void RenderExpression(const BinExport2& proto,
       }
       auto num_children = children.size();
       if (symbol == "{") {  // ARM Register lists
-        absl::StrAppend(output, "{");
+        AppendIfRendering(output, "{");
         for (int i = 0; i < num_children; i++) {
-          RenderExpression(proto, operand, index + 1 + i, immediate_size,
-                           output, immediates);
+          RenderExpression(proto, implicit_size_prefix, operand, index + 1 + i,
+                           immediate_size, output, immediates);
           if (i != num_children - 1) {
-            absl::StrAppend(output, ",");
+            AppendIfRendering(output, ",");
           }
         }
-        absl::StrAppend(output, "}");
+        AppendIfRendering(output, "}");
       } else if (num_children == 1) {
         // Only a single child, treat expression as prefix operator (for
         // example: 'ss:').
-        absl::StrAppend(output, symbol);
-        RenderExpression(proto, operand, index + 1, immediate_size, output,
-                         immediates);
+        AppendIfRendering(output, symbol);
+        RenderExpression(proto, implicit_size_prefix, operand, index + 1,
+                         immediate_size, output, immediates);
       } else if (num_children > 1) {
         // Multiple children, treat expression as infix operator ('+' or '*').
-        RenderExpression(proto, operand, index + 1, immediate_size, output,
-                         immediates);
+        RenderExpression(proto, implicit_size_prefix, operand, index + 1,
+                         immediate_size, output, immediates);
         for (int i = 1; i < num_children; i++) {
-          absl::StrAppend(output, symbol);
-          RenderExpression(proto, operand, index + 1 + i, immediate_size,
-                           output, immediates);
+          AppendIfRendering(output, symbol);
+          RenderExpression(proto, implicit_size_prefix, operand, index + 1 + i,
+                           immediate_size, output, immediates);
         }
       }
       break;
     }
     case BinExport2::Expression::SYMBOL:
     case BinExport2::Expression::REGISTER:
-      absl::StrAppend(output, symbol);
+      AppendIfRendering(output, symbol);
       break;
     case BinExport2::Expression::SIZE_PREFIX: {
-      absl::string_view architecture_name(
-          proto.meta_information().architecture_name());
-      const bool long_mode = absl::EndsWith(architecture_name, "64");
-      if ((long_mode && symbol != "b8") || (!long_mode && symbol != "b4")) {
+      if (output && symbol != implicit_size_prefix) {
         absl::StrAppend(output, symbol, " ");
       }
 
@@ -104,38 +114,108 @@ void RenderExpression(const BinExport2& proto,
         immediate_size = kByte;
       }
 
-      RenderExpression(proto, operand, index + 1, immediate_size, output,
-                       immediates);
+      RenderExpression(proto, implicit_size_prefix, operand, index + 1,
+                       immediate_size, output, immediates);
       break;
     }
     case BinExport2::Expression::DEREFERENCE:
-      absl::StrAppend(output, "[");
+      AppendIfRendering(output, "[");
       if (index + 1 < operand.expression_index_size()) {
-        RenderExpression(proto, operand, index + 1, immediate_size, output,
-                         immediates);
+        RenderExpression(proto, implicit_size_prefix, operand, index + 1,
+                         immediate_size, output, immediates);
       }
-      absl::StrAppend(output, "]");
+      AppendIfRendering(output, "]");
       break;
     case BinExport2::Expression::IMMEDIATE_INT:
     case BinExport2::Expression::IMMEDIATE_FLOAT:
     default:
-      absl::StrAppend(output, "0x", absl::Hex(expression.immediate()));
+      if (output) {
+        absl::StrAppend(output, "0x", absl::Hex(expression.immediate()));
+      }
       immediates->emplace_back(expression.immediate(), immediate_size);
       break;
   }
 }
 
+// Stores the address of the entry basic block of the specified flow graph in
+// address. Returns false if the entry basic block has no instructions.
+bool GetFunctionAddress(const BinExport2& proto,
+                        const BinExport2::FlowGraph& flow_graph,
+                        MemoryAddress* address) {
+  const auto& entry_basic_block =
+      proto.basic_block(flow_graph.entry_basic_block_index());
+  if (entry_basic_block.instruction_index_size() == 0) {
+    return false;
+  }
+  *address = GetInstructionAddress(
+      proto, entry_basic_block.instruction_index(0).begin_index());
+  return true;
+}
+
+// Hashes the mnemonics of the flow graph's basic blocks in order, so that the
+// hash does not depend on addresses, immediates or the mnemonic table layout
+// of the file.
+uint64_t GetFunctionHash(const BinExport2& proto,
+                         const BinExport2::FlowGraph& flow_graph) {
+  std::string normalized = absl::StrCat(flow_graph.edge_size(), ":");
+  for (const auto& basic_block_index : flow_graph.basic_block_index()) {
+    for (const auto& instruction_index_range :
+         proto.basic_block(basic_block_index).instruction_index()) {
+      const int begin_index = instruction_index_range.begin_index();
+      const int end_index = instruction_index_range.has_end_index()
+                                ? instruction_index_range.end_index()
+                                : begin_index + 1;
+      for (int i = begin_index; i < end_index; ++i) {
+        absl::StrAppend(
+            &normalized,
+            proto.mnemonic(proto.instruction(i).mnemonic_index()).name(), ",");
+      }
+    }
+    normalized.push_back(';');
+  }
+  return absl::hash_internal::CityHash64(normalized.data(), normalized.size());
+}
+
 }  // namespace
 
 absl::Status ParseBinExport(
     absl::string_view filename,
     const FunctionReceiverCallback& function_receiver,
     const InstructionReceiverCallback& instruction_receiver) {
-  std::ifstream file(std::string(filename), std::ios_base::binary);
-  BinExport2 proto;
-  if (!proto.ParseFromIstream(&file)) {
-    return absl::InternalError(absl::StrCat("failed parsing ", filename));
+  return ParseBinExport(filename, function_receiver, instruction_receiver,
+                        BinExportReaderOptions());
+}
+
+absl::Status ParseBinExport(
+    absl::string_view filename,
+    const FunctionReceiverCallback& function_receiver,
+    const InstructionReceiverCallback& instruction_receiver,
+    const BinExportReaderOptions& options) {
+  // Parse directly from the mapped file into an arena. This avoids copying
+  // the file contents through a stream and makes releasing the decoded
+  // message cheap.
+  google::protobuf::Arena arena;
+  auto& proto = *google::protobuf::Arena::CreateMessage<BinExport2>(&arena);
+  {
+    NA_ASSIGN_OR_RETURN(auto file, MappedFile::Open(filename));
+    const absl::string_view data = file->data();
+    if (data.size() > std::numeric_limits<int>::max()) {
+      return absl::InvalidArgumentError(
+          absl::StrCat("file too large: ", filename));
+    }
+    if (!proto.ParseFromArray(data.data(), data.size())) {
+      return absl::InternalError(absl::StrCat("failed parsing ", filename));
+    }
+  }  // Unmap the file, the proto does not reference its contents.
+
+  const std::string& architecture_name =
+      proto.meta_information().architecture_name();
+  if (options.architecture_receiver) {
+    options.architecture_receiver(architecture_name);
   }
+  // The operand size that is implied by the architecture and not rendered.
+  const absl::string_view implicit_size_prefix =
+      absl::EndsWith(architecture_name, "64") ? "b8" : "b4";
 
   // TODO(cblichmann): Read MD indices if we have them.
   std::map<MemoryAddress, double> md_index_map;
@@ -151,6 +231,13 @@ absl::Status ParseBinExport(
   }
 
   for (const auto& flow_graph : proto.flow_graph()) {
+    MemoryAddress function_address = 0;
+    if (options.function_hash_receiver &&
+        GetFunctionAddress(proto, flow_graph, &function_address)) {
+      options.function_hash_receiver(function_address,
+                                     GetFunctionHash(proto, flow_graph));
+    }
+
     MemoryAddress computed_instruction_address = 0;
     int last_instruction_index = 0;
     for (const auto& basic_block_index : flow_graph.basic_block_index()) {
@@ -175,8 +262,21 @@ absl::Status ParseBinExport(
             basic_block_address = instruction_address;
           }
 
-          std::string disassembly(absl::StrCat(
-              proto.mnemonic(instruction.mnemonic_index()).name(), " "));
+          const auto& raw_bytes = instruction.raw_bytes();
+          computed_instruction_address = instruction_address + raw_bytes.size();
+          last_instruction_index = i;
+          if (options.wanted_instruction &&
+              !options.wanted_instruction(instruction_address)) {
+            continue;
+          }
+
+          std::string disassembly;
+          std::string* disassembly_output = nullptr;
+          if (options.render_disassembly) {
+            disassembly = absl::StrCat(
+                proto.mnemonic(instruction.mnemonic_index()).name(), " ");
+            disassembly_output = &disassembly;
+          }
           Immediates immediates;
           for (int i = 0; i < instruction.operand_index_size(); i++) {
             const auto& operand = proto.operand(instruction.operand_index(i));
@@ -184,21 +284,17 @@ absl::Status ParseBinExport(
               const auto& expression =
                   proto.expression(operand.expression_index(j));
               if (!expression.has_parent_index()) {
-                RenderExpression(proto, operand, j, kByte, &disassembly,
-                                 &immediates);
+                RenderExpression(proto, implicit_size_prefix, operand, j,
+                                 kByte, disassembly_output, &immediates);
               }
             }
             if (i != instruction.operand_index_size() - 1) {
-              absl::StrAppend(&disassembly, ", ");
+              AppendIfRendering(disassembly_output, ", ");
             }
           }
 
-          const auto& raw_bytes = instruction.raw_bytes();
           instruction_receiver(basic_block_address, instruction_address,
                                raw_bytes, disassembly, immediates);
-
-          computed_instruction_address = instruction_address + raw_bytes.size();
-          last_instruction_index = i;
         }
       }
     }
@@ -18,6 +18,7 @@
 #ifndef VXSIG_BINEXPORT_READER_H_
 #define VXSIG_BINEXPORT_READER_H_
 
+#include <cstdint>
 #include <functional>
 
 #include "absl/strings/string_view.h"
@@ -50,6 +51,45 @@ using InstructionReceiverCallback = std::function<void(
     const std::string& raw_bytes, const std::string& disassembly,
     const Immediates& immediates)>;
 
+// Called for each instruction before it is decoded. Returns whether the
+// instruction at the specified address should be passed to the
+// InstructionReceiverCallback.
+using InstructionPredicate =
+    std::function<bool(MemoryAddress instruction_address)>;
+
+// Each time a flow graph is encountered, this callback gets called with the
+// function's entry address and a normalized hash of the function. The hash
+// only depends on the sequence of instruction mnemonics per basic block and
+// on the number of flow graph edges, so it stays the same if a function is
+// relocated or linked into a different binary.
+using FunctionHashReceiverCallback = std::function<void(
+    MemoryAddress function_address, uint64_t function_hash)>;
+
+// Called once per file with the architecture name from the file's meta
+// information, for example "x86-32" or "ARM-64".
+using ArchitectureReceiverCallback =
+    std::function<void(absl::string_view architecture_name)>;
+
+struct BinExportReaderOptions {
+  // If set, only instructions for which this predicate returns true are
+  // decoded and passed to the InstructionReceiverCallback. Operand rendering
+  // and immediate extraction are skipped for all other instructions.
+  InstructionPredicate wanted_instruction;
+
+  // Whether to render the instruction disassembly. If false, the disassembly
+  // passed to the InstructionReceiverCallback is empty. Immediates are
+  // extracted either way.
+  bool render_disassembly = true;
+
+  // If set, receives the normalized hash of each function that has a flow
+  // graph.
+  FunctionHashReceiverCallback function_hash_receiver;
+
+  // If set, receives the architecture name before any function or
+  // instruction is passed to the other callbacks.
+  ArchitectureReceiverCallback architecture_receiver;
+};
+
 // Parses the specified .BinExport file and calls the specified callback
 // function for all encountered functions.
 absl::Status ParseBinExport(
@@ -57,6 +97,13 @@ absl::Status ParseBinExport(
     const FunctionReceiverCallback& function_receiver,
     const InstructionReceiverCallback& instruction_receiver);
 
+// Like above, but only decodes the instructions selected by options.
+absl::Status ParseBinExport(
+    absl::string_view filename,
+    const FunctionReceiverCallback& function_receiver,
+    const InstructionReceiverCallback& instruction_receiver,
+    const BinExportReaderOptions& options);
+
 }  // namespace security::vxsig
 
 #endif  // VXSIG_BINEXPORT_READER_H_
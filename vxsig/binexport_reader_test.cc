@@ -15,9 +15,11 @@
 #include "vxsig/binexport_reader.h"
 
 #include <cstddef>
+#include <cstdint>
 #include <string>
 #include <utility>
 #include <map>
+#include <vector>
 
 #include "absl/strings/str_cat.h"
 #include "gmock/gmock.h"
@@ -26,7 +28,10 @@
 #include "absl/status/status.h"
 #include "third_party/zynamics/binexport/util/status_matchers.h"
 
+using testing::ElementsAre;
 using testing::Eq;
+using testing::Gt;
+using testing::Le;
 using testing::Ne;
 using not_absl::IsOk;
 
@@ -92,4 +97,109 @@ TEST_F(BinExportReaderTest, ParseBinExport2Complex) {
   EXPECT_THAT("\x83\x7D\xFC\x10", Eq(found->second));  // cmp ss:[ebp-4], 10h
 }
 
+TEST_F(BinExportReaderTest, ParseBinExport2WantedInstructions) {
+  std::string file_name = JoinPath(
+      getenv("TEST_SRCDIR"),
+      "com_google_vxsig/vxsig/testdata/"
+      "6d661e63d51d2b38c40d7a16d0cd957a125d397e13b1e50280c3d06bc26bb315."
+      "BinExport");
+
+  BinExportReaderOptions options;
+  options.wanted_instruction = [](MemoryAddress instruction_address) {
+    return instruction_address == 0x004015D6;
+  };
+  options.render_disassembly = false;
+  std::string found_bytes;
+  ASSERT_THAT(
+      ParseBinExport(
+          file_name,
+          [this](const std::string& /* sha256 */, MemoryAddress,
+                 BinExport2::CallGraph::Vertex::Type,
+                 double /* md_index */) { ++num_functions_; },
+          [this, &found_bytes](MemoryAddress /* basic_block_address */,
+                               MemoryAddress instruction_address,
+                               const std::string& instruction_bytes,
+                               const std::string& disassembly,
+                               const Immediates& immediates) {
+            ++num_instructions_;
+            EXPECT_THAT(instruction_address, Eq(0x004015D6));
+            EXPECT_TRUE(disassembly.empty());
+            // Immediates are still extracted without disassembly.
+            EXPECT_THAT(immediates, Ne(Immediates()));
+            found_bytes = instruction_bytes;
+          },
+          options),
+      IsOk());
+  EXPECT_THAT(num_functions_, Eq(624));  // Functions are not filtered
+  EXPECT_THAT(num_instructions_, Eq(1));
+  EXPECT_THAT(found_bytes, Eq("\x83\x7D\xFC\x10"));
+}
+
+TEST_F(BinExportReaderTest, ParseBinExport2FunctionHashes) {
+  std::string file_name = JoinPath(
+      getenv("TEST_SRCDIR"),
+      "com_google_vxsig/vxsig/testdata/"
+      "6d661e63d51d2b38c40d7a16d0cd957a125d397e13b1e50280c3d06bc26bb315."
+      "BinExport");
+
+  std::map<MemoryAddress, uint64_t> function_hashes;
+  BinExportReaderOptions options;
+  options.wanted_instruction = [](MemoryAddress) { return false; };
+  options.function_hash_receiver = [&function_hashes](
+                                       MemoryAddress function_address,
+                                       uint64_t function_hash) {
+    EXPECT_TRUE(function_hashes.emplace(function_address, function_hash).second)
+        << "Duplicate function";
+  };
+  ASSERT_THAT(
+      ParseBinExport(
+          file_name,
+          [this](const std::string& /* sha256 */, MemoryAddress,
+                 BinExport2::CallGraph::Vertex::Type,
+                 double /* md_index */) { ++num_functions_; },
+          [this](MemoryAddress /* basic_block_address */,
+                 MemoryAddress /* instruction_address */,
+                 const std::string& /* instruction_bytes */,
+                 const std::string& /* disassembly */,
+                 const Immediates& /* immediates */) { ++num_instructions_; },
+          options),
+      IsOk());
+  EXPECT_THAT(num_instructions_, Eq(0));
+  EXPECT_THAT(function_hashes.size(), Le(num_functions_));
+  EXPECT_THAT(function_hashes.size(), Gt(0));
+}
+
+TEST_F(BinExportReaderTest, ParseBinExport2Architecture) {
+  std::string file_name = JoinPath(
+      getenv("TEST_SRCDIR"),
+      "com_google_vxsig/vxsig/testdata/"
+      "6d661e63d51d2b38c40d7a16d0cd957a125d397e13b1e50280c3d06bc26bb315."
+      "BinExport");
+
+  std::vector<std::string> architectures;
+  BinExportReaderOptions options;
+  options.wanted_instruction = [](MemoryAddress) { return false; };
+  options.architecture_receiver =
+      [&architectures](absl::string_view architecture_name) {
+        architectures.emplace_back(architecture_name);
+      };
+  ASSERT_THAT(
+      ParseBinExport(
+          file_name,
+          [&architectures](const std::string& /* sha256 */, MemoryAddress,
+                           BinExport2::CallGraph::Vertex::Type,
+                           double /* md_index */) {
+            // The architecture is known before the first function.
+            EXPECT_THAT(architectures.size(), Eq(1));
+          },
+          [](MemoryAddress /* basic_block_address */,
+             MemoryAddress /* instruction_address */,
+             const std::string& /* instruction_bytes */,
+             const std::string& /* disassembly */,
+             const Immediates& /* immediates */) {},
+          options),
+      IsOk());
+  EXPECT_THAT(architectures, ElementsAre("x86-32"));
+}
+
 }  // namespace security::vxsig
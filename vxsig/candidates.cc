@@ -15,6 +15,7 @@
 #include "vxsig/candidates.h"
 
 #include <algorithm>
+#include <cstdint>
 #include <iterator>
 #include <map>
 #include <memory>
@@ -22,20 +23,40 @@
 #include <vector>
 
 #include "absl/base/internal/raw_logging.h"
+#include "absl/container/flat_hash_set.h"
 #include "absl/memory/memory.h"
 #include "absl/strings/str_format.h"
+#include "absl/time/clock.h"
 #include "vxsig/common_subsequence.h"
 #include "vxsig/types.h"
 
 namespace security::vxsig {
 namespace {
 
-bool IsCandidateFunction(const MatchedFunction& func) {
+// Returns whether the function only consists of a single instruction. These
+// are usually jump thunks that the disassembler did not recognize as such.
+bool IsThunkLike(const MatchedFunction& func) {
+  return func.basic_blocks.size() == 1 &&
+         (*func.basic_blocks.begin())->instructions.size() == 1;
+}
+
+bool IsCandidateFunction(const MatchedFunction& func,
+                         const CandidatePruning& pruning) {
   return func.type == BinExport2::CallGraph::Vertex::NORMAL &&
-         !func.basic_blocks.empty();
+         !func.basic_blocks.empty() &&
+         !(pruning.skip_thunks && IsThunkLike(func));
+}
+
+int64_t InstructionBytes(const MatchedBasicBlock& bb) {
+  int64_t num_bytes = 0;
+  for (const auto* instr : bb.instructions) {
+    num_bytes += instr->raw_instruction_bytes.size();
+  }
+  return num_bytes;
 }
 
-bool IsCandidateBasicBlock(const MatchedBasicBlock& bb) {
+bool IsCandidateBasicBlock(const MatchedBasicBlock& bb,
+                           const CandidatePruning& pruning) {
   if(bb.instructions.empty()) {
     ABSL_RAW_LOG(FATAL, "%s",
                  absl::StrFormat("Basic block at 0x%08X has no instructions",
@@ -44,72 +65,225 @@ bool IsCandidateBasicBlock(const MatchedBasicBlock& bb) {
   }
   // If we ever implement a refcount, add a check whether it is > 0 (using
   // CHECK_GT).
-  return bb.match.id != 0;
+  return bb.match.id != 0 && (pruning.min_basic_block_bytes <= 0 ||
+                              InstructionBytes(bb) >=
+                                  pruning.min_basic_block_bytes);
+}
+
+// Returns whether none of the sequences contains an id more than once. This
+// is the case for ids assigned by PropagateIds(), unless basic blocks are
+// shared between functions.
+bool HasDistinctIds(const std::vector<IdentSequence>& sequences) {
+  absl::flat_hash_set<Ident> seen;
+  for (const auto& sequence : sequences) {
+    seen.clear();
+    for (const Ident id : sequence) {
+      if (!seen.insert(id).second) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+// Solves k-LCS on the specified id sequences, using the faster algorithm for
+// permutations if possible. Fills stats if it is non-null.
+void CommonIdSubsequence(const std::vector<IdentSequence>& sequences,
+                         IdentSequence* result, ThreadPool* pool,
+                         CommonSubsequenceStats* stats) {
+  const absl::Time start = absl::Now();
+  if (HasDistinctIds(sequences)) {
+    CommonSubsequence<LcsElements::kDistinct>(
+        sequences, back_inserter(*result), pool);
+  } else {
+    CommonSubsequence(sequences, back_inserter(*result), pool);
+  }
+  if (stats) {
+    *stats = CommonSubsequenceStats();
+    stats->time = absl::Now() - start;
+    stats->num_sequences = sequences.size();
+    for (const auto& sequence : sequences) {
+      stats->total_input_size += sequence.size();
+      stats->max_input_size =
+          std::max<int64_t>(stats->max_input_size, sequence.size());
+    }
+    stats->output_size = result->size();
+  }
+}
+
+// Returns the ids of the candidate functions of a column in address order.
+IdentSequence FunctionIdSequence(const MatchChainColumn& column,
+                                 const CandidatePruning& pruning) {
+  IdentSequence ids;
+  for (const auto& func_index_entry : column.functions_by_address()) {
+    const auto& func = *func_index_entry.second;
+    if (IsCandidateFunction(func, pruning)) {
+      ids.push_back(func.match.id);
+    }
+  }
+  return ids;
+}
+
+// Returns the ids of the candidate basic blocks of the specified functions in
+// a column in address order.
+IdentSequence BasicBlockIdSequence(MatchChainColumn* column,
+                                   const IdentSequence& func_candidate_ids,
+                                   const CandidatePruning& pruning) {
+  using MatchedBasicBlockWord = std::vector<MatchedBasicBlock*>;
+  MatchedBasicBlockWord bb_word;
+  IdentSequence bb_word_ids;
+
+  // Build a basic block "word" consisting of per-binary basic block ids of
+  // the respective candidate function.
+  for (const auto& func_candidate : func_candidate_ids) {
+    auto* func = column->FindFunctionById(func_candidate);
+    ABSL_RAW_CHECK(func, "No function for candidate");
+
+    bb_word.insert(bb_word.end(), func->basic_blocks.begin(),
+                   func->basic_blocks.end());
+  }
+
+  // Due to potential basic block sharing and function overlaps the basic
+  // block word must be sorted again.
+  std::sort(bb_word.begin(), bb_word.end(), MatchCompare<MatchedBasicBlock>());
+
+  for (const auto& bb : bb_word) {
+    if (IsCandidateBasicBlock(*bb, pruning)) {
+      bb_word_ids.push_back(bb->match.id);
+    }
+  }
+  return bb_word_ids;
+}
+
+// Keeps the pruning.max_functions function candidates that have the most
+// instruction bytes in candidate basic blocks in the specified column. The
+// order of the candidates is kept.
+void KeepTopFunctions(MatchChainColumn* column,
+                      const CandidatePruning& pruning,
+                      IdentSequence* func_candidate_ids) {
+  if (pruning.max_functions <= 0 ||
+      func_candidate_ids->size() <= pruning.max_functions) {
+    return;
+  }
+  std::vector<int64_t> coverage;
+  coverage.reserve(func_candidate_ids->size());
+  for (const auto& func_candidate : *func_candidate_ids) {
+    const auto* func = column->FindFunctionById(func_candidate);
+    ABSL_RAW_CHECK(func, "No function for candidate");
+    int64_t num_bytes = 0;
+    for (const auto* bb : func->basic_blocks) {
+      if (IsCandidateBasicBlock(*bb, pruning)) {
+        num_bytes += InstructionBytes(*bb);
+      }
+    }
+    coverage.push_back(num_bytes);
+  }
+  std::vector<int> order(coverage.size());
+  for (int i = 0; i < order.size(); ++i) {
+    order[i] = i;
+  }
+  std::stable_sort(order.begin(), order.end(), [&coverage](int a, int b) {
+    return coverage[a] > coverage[b];
+  });
+  std::vector<bool> kept(order.size());
+  for (int i = 0; i < pruning.max_functions; ++i) {
+    kept[order[i]] = true;
+  }
+  int num_kept = 0;
+  for (int i = 0; i < kept.size(); ++i) {
+    if (kept[i]) {
+      (*func_candidate_ids)[num_kept++] = (*func_candidate_ids)[i];
+    }
+  }
+  func_candidate_ids->resize(num_kept);
 }
 
 }  // namespace
 
 void ComputeFunctionCandidates(const MatchChainTable& match_chain_table,
-                               IdentSequence* func_candidate_ids) {
+                               const CandidatePruning& pruning,
+                               IdentSequence* func_candidate_ids,
+                               ThreadPool* pool,
+                               CommonSubsequenceStats* stats) {
   std::vector<IdentSequence> func_ids;
   func_ids.reserve(match_chain_table.size());
-
   for (const auto& column : match_chain_table) {
-    func_ids.emplace_back();
-    auto& column_ids = func_ids.back();
-
-    for (const auto& func_index_entry : column->functions_by_address()) {
-      const auto& func = *func_index_entry.second;
-      if (IsCandidateFunction(func)) {
-        column_ids.push_back(func.match.id);
-      }
-    }
+    func_ids.push_back(FunctionIdSequence(*column, pruning));
   }
 
   // Solve k-LCS on resulting permutations to obtain a stable function order.
-  CommonSubsequence(func_ids, back_inserter(*func_candidate_ids));
+  CommonIdSubsequence(func_ids, func_candidate_ids, pool, stats);
+  if (!match_chain_table.empty()) {
+    KeepTopFunctions(match_chain_table.front().get(), pruning,
+                     func_candidate_ids);
+  }
+}
+
+void ComputeFunctionCandidates(const MatchChainTable& match_chain_table,
+                               IdentSequence* func_candidate_ids) {
+  ComputeFunctionCandidates(match_chain_table, CandidatePruning(),
+                            func_candidate_ids, /*pool=*/nullptr);
 }
 
 void ComputeBasicBlockCandidates(const MatchChainTable& match_chain_table,
+                                 const CandidatePruning& pruning,
                                  const IdentSequence& func_candidate_ids,
-                                 IdentSequence* bb_candidate_ids) {
-  using MatchedBasicBlockWord = std::vector<MatchedBasicBlock*>;
+                                 IdentSequence* bb_candidate_ids,
+                                 ThreadPool* pool,
+                                 CommonSubsequenceStats* stats) {
   std::vector<IdentSequence> bb_ids;
   bb_ids.reserve(match_chain_table.size());
-
   for (const auto& column : match_chain_table) {
-    MatchedBasicBlockWord bb_word;
-    IdentSequence bb_word_ids;
-
-    // Build a basic block "word" consisting of per-binary basic block ids of
-    // the respective candidate function.
-    for (const auto& func_candidate : func_candidate_ids) {
-      auto* func = column->FindFunctionById(func_candidate);
-      ABSL_RAW_CHECK(func, "No function for candidate");
+    bb_ids.push_back(
+        BasicBlockIdSequence(column.get(), func_candidate_ids, pruning));
+  }
 
-      bb_word.insert(bb_word.end(), func->basic_blocks.begin(),
-                     func->basic_blocks.end());
-    }
+  // Solve k-LCS on resulting permutations to obtain a stable basic block order.
+  CommonIdSubsequence(bb_ids, bb_candidate_ids, pool, stats);
+}
 
-    // Due to potential basic block sharing and function overlaps the basic
-    // block word must be sorted again.
-    std::sort(bb_word.begin(), bb_word.end(),
-              MatchCompare<MatchedBasicBlock>());
+void ComputeBasicBlockCandidates(const MatchChainTable& match_chain_table,
+                                 const IdentSequence& func_candidate_ids,
+                                 IdentSequence* bb_candidate_ids) {
+  ComputeBasicBlockCandidates(match_chain_table, CandidatePruning(),
+                              func_candidate_ids, bb_candidate_ids,
+                              /*pool=*/nullptr);
+}
 
-    for (const auto& bb : bb_word) {
-      if (IsCandidateBasicBlock(*bb)) {
-        bb_word_ids.push_back(bb->match.id);
-      }
-    }
-    bb_ids.push_back(bb_word_ids);
+void NarrowFunctionCandidates(absl::Span<MatchChainColumn* const> columns,
+                              const CandidatePruning& pruning,
+                              IdentSequence* func_candidate_ids,
+                              ThreadPool* pool,
+                              CommonSubsequenceStats* stats) {
+  std::vector<IdentSequence> func_ids;
+  func_ids.reserve(columns.size() + 1);
+  func_ids.push_back(std::move(*func_candidate_ids));
+  for (const auto* column : columns) {
+    func_ids.push_back(FunctionIdSequence(*column, pruning));
   }
+  func_candidate_ids->clear();
+  CommonIdSubsequence(func_ids, func_candidate_ids, pool, stats);
+}
 
-  // Solve k-LCS on resulting permutations to obtain a stable basic block order.
-  CommonSubsequence(bb_ids, back_inserter(*bb_candidate_ids));
+void NarrowBasicBlockCandidates(absl::Span<MatchChainColumn* const> columns,
+                                const CandidatePruning& pruning,
+                                const IdentSequence& func_candidate_ids,
+                                IdentSequence* bb_candidate_ids,
+                                ThreadPool* pool,
+                                CommonSubsequenceStats* stats) {
+  std::vector<IdentSequence> bb_ids;
+  bb_ids.reserve(columns.size() + 1);
+  bb_ids.push_back(std::move(*bb_candidate_ids));
+  for (auto* column : columns) {
+    bb_ids.push_back(BasicBlockIdSequence(column, func_candidate_ids, pruning));
+  }
+  bb_candidate_ids->clear();
+  CommonIdSubsequence(bb_ids, bb_candidate_ids, pool, stats);
 }
 
 void FilterBasicBlockOverlaps(const MatchChainTable& match_chain_table,
-                              IdentSequence* bb_candidate_ids) {
+                              IdentSequence* bb_candidate_ids,
+                              ThreadPool* pool) {
   // TODO(cblichmann): Given the basic block match chain below (assume one
   // instruction per basic block), it is a priori unclear what the best
   // filtering strategy is.
@@ -125,28 +299,56 @@ void FilterBasicBlockOverlaps(const MatchChainTable& match_chain_table,
   // combinations of filtered basic block id sets and select the one with the
   // maximal cardinality.
 
-  for (const auto& column : match_chain_table) {
+  // Resolve the basic blocks of all candidates up front, this is independent
+  // for each column.
+  const int num_candidates = bb_candidate_ids->size();
+  std::vector<std::vector<const MatchedBasicBlock*>> column_bbs(
+      match_chain_table.size());
+  ParallelFor(match_chain_table.size(), pool,
+              [&match_chain_table, bb_candidate_ids, &column_bbs](int i) {
+                auto& bbs = column_bbs[i];
+                bbs.reserve(bb_candidate_ids->size());
+                for (const auto& bb_id : *bb_candidate_ids) {
+                  const auto* bb =
+                      match_chain_table[i]->FindBasicBlockById(bb_id);
+                  ABSL_RAW_CHECK(bb, "No basic block for candidate");
+                  bbs.push_back(bb);
+                }
+              });
+
+  // Each column only looks at the candidates that the previous columns kept,
+  // so the columns are scanned in order. Rejected candidates are marked and
+  // removed in a single pass at the end.
+  std::vector<bool> rejected(num_candidates);
+  for (const auto& bbs : column_bbs) {
     MemoryAddress last_addr = 0;
-    for (auto it = bb_candidate_ids->begin(); it != bb_candidate_ids->end();) {
-      const auto* bb = column->FindBasicBlockById(*it);
-      ABSL_RAW_CHECK(bb, "No basic block for candidate");
-
-      bool skip_bb = false;
-      for (const auto instr : bb->instructions) {
-        skip_bb = instr->match.address <= last_addr;
-        if (skip_bb) {
+    for (int i = 0; i < num_candidates; ++i) {
+      if (rejected[i]) {
+        continue;
+      }
+      for (const auto instr : bbs[i]->instructions) {
+        if (instr->match.address <= last_addr) {
+          rejected[i] = true;
           break;
         }
         last_addr = instr->match.address;
       }
+    }
+  }
 
-      if (skip_bb) {
-        it = bb_candidate_ids->erase(it);
-      } else {
-        ++it;
-      }
+  int num_kept = 0;
+  for (int i = 0; i < num_candidates; ++i) {
+    if (!rejected[i]) {
+      (*bb_candidate_ids)[num_kept++] = (*bb_candidate_ids)[i];
     }
   }
+  bb_candidate_ids->resize(num_kept);
+}
+
+void FilterBasicBlockOverlaps(const MatchChainTable& match_chain_table,
+                              IdentSequence* bb_candidate_ids) {
+  FilterBasicBlockOverlaps(match_chain_table, bb_candidate_ids,
+                           /*pool=*/nullptr);
 }
 
 }  // namespace security::vxsig
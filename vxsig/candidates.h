@@ -18,23 +18,93 @@
 #ifndef VXSIG_CANDIDATES_H_
 #define VXSIG_CANDIDATES_H_
 
+#include <cstdint>
+
+#include "absl/time/time.h"
+#include "absl/types/span.h"
 #include "vxsig/match_chain_table.h"
+#include "vxsig/thread_pool.h"
 #include "vxsig/types.h"
 
 namespace security::vxsig {
 
-// Computes function candidates filtered by the specified predicate callback.
+// Input and output sizes of the common subsequence computation of the
+// functions below and the time it took.
+struct CommonSubsequenceStats {
+  int num_sequences = 0;
+  int64_t total_input_size = 0;
+  int64_t max_input_size = 0;
+  int64_t output_size = 0;
+  absl::Duration time;
+};
+
+// Limits on the candidates that go into the common subsequence computations.
+// Most of what these prune would be dropped later anyway, by the minimum
+// piece length or by signature trimming. The defaults keep all candidates.
+struct CandidatePruning {
+  // Basic blocks with fewer instruction bytes are not candidates.
+  int min_basic_block_bytes = 0;
+
+  // If positive, only this many function candidates are kept, the ones with
+  // the most instruction bytes in candidate basic blocks in the first column.
+  int max_functions = 0;
+
+  // Whether to skip functions that consist of a single instruction. These are
+  // usually thunks that are not typed as such.
+  bool skip_thunks = false;
+};
+
+// Computes function candidates, leaving out the functions and basic blocks
+// that pruning excludes. If pool is non-null, the common subsequence
+// computation runs on it. If stats is non-null, it is filled with statistics
+// of the computation.
+void ComputeFunctionCandidates(const MatchChainTable& match_chain_table,
+                               const CandidatePruning& pruning,
+                               IdentSequence* func_candidate_ids,
+                               ThreadPool* pool,
+                               CommonSubsequenceStats* stats = nullptr);
 void ComputeFunctionCandidates(const MatchChainTable& match_chain_table,
                                IdentSequence* func_candidate_ids);
 
 // Computes basic block candidates for the basic blocks of the given candidate
-// functions.
+// functions, pruned like above. If pool is non-null, the common subsequence
+// computation runs on it. If stats is non-null, it is filled like above.
+void ComputeBasicBlockCandidates(const MatchChainTable& match_chain_table,
+                                 const CandidatePruning& pruning,
+                                 const IdentSequence& func_candidate_ids,
+                                 IdentSequence* bb_candidate_ids,
+                                 ThreadPool* pool,
+                                 CommonSubsequenceStats* stats = nullptr);
 void ComputeBasicBlockCandidates(const MatchChainTable& match_chain_table,
                                  const IdentSequence& func_candidate_ids,
                                  IdentSequence* bb_candidate_ids);
 
+// Narrows the function and basic block candidates computed for a table to the
+// ones that are also common to the specified columns, which are appended to
+// the table. Instead of solving k-LCS over all columns again, the existing
+// candidates stand in for the columns they were computed from and form one
+// more sequence, next to the ones of the new columns. The result is a common
+// subsequence of all columns, but not necessarily the longest one. The basic
+// block candidates must be narrowed with the narrowed function candidates.
+// The pruning should be the same as for the existing candidates.
+void NarrowFunctionCandidates(absl::Span<MatchChainColumn* const> columns,
+                              const CandidatePruning& pruning,
+                              IdentSequence* func_candidate_ids,
+                              ThreadPool* pool,
+                              CommonSubsequenceStats* stats = nullptr);
+void NarrowBasicBlockCandidates(absl::Span<MatchChainColumn* const> columns,
+                                const CandidatePruning& pruning,
+                                const IdentSequence& func_candidate_ids,
+                                IdentSequence* bb_candidate_ids,
+                                ThreadPool* pool,
+                                CommonSubsequenceStats* stats = nullptr);
+
 // Filters overlapping basic blocks from a list of basicblock candidates.
 // Overlapping basic blocks mean basicblocks that share common instructions.
+// If pool is non-null, the basic blocks of the candidates are looked up on it.
+void FilterBasicBlockOverlaps(const MatchChainTable& match_chain_table,
+                              IdentSequence* bb_candidate_ids,
+                              ThreadPool* pool);
 void FilterBasicBlockOverlaps(const MatchChainTable& match_chain_table,
                               IdentSequence* bb_candidate_ids);
 
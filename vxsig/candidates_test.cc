@@ -19,9 +19,12 @@
 
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
+#include "vxsig/thread_pool.h"
 
 using testing::AnyOf;
 using testing::ElementsAre;
+using testing::ElementsAreArray;
+using testing::IsEmpty;
 using testing::IsNull;
 using testing::Not;
 
@@ -100,6 +103,60 @@ TEST_F(CandidatesTest, ComputeBasicBlockCandidates) {
   EXPECT_THAT(bb_candidate_ids, ElementsAre(2, 3, 4, 5));
 }
 
+TEST_F(CandidatesTest, NarrowCandidates) {
+  // Candidates of an earlier table that only had the first column, narrowed
+  // by appending the second one.
+  IdentSequence func_candidate_ids = {1, 2, 3, 4, 5};
+  NarrowFunctionCandidates({table_[1].get()}, CandidatePruning(),
+                           &func_candidate_ids, /*pool=*/nullptr);
+  // 0x40001000 moves function 1 to the end in the second column.
+  EXPECT_THAT(func_candidate_ids, ElementsAre(2, 3, 4, 5));
+
+  IdentSequence bb_candidate_ids = {1, 2, 3, 4, 5};
+  NarrowBasicBlockCandidates({table_[1].get()}, CandidatePruning(),
+                             func_candidate_ids, &bb_candidate_ids,
+                             /*pool=*/nullptr);
+  EXPECT_THAT(bb_candidate_ids, ElementsAre(2, 3, 4, 5));
+}
+
+TEST_F(CandidatesTest, PruneCandidates) {
+  // Every function in the fixture consists of a single instruction.
+  CandidatePruning pruning;
+  pruning.skip_thunks = true;
+  IdentSequence func_candidate_ids;
+  ComputeFunctionCandidates(table_, pruning, &func_candidate_ids,
+                            /*pool=*/nullptr);
+  EXPECT_THAT(func_candidate_ids, IsEmpty());
+
+  // Give the instructions of each chain a size.
+  const absl::string_view kBytes[kNumSimpleMatches] = {"ab", "abcd", "ab",
+                                                       "abcdefgh", "abcd"};
+  for (int i = 0; i < kNumSimpleMatches; ++i) {
+    for (int j = 0; j < kNumFakeBinaries; ++j) {
+      auto* bb = table_[j]->FindBasicBlockByAddress(
+          kSimpleChains[i * kNumFakeBinaries + j]);
+      ASSERT_THAT(bb, Not(IsNull()));
+      for (auto* instr : bb->instructions) {
+        instr->raw_instruction_bytes = kBytes[i];
+      }
+    }
+  }
+  pruning.skip_thunks = false;
+  pruning.min_basic_block_bytes = 3;
+  IdentSequence bb_candidate_ids;
+  ComputeBasicBlockCandidates(table_, pruning, {1, 2, 3, 4, 5},
+                              &bb_candidate_ids, /*pool=*/nullptr);
+  EXPECT_THAT(bb_candidate_ids, ElementsAre(2, 4, 5));
+
+  // Keeps the functions with the most bytes, in their original order. Of
+  // the two with four bytes, the first one is kept.
+  pruning.min_basic_block_bytes = 0;
+  pruning.max_functions = 2;
+  ComputeFunctionCandidates(table_, pruning, &func_candidate_ids,
+                            /*pool=*/nullptr);
+  EXPECT_THAT(func_candidate_ids, ElementsAre(2, 4));
+}
+
 TEST_F(CandidatesTest, FilterBasicBlockOverlaps) {
   // Insert an overlapping instruction into an existing basic block.
   auto* bb = table_[1]->FindBasicBlockByAddress(0x10003000);
@@ -120,4 +177,21 @@ TEST_F(CandidatesTest, FilterBasicBlockOverlaps) {
   EXPECT_THAT(bb_candidate_ids, AnyOf(ElementsAre(1), ElementsAre(3, 4, 5)));
 }
 
+TEST_F(CandidatesTest, FilterBasicBlockOverlapsOnThreadPool) {
+  auto* bb = table_[1]->FindBasicBlockByAddress(0x10003000);
+  ASSERT_THAT(bb, Not(IsNull()));
+  table_[1]->InsertInstructionMatch(bb, {0x10002000, 0});
+
+  IdentSequence bb_candidate_ids;
+  for (int i = 1; i <= kNumSimpleMatches; ++i) {
+    bb_candidate_ids.push_back(i);
+  }
+  IdentSequence expected = bb_candidate_ids;
+  FilterBasicBlockOverlaps(table_, &expected);
+
+  ThreadPool pool(2);
+  FilterBasicBlockOverlaps(table_, &bb_candidate_ids, &pool);
+  EXPECT_THAT(bb_candidate_ids, ElementsAreArray(expected));
+}
+
 }  // namespace security::vxsig
@@ -17,9 +17,10 @@
 #include <algorithm>
 #include <cstddef>
 #include <cstdint>
+#include <string>
 
-#include "absl/strings/escaping.h"
 #include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
 #include "third_party/zynamics/binexport/util/status_macros.h"
 
 namespace security::vxsig {
@@ -34,74 +35,87 @@ enum {
 
 static constexpr char kClamAvWildcard[] = "*";
 
+// Appends the wildcard that matches the bytes following piece, see
+// RawSignature::Piece.
+void AppendWildcard(const RawSignature::Piece& piece, std::string* output) {
+  if (piece.max_qualifier() < 0) {
+    // The minimum of unbounded wildcards is not rendered, which only makes
+    // them slightly more permissive.
+    output->append(kClamAvWildcard);
+  } else if (piece.min_qualifier() == piece.max_qualifier()) {
+    absl::StrAppend(output, "{", piece.min_qualifier(), "}");
+  } else if (piece.min_qualifier() == 0) {
+    absl::StrAppend(output, "{-", piece.max_qualifier(), "}");
+  } else {
+    absl::StrAppend(output, "{", piece.min_qualifier(), "-",
+                    piece.max_qualifier(), "}");
+  }
+}
+
 }  // namespace
 
 absl::Status ClamAvSignatureFormatter::DoFormat(
-    Signature* signature) const {
-  std::string* signature_data =
-      signature->mutable_clam_av_signature()->mutable_data();
+    const RawSignature& raw_signature, Signature* signature) const {
+  return FormatTo(signature->definition(), raw_signature,
+                  signature->mutable_clam_av_signature()->mutable_data());
+}
 
+absl::Status ClamAvSignatureFormatter::FormatTo(
+    const SignatureDefinition& definition, const RawSignature& raw_signature,
+    std::string* output) const {
   // Avoid too many reallocations.
-  signature_data->clear();
-  signature_data->reserve(static_cast<int>(kClamAvMaxLineLen));
+  output->clear();
+  output->reserve(static_cast<int>(kClamAvMaxLineLen));
 
-  absl::StrAppend(signature_data, signature->definition().detection_name(),
-                  ":0:*:");
+  absl::StrAppend(output, definition.detection_name(), ":0:*:");
 
   RawSignature subset_regex;
-  NA_RETURN_IF_ERROR(
-      GetRelevantSignatureSubset(*signature, kClamAvMinBytes, &subset_regex));
+  NA_RETURN_IF_ERROR(GetRelevantSignatureSubset(
+      definition, raw_signature, kClamAvMinBytes, goodware_index(),
+      &subset_regex));
 
   int max_copy_bytes = 0;
-  bool needs_wildcard = false;
+  const RawSignature::Piece* previous_piece = nullptr;
   for (const auto& piece : subset_regex.piece()) {
+    // Render the wildcard first, so that its length is known.
+    const size_t wildcard_start = output->size();
+    if (previous_piece) {
+      AppendWildcard(*previous_piece, output);
+    }
     // Append wildcard and hexadecimal signature piece.
-    max_copy_bytes = (kClamAvMaxLineLen - signature_data->size() -
-                      (needs_wildcard ? ABSL_ARRAYSIZE(kClamAvWildcard) : 0)) /
+    max_copy_bytes = (static_cast<int>(kClamAvMaxLineLen) -
+                      static_cast<int>(output->size())) /
                      2 /* Two hex bytes per byte */;
     if (max_copy_bytes < kClamAvMinBytes) {
       // Break if the signature would become longer than 8191 bytes (including
       // signature name), this is a ClamAV limitation.
+      output->resize(wildcard_start);
       break;
     }
-    if (needs_wildcard) {
-      absl::StrAppend(signature_data, kClamAvWildcard);
-    }
-    const auto piece_bytes(piece.bytes().substr(0, max_copy_bytes));
-    int start_mask = signature_data->size();
-    absl::StrAppend(signature_data, absl::BytesToHexString(piece_bytes));
-    for (const auto& masked_nibble : piece.masked_nibble()) {
-      if (masked_nibble / 2 < max_copy_bytes) {
-        (*signature_data)[start_mask + masked_nibble] = '?';
-      }
-    }
-    needs_wildcard = true;
+    AppendMaskedHex(absl::string_view(piece.bytes()).substr(0, max_copy_bytes),
+                    piece.masked_nibble(), output);
+    previous_piece = &piece;
   }
   // A return value of false can only happen if the detection name is overly
   // long.
-  if (signature_data->size() > kClamAvMaxLineLen) {
+  if (output->size() > kClamAvMaxLineLen) {
     return absl::OutOfRangeError(
-        absl::StrCat("Signature data size too long: ", signature_data->size(),
-                     " > ", kClamAvMaxLineLen));
+        absl::StrCat("Signature data size too long: ", output->size(), " > ",
+                     kClamAvMaxLineLen));
   }
   return absl::OkStatus();
 }
 
-absl::Status ClamAvSignatureFormatter::DoFormatDatabase(
-    const Signatures& signatures, std::string* database) const {
-  if (!database) {
-    return absl::InvalidArgumentError("Database must not be nullptr");
-  }
-  Signature format_signature;
-  for (const auto& signature : signatures.signature()) {
-    const auto* signature_data = &signature.clam_av_signature().data();
-    if (signature_data->empty()) {
-      format_signature = signature;
-      NA_RETURN_IF_ERROR(Format(&format_signature));
-      signature_data = &format_signature.clam_av_signature().data();
-    }
-    absl::StrAppend(database, *signature_data, "\n");
+absl::Status ClamAvSignatureFormatter::DoFormatDatabaseEntry(
+    const Signature& signature, std::string* entry) const {
+  const auto& signature_data = signature.clam_av_signature().data();
+  if (signature_data.empty()) {
+    NA_RETURN_IF_ERROR(
+        FormatTo(signature.definition(), signature.raw_signature(), entry));
+  } else {
+    entry->assign(signature_data);
   }
+  entry->push_back('\n');
   return absl::OkStatus();
 }
 
@@ -25,10 +25,17 @@ namespace security::vxsig {
 // details.
 class ClamAvSignatureFormatter : public SignatureFormatter {
  private:
-  absl::Status DoFormat(Signature* signature) const override;
+  absl::Status DoFormat(const RawSignature& raw_signature,
+                        Signature* signature) const override;
 
-  absl::Status DoFormatDatabase(const Signatures& signatures,
-                                    std::string* database) const override;
+  absl::Status DoFormatDatabaseEntry(const Signature& signature,
+                                     std::string* entry) const override;
+
+  // Formats the signature with the specified definition and raw signature into
+  // output, replacing its contents.
+  absl::Status FormatTo(const SignatureDefinition& definition,
+                        const RawSignature& raw_signature,
+                        std::string* output) const;
 };
 
 }  // namespace security::vxsig
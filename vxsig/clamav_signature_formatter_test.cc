@@ -12,10 +12,15 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
 #include <memory>
+#include <string>
 
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
+#include "third_party/zynamics/binexport/util/filesystem.h"
 #include "third_party/zynamics/binexport/util/status_matchers.h"
 #include "vxsig/signature_formatter.h"
 #include "vxsig/signature_test_util.h"
@@ -58,6 +63,22 @@ TEST_F(ClamAvSignatureFormatterTest, TestStripSingleByte) {
               Eq("test:0:*:31323334*35363738"));
 }
 
+TEST_F(ClamAvSignatureFormatterTest, TestBoundedWildcards) {
+  auto* definition = signature_.mutable_definition();
+  definition->set_detection_name("test");
+  definition->set_min_piece_length(2);
+  auto* raw_signature = signature_.mutable_raw_signature();
+  AddSignaturePieces({"12", "34", "56", "78", "9"}, raw_signature);
+  raw_signature->mutable_piece(0)->set_max_qualifier(3);
+  raw_signature->mutable_piece(1)->set_min_qualifier(2);
+  raw_signature->mutable_piece(1)->set_max_qualifier(2);
+  raw_signature->mutable_piece(2)->set_min_qualifier(1);
+  raw_signature->mutable_piece(2)->set_max_qualifier(4);
+  ASSERT_THAT(formatter_->Format(&signature_), IsOk());
+  EXPECT_THAT(signature_.clam_av_signature().data(),
+              Eq("test:0:*:3132{-3}3334{2}3536{1-4}3738"));
+}
+
 TEST_F(ClamAvSignatureFormatterTest, TestDatabaseSingleSignature) {
   Signatures signatures;
   auto* signature = signatures.add_signature();
@@ -88,4 +109,29 @@ TEST_F(ClamAvSignatureFormatterTest, TestDatabaseMultipleSignatures) {
   EXPECT_THAT(database, Eq("one:0:*:3132*3334\ntwo:0:*:3536*3738\n"));
 }
 
+TEST_F(ClamAvSignatureFormatterTest, TestDatabaseFileSink) {
+  Signatures signatures;
+  for (const char* name : {"one", "two"}) {
+    auto* signature = signatures.add_signature();
+    signature->mutable_definition()->set_detection_name(name);
+    signature->mutable_definition()->set_min_piece_length(2);
+    AddSignaturePieces({"12", "34"}, signature->mutable_raw_signature());
+  }
+  std::string expected;
+  ASSERT_THAT(formatter_->FormatDatabase(signatures, &expected), IsOk());
+
+  const std::string filename =
+      JoinPath(getenv("TEST_TMPDIR"), "clamav_signature_formatter_db.ndb");
+  {
+    auto sink_or = FileSignatureSink::Open(filename);
+    ASSERT_THAT(sink_or.status(), IsOk());
+    auto sink = std::move(sink_or).ValueOrDie();
+    ASSERT_THAT(formatter_->FormatDatabase(signatures, sink.get()), IsOk());
+    ASSERT_THAT(sink->Close(), IsOk());
+  }
+  std::ifstream file(filename, std::ios::binary);
+  EXPECT_THAT(std::string(std::istreambuf_iterator<char>(file), {}),
+              Eq(expected));
+}
+
 }  // namespace security::vxsig
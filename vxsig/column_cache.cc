@@ -0,0 +1,157 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "vxsig/column_cache.h"
+
+#include <iterator>
+#include <utility>
+
+#include "absl/memory/memory.h"
+
+namespace security::vxsig {
+
+size_t EstimateColumnBytes(const MatchChainColumn& column) {
+  // Each entity is stored once in its address index and referenced once from
+  // the child pool of its parent.
+  constexpr size_t kIndexOverhead =
+      sizeof(std::pair<MemoryAddress, void*>) + sizeof(void*);
+  size_t bytes = sizeof(MatchChainColumn) + column.filename().size() +
+                 column.sha256().size() + column.diff_directory().size();
+  bytes += column.functions_by_address().size() *
+           (sizeof(MatchedFunction) + kIndexOverhead);
+  bytes += column.basic_blocks_by_address().size() *
+           (sizeof(MatchedBasicBlock) + kIndexOverhead);
+  for (const auto& entry : column.instructions_by_address()) {
+    bytes += sizeof(MatchedInstruction) + kIndexOverhead +
+             entry.second->immediates.capacity() *
+                 sizeof(*entry.second->immediates.data());
+  }
+  bytes += column.filtered_functions().size() * sizeof(MemoryAddress);
+  return bytes;
+}
+
+ColumnCache::ColumnCache(size_t memory_budget)
+    : memory_budget_(memory_budget) {}
+
+std::shared_ptr<const CachedColumn> ColumnCache::Lookup(
+    const std::string& key) {
+  absl::MutexLock lock(&mutex_);
+  auto found = entries_.find(key);
+  if (found == entries_.end()) {
+    ++stats_.misses;
+    return nullptr;
+  }
+  auto it = found->second;
+  for (const auto& dependency : it->second->dependencies) {
+    FileStamp stamp;
+    if (!GetFileStamp(dependency.first, &stamp).ok() ||
+        stamp != dependency.second) {
+      EraseLocked(it);
+      ++stats_.misses;
+      return nullptr;
+    }
+  }
+  lru_.splice(lru_.begin(), lru_, it);
+  ++stats_.hits;
+  return it->second;
+}
+
+void ColumnCache::Insert(const std::string& key,
+                         std::shared_ptr<CachedColumn> entry) {
+  entry->bytes = EstimateColumnBytes(*entry->column) +
+                 (entry->intern_pool ? entry->intern_pool->bytes() : 0);
+  absl::MutexLock lock(&mutex_);
+  auto found = entries_.find(key);
+  if (found != entries_.end()) {
+    EraseLocked(found->second);
+  }
+  stats_.bytes += entry->bytes;
+  ++stats_.num_entries;
+  lru_.emplace_front(key, std::move(entry));
+  entries_[key] = lru_.begin();
+  while (stats_.bytes > memory_budget_ && lru_.size() > 1) {
+    EraseLocked(std::prev(lru_.end()));
+    ++stats_.evictions;
+  }
+}
+
+ColumnCache::Stats ColumnCache::stats() const {
+  absl::MutexLock lock(&mutex_);
+  return stats_;
+}
+
+void ColumnCache::EraseLocked(LruList::iterator it) {
+  stats_.bytes -= it->second->bytes;
+  --stats_.num_entries;
+  entries_.erase(it->first);
+  lru_.erase(it);
+}
+
+void ColumnBatch::AddUse(const std::string& key) {
+  absl::MutexLock lock(&mutex_);
+  ++GetSlotLocked(key)->num_uses;
+}
+
+bool ColumnBatch::Claim(const std::string& key) {
+  absl::MutexLock lock(&mutex_);
+  Slot* slot = GetSlotLocked(key);
+  if (slot->claimed) {
+    return false;
+  }
+  slot->claimed = true;
+  ++num_claims_;
+  return true;
+}
+
+void ColumnBatch::Publish(const std::string& key, const absl::Status& status,
+                          std::shared_ptr<const CachedColumn> entry) {
+  absl::MutexLock lock(&mutex_);
+  Slot* slot = GetSlotLocked(key);
+  slot->published = true;
+  slot->status = status;
+  slot->entry = status.ok() ? std::move(entry) : nullptr;
+}
+
+absl::Status ColumnBatch::Wait(const std::string& key,
+                               std::shared_ptr<const CachedColumn>* entry) {
+  absl::MutexLock lock(&mutex_);
+  const Slot* slot = GetSlotLocked(key);
+  mutex_.Await(absl::Condition(&slot->published));
+  *entry = slot->entry;
+  return slot->status;
+}
+
+void ColumnBatch::Release(const std::string& key) {
+  absl::MutexLock lock(&mutex_);
+  auto found = slots_.find(key);
+  if (found != slots_.end() && --found->second->num_uses <= 0) {
+    slots_.erase(found);
+  }
+}
+
+int64_t ColumnBatch::num_claims() const {
+  absl::MutexLock lock(&mutex_);
+  return num_claims_;
+}
+
+ColumnBatch::Slot* ColumnBatch::GetSlotLocked(const std::string& key) {
+  auto& slot = slots_[key];
+  if (!slot) {
+    slot = absl::make_unique<Slot>();
+  }
+  return slot.get();
+}
+
+}  // namespace security::vxsig
@@ -0,0 +1,185 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// An in-memory cache of fully loaded match chain columns for long-running
+// processes, like the signature server. Chains of related binaries often
+// share most of their diff results, so keeping the parsed columns around
+// saves re-reading the same BinDiff and BinExport files for every request.
+// Within a single batch of tables, ColumnBatch shares the columns instead.
+
+#ifndef VXSIG_COLUMN_CACHE_H_
+#define VXSIG_COLUMN_CACHE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/status/status.h"
+#include "absl/synchronization/mutex.h"
+#include "vxsig/intern_pool.h"
+#include "vxsig/match_chain_cache.h"
+#include "vxsig/match_chain_table.h"
+
+namespace security::vxsig {
+
+// A loaded column along with everything that is needed to use it in a table
+// and to tell whether it is still up to date. Cached columns are shared
+// between requests and must not be modified. Tables use copies made by
+// MatchChainColumn::Clone(), which reference the intern pool of the entry.
+struct CachedColumn {
+  // Pool for the instruction bytes and disassembly of the column. Declared
+  // first, as the column references it.
+  std::unique_ptr<InternPool> intern_pool;
+  std::unique_ptr<MatchChainColumn> column;
+
+  // Filename of the secondary binary of the diff result the column was
+  // parsed from, i.e. the filename of the next column in the chain. Empty for
+  // the last column of a chain.
+  std::string secondary_filename;
+
+  // Number of rows read from the diff result.
+  int64_t num_diff_rows = 0;
+
+  // The input files of the column and their stamps at the time it was loaded.
+  std::vector<std::pair<std::string, FileStamp>> dependencies;
+
+  // Estimated memory use of the entry in bytes, set by ColumnCache::Insert().
+  size_t bytes = 0;
+};
+
+// Returns an estimate of the memory used by the specified column, not
+// counting its intern pool.
+size_t EstimateColumnBytes(const MatchChainColumn& column);
+
+// Keeps cached columns in least recently used order and evicts the oldest
+// ones once their estimated total size exceeds the memory budget. Entries
+// that are still in use by a table stay alive until the table releases them,
+// so the budget may be exceeded temporarily.
+// This class is thread-safe.
+class ColumnCache {
+ public:
+  struct Stats {
+    int64_t hits = 0;
+    int64_t misses = 0;
+    int64_t evictions = 0;
+    int64_t num_entries = 0;
+    size_t bytes = 0;
+  };
+
+  explicit ColumnCache(size_t memory_budget);
+
+  ColumnCache(const ColumnCache&) = delete;
+  ColumnCache& operator=(const ColumnCache&) = delete;
+
+  // Returns the column cached for the specified key and marks it as most
+  // recently used. Returns null if there is no such column or if one of its
+  // dependencies changed on disk. Stale entries are removed.
+  std::shared_ptr<const CachedColumn> Lookup(const std::string& key);
+
+  // Adds a column to the cache, replacing an existing entry with the same key,
+  // and evicts the least recently used entries until the cache fits into the
+  // budget again. The new entry itself is always kept, even if it is larger
+  // than the whole budget.
+  void Insert(const std::string& key, std::shared_ptr<CachedColumn> entry);
+
+  size_t memory_budget() const { return memory_budget_; }
+  Stats stats() const;
+
+ private:
+  using LruList =
+      std::list<std::pair<std::string, std::shared_ptr<const CachedColumn>>>;
+
+  void EraseLocked(LruList::iterator it) ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  const size_t memory_budget_;
+
+  mutable absl::Mutex mutex_;
+  // Most recently used entries first.
+  LruList lru_ ABSL_GUARDED_BY(mutex_);
+  absl::flat_hash_map<std::string, LruList::iterator> entries_
+      ABSL_GUARDED_BY(mutex_);
+  Stats stats_ ABSL_GUARDED_BY(mutex_);
+};
+
+// The columns shared by the jobs of one batch of tables, like the ones of
+// AvSignatureGenerator::GenerateSignatures(). Unlike ColumnCache, it loads
+// each column exactly once: the first job that claims a column loads it and
+// publishes it, while jobs that need the same column wait for it. A column is
+// dropped once all of its declared uses are released.
+// This class is thread-safe.
+class ColumnBatch {
+ public:
+  ColumnBatch() = default;
+
+  ColumnBatch(const ColumnBatch&) = delete;
+  ColumnBatch& operator=(const ColumnBatch&) = delete;
+
+  // Declares one more use of the column for the specified key. Uses should be
+  // declared before any job starts, so that a column is not dropped while a
+  // later job still needs it.
+  void AddUse(const std::string& key);
+
+  // Returns true if the caller is the first to ask for the column for the
+  // specified key. The caller then has to load the column and pass it to
+  // Publish(). Otherwise, Wait() returns the column. Callers must publish all
+  // columns they claimed before they wait for any others.
+  bool Claim(const std::string& key);
+
+  // Makes the column for the specified key available to the jobs waiting for
+  // it. If status is not OK, loading the column failed and the waiting jobs
+  // receive status instead.
+  void Publish(const std::string& key, const absl::Status& status,
+               std::shared_ptr<const CachedColumn> entry);
+
+  // Waits until the column for the specified key is published and stores it
+  // in entry. Returns the status of the job that loaded it.
+  absl::Status Wait(const std::string& key,
+                    std::shared_ptr<const CachedColumn>* entry);
+
+  // Releases one use of the column for the specified key. The column is
+  // dropped with its last use, tables that still hold copies keep it alive.
+  void Release(const std::string& key);
+
+  // Returns how many columns were claimed, i.e. loaded or being loaded.
+  int64_t num_claims() const;
+
+ private:
+  struct Slot {
+    int num_uses = 0;
+    bool claimed = false;
+    bool published = false;
+    absl::Status status;
+    std::shared_ptr<const CachedColumn> entry;
+  };
+
+  // Returns the slot for key, creating it if needed.
+  Slot* GetSlotLocked(const std::string& key)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  mutable absl::Mutex mutex_;
+  absl::flat_hash_map<std::string, std::unique_ptr<Slot>> slots_
+      ABSL_GUARDED_BY(mutex_);
+  int64_t num_claims_ ABSL_GUARDED_BY(mutex_) = 0;
+};
+
+}  // namespace security::vxsig
+
+#endif  // VXSIG_COLUMN_CACHE_H_
@@ -0,0 +1,200 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "vxsig/column_cache.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/memory/memory.h"
+#include "absl/status/status.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "third_party/zynamics/binexport/util/filesystem.h"
+#include "third_party/zynamics/binexport/util/status_matchers.h"
+#include "vxsig/thread_pool.h"
+
+using not_absl::IsOk;
+
+using testing::Eq;
+using testing::Gt;
+using testing::IsFalse;
+using testing::IsNull;
+using testing::IsTrue;
+using testing::NotNull;
+
+namespace security::vxsig {
+namespace {
+
+// Returns a cache entry with a column of num_functions single instruction
+// functions.
+std::shared_ptr<CachedColumn> MakeEntry(int num_functions) {
+  auto entry = std::make_shared<CachedColumn>();
+  entry->intern_pool = absl::make_unique<InternPool>();
+  entry->column = absl::make_unique<MatchChainColumn>();
+  entry->column->set_intern_pool(entry->intern_pool.get());
+  for (int i = 0; i < num_functions; ++i) {
+    const MemoryAddress address = 0x1000 + i * 0x10;
+    auto* func = entry->column->InsertFunctionMatch({address, address});
+    auto* bb = entry->column->InsertBasicBlockMatch(func, {address, address});
+    entry->column->InsertInstructionMatch(bb, {address, address})
+        ->raw_instruction_bytes = entry->intern_pool->Intern("\xc3");
+  }
+  entry->column->Compact();
+  return entry;
+}
+
+TEST(ColumnCacheTest, EstimateGrowsWithColumn) {
+  EXPECT_THAT(EstimateColumnBytes(*MakeEntry(10)->column),
+              Gt(EstimateColumnBytes(*MakeEntry(1)->column)));
+}
+
+TEST(ColumnCacheTest, LookupAndInsert) {
+  ColumnCache cache(1 << 20);
+  EXPECT_THAT(cache.Lookup("a"), IsNull());
+
+  auto entry = MakeEntry(1);
+  cache.Insert("a", entry);
+  EXPECT_THAT(cache.Lookup("a").get(), Eq(entry.get()));
+  EXPECT_THAT(entry->bytes, Gt(0));
+
+  const auto stats = cache.stats();
+  EXPECT_THAT(stats.hits, Eq(1));
+  EXPECT_THAT(stats.misses, Eq(1));
+  EXPECT_THAT(stats.num_entries, Eq(1));
+  EXPECT_THAT(stats.bytes, Eq(entry->bytes));
+}
+
+TEST(ColumnCacheTest, EvictsLeastRecentlyUsed) {
+  const size_t entry_bytes = [] {
+    ColumnCache cache(0);
+    auto entry = MakeEntry(100);
+    cache.Insert("a", entry);
+    return entry->bytes;
+  }();
+
+  // Room for two entries.
+  ColumnCache cache(2 * entry_bytes + entry_bytes / 2);
+  cache.Insert("a", MakeEntry(100));
+  cache.Insert("b", MakeEntry(100));
+  ASSERT_THAT(cache.Lookup("a"), NotNull());  // Now "b" is the oldest
+  cache.Insert("c", MakeEntry(100));
+
+  EXPECT_THAT(cache.Lookup("a"), NotNull());
+  EXPECT_THAT(cache.Lookup("b"), IsNull());
+  EXPECT_THAT(cache.Lookup("c"), NotNull());
+  EXPECT_THAT(cache.stats().evictions, Eq(1));
+  EXPECT_THAT(cache.stats().num_entries, Eq(2));
+}
+
+TEST(ColumnCacheTest, KeepsOversizedEntry) {
+  ColumnCache cache(1);
+  cache.Insert("a", MakeEntry(1));
+  cache.Insert("b", MakeEntry(1));
+  EXPECT_THAT(cache.Lookup("a"), IsNull());
+  EXPECT_THAT(cache.Lookup("b"), NotNull());
+}
+
+TEST(ColumnCacheTest, EvictedEntryStaysAliveWhileInUse) {
+  ColumnCache cache(1);
+  cache.Insert("a", MakeEntry(1));
+  auto entry = cache.Lookup("a");
+  ASSERT_THAT(entry, NotNull());
+  cache.Insert("b", MakeEntry(1));
+  EXPECT_THAT(cache.Lookup("a"), IsNull());
+  EXPECT_THAT(entry->column->functions_by_address().size(), Eq(1));
+}
+
+TEST(ColumnCacheTest, StaleDependency) {
+  const std::string dependency =
+      JoinPath(getenv("TEST_TMPDIR"), "column_cache_dep");
+  std::ofstream(dependency) << "input";
+  FileStamp stamp;
+  ASSERT_TRUE(GetFileStamp(dependency, &stamp).ok());
+
+  ColumnCache cache(1 << 20);
+  auto entry = MakeEntry(1);
+  entry->dependencies.emplace_back(dependency, stamp);
+  cache.Insert("a", entry);
+  EXPECT_THAT(cache.Lookup("a"), NotNull());
+
+  std::ofstream(dependency) << "changed input";
+  EXPECT_THAT(cache.Lookup("a"), IsNull());
+  EXPECT_THAT(cache.stats().num_entries, Eq(0));
+}
+
+TEST(ColumnBatchTest, ClaimOnce) {
+  ColumnBatch batch;
+  batch.AddUse("a");
+  batch.AddUse("a");
+  EXPECT_THAT(batch.Claim("a"), IsTrue());
+  EXPECT_THAT(batch.Claim("a"), IsFalse());
+
+  auto entry = MakeEntry(1);
+  batch.Publish("a", absl::OkStatus(), entry);
+  std::shared_ptr<const CachedColumn> shared;
+  EXPECT_THAT(batch.Wait("a", &shared), IsOk());
+  EXPECT_THAT(shared.get(), Eq(entry.get()));
+  EXPECT_THAT(batch.num_claims(), Eq(1));
+
+  // The column is dropped with its last use.
+  batch.Release("a");
+  batch.Release("a");
+  EXPECT_THAT(batch.Claim("a"), IsTrue());
+}
+
+TEST(ColumnBatchTest, WaitersReceiveLoadError) {
+  ColumnBatch batch;
+  ASSERT_THAT(batch.Claim("a"), IsTrue());
+  batch.Publish("a", absl::NotFoundError("missing"), MakeEntry(1));
+  std::shared_ptr<const CachedColumn> shared;
+  EXPECT_THAT(batch.Wait("a", &shared).code(),
+              Eq(absl::StatusCode::kNotFound));
+  EXPECT_THAT(shared, IsNull());
+}
+
+TEST(ColumnBatchTest, ConcurrentJobsLoadOnce) {
+  constexpr int kNumJobs = 16;
+  ColumnBatch batch;
+  for (int i = 0; i < kNumJobs; ++i) {
+    batch.AddUse("a");
+  }
+  ThreadPool pool(4);
+  std::atomic<int> num_loads(0);
+  std::vector<const CachedColumn*> entries(kNumJobs);
+  ParallelFor(kNumJobs, &pool, [&](int i) {
+    std::shared_ptr<const CachedColumn> entry;
+    if (batch.Claim("a")) {
+      ++num_loads;
+      entry = MakeEntry(1);
+      batch.Publish("a", absl::OkStatus(), entry);
+    } else {
+      EXPECT_THAT(batch.Wait("a", &entry), IsOk());
+    }
+    entries[i] = entry.get();
+    batch.Release("a");
+  });
+  EXPECT_THAT(num_loads.load(), Eq(1));
+  for (const auto* entry : entries) {
+    EXPECT_THAT(entry, Eq(entries.front()));
+  }
+}
+
+}  // namespace
+}  // namespace security::vxsig
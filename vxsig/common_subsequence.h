@@ -20,6 +20,7 @@
 #define VXSIG_COMMON_SUBSEQUENCE_H_
 
 #include <algorithm>
+#include <cstdint>
 #include <iterator>
 #include <set>
 #include <string>
@@ -27,11 +28,104 @@
 #include <vector>
 
 #include "absl/base/internal/raw_logging.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/container/flat_hash_set.h"
+#include "absl/hash/hash.h"
 #include "vxsig/hamming.h"
 #include "vxsig/longest_common_subsequence.h"
+#include "vxsig/thread_pool.h"
 
 namespace security::vxsig {
 
+namespace detail {
+
+// Set of sequence elements with constant time lookups, used to prune
+// sequences to the elements of an LCS. Element types with a dense
+// LcsAlphabet use a bitset over the alphabet, all others a hash set.
+template <typename T, bool kDense = LcsAlphabet<T>::kEnabled>
+class ElementSet {
+ public:
+  template <typename IteratorT>
+  ElementSet(IteratorT first, IteratorT last) : elements_(first, last) {}
+
+  bool contains(const T& value) const { return elements_.contains(value); }
+
+ private:
+  absl::flat_hash_set<T> elements_;
+};
+
+template <typename T>
+class ElementSet<T, /*kDense=*/true> {
+ public:
+  template <typename IteratorT>
+  ElementSet(IteratorT first, IteratorT last)
+      : elements_(LcsAlphabet<T>::kSize) {
+    for (; first != last; ++first) {
+      elements_[LcsAlphabet<T>::Index(*first)] = true;
+    }
+  }
+
+  bool contains(const T& value) const {
+    return elements_[LcsAlphabet<T>::Index(value)];
+  }
+
+ private:
+  std::vector<bool> elements_;
+};
+
+// Hash of sequence elements that is consistent with their equality. Element
+// types with a dense LcsAlphabet are hashed by their alphabet index, as their
+// equality may ignore some of their members. All others use absl::Hash.
+template <typename T, bool kDense = LcsAlphabet<T>::kEnabled>
+struct ElementHash {
+  size_t operator()(const T& value) const { return absl::Hash<T>()(value); }
+};
+
+template <typename T>
+struct ElementHash<T, /*kDense=*/true> {
+  size_t operator()(const T& value) const {
+    return LcsAlphabet<T>::Index(value);
+  }
+};
+
+// Returns a fingerprint of the specified sequence, so that equal sequences
+// have equal fingerprints.
+template <typename ContT>
+uint64_t SequenceFingerprint(const ContT& sequence) {
+  const ElementHash<typename ContT::value_type> hash;
+  uint64_t fingerprint = 0xcbf29ce484222325ULL;  // FNV-1a
+  for (const auto& value : sequence) {
+    fingerprint = (fingerprint ^ hash(value)) * 0x100000001b3ULL;
+  }
+  return fingerprint;
+}
+
+// Returns the first occurrence of each distinct sequence, in input order.
+// Sequences are grouped by their fingerprint first, so that only sequences
+// with colliding fingerprints are compared element by element.
+template <typename NestedContT>
+std::vector<const typename NestedContT::value_type*> DistinctSequences(
+    const NestedContT& sequences) {
+  using SequenceT = typename NestedContT::value_type;
+  std::vector<const SequenceT*> distinct;
+  absl::flat_hash_map<uint64_t, std::vector<const SequenceT*>> by_fingerprint;
+  for (const auto& sequence : sequences) {
+    auto& group = by_fingerprint[SequenceFingerprint(sequence)];
+    const bool seen = std::any_of(
+        group.begin(), group.end(), [&sequence](const SequenceT* other) {
+          return std::equal(sequence.begin(), sequence.end(), other->begin(),
+                            other->end());
+        });
+    if (!seen) {
+      group.push_back(&sequence);
+      distinct.push_back(&sequence);
+    }
+  }
+  return distinct;
+}
+
+}  // namespace detail
+
 // Removes from the range [first,last) the elements not in the range
 // [keep_first, keep_last). That is, PruneSequence returns an iterator new_last
 // such that the range [first, new_last) contains no elements from the range
@@ -72,23 +166,65 @@ IteratorT PruneSequence(IteratorT first, IteratorT last,
 // copy is kept. The resulting (smaller) problem set is then processed
 // recursively.
 //
+// Identical input sequences are detected up front by their fingerprints, and
+// the folding only runs on the distinct ones. If all input sequences are
+// identical, the first one is returned right away. This yields the same
+// result, as the folding also keeps only one copy of duplicates.
+//
 // The worst case performance of this algorithm does not exceed O(n^2 + k * n)
 // time and O(n^2) space, where k is the number of input sequences and n the
 // maximum length of a sequence.
-template <typename NestedContT, typename OutputIteratorT>
-void CommonSubsequence(const NestedContT& sequences, OutputIteratorT result) {
+// The pairwise distances are kept across folds, so that each fold only
+// recomputes the distances of the sequences it changed.
+// If pool is non-null, the pairwise LCS computations, the distance updates and
+// the pruning of the remaining sequences run on it. Otherwise, they use the
+// LCS workspace of the calling thread, which is kept across calls.
+// If kElements is LcsElements::kDistinct, no sequence may contain an element
+// more than once. Pruning preserves this, so all pairwise LCS computations
+// then use the faster algorithm for distinct elements.
+template <LcsElements kElements = LcsElements::kAny, typename NestedContT,
+          typename OutputIteratorT>
+void CommonSubsequence(const NestedContT& sequences, OutputIteratorT result,
+                       ThreadPool* pool) {
   using ValueType = typename NestedContT::value_type::value_type;
 
   if (sequences.size() < 2) {
     ABSL_RAW_LOG(FATAL, "Invalid number of sequences");
   }
 
-  // Create a modifiable copy of sequences.
+  const auto distinct = detail::DistinctSequences(sequences);
+  if (distinct.size() == 1) {
+    std::copy(distinct[0]->begin(), distinct[0]->end(), result);
+    return;
+  }
+
+  // Create a modifiable copy of the distinct sequences.
   std::vector<std::vector<ValueType>> sub_seqs;
-  sub_seqs.reserve(sequences.size());
-  for (const auto& sequence : sequences) {
-    sub_seqs.emplace_back(sequence.begin(), sequence.end());
+  sub_seqs.reserve(distinct.size());
+  for (const auto* sequence : distinct) {
+    sub_seqs.emplace_back(sequence->begin(), sequence->end());
+  }
+
+  // Pairwise Hamming distances of sub_seqs, distances[i][j] holds the
+  // distance of sequences i and j for j < i. After each fold, only the
+  // entries of sequences that changed are recomputed.
+  std::vector<std::vector<size_t>> distances;
+  std::vector<char> changed(sub_seqs.size(), true);
+  for (int i = 0; i < sub_seqs.size(); ++i) {
+    distances.emplace_back(i);
   }
+  auto update_distances = [&sub_seqs, &distances, &changed, pool]() {
+    ParallelFor(sub_seqs.size(), pool,
+                [&sub_seqs, &distances, &changed](int i) {
+                  for (int j = 0; j < i; ++j) {
+                    if (changed[i] || changed[j]) {
+                      distances[i][j] =
+                          HammingDistance(sub_seqs[i], sub_seqs[j]);
+                    }
+                  }
+                });
+  };
+  update_distances();
 
   while (sub_seqs.size() > 2) {
     // Find the two sequences with the greatest Hamming distance and
@@ -100,7 +236,7 @@ void CommonSubsequence(const NestedContT& sequences, OutputIteratorT result) {
     for (int i = 0; i < sub_seqs.size(); ++i) {
       for (int j = 0; j < i; ++j) {
         // Current Hamming distance.
-        const size_t cur_dist = HammingDistance(sub_seqs[i], sub_seqs[j]);
+        const size_t cur_dist = distances[i][j];
         if (cur_dist == 0) {
           kill.insert(kill.end(), i);
         } else if (cur_dist > max_dist) {
@@ -119,11 +255,17 @@ void CommonSubsequence(const NestedContT& sequences, OutputIteratorT result) {
 
     // Call regular 2-LCS algorithm on the two least similar sequences.
     std::vector<ValueType> max_dist_lcs;
-    LongestCommonSubsequence(sub_seqs[shd.second].begin(),
-                             sub_seqs[shd.second].end(),
-                             sub_seqs[shd.first].begin(),
-                             sub_seqs[shd.first].end(),
-                             back_inserter(max_dist_lcs));
+    if (pool) {
+      LongestCommonSubsequence<kElements>(
+          sub_seqs[shd.second].begin(), sub_seqs[shd.second].end(),
+          sub_seqs[shd.first].begin(), sub_seqs[shd.first].end(),
+          back_inserter(max_dist_lcs), pool);
+    } else {
+      LongestCommonSubsequence<kElements>(
+          sub_seqs[shd.second].begin(), sub_seqs[shd.second].end(),
+          sub_seqs[shd.first].begin(), sub_seqs[shd.first].end(),
+          back_inserter(max_dist_lcs), ThreadLocalLcsWorkspace());
+    }
 
     // Replace the two most similar sequences with their LCS. From all other
     // sequences, remove any element not found in the LCS. Those elements
@@ -137,18 +279,34 @@ void CommonSubsequence(const NestedContT& sequences, OutputIteratorT result) {
     // sub_seqs are valid.
     for (auto it = kill.crbegin(); it != kill.crend(); ++it) {
       sub_seqs.erase(sub_seqs.begin() + *it);
+      distances.erase(distances.begin() + *it);
+      for (int i = *it; i < distances.size(); ++i) {
+        distances[i].erase(distances[i].begin() + *it);
+      }
     }
 
-    // Prune all elements not in max_dist_lcs.
-    for (auto& sequence : sub_seqs) {
-      sequence.erase(PruneSequence(sequence.begin(), sequence.end(),
-                                   max_dist_lcs.begin(), max_dist_lcs.end()),
-                     sequence.end());
-    }
+    // Prune all elements not in max_dist_lcs. The passes are independent of
+    // each other and only sequences that lost elements need new distances.
+    const detail::ElementSet<ValueType> keep(max_dist_lcs.begin(),
+                                             max_dist_lcs.end());
+    changed.assign(sub_seqs.size(), false);
+    ParallelFor(sub_seqs.size(), pool, [&sub_seqs, &changed, &keep](int i) {
+      auto& sequence = sub_seqs[i];
+      auto new_end = std::remove_if(
+          sequence.begin(), sequence.end(),
+          [&keep](const ValueType& value) { return !keep.contains(value); });
+      changed[i] = new_end != sequence.end();
+      sequence.erase(new_end, sequence.end());
+    });
 
     // Add LCS to sub-problem set as well (since the original sequences
     // were removed).
     sub_seqs.insert(sub_seqs.end(), max_dist_lcs);
+    changed.push_back(true);
+    distances.emplace_back(sub_seqs.size() - 1);
+    if (sub_seqs.size() > 2) {
+      update_distances();
+    }
   }
 
   if (sub_seqs.size() == 1) {
@@ -156,14 +314,27 @@ void CommonSubsequence(const NestedContT& sequences, OutputIteratorT result) {
     std::copy(sub_seqs[0].begin(), sub_seqs[0].end(), result);
   } else if (sub_seqs.size() == 2) {
     // Problem size 2 is the well-known longest common subsequence problem.
-    LongestCommonSubsequence(sub_seqs[0].begin(), sub_seqs[0].end(),
-                             sub_seqs[1].begin(), sub_seqs[1].end(), result);
+    if (pool) {
+      LongestCommonSubsequence<kElements>(
+          sub_seqs[0].begin(), sub_seqs[0].end(), sub_seqs[1].begin(),
+          sub_seqs[1].end(), result, pool);
+    } else {
+      LongestCommonSubsequence<kElements>(
+          sub_seqs[0].begin(), sub_seqs[0].end(), sub_seqs[1].begin(),
+          sub_seqs[1].end(), result, ThreadLocalLcsWorkspace());
+    }
   } else {
     ABSL_RAW_LOG(FATAL, "Invalid number of sub-sequences left: %d",
                  static_cast<int>(sub_seqs.size()));
   }
 }
 
+template <LcsElements kElements = LcsElements::kAny, typename NestedContT,
+          typename OutputIteratorT>
+void CommonSubsequence(const NestedContT& sequences, OutputIteratorT result) {
+  CommonSubsequence<kElements>(sequences, result, /*pool=*/nullptr);
+}
+
 }  // namespace security::vxsig
 
 #endif  // VXSIG_COMMON_SUBSEQUENCE_H_
@@ -16,18 +16,78 @@
 
 #include <cstdint>
 #include <iterator>
+#include <random>
+#include <set>
 #include <string>
 #include <vector>
 
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
+#include "vxsig/hamming.h"
+#include "vxsig/longest_common_subsequence.h"
+#include "vxsig/thread_pool.h"
 
 using testing::ElementsAre;
+using testing::ElementsAreArray;
 using testing::Eq;
 using testing::IsEmpty;
 using testing::SizeIs;
 
 namespace security::vxsig {
+namespace {
+
+// Folds the sequences like CommonSubsequence(), but recomputes all pairwise
+// distances in each iteration and prunes using PruneSequence().
+template <typename T>
+std::vector<T> ReferenceCommonSubsequence(
+    std::vector<std::vector<T>> sub_seqs) {
+  while (sub_seqs.size() > 2) {
+    size_t max_dist = 0;
+    std::pair<int, int> shd(0, 0);
+    std::set<int> kill;
+    for (int i = 0; i < sub_seqs.size(); ++i) {
+      for (int j = 0; j < i; ++j) {
+        const size_t cur_dist = HammingDistance(sub_seqs[i], sub_seqs[j]);
+        if (cur_dist == 0) {
+          kill.insert(i);
+        } else if (cur_dist > max_dist) {
+          max_dist = cur_dist;
+          shd = {i, j};
+        }
+      }
+    }
+    if (kill.size() == sub_seqs.size() - 1) {
+      return sub_seqs[0];
+    }
+    std::vector<T> lcs;
+    LongestCommonSubsequence(
+        sub_seqs[shd.second].begin(), sub_seqs[shd.second].end(),
+        sub_seqs[shd.first].begin(), sub_seqs[shd.first].end(),
+        std::back_inserter(lcs));
+    kill.insert(shd.first);
+    kill.insert(shd.second);
+    for (auto it = kill.crbegin(); it != kill.crend(); ++it) {
+      sub_seqs.erase(sub_seqs.begin() + *it);
+    }
+    for (auto& sequence : sub_seqs) {
+      sequence.erase(
+          PruneSequence(sequence.begin(), sequence.end(), lcs.begin(),
+                        lcs.end()),
+          sequence.end());
+    }
+    sub_seqs.push_back(lcs);
+  }
+  if (sub_seqs.size() == 1) {
+    return sub_seqs[0];
+  }
+  std::vector<T> lcs;
+  LongestCommonSubsequence(sub_seqs[0].begin(), sub_seqs[0].end(),
+                           sub_seqs[1].begin(), sub_seqs[1].end(),
+                           std::back_inserter(lcs));
+  return lcs;
+}
+
+}  // namespace
 
 TEST(PruneSequenceTest, OperateOnStrings) {
   std::string keep;
@@ -274,4 +334,93 @@ TEST(CommonSubsequence, SingleCandidate) {
   EXPECT_THAT(result, SizeIs(1));
 }
 
+TEST(CommonSubsequence, MatchesReferenceFolding) {
+  std::mt19937 rng(11);
+  ThreadPool pool(3);
+  for (const int num_seqs : {3, 8, 35}) {
+    // Random permutations with a few duplicates and dropped elements, similar
+    // to the function ids of a match chain table.
+    std::vector<std::vector<uint32_t>> ids(num_seqs);
+    std::vector<std::vector<char>> bytes(num_seqs);
+    std::vector<uint32_t> base(200);
+    for (int i = 0; i < base.size(); ++i) {
+      base[i] = i * 7919;
+    }
+    for (int i = 0; i < num_seqs; ++i) {
+      if (i > 0 && rng() % 5 == 0) {
+        ids[i] = ids[i - 1];
+      } else {
+        ids[i] = base;
+        for (int swaps = rng() % 20; swaps > 0; --swaps) {
+          std::swap(ids[i][rng() % ids[i].size()],
+                    ids[i][rng() % ids[i].size()]);
+        }
+        ids[i].erase(ids[i].begin() + rng() % ids[i].size());
+      }
+      for (const uint32_t id : ids[i]) {
+        bytes[i].push_back(static_cast<char>(id % 23));
+      }
+    }
+
+    const auto expected_ids = ReferenceCommonSubsequence(ids);
+    const auto expected_bytes = ReferenceCommonSubsequence(bytes);
+    for (ThreadPool* p : {static_cast<ThreadPool*>(nullptr), &pool}) {
+      std::vector<uint32_t> actual_ids;
+      CommonSubsequence(ids, std::back_inserter(actual_ids), p);
+      EXPECT_THAT(actual_ids, ElementsAreArray(expected_ids));
+
+      std::vector<char> actual_bytes;
+      CommonSubsequence(bytes, std::back_inserter(actual_bytes), p);
+      EXPECT_THAT(actual_bytes, ElementsAreArray(expected_bytes));
+    }
+  }
+}
+
+TEST(CommonSubsequence, DuplicateSequences) {
+  // Only a few distinct sequences, repeated out of order.
+  const std::vector<std::string> distinct = {"xAcommonBy", "CcoDmmonE",
+                                             "commFGonH"};
+  std::vector<std::string> seqs;
+  for (const int i : {0, 1, 0, 2, 1, 1, 0, 2}) {
+    seqs.push_back(distinct[i]);
+  }
+  std::string expected;
+  CommonSubsequence(distinct, std::back_inserter(expected));
+  EXPECT_THAT(expected, Eq("common"));
+
+  std::string actual;
+  CommonSubsequence(seqs, std::back_inserter(actual));
+  EXPECT_THAT(actual, Eq(expected));
+  std::vector<std::vector<char>> char_seqs;
+  for (const auto& seq : seqs) {
+    char_seqs.emplace_back(seq.begin(), seq.end());
+  }
+  EXPECT_THAT(ReferenceCommonSubsequence(char_seqs),
+              ElementsAreArray(expected));
+}
+
+TEST(CommonSubsequence, DistinctElements) {
+  // Rotations and swaps of the same ids, like the function ids of a match
+  // chain table.
+  std::mt19937 rng(3);
+  std::vector<std::vector<uint32_t>> seqs(12);
+  for (int i = 0; i < seqs.size(); ++i) {
+    for (int j = 0; j < 300; ++j) {
+      seqs[i].push_back((j + i * 3) % 300 + 1000);
+    }
+    for (int swaps = 0; swaps < 10; ++swaps) {
+      std::swap(seqs[i][rng() % 300], seqs[i][rng() % 300]);
+    }
+  }
+  std::vector<uint32_t> expected;
+  CommonSubsequence(seqs, std::back_inserter(expected));
+  ThreadPool pool(2);
+  for (ThreadPool* p : {static_cast<ThreadPool*>(nullptr), &pool}) {
+    std::vector<uint32_t> actual;
+    CommonSubsequence<LcsElements::kDistinct>(
+        seqs, std::back_inserter(actual), p);
+    EXPECT_THAT(actual, ElementsAreArray(expected));
+  }
+}
+
 }  // namespace security::vxsig
@@ -14,164 +14,333 @@
 
 #include "vxsig/diff_result_reader.h"
 
+#include <algorithm>
 #include <cstdint>
-#include <cstring>
+#include <limits>
 #include <memory>
+#include <utility>
+#include <vector>
 
-#include "absl/base/internal/raw_logging.h"
-#include "absl/memory/memory.h"
 #include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "absl/strings/str_join.h"
 #include "absl/strings/string_view.h"
 #include "absl/strings/substitute.h"
 #include "third_party/sqlite/sqlite3.h"
+#include "third_party/zynamics/binexport/util/status_macros.h"
 
 namespace security::vxsig {
 
-struct Sqlite3Closer {
+namespace {
+
+// Returns the conditions on the function table for the specified filter, to
+// be used in the WHERE clause of the match query. Filtered addresses are
+// emitted as integer literals, as SQLite has no array binding by default.
+// SQLite stores addresses as signed 64-bit integers, so the literals are
+// converted the same way.
+std::string FunctionFilterCondition(const BinDiffFunctionFilter& filter) {
+  std::string condition;
+  if (filter.min_address > filter.max_address) {
+    absl::StrAppend(&condition, " AND 0");
+  } else if (filter.min_address > 0 ||
+             filter.max_address < std::numeric_limits<MemoryAddress>::max()) {
+    // Addresses at or above 2^63 are stored as negative numbers. A range
+    // that contains both kinds of addresses wraps around in SQLite's order.
+    const auto min_address = static_cast<int64_t>(filter.min_address);
+    const auto max_address = static_cast<int64_t>(filter.max_address);
+    absl::StrAppend(&condition, " AND (f.address1 >= ", min_address,
+                    min_address <= max_address ? " AND " : " OR ",
+                    "f.address1 <= ", max_address, ")");
+  }
+  if (filter.mode == BinDiffFunctionFilter::kNone) {
+    return condition;
+  }
+  std::vector<MemoryAddress> addresses(filter.addresses);
+  std::sort(addresses.begin(), addresses.end());
+  absl::StrAppend(
+      &condition, " AND f.address1 ",
+      filter.mode == BinDiffFunctionFilter::kBlacklist ? "NOT IN (" : "IN (",
+      absl::StrJoin(addresses, ",",
+                    [](std::string* out, MemoryAddress address) {
+                      absl::StrAppend(out, static_cast<int64_t>(address));
+                    }),
+      ")");
+  return condition;
+}
+
+// Percent-encodes the characters that have a special meaning in SQLite URI
+// filenames.
+std::string FilenameToUri(absl::string_view filename) {
+  std::string uri("file:");
+  for (const char c : filename) {
+    if (c == '%' || c == '?' || c == '#') {
+      absl::StrAppendFormat(&uri, "%%%02X", c);
+    } else {
+      uri.push_back(c);
+    }
+  }
+  return absl::StrCat(uri, "?mode=ro");
+}
+
+// Calls sqlite3_reset() on the statement when going out of scope, so that
+// statements never keep the attached database busy.
+class StatementResetter {
  public:
-  Sqlite3Closer();
-  ~Sqlite3Closer();
+  explicit StatementResetter(sqlite3_stmt* stmt) : stmt_(stmt) {}
+  ~StatementResetter() {
+    sqlite3_reset(stmt_);
+    sqlite3_clear_bindings(stmt_);
+  }
 
-  sqlite3* handle;
+ private:
+  sqlite3_stmt* stmt_;
 };
 
-Sqlite3Closer::Sqlite3Closer() : handle(nullptr) {}
+void ReadFileMetaData(sqlite3_stmt* stmt, FileMetaData* metadata) {
+  metadata->filename.assign(
+      reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0)));
+  metadata->original_filename.assign(
+      reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1)));
+  metadata->original_hash.assign(
+      reinterpret_cast<const char*>(sqlite3_column_text(stmt, 2)));
+}
+
+}  // namespace
 
-Sqlite3Closer::~Sqlite3Closer() {
-  if (!handle) {
-    return;
+void BinDiffReadStats::Add(const BinDiffReadStats& other) {
+  num_files += other.num_files;
+  num_rows += other.num_rows;
+  open_time += other.open_time;
+  metadata_time += other.metadata_time;
+  match_time += other.match_time;
+}
+
+not_absl::StatusOr<std::unique_ptr<BinDiffReader>> BinDiffReader::Create() {
+  std::unique_ptr<BinDiffReader> reader(new BinDiffReader());
+  // The main database is a private in-memory one, the BinDiff files get
+  // attached to it one at a time. Statements stay valid across files.
+  if (sqlite3_open_v2(":memory:", &reader->db_,
+                      SQLITE_OPEN_READWRITE | SQLITE_OPEN_URI, nullptr) !=
+      SQLITE_OK) {
+    return absl::InternalError("SQLite open failed for in-memory database");
   }
+  // BinDiff files are only ever read, so use temporary storage in memory, and
+  // no locking and journaling overhead from writes.
+  NA_RETURN_IF_ERROR(reader->Execute("PRAGMA temp_store=MEMORY;"));
+  NA_RETURN_IF_ERROR(reader->Prepare("ATTACH DATABASE ?1 AS diff;",
+                                     &reader->attach_stmt_));
+  NA_RETURN_IF_ERROR(
+      reader->Prepare("DETACH DATABASE diff;", &reader->detach_stmt_));
+  return reader;
+}
 
-  // Log if there was an error.
-  if (sqlite3_errcode(handle) != SQLITE_OK) {
-    ABSL_RAW_LOG(WARNING, "%s", sqlite3_errmsg(handle));
+BinDiffReader::~BinDiffReader() {
+  for (auto& entry : match_stmts_) {
+    sqlite3_finalize(entry.second);
   }
+  sqlite3_finalize(file_stmt_);
+  sqlite3_finalize(metadata_stmt_);
+  sqlite3_finalize(detach_stmt_);
+  sqlite3_finalize(attach_stmt_);
+  sqlite3_close(db_);
+}
 
-  sqlite3_close(handle);
+absl::Status BinDiffReader::Execute(const char* sql) {
+  char* error = nullptr;
+  if (sqlite3_exec(db_, sql, nullptr, nullptr, &error) != SQLITE_OK) {
+    absl::Status status = absl::InternalError(
+        absl::StrCat("SQLite error: ", error ? error : sqlite3_errmsg(db_)));
+    sqlite3_free(error);
+    return status;
+  }
+  return absl::OkStatus();
 }
 
-absl::Status ParseBinDiff(
-    absl::string_view filename,
+absl::Status BinDiffReader::Prepare(absl::string_view sql,
+                                    sqlite3_stmt** stmt) {
+  if (*stmt) {
+    return absl::OkStatus();
+  }
+  if (sqlite3_prepare_v2(db_, sql.data(), sql.size(), stmt, nullptr) !=
+      SQLITE_OK) {
+    return absl::InternalError(
+        absl::StrCat("SQLite prepare statement failed: ", sqlite3_errmsg(db_)));
+  }
+  return absl::OkStatus();
+}
+
+absl::Status BinDiffReader::Read(
+    absl::string_view filename, const BinDiffFunctionFilter& filter,
     const MatchReceiverCallback& function_match_receiver,
     const MatchReceiverCallback& basic_block_match_receiver,
     const MatchReceiverCallback& instruction_match_receiver,
     std::pair<FileMetaData, FileMetaData>* metadata) {
+  return ReadWithAttached(filename, [&]() {
+    return ReadAttached(filename, filter, function_match_receiver,
+                        basic_block_match_receiver, instruction_match_receiver,
+                        metadata);
+  });
+}
+
+absl::Status BinDiffReader::ReadSummary(absl::string_view filename,
+                                        BinDiffSummary* summary) {
+  return ReadWithAttached(
+      filename, [&]() { return ReadAttachedSummary(filename, summary); });
+}
+
+absl::Status BinDiffReader::ReadWithAttached(
+    absl::string_view filename, const std::function<absl::Status()>& read) {
   if (filename.empty()) {
     return absl::InvalidArgumentError("Empty BinDiff filename");
   }
+  last_stats_ = BinDiffReadStats();
+  last_stats_.num_files = 1;
 
-  const char* query =
-      "SELECT file1, file2 FROM \"metadata\";"
-      "SELECT filename, exefilename, hash FROM \"file\" WHERE id=:file;"
-      "SELECT"
-      " f.id, f.address1, f.address2,"
-      " b.id, b.address1, b.address2,"
-      " i.address1, i.address2 "
-      "FROM"
-      " \"function\" AS f,"
-      " \"basicblock\" AS b,"
-      " \"instruction\" AS i "
-      "WHERE"
-      " f.id = b.functionid AND"
-      " b.id = i.basicblockid "
-      "ORDER BY"
-      " f.id, f.address1, f.address2,"
-      " b.id, b.address1, b.address2,"
-      " i.address1, i.address2;";
-  enum { kNumMatchCols = 8 };
-
-  // Open database file without VFS (last argument of sqlite_open_v2).
-  Sqlite3Closer db;
-  if (sqlite3_open_v2(std::string(filename).c_str(), &db.handle,
-                      SQLITE_OPEN_READONLY, nullptr)) {
-    return absl::FailedPreconditionError(
-        absl::StrCat("SQLite open failed for ", filename));
+  absl::Time start = absl::Now();
+  {
+    const std::string uri = FilenameToUri(filename);
+    StatementResetter resetter(attach_stmt_);
+    if (sqlite3_bind_text(attach_stmt_, 1, uri.c_str(), uri.size(),
+                          SQLITE_TRANSIENT) != SQLITE_OK ||
+        sqlite3_step(attach_stmt_) != SQLITE_DONE) {
+      return absl::FailedPreconditionError(absl::StrCat(
+          "SQLite open failed for ", filename, ": ", sqlite3_errmsg(db_)));
+    }
   }
-
-  // Get file IDs.
-  sqlite3_stmt* stmt;
-  if (sqlite3_prepare_v2(db.handle, query, strlen(query), &stmt, &query) !=
-          SQLITE_OK ||
-      sqlite3_step(stmt) != SQLITE_ROW) {
-    return absl::InternalError(absl::StrCat(
-        "SQLite prepare statement failed for file metadata in ", filename));
+  // Page cache and memory mapping are per attached database.
+  absl::Status status = Execute(
+      "PRAGMA diff.cache_size=-65536;"  // In KiB
+      "PRAGMA diff.mmap_size=1073741824;"
+      "PRAGMA query_only=ON;");
+  if (status.ok()) {
+    last_stats_.open_time = absl::Now() - start;
+    status = read();
   }
 
-  int file1_id = sqlite3_column_int(stmt, 0);
-  int file2_id = sqlite3_column_int(stmt, 1);
-  if (sqlite3_finalize(stmt) != SQLITE_OK) {
-    return absl::InternalError(
-        absl::StrCat("SQLite finalize statement failed, file: ", filename));
+  {
+    // Always detach, so that the reader can be used for the next file.
+    StatementResetter resetter(detach_stmt_);
+    absl::Status detach_status = Execute("PRAGMA query_only=OFF;");
+    if (detach_status.ok() && sqlite3_step(detach_stmt_) != SQLITE_DONE) {
+      detach_status = absl::InternalError(absl::StrCat(
+          "SQLite detach failed for ", filename, ": ", sqlite3_errmsg(db_)));
+    }
+    if (status.ok()) {
+      status = detach_status;
+    }
   }
+  total_stats_.Add(last_stats_);
+  return status;
+}
 
-  // Query metadata for primary and secondary file.
-  if (sqlite3_prepare_v2(db.handle, query, strlen(query), &stmt, &query) !=
-          SQLITE_OK ||
-      sqlite3_bind_int(stmt, 1, file1_id) != SQLITE_OK ||
-      sqlite3_step(stmt) != SQLITE_ROW) {
-    return absl::InternalError(absl::StrCat(
-        "SQLite result error querying file ids, file: ", filename));
+absl::Status BinDiffReader::ReadAttachedSummary(absl::string_view filename,
+                                                BinDiffSummary* summary) {
+  absl::Time start = absl::Now();
+  NA_RETURN_IF_ERROR(
+      Prepare("SELECT file1, file2, similarity, confidence "
+              "FROM diff.\"metadata\";",
+              &metadata_stmt_));
+  NA_RETURN_IF_ERROR(
+      Prepare("SELECT filename, exefilename, hash FROM diff.\"file\" "
+              "WHERE id=:file;",
+              &file_stmt_));
+
+  // Get file IDs.
+  int file1_id;
+  int file2_id;
+  {
+    StatementResetter resetter(metadata_stmt_);
+    if (sqlite3_step(metadata_stmt_) != SQLITE_ROW) {
+      return absl::InternalError(absl::StrCat(
+          "SQLite prepare statement failed for file metadata in ", filename));
+    }
+    file1_id = sqlite3_column_int(metadata_stmt_, 0);
+    file2_id = sqlite3_column_int(metadata_stmt_, 1);
+    summary->similarity = sqlite3_column_double(metadata_stmt_, 2);
+    summary->confidence = sqlite3_column_double(metadata_stmt_, 3);
   }
 
-  if (metadata != nullptr) {
-    metadata->first.filename.assign(
-        reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0)));
-    metadata->first.original_filename.assign(
-        reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1)));
-    metadata->first.original_hash.assign(
-        reinterpret_cast<const char*>(sqlite3_column_text(stmt, 2)));
-    sqlite3_reset(stmt);
-    if (sqlite3_bind_int(stmt, 1, file2_id) != SQLITE_OK ||
-        sqlite3_step(stmt) != SQLITE_ROW) {
-      sqlite3_finalize(stmt);
+  // Query metadata for primary and secondary file.
+  {
+    StatementResetter resetter(file_stmt_);
+    if (sqlite3_bind_int(file_stmt_, 1, file1_id) != SQLITE_OK ||
+        sqlite3_step(file_stmt_) != SQLITE_ROW) {
+      return absl::InternalError(absl::StrCat(
+          "SQLite result error querying file ids, file: ", filename));
+    }
+    ReadFileMetaData(file_stmt_, &summary->primary);
+    sqlite3_reset(file_stmt_);
+    if (sqlite3_bind_int(file_stmt_, 1, file2_id) != SQLITE_OK ||
+        sqlite3_step(file_stmt_) != SQLITE_ROW) {
       return absl::InternalError(absl::StrCat(
           "SQLite result error querying file metadata, file: ", filename));
     }
-
-    metadata->second.filename.assign(
-        reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0)));
-    metadata->second.original_filename.assign(
-        reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1)));
-    metadata->second.original_hash.assign(
-        reinterpret_cast<const char*>(sqlite3_column_text(stmt, 2)));
-  }
-  if (sqlite3_finalize(stmt) != SQLITE_OK) {
-    return absl::InternalError(
-        absl::StrCat("SQLite finalize statement failed for ", filename));
+    ReadFileMetaData(file_stmt_, &summary->secondary);
   }
+  last_stats_.metadata_time = absl::Now() - start;
+  return absl::OkStatus();
+}
 
-  // Query function matches.
-  if (sqlite3_prepare_v2(db.handle, query, strlen(query), &stmt, nullptr)) {
-    return absl::InternalError(absl::StrCat(
-        "SQLite prepare statement failed querying function matches, file: ",
-        filename));
+absl::Status BinDiffReader::ReadAttached(
+    absl::string_view filename, const BinDiffFunctionFilter& filter,
+    const MatchReceiverCallback& function_match_receiver,
+    const MatchReceiverCallback& basic_block_match_receiver,
+    const MatchReceiverCallback& instruction_match_receiver,
+    std::pair<FileMetaData, FileMetaData>* metadata) {
+  BinDiffSummary summary;
+  NA_RETURN_IF_ERROR(ReadAttachedSummary(filename, &summary));
+  if (metadata != nullptr) {
+    metadata->first = std::move(summary.primary);
+    metadata->second = std::move(summary.secondary);
   }
 
+  // Query function matches. Statements are cached per filter condition, as
+  // usually only the first file of a chain is filtered.
+  const absl::Time start = absl::Now();
+  const std::string condition = FunctionFilterCondition(filter);
+  sqlite3_stmt*& stmt = match_stmts_[condition];
+  // Ids are the primary keys of their tables, so ordering by them groups the
+  // rows of a function and basic block without sorting on the addresses.
+  NA_RETURN_IF_ERROR(Prepare(
+      absl::StrCat("SELECT"
+                   " f.id, f.address1, f.address2,"
+                   " b.id, b.address1, b.address2,"
+                   " i.address1, i.address2 "
+                   "FROM"
+                   " diff.\"function\" AS f,"
+                   " diff.\"basicblock\" AS b,"
+                   " diff.\"instruction\" AS i "
+                   "WHERE"
+                   " f.id = b.functionid AND"
+                   " b.id = i.basicblockid",
+                   condition,
+                   " ORDER BY"
+                   " f.id, b.id, i.address1, i.address2;"),
+      &stmt));
+  StatementResetter resetter(stmt);
+
   int32_t last_function_id = -1;
   int32_t last_basic_block_id = -1;
   MemoryAddressPair function_match, basic_block_match, instruction_match;
-  int32_t col = 0;
   while (true) {
     int result = sqlite3_step(stmt);
     if (result == SQLITE_DONE) {
       break;
     }
     if (result != SQLITE_ROW) {
-      sqlite3_finalize(stmt);
       return absl::FailedPreconditionError(absl::Substitute(
           "SQLite result error: $0, file $1", result, filename));
     }
+    ++last_stats_.num_rows;
 
-    int32_t function_id = sqlite3_column_int(stmt, col++ % kNumMatchCols);
-    function_match.first = sqlite3_column_int64(stmt, col++ % kNumMatchCols);
-    function_match.second = sqlite3_column_int64(stmt, col++ % kNumMatchCols);
-    int32_t basic_block_id = sqlite3_column_int(stmt, col++ % kNumMatchCols);
-    basic_block_match.first = sqlite3_column_int64(stmt, col++ % kNumMatchCols);
-    basic_block_match.second =
-        sqlite3_column_int64(stmt, col++ % kNumMatchCols);
-    instruction_match.first = sqlite3_column_int64(stmt, col++ % kNumMatchCols);
-    instruction_match.second =
-        sqlite3_column_int64(stmt, col++ % kNumMatchCols);
+    int32_t function_id = sqlite3_column_int(stmt, 0);
+    function_match.first = sqlite3_column_int64(stmt, 1);
+    function_match.second = sqlite3_column_int64(stmt, 2);
+    int32_t basic_block_id = sqlite3_column_int(stmt, 3);
+    basic_block_match.first = sqlite3_column_int64(stmt, 4);
+    basic_block_match.second = sqlite3_column_int64(stmt, 5);
+    instruction_match.first = sqlite3_column_int64(stmt, 6);
+    instruction_match.second = sqlite3_column_int64(stmt, 7);
 
     if (function_id != last_function_id) {
       function_match_receiver(function_match);
@@ -185,12 +354,31 @@ absl::Status ParseBinDiff(
       instruction_match_receiver(instruction_match);
     }
   }
-  if (sqlite3_finalize(stmt) != SQLITE_OK) {
-    return absl::InternalError(
-        absl::StrCat("SQLite finalize statement failed, file: ", filename));
-  }
-
+  last_stats_.match_time = absl::Now() - start;
   return absl::OkStatus();
 }
 
+absl::Status ParseBinDiff(
+    absl::string_view filename,
+    const MatchReceiverCallback& function_match_receiver,
+    const MatchReceiverCallback& basic_block_match_receiver,
+    const MatchReceiverCallback& instruction_match_receiver,
+    std::pair<FileMetaData, FileMetaData>* metadata) {
+  return ParseBinDiff(filename, BinDiffFunctionFilter(),
+                      function_match_receiver, basic_block_match_receiver,
+                      instruction_match_receiver, metadata);
+}
+
+absl::Status ParseBinDiff(
+    absl::string_view filename, const BinDiffFunctionFilter& filter,
+    const MatchReceiverCallback& function_match_receiver,
+    const MatchReceiverCallback& basic_block_match_receiver,
+    const MatchReceiverCallback& instruction_match_receiver,
+    std::pair<FileMetaData, FileMetaData>* metadata) {
+  NA_ASSIGN_OR_RETURN(auto reader, BinDiffReader::Create());
+  return reader->Read(filename, filter, function_match_receiver,
+                      basic_block_match_receiver, instruction_match_receiver,
+                      metadata);
+}
+
 }  // namespace security::vxsig
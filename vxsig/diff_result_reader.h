@@ -17,14 +17,24 @@
 #ifndef VXSIG_DIFF_RESULT_READER_H_
 #define VXSIG_DIFF_RESULT_READER_H_
 
+#include <cstdint>
 #include <functional>
+#include <limits>
+#include <memory>
 #include <string>
 #include <utility>
+#include <vector>
 
+#include "absl/container/flat_hash_map.h"
 #include "absl/strings/string_view.h"
 #include "absl/status/status.h"
+#include "absl/time/time.h"
+#include "third_party/zynamics/binexport/util/statusor.h"
 #include "vxsig/types.h"
 
+struct sqlite3;
+struct sqlite3_stmt;
+
 namespace security::vxsig {
 
 // A POD with metadata for one of the matched files that comprise a BinDiff
@@ -35,10 +45,117 @@ struct FileMetaData {
   std::string original_hash;
 };
 
+// The overall result of a BinDiff run, as stored in the metadata table of the
+// result file.
+struct BinDiffSummary {
+  FileMetaData primary;
+  FileMetaData secondary;
+  double similarity = 0.0;  // In [0, 1]
+  double confidence = 0.0;  // In [0, 1]
+};
+
 // Whenever a match is encountered, this callback gets called with its
 // corresponding addresses in both binaries.
 using MatchReceiverCallback = std::function<void(const MemoryAddressPair&)>;
 
+// Restricts the matches reported by ParseBinDiff() to a subset of the functions
+// in the primary binary. The restriction is applied in the database query, so
+// that filtered matches are never read.
+struct BinDiffFunctionFilter {
+  enum Mode {
+    kNone,       // Report all functions
+    kWhitelist,  // Only report functions listed in addresses
+    kBlacklist,  // Report all functions except those listed in addresses
+  };
+
+  Mode mode = kNone;
+  std::vector<MemoryAddress> addresses;
+
+  // Only report functions with primary addresses in [min_address,
+  // max_address]. Applies in addition to the mode above.
+  MemoryAddress min_address = 0;
+  MemoryAddress max_address = std::numeric_limits<MemoryAddress>::max();
+};
+
+// Timing counters for reading BinDiff result files.
+struct BinDiffReadStats {
+  void Add(const BinDiffReadStats& other);
+
+  int num_files = 0;
+  int64_t num_rows = 0;  // Number of rows of the match query
+
+  absl::Duration open_time;      // Opening the file and applying settings
+  absl::Duration metadata_time;  // Reading the file metadata
+  absl::Duration match_time;     // Reading matches, including the callbacks
+};
+
+// Reads BinDiff result files. Keeps a single SQLite connection with settings
+// tuned for reading and attaches the files to it one at a time, so that the
+// prepared statements can be reused for all files.
+// This class is not thread-safe, use one instance per thread.
+class BinDiffReader {
+ public:
+  static not_absl::StatusOr<std::unique_ptr<BinDiffReader>> Create();
+
+  BinDiffReader(const BinDiffReader&) = delete;
+  BinDiffReader& operator=(const BinDiffReader&) = delete;
+
+  ~BinDiffReader();
+
+  // Reads the specified .BinDiff file, see ParseBinDiff() below.
+  absl::Status Read(absl::string_view filename,
+                    const BinDiffFunctionFilter& filter,
+                    const MatchReceiverCallback& function_match_receiver,
+                    const MatchReceiverCallback& basic_block_match_receiver,
+                    const MatchReceiverCallback& instruction_match_receiver,
+                    std::pair<FileMetaData, FileMetaData>* metadata);
+
+  // Reads only the metadata of the specified .BinDiff file, without any of
+  // its matches. This is cheap enough to be used for choosing which files to
+  // read in full.
+  absl::Status ReadSummary(absl::string_view filename,
+                           BinDiffSummary* summary);
+
+  // Counters for the last file read and for all files read by this instance.
+  const BinDiffReadStats& last_stats() const { return last_stats_; }
+  const BinDiffReadStats& total_stats() const { return total_stats_; }
+
+ private:
+  BinDiffReader() = default;
+
+  absl::Status Execute(const char* sql);
+
+  // Prepares the statement unless it has been prepared before.
+  absl::Status Prepare(absl::string_view sql, sqlite3_stmt** stmt);
+
+  // Attaches the specified file, calls read and detaches the file again.
+  absl::Status ReadWithAttached(absl::string_view filename,
+                                const std::function<absl::Status()>& read);
+
+  // Reads the metadata of the currently attached file.
+  absl::Status ReadAttachedSummary(absl::string_view filename,
+                                   BinDiffSummary* summary);
+
+  // Reads metadata and matches from the currently attached file.
+  absl::Status ReadAttached(
+      absl::string_view filename, const BinDiffFunctionFilter& filter,
+      const MatchReceiverCallback& function_match_receiver,
+      const MatchReceiverCallback& basic_block_match_receiver,
+      const MatchReceiverCallback& instruction_match_receiver,
+      std::pair<FileMetaData, FileMetaData>* metadata);
+
+  sqlite3* db_ = nullptr;
+  sqlite3_stmt* attach_stmt_ = nullptr;
+  sqlite3_stmt* detach_stmt_ = nullptr;
+  sqlite3_stmt* metadata_stmt_ = nullptr;
+  sqlite3_stmt* file_stmt_ = nullptr;
+  // Match queries, keyed by their function filter condition.
+  absl::flat_hash_map<std::string, sqlite3_stmt*> match_stmts_;
+
+  BinDiffReadStats last_stats_;
+  BinDiffReadStats total_stats_;
+};
+
 // Parses the specified .BinDiff file and calls the specified callback
 // functions for all encountered matches. If the metadata parameter is
 // non-null, it is filled with metadata that is stored in the BinDiff result
@@ -51,6 +168,14 @@ absl::Status ParseBinDiff(
     const MatchReceiverCallback& instruction_match_receiver,
     std::pair<FileMetaData, FileMetaData>* metadata);
 
+// Like above, but only reports the matches of functions selected by filter.
+absl::Status ParseBinDiff(
+    absl::string_view filename, const BinDiffFunctionFilter& filter,
+    const MatchReceiverCallback& function_match_receiver,
+    const MatchReceiverCallback& basic_block_match_receiver,
+    const MatchReceiverCallback& instruction_match_receiver,
+    std::pair<FileMetaData, FileMetaData>* metadata);
+
 }  // namespace security::vxsig
 
 #endif  // VXSIG_DIFF_RESULT_READER_H_
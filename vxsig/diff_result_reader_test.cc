@@ -15,6 +15,8 @@
 #include "vxsig/diff_result_reader.h"
 
 #include <cstddef>
+#include <cstdint>
+#include <fstream>
 #include <utility>
 
 #include "absl/container/flat_hash_set.h"
@@ -22,14 +24,20 @@
 #include "absl/strings/string_view.h"
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
+#include "third_party/sqlite/sqlite3.h"
 #include "third_party/zynamics/binexport/util/filesystem.h"
 #include "absl/status/status.h"
 #include "third_party/zynamics/binexport/util/status_matchers.h"
 
 using not_absl::IsOk;
 using testing::Contains;
+using testing::DoubleNear;
+using testing::ElementsAre;
 using testing::Eq;
+using testing::IsEmpty;
 using testing::IsTrue;
+using testing::Not;
+using testing::SizeIs;
 
 namespace security::vxsig {
 namespace {
@@ -582,5 +590,196 @@ TEST_F(DiffResultReaderTest, ParseWithMetadata) {
               Eq("86781CF0DF581B166A9ACAE32373BEB465704B54"));
 }
 
+TEST_F(DiffResultReaderTest, ParseWithFunctionFilter) {
+  std::string file_name = JoinPath(
+      getenv("TEST_SRCDIR"),
+      "com_google_vxsig/vxsig/testdata/sshd.korg_vs_sshd.trojan1.BinDiff");
+  ASSERT_THAT(FileExists(file_name), IsTrue());
+
+  absl::flat_hash_set<MemoryAddressPair> functions;
+  size_t num_basic_block_matches = 0;
+  auto parse = [&](const BinDiffFunctionFilter& filter) {
+    functions.clear();
+    num_basic_block_matches = 0;
+    return ParseBinDiff(
+        file_name, filter,
+        [&functions](const MemoryAddressPair& match) {
+          functions.insert(match);
+        },
+        [&num_basic_block_matches](const MemoryAddressPair&) {
+          ++num_basic_block_matches;
+        },
+        /*instruction_match_receiver=*/nullptr, /*metadata=*/nullptr);
+  };
+
+  BinDiffFunctionFilter filter;
+  filter.mode = BinDiffFunctionFilter::kWhitelist;
+  filter.addresses = {0x00058410, 0x0005a940, 0x12345678};
+  ASSERT_THAT(parse(filter), IsOk());
+  EXPECT_THAT(functions, SizeIs(2));
+  EXPECT_THAT(functions, Contains(MemoryAddressPair(0x00058410, 0x080958f0)));
+  EXPECT_THAT(functions, Contains(MemoryAddressPair(0x0005a940, 0x08097d80)));
+
+  filter.mode = BinDiffFunctionFilter::kBlacklist;
+  ASSERT_THAT(parse(filter), IsOk());
+  EXPECT_THAT(functions, SizeIs(kNumFunctionMatches - 2));
+  EXPECT_THAT(functions,
+              Not(Contains(MemoryAddressPair(0x00058410, 0x080958f0))));
+
+  filter.mode = BinDiffFunctionFilter::kWhitelist;
+  filter.addresses.clear();
+  ASSERT_THAT(parse(filter), IsOk());
+  EXPECT_THAT(functions, IsEmpty());
+  EXPECT_THAT(num_basic_block_matches, Eq(0));
+
+  filter = BinDiffFunctionFilter();
+  filter.min_address = 0x00058410;
+  filter.max_address = 0x00058670;
+  ASSERT_THAT(parse(filter), IsOk());
+  EXPECT_THAT(functions, SizeIs(5));  // Range is inclusive
+}
+
+TEST_F(DiffResultReaderTest, ParseWithFunctionFilterHighAddresses) {
+  const std::string file_name = JoinPath(
+      getenv("TEST_SRCDIR"),
+      "com_google_vxsig/vxsig/testdata/sshd.korg_vs_sshd.trojan1.BinDiff");
+  const std::string copy_name =
+      JoinPath(getenv("TEST_TMPDIR"), "high_addresses.BinDiff");
+  {
+    std::ifstream in(file_name, std::ios::binary);
+    std::ofstream out(copy_name, std::ios::binary | std::ios::trunc);
+    out << in.rdbuf();
+    ASSERT_THAT(out.good(), IsTrue());
+  }
+
+  // Move one function above 2^63, where SQLite stores it as a negative
+  // number.
+  constexpr MemoryAddress kHighAddress = 0x8000000000058410;
+  sqlite3* db = nullptr;
+  ASSERT_THAT(sqlite3_open(copy_name.c_str(), &db), Eq(SQLITE_OK));
+  ASSERT_THAT(
+      sqlite3_exec(db,
+                   absl::StrCat("UPDATE \"function\" SET address1 = ",
+                                static_cast<int64_t>(kHighAddress),
+                                " WHERE address1 = ", 0x00058410, ";")
+                       .c_str(),
+                   nullptr, nullptr, nullptr),
+      Eq(SQLITE_OK));
+  sqlite3_close(db);
+
+  absl::flat_hash_set<MemoryAddressPair> functions;
+  auto parse = [&](const BinDiffFunctionFilter& filter) {
+    functions.clear();
+    return ParseBinDiff(
+        copy_name, filter,
+        [&functions](const MemoryAddressPair& match) {
+          functions.insert(match);
+        },
+        [](const MemoryAddressPair&) {},
+        /*instruction_match_receiver=*/nullptr, /*metadata=*/nullptr);
+  };
+  const MemoryAddressPair high_function(kHighAddress, 0x080958f0);
+
+  BinDiffFunctionFilter filter;
+  filter.mode = BinDiffFunctionFilter::kWhitelist;
+  filter.addresses = {kHighAddress, 0x0005a940};
+  ASSERT_THAT(parse(filter), IsOk());
+  EXPECT_THAT(functions, SizeIs(2));
+  EXPECT_THAT(functions, Contains(high_function));
+
+  filter.mode = BinDiffFunctionFilter::kBlacklist;
+  ASSERT_THAT(parse(filter), IsOk());
+  EXPECT_THAT(functions, SizeIs(kNumFunctionMatches - 2));
+  EXPECT_THAT(functions, Not(Contains(high_function)));
+
+  filter = BinDiffFunctionFilter();
+  filter.min_address = kHighAddress;
+  ASSERT_THAT(parse(filter), IsOk());
+  EXPECT_THAT(functions, ElementsAre(high_function));
+
+  // The range contains both low and high addresses.
+  filter.min_address = 0x0005a940;
+  ASSERT_THAT(parse(filter), IsOk());
+  EXPECT_THAT(functions, Contains(high_function));
+  EXPECT_THAT(functions, Contains(MemoryAddressPair(0x0005a940, 0x08097d80)));
+
+  filter.min_address = 0;
+  filter.max_address = kHighAddress - 1;
+  ASSERT_THAT(parse(filter), IsOk());
+  EXPECT_THAT(functions, SizeIs(kNumFunctionMatches - 1));
+  EXPECT_THAT(functions, Not(Contains(high_function)));
+}
+
+TEST_F(DiffResultReaderTest, ReaderReusedAcrossFiles) {
+  const std::string testdata =
+      JoinPath(getenv("TEST_SRCDIR"), "com_google_vxsig/vxsig/testdata");
+  auto reader_or = BinDiffReader::Create();
+  ASSERT_THAT(reader_or.status(), IsOk());
+  auto& reader = *reader_or.ValueOrDie();
+
+  std::pair<FileMetaData, FileMetaData> meta;
+  for (int i = 0; i < 2; ++i) {
+    num_function_matches_ = 0;
+    ASSERT_THAT(
+        reader.Read(JoinPath(testdata, "sshd.korg_vs_sshd.trojan1.BinDiff"),
+                    BinDiffFunctionFilter(),
+                    std::bind(ReceiveFunctionMatches, expect_functions_,
+                              &num_function_matches_, arg::_1),
+                    [](const MemoryAddressPair&) {},
+                    /*instruction_match_receiver=*/nullptr, &meta),
+        IsOk());
+    EXPECT_THAT(num_function_matches_, Eq(kNumFunctionMatches));
+    EXPECT_THAT(reader.last_stats().num_files, Eq(1));
+    EXPECT_THAT(reader.last_stats().num_rows, Eq(kNumInstructionMatches));
+  }
+  EXPECT_THAT(reader.total_stats().num_files, Eq(2));
+  EXPECT_THAT(reader.total_stats().num_rows, Eq(2 * kNumInstructionMatches));
+
+  // Errors must not leave the reader in an unusable state.
+  EXPECT_FALSE(
+      reader
+          .Read(JoinPath(testdata, "does_not_exist.BinDiff"),
+                BinDiffFunctionFilter(), [](const MemoryAddressPair&) {},
+                [](const MemoryAddressPair&) {}, nullptr, nullptr)
+          .ok());
+
+  ASSERT_THAT(
+      reader.Read(
+          JoinPath(testdata,
+                   "1794a0afbfc38411dec87fa2660d6dd6515cf8d03cb32bb24a1d7a8e1e"
+                   "cf30fa_vs_1b0a84953909816c1945c2153605c2ddeb3b138fb4c262c7"
+                   "262cd9689ed25f82.BinDiff"),
+          BinDiffFunctionFilter(), [](const MemoryAddressPair&) {},
+          [](const MemoryAddressPair&) {}, nullptr, &meta),
+      IsOk());
+  EXPECT_THAT(
+      meta.first.filename,
+      Eq("1794a0afbfc38411dec87fa2660d6dd6515cf8d03cb32bb24a1d7a8e1ecf30fa"));
+  EXPECT_THAT(
+      meta.second.filename,
+      Eq("1b0a84953909816c1945c2153605c2ddeb3b138fb4c262c7262cd9689ed25f82"));
+}
+
+TEST_F(DiffResultReaderTest, ReadSummary) {
+  auto reader_or = BinDiffReader::Create();
+  ASSERT_THAT(reader_or.status(), IsOk());
+  auto& reader = *reader_or.ValueOrDie();
+
+  BinDiffSummary summary;
+  ASSERT_THAT(
+      reader.ReadSummary(
+          JoinPath(getenv("TEST_SRCDIR"),
+                   "com_google_vxsig/vxsig/testdata/"
+                   "sshd.korg_vs_sshd.trojan1.BinDiff"),
+          &summary),
+      IsOk());
+  EXPECT_THAT(summary.primary.filename, Eq("sshd.korg"));
+  EXPECT_THAT(summary.secondary.filename, Eq("sshd.trojan1"));
+  EXPECT_THAT(summary.similarity, DoubleNear(0.4747, 1e-4));
+  EXPECT_THAT(summary.confidence, DoubleNear(0.9763, 1e-4));
+  // No matches are read.
+  EXPECT_THAT(reader.last_stats().num_rows, Eq(0));
+}
+
 }  // namespace
 }  // namespace security::vxsig
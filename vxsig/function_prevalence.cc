@@ -0,0 +1,159 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "vxsig/function_prevalence.h"
+
+#include <algorithm>
+#include <numeric>
+#include <utility>
+
+#include "absl/base/internal/endian.h"
+#include "absl/memory/memory.h"
+#include "absl/strings/str_cat.h"
+#include "third_party/zynamics/binexport/util/status_macros.h"
+#include "vxsig/atomic_file.h"
+#include "vxsig/binexport_reader.h"
+
+namespace security::vxsig {
+namespace {
+
+// Bump this when changing the file layout.
+constexpr absl::string_view kIndexMagic = "VXSIGFP1";
+
+// Magic, number of binaries, reserved and number of entries. The header size
+// is a multiple of eight, so the hash array is naturally aligned.
+constexpr size_t kHeaderSize = 8 + 4 + 4 + 8;
+constexpr size_t kEntrySize = sizeof(uint64_t) + sizeof(uint32_t);
+
+}  // namespace
+
+not_absl::StatusOr<std::unique_ptr<MappedFunctionPrevalenceIndex>>
+MappedFunctionPrevalenceIndex::Open(absl::string_view filename) {
+  NA_ASSIGN_OR_RETURN(auto file, MappedFile::Open(filename));
+  const absl::string_view data = file->data();
+  if (data.size() < kHeaderSize || data.substr(0, 8) != kIndexMagic) {
+    return absl::DataLossError(
+        absl::StrCat("not a function prevalence index: ", filename));
+  }
+  const uint64_t size = absl::little_endian::Load64(data.data() + 16);
+  if (size > (data.size() - kHeaderSize) / kEntrySize ||
+      data.size() - kHeaderSize != size * kEntrySize) {
+    return absl::DataLossError(
+        absl::StrCat("truncated function prevalence index: ", filename));
+  }
+  auto index = absl::WrapUnique(new MappedFunctionPrevalenceIndex());
+  index->num_binaries_ = absl::little_endian::Load32(data.data() + 8);
+  index->size_ = size;
+  index->hashes_ = data.data() + kHeaderSize;
+  index->counts_ = index->hashes_ + size * sizeof(uint64_t);
+  index->file_ = std::move(file);
+  return index;
+}
+
+uint64_t MappedFunctionPrevalenceIndex::hash(size_t i) const {
+  return absl::little_endian::Load64(hashes_ + i * sizeof(uint64_t));
+}
+
+uint32_t MappedFunctionPrevalenceIndex::count(size_t i) const {
+  return absl::little_endian::Load32(counts_ + i * sizeof(uint32_t));
+}
+
+void MappedFunctionPrevalenceIndex::Lookup(absl::Span<const uint64_t> hashes,
+                                           absl::Span<uint32_t> counts) const {
+  std::vector<size_t> order(hashes.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::sort(order.begin(), order.end(),
+            [&hashes](size_t a, size_t b) { return hashes[a] < hashes[b]; });
+
+  // Each query only needs to search the part of the index after the previous
+  // one.
+  size_t first = 0;
+  for (const size_t query : order) {
+    const uint64_t wanted = hashes[query];
+    size_t len = size_ - first;
+    while (len > 0) {
+      const size_t half = len / 2;
+      if (hash(first + half) < wanted) {
+        first += half + 1;
+        len -= half + 1;
+      } else {
+        len = half;
+      }
+    }
+    counts[query] = first < size_ && hash(first) == wanted ? count(first) : 0;
+  }
+}
+
+absl::Status FunctionPrevalenceIndexBuilder::AddBinExport(
+    absl::string_view filename) {
+  std::string sha256;
+  std::vector<uint64_t> function_hashes;
+  BinExportReaderOptions options;
+  options.wanted_instruction = [](MemoryAddress) { return false; };
+  options.render_disassembly = false;
+  options.function_hash_receiver = [&function_hashes](MemoryAddress,
+                                                      uint64_t function_hash) {
+    function_hashes.push_back(function_hash);
+  };
+  NA_RETURN_IF_ERROR(ParseBinExport(
+      filename,
+      [&sha256](const std::string& binary_sha256, MemoryAddress,
+                BinExport2::CallGraph::Vertex::Type, double /*md_index*/) {
+        sha256 = binary_sha256;
+      },
+      [](MemoryAddress, MemoryAddress, const std::string&, const std::string&,
+         const Immediates&) {},
+      options));
+  AddBinary(sha256, function_hashes);
+  return absl::OkStatus();
+}
+
+void FunctionPrevalenceIndexBuilder::AddBinary(
+    absl::string_view sha256, absl::Span<const uint64_t> function_hashes) {
+  if (!sha256.empty() && !seen_sha256_.emplace(sha256).second) {
+    return;
+  }
+  ++num_binaries_;
+  absl::flat_hash_set<uint64_t> unique_hashes(function_hashes.begin(),
+                                              function_hashes.end());
+  unique_hashes.erase(0);
+  for (const uint64_t function_hash : unique_hashes) {
+    ++counts_[function_hash];
+  }
+}
+
+absl::Status FunctionPrevalenceIndexBuilder::Write(
+    absl::string_view filename) const {
+  std::vector<std::pair<uint64_t, uint32_t>> entries(counts_.begin(),
+                                                     counts_.end());
+  std::sort(entries.begin(), entries.end());
+
+  std::string buffer(kHeaderSize + entries.size() * kEntrySize, '\0');
+  char* out = &buffer[0];
+  std::copy(kIndexMagic.begin(), kIndexMagic.end(), out);
+  absl::little_endian::Store32(out + 8, num_binaries_);
+  absl::little_endian::Store64(out + 16, entries.size());
+  char* hashes = out + kHeaderSize;
+  char* counts = hashes + entries.size() * sizeof(uint64_t);
+  for (const auto& entry : entries) {
+    absl::little_endian::Store64(hashes, entry.first);
+    absl::little_endian::Store32(counts, entry.second);
+    hashes += sizeof(uint64_t);
+    counts += sizeof(uint32_t);
+  }
+
+  return WriteFileAtomically(filename, {buffer});
+}
+
+}  // namespace security::vxsig
@@ -0,0 +1,127 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// A corpus index of function prevalence. The index counts in how many
+// binaries of a corpus, typically goodware and common libraries, a function
+// occurs. Functions are identified by the normalized hash computed by the
+// BinExport reader, so that the same library function matches regardless of
+// where it was linked.
+//
+// Index files consist of a small header followed by a sorted array of
+// function hashes and a parallel array of binary counts, all stored as
+// little-endian integers. The file is memory-mapped and queried in place, so
+// opening even a large index is cheap.
+
+#ifndef VXSIG_FUNCTION_PREVALENCE_H_
+#define VXSIG_FUNCTION_PREVALENCE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/container/flat_hash_set.h"
+#include "absl/status/status.h"
+#include "absl/strings/string_view.h"
+#include "absl/types/span.h"
+#include "third_party/zynamics/binexport/util/statusor.h"
+#include "vxsig/mapped_file.h"
+
+namespace security::vxsig {
+
+// Interface for looking up how common functions are.
+class FunctionPrevalenceIndex {
+ public:
+  virtual ~FunctionPrevalenceIndex() = default;
+
+  // Returns the number of binaries that the index was built from.
+  virtual uint32_t num_binaries() const = 0;
+
+  // Stores the number of binaries containing each of the specified function
+  // hashes in the respective element of counts, which must have the same
+  // size as hashes. Unknown functions get a count of zero. Implementations
+  // need to be safe to call concurrently.
+  virtual void Lookup(absl::Span<const uint64_t> hashes,
+                      absl::Span<uint32_t> counts) const = 0;
+};
+
+// A function prevalence index that is queried directly from a memory-mapped
+// index file.
+class MappedFunctionPrevalenceIndex : public FunctionPrevalenceIndex {
+ public:
+  // Maps the specified index file, as written by
+  // FunctionPrevalenceIndexBuilder::Write(), into memory. Returns a DataLoss
+  // error if the file is not a valid index.
+  static not_absl::StatusOr<std::unique_ptr<MappedFunctionPrevalenceIndex>>
+  Open(absl::string_view filename);
+
+  MappedFunctionPrevalenceIndex(const MappedFunctionPrevalenceIndex&) = delete;
+  MappedFunctionPrevalenceIndex& operator=(
+      const MappedFunctionPrevalenceIndex&) = delete;
+
+  uint32_t num_binaries() const override { return num_binaries_; }
+
+  // Returns the number of distinct function hashes in the index.
+  size_t size() const { return size_; }
+
+  // Sorts the query hashes first, so that a batch is answered in a single
+  // forward pass over the index.
+  void Lookup(absl::Span<const uint64_t> hashes,
+              absl::Span<uint32_t> counts) const override;
+
+ private:
+  MappedFunctionPrevalenceIndex() = default;
+
+  uint64_t hash(size_t i) const;
+  uint32_t count(size_t i) const;
+
+  std::unique_ptr<MappedFile> file_;
+  const char* hashes_ = nullptr;
+  const char* counts_ = nullptr;
+  size_t size_ = 0;
+  uint32_t num_binaries_ = 0;
+};
+
+// Builds a function prevalence index from a corpus of binaries. Each function
+// hash is counted at most once per binary, and binaries with the same SHA256
+// are only counted once.
+class FunctionPrevalenceIndexBuilder {
+ public:
+  // Adds the functions of the specified BinExport file. Only the call graph
+  // and the instruction mnemonics are read, instructions are not decoded.
+  absl::Status AddBinExport(absl::string_view filename);
+
+  // Adds a binary that contains the specified function hashes. Duplicate and
+  // zero hashes are ignored. If sha256 is not empty and a binary with the same
+  // SHA256 was already added, does nothing.
+  void AddBinary(absl::string_view sha256,
+                 absl::Span<const uint64_t> function_hashes);
+
+  // Returns the number of binaries added so far.
+  uint32_t num_binaries() const { return num_binaries_; }
+
+  // Writes the index to the specified file.
+  absl::Status Write(absl::string_view filename) const;
+
+ private:
+  absl::flat_hash_map<uint64_t, uint32_t> counts_;
+  absl::flat_hash_set<std::string> seen_sha256_;
+  uint32_t num_binaries_ = 0;
+};
+
+}  // namespace security::vxsig
+
+#endif  // VXSIG_FUNCTION_PREVALENCE_H_
@@ -0,0 +1,126 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "vxsig/function_prevalence.h"
+
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "third_party/zynamics/binexport/util/filesystem.h"
+#include "third_party/zynamics/binexport/util/status_matchers.h"
+
+using not_absl::IsOk;
+using testing::ElementsAre;
+using testing::Eq;
+using testing::Gt;
+using testing::Not;
+
+namespace security::vxsig {
+namespace {
+
+std::string TestFile(absl::string_view name) {
+  return JoinPath(getenv("TEST_TMPDIR"), name);
+}
+
+TEST(FunctionPrevalenceTest, BuildAndLookup) {
+  FunctionPrevalenceIndexBuilder builder;
+  builder.AddBinary("first", {1, 2, 3});
+  builder.AddBinary("second", {2, 3, 3, 0});
+  builder.AddBinary("first", {1, 2, 3, 4});  // Same binary, not counted
+  builder.AddBinary("", {3});
+  EXPECT_THAT(builder.num_binaries(), Eq(3));
+
+  const std::string filename = TestFile("prevalence_index");
+  ASSERT_THAT(builder.Write(filename), IsOk());
+  auto index_or = MappedFunctionPrevalenceIndex::Open(filename);
+  ASSERT_THAT(index_or.status(), IsOk());
+  const auto& index = *index_or.ValueOrDie();
+  EXPECT_THAT(index.num_binaries(), Eq(3));
+  EXPECT_THAT(index.size(), Eq(3));
+
+  // Queries do not need to be sorted and may contain duplicates.
+  const std::vector<uint64_t> hashes = {3, 99, 1, 0, 2, 3, 4};
+  std::vector<uint32_t> counts(hashes.size(), 42);
+  index.Lookup(hashes, absl::MakeSpan(counts));
+  EXPECT_THAT(counts, ElementsAre(3, 0, 1, 0, 2, 3, 0));
+}
+
+TEST(FunctionPrevalenceTest, EmptyIndex) {
+  const std::string filename = TestFile("empty_prevalence_index");
+  ASSERT_THAT(FunctionPrevalenceIndexBuilder().Write(filename), IsOk());
+  auto index_or = MappedFunctionPrevalenceIndex::Open(filename);
+  ASSERT_THAT(index_or.status(), IsOk());
+  const std::vector<uint64_t> hashes = {1};
+  std::vector<uint32_t> counts(hashes.size(), 42);
+  index_or.ValueOrDie()->Lookup(hashes, absl::MakeSpan(counts));
+  EXPECT_THAT(counts, ElementsAre(0));
+}
+
+TEST(FunctionPrevalenceTest, RejectsInvalidFiles) {
+  const std::string filename = TestFile("prevalence_index");
+  FunctionPrevalenceIndexBuilder builder;
+  builder.AddBinary("", {1, 2});
+  ASSERT_THAT(builder.Write(filename), IsOk());
+  std::string contents;
+  {
+    std::ifstream file(filename, std::ios_base::binary);
+    contents.assign(std::istreambuf_iterator<char>(file),
+                    std::istreambuf_iterator<char>());
+  }
+
+  const std::string truncated = TestFile("truncated_prevalence_index");
+  {
+    std::ofstream file(truncated, std::ios_base::binary);
+    file.write(contents.data(), contents.size() - 1);
+  }
+  EXPECT_THAT(MappedFunctionPrevalenceIndex::Open(truncated).status(),
+              Not(IsOk()));
+
+  const std::string not_an_index = TestFile("not_a_prevalence_index");
+  {
+    std::ofstream file(not_an_index, std::ios_base::binary);
+    file << "VXSIGMC2 is a match chain cache";
+  }
+  EXPECT_THAT(MappedFunctionPrevalenceIndex::Open(not_an_index).status(),
+              Not(IsOk()));
+}
+
+TEST(FunctionPrevalenceTest, AddBinExport) {
+  const std::string binexport = JoinPath(
+      getenv("TEST_SRCDIR"),
+      "com_google_vxsig/vxsig/testdata/"
+      "1794a0afbfc38411dec87fa2660d6dd6515cf8d03cb32bb24a1d7a8e1ecf30fa."
+      "BinExport");
+  FunctionPrevalenceIndexBuilder builder;
+  ASSERT_THAT(builder.AddBinExport(binexport), IsOk());
+  ASSERT_THAT(builder.AddBinExport(binexport), IsOk());
+  EXPECT_THAT(builder.num_binaries(), Eq(1));
+
+  const std::string filename = TestFile("binexport_prevalence_index");
+  ASSERT_THAT(builder.Write(filename), IsOk());
+  auto index_or = MappedFunctionPrevalenceIndex::Open(filename);
+  ASSERT_THAT(index_or.status(), IsOk());
+  EXPECT_THAT(index_or.ValueOrDie()->size(), Gt(0));
+
+  EXPECT_THAT(builder.AddBinExport(TestFile("does_not_exist")), Not(IsOk()));
+}
+
+}  // namespace
+}  // namespace security::vxsig
@@ -0,0 +1,90 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "vxsig/generation_stats.h"
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+#include <cstdio>
+
+#include "absl/time/clock.h"
+
+namespace security::vxsig {
+
+absl::Duration ProcessCpuTime() {
+#ifndef _WIN32
+  timespec cpu_time;
+  if (clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu_time) == 0) {
+    return absl::DurationFromTimespec(cpu_time);
+  }
+#endif
+  return absl::ZeroDuration();
+}
+
+int64_t PeakRssBytes() {
+#ifndef _WIN32
+  rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) == 0) {
+#ifdef __APPLE__
+    return usage.ru_maxrss;  // Already in bytes
+#else
+    return static_cast<int64_t>(usage.ru_maxrss) * 1024;
+#endif
+  }
+#endif
+  return 0;
+}
+
+int64_t CurrentRssBytes() {
+#ifdef __linux__
+  // The second field is the number of resident pages.
+  FILE* statm = fopen("/proc/self/statm", "r");
+  if (statm) {
+    long long size = 0;      // NOLINT(runtime/int)
+    long long resident = 0;  // NOLINT(runtime/int)
+    const bool ok = fscanf(statm, "%lld %lld", &size, &resident) == 2;
+    fclose(statm);
+    if (ok) {
+      return resident * sysconf(_SC_PAGESIZE);
+    }
+  }
+#endif
+  return 0;
+}
+
+StageTimer::StageTimer(absl::string_view name, GenerationStats* stats)
+    : name_(name), stats_(stats) {
+  if (stats_) {
+    wall_start_ = absl::Now();
+    cpu_start_ = ProcessCpuTime();
+  }
+}
+
+StageTimer::~StageTimer() {
+  if (!stats_) {
+    return;
+  }
+  auto* stage = stats_->add_stage();
+  stage->set_name(name_);
+  stage->set_wall_time_us(absl::ToInt64Microseconds(absl::Now() - wall_start_));
+  stage->set_cpu_time_us(
+      absl::ToInt64Microseconds(ProcessCpuTime() - cpu_start_));
+}
+
+}  // namespace security::vxsig
@@ -0,0 +1,67 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// Helpers to fill GenerationStats messages: timing of generator stages and
+// resource usage of the process.
+
+#ifndef VXSIG_GENERATION_STATS_H_
+#define VXSIG_GENERATION_STATS_H_
+
+#include <cstdint>
+#include <string>
+
+#include "absl/strings/string_view.h"
+#include "absl/time/time.h"
+#include "vxsig/vxsig.pb.h"
+
+namespace security::vxsig {
+
+// Returns the CPU time that the process has used so far, summed over all of
+// its threads. Returns zero if the platform does not support this.
+absl::Duration ProcessCpuTime();
+
+// Returns the peak resident set size of the process so far. Returns zero if
+// the platform does not support this.
+int64_t PeakRssBytes();
+
+// Returns the current resident set size of the process. Returns zero if the
+// platform does not support this.
+int64_t CurrentRssBytes();
+
+// Measures the wall and CPU time of a scope and adds it as a stage to a
+// GenerationStats message on destruction. Does nothing if stats is nullptr.
+// Usage:
+//   {
+//     StageTimer timer("parse_diff_results", &stats);
+//     ...
+//   }
+class StageTimer {
+ public:
+  StageTimer(absl::string_view name, GenerationStats* stats);
+  ~StageTimer();
+
+  StageTimer(const StageTimer&) = delete;
+  StageTimer& operator=(const StageTimer&) = delete;
+
+ private:
+  std::string name_;
+  GenerationStats* stats_;
+  absl::Time wall_start_;
+  absl::Duration cpu_start_;
+};
+
+}  // namespace security::vxsig
+
+#endif  // VXSIG_GENERATION_STATS_H_
@@ -0,0 +1,55 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "vxsig/generation_stats.h"
+
+#include "absl/time/clock.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+using testing::Ge;
+using testing::Gt;
+using testing::SizeIs;
+using testing::StrEq;
+
+namespace security::vxsig {
+namespace {
+
+TEST(GenerationStatsTest, StageTimerAddsStage) {
+  GenerationStats stats;
+  {
+    StageTimer timer("first", &stats);
+    absl::SleepFor(absl::Milliseconds(2));
+  }
+  { StageTimer timer("second", &stats); }
+  ASSERT_THAT(stats.stage(), SizeIs(2));
+  EXPECT_THAT(stats.stage(0).name(), StrEq("first"));
+  EXPECT_THAT(stats.stage(0).wall_time_us(), Ge(2000));
+  EXPECT_THAT(stats.stage(0).cpu_time_us(), Ge(0));
+  EXPECT_THAT(stats.stage(1).name(), StrEq("second"));
+}
+
+TEST(GenerationStatsTest, StageTimerWithoutStats) {
+  StageTimer timer("ignored", /*stats=*/nullptr);
+}
+
+TEST(GenerationStatsTest, PeakRss) { EXPECT_THAT(PeakRssBytes(), Gt(0)); }
+
+#ifdef __linux__
+TEST(GenerationStatsTest, CurrentRss) { EXPECT_THAT(CurrentRssBytes(), Gt(0)); }
+#endif
+
+}  // namespace
+}  // namespace security::vxsig
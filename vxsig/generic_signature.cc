@@ -16,16 +16,19 @@
 
 #include <algorithm>
 #include <cstddef>
+#include <cstdint>
 #include <iterator>
+#include <limits>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "absl/base/attributes.h"
-#include "absl/base/internal/endian.h"
-#include "absl/container/flat_hash_set.h"
 #include "absl/memory/memory.h"
 #include "absl/strings/str_cat.h"
+#include "third_party/zynamics/binexport/util/status_macros.h"
 #include "vxsig/common_subsequence.h"
+#include "vxsig/longest_common_subsequence.h"
 #include "vxsig/subsequence_regex.h"
 
 namespace security::vxsig {
@@ -40,28 +43,98 @@ struct ByteWithExtra {
   int weight;  // See MatchedBasicBlock and RawSignature::Piece::weight.
   // Keep the association with the disassembly.
   const MatchedInstruction* origin;
+  // Bounds of the number of bytes matched by a kWildcard, see
+  // RawSignature::Piece. A max_qualifier of -1 means unbounded.
+  int min_qualifier = 0;
+  int max_qualifier = -1;
 };
 
-bool operator==(const ByteWithExtra& lhs, const ByteWithExtra& rhs) {
-  // Intentionally ignore the weight.
-  return lhs.value == rhs.value && lhs.type == rhs.type;
+constexpr ByteWithExtra kWildcardByte = {
+    /*value=*/0, ByteWithExtra::kWildcard, /*weight=*/0};
+
+using ByteWithExtraString = std::vector<ByteWithExtra>;
+
+// Weight and origin of a ByteWithExtra.
+struct ByteExtra {
+  int weight;
+  const MatchedInstruction* origin;
+};
+
+// Compact form of ByteWithExtra that is used while building the regex of a
+// single basic block. The byte value and type are packed into symbol, which is
+// all that the common subsequence and regex computations look at. The weight
+// and origin are kept in a side table, at index extra, so that the regex can
+// be converted back. For wildcards, extra is the index of their bounds.
+struct PackedByte {
+  uint16_t symbol;  // type << 8 | value
+  uint32_t extra;
+};
+
+bool operator==(const PackedByte& lhs, const PackedByte& rhs) {
+  // Intentionally ignore the extra information.
+  return lhs.symbol == rhs.symbol;
 }
 
-// Marked as live to avoid potential later surprises.
-ABSL_ATTRIBUTE_UNUSED bool operator!=(const ByteWithExtra& lhs,
-                                      const ByteWithExtra& rhs) {
+bool operator!=(const PackedByte& lhs, const PackedByte& rhs) {
   return !(lhs == rhs);
 }
 
-constexpr ByteWithExtra kWildcardByte = {
-    /*value=*/0, ByteWithExtra::kWildcard, /*weight=*/0};
+using PackedByteString = std::vector<PackedByte>;
 
-using ByteWithExtraString = std::vector<ByteWithExtra>;
-using ByteWithExtraStringBackInserter =
-    std::back_insert_iterator<ByteWithExtraString>;
+// Index of the bounds of unbounded wildcards.
+constexpr uint32_t kUnboundedWildcard = 0;
+
+constexpr PackedByte kPackedWildcardByte = {ByteWithExtra::kWildcard << 8,
+                                            kUnboundedWildcard};
+
+// The byte sequences of a basic block in all columns, in packed form, together
+// with the side tables that their weights and origins and the bounds of
+// wildcards are stored in.
+struct BasicBlockBytes {
+  BasicBlockBytes() : wildcards({{/*min=*/0, /*max=*/-1}}) {}
+
+  void Add(uint8_t value, decltype(ByteWithExtra::type) type, int weight,
+           const MatchedInstruction* origin, PackedByteString* sequence) {
+    sequence->push_back({static_cast<uint16_t>(type << 8 | value),
+                         static_cast<uint32_t>(extras.size())});
+    extras.push_back({weight, origin});
+  }
+
+  void AddWildcard(int min_qualifier, int max_qualifier,
+                   PackedByteString* regex) {
+    regex->push_back({kPackedWildcardByte.symbol,
+                      static_cast<uint32_t>(wildcards.size())});
+    wildcards.push_back({min_qualifier, max_qualifier});
+  }
+
+  ByteWithExtra Unpack(const PackedByte& byte) const {
+    if (byte.symbol == kPackedWildcardByte.symbol) {
+      const auto& bounds = wildcards[byte.extra];
+      return {/*value=*/0, ByteWithExtra::kWildcard, /*weight=*/0,
+              /*origin=*/nullptr, bounds.first, bounds.second};
+    }
+    const ByteExtra& extra = extras[byte.extra];
+    return {static_cast<uint8_t>(byte.symbol & 0xFF),
+            static_cast<decltype(ByteWithExtra::type)>(byte.symbol >> 8),
+            extra.weight, extra.origin};
+  }
+
+  std::vector<PackedByteString> sequences;
+  std::vector<ByteExtra> extras;
+  std::vector<std::pair<int, int>> wildcards;
+};
 
 }  // namespace
 
+// Equality of PackedByte only depends on the byte value and the type, so the
+// LCS of signature byte strings can use the bit-parallel kernel.
+template <>
+struct LcsAlphabet<PackedByte> {
+  static constexpr bool kEnabled = true;
+  static constexpr int kSize = 3 * 256;
+  static int Index(const PackedByte& byte) { return byte.symbol; }
+};
+
 int GetSignatureSize(const Signature& signature) {
   int size = 0;
   for (const auto& piece : signature.raw_signature().piece()) {
@@ -70,16 +143,33 @@ int GetSignatureSize(const Signature& signature) {
   return size;
 }
 
+// Sets the bounds of the wildcard that follows piece. Unbounded wildcards
+// without a minimum are left at the default values.
+void SetPieceQualifiers(int64_t min_qualifier, int64_t max_qualifier,
+                        RawSignature::Piece* piece) {
+  if (min_qualifier > 0) {
+    piece->set_min_qualifier(min_qualifier);
+  }
+  if (max_qualifier >= 0) {
+    piece->set_max_qualifier(max_qualifier);
+  }
+}
+
 RawSignature ToRawSignatureProto(const ByteWithExtraString& regex) {
   // Convert to Protobuf based signature.
   RawSignature signature_regex;
   auto* cur_piece = signature_regex.add_piece();
+  RawSignature::Piece* last_piece = nullptr;
   bool add_new_piece = false;
   const MatchedInstruction* last_instruction = nullptr;
+  // Bounds of the bytes skipped since the last byte that was added to a piece.
+  int64_t gap_min = 0;
+  int64_t gap_max = 0;
   int i = 0;
   for (const auto& byte_with_extra : regex) {
     if (byte_with_extra.type != ByteWithExtra::kWildcard) {
       if (add_new_piece) {
+        last_piece = cur_piece;
         cur_piece = signature_regex.add_piece();
         i = 0;
       }
@@ -87,13 +177,23 @@ RawSignature ToRawSignatureProto(const ByteWithExtraString& regex) {
 
       if (byte_with_extra.type == ByteWithExtra::kSingleWildcard) {
         if (cur_piece->bytes().empty()) {
-          // Never add single wildcards to the start of a signature piece.
+          // Never add single wildcards to the start of a signature piece. The
+          // byte becomes part of the wildcard in front of the piece instead.
+          ++gap_min;
+          if (gap_max >= 0) {
+            ++gap_max;
+          }
           continue;
         }
 
         cur_piece->add_masked_nibble(i * 2);
         cur_piece->add_masked_nibble(i * 2 + 1);
       }
+      if (cur_piece->bytes().empty() && last_piece) {
+        SetPieceQualifiers(gap_min, gap_max, last_piece);
+      }
+      gap_min = 0;
+      gap_max = 0;
       *cur_piece->mutable_bytes() += byte_with_extra.value;
       ++i;
       // Each group of consecutive bytes should have the same weight.
@@ -112,8 +212,13 @@ RawSignature ToRawSignatureProto(const ByteWithExtraString& regex) {
     } else {
       // The last byte_with_wildcard was a wildcard so we need to add a new
       // piece to the signature. We only want to add a single piece for multiple
-      // consecutive wildcards or we'd end up with empty pieces.
+      // consecutive wildcards or we'd end up with empty pieces. The bounds of
+      // consecutive wildcards add up.
       add_new_piece = !cur_piece->bytes().empty();
+      gap_min += byte_with_extra.min_qualifier;
+      gap_max = gap_max < 0 || byte_with_extra.max_qualifier < 0
+                    ? -1
+                    : gap_max + byte_with_extra.max_qualifier;
     }
   }
 
@@ -128,43 +233,19 @@ RawSignature ToRawSignatureProto(const ByteWithExtraString& regex) {
 void AddInstructionBytes(const MatchedBasicBlock& bb,
                          const MatchedInstruction& instr,
                          bool disable_nibble_masking,
-                         ByteWithExtraString* bb_sequence) {
+                         BasicBlockBytes* bb_bytes,
+                         PackedByteString* bb_sequence) {
   CHECK(bb_sequence);
 
-  absl::flat_hash_set<int> immediate_pos;
-  immediate_pos.reserve(instr.immediates.size());
-  if (!disable_nibble_masking) {
-    std::string immediate(4, '\0');
-    for (const auto& immediate_value : instr.immediates) {
-      if (immediate_value.second !=
-          kDWord) {  // Only look at 32-bit immediates.
-        continue;
-      }
-      // Only look for little endian encoded immediates.
-      absl::little_endian::Store32(&immediate[0], immediate_value.first);
-      const auto found = instr.raw_instruction_bytes.rfind(immediate);
-      if (found != std::string::npos) {
-        immediate_pos.insert(found);
-      }
-    }
-  }
-
-  for (int i = 0; i < instr.raw_instruction_bytes.size();) {
-    const auto& raw_bytes = instr.raw_instruction_bytes;
-    if (disable_nibble_masking ||
-        immediate_pos.find(i) == immediate_pos.end()) {
-      bb_sequence->push_back(
-          {raw_bytes[i++], ByteWithExtra::kRegularByte, bb.weight, &instr});
-    } else {
-      bb_sequence->push_back(
-          {raw_bytes[i++], ByteWithExtra::kSingleWildcard, bb.weight, &instr});
-      bb_sequence->push_back(
-          {raw_bytes[i++], ByteWithExtra::kSingleWildcard, bb.weight, &instr});
-      bb_sequence->push_back(
-          {raw_bytes[i++], ByteWithExtra::kSingleWildcard, bb.weight, &instr});
-      bb_sequence->push_back(
-          {raw_bytes[i++], ByteWithExtra::kSingleWildcard, bb.weight, &instr});
-    }
+  const auto& raw_bytes = instr.raw_instruction_bytes;
+  const uint64_t immediate_mask =
+      disable_nibble_masking ? 0 : instr.immediate_mask;
+  for (int i = 0; i < raw_bytes.size(); ++i) {
+    bb_bytes->Add(raw_bytes[i],
+                  i < 64 && ((immediate_mask >> i) & 1)
+                      ? ByteWithExtra::kSingleWildcard
+                      : ByteWithExtra::kRegularByte,
+                  bb.weight, &instr, bb_sequence);
   }
 }
 
@@ -204,9 +285,121 @@ void PenalizeShortAtoms(int min_piece_length, ByteWithExtraString* regex) {
   }
 }
 
+// Builds the regular expression of a basic block from the common subsequence
+// of its byte sequences, aligned as computed by SubsequencePositions(). Like
+// RegexFromAlignment(), this inserts a wildcard wherever one of the sequences
+// skips bytes. Its bounds are the minimum and maximum number of bytes skipped,
+// unless a skipped range contains an inter-instruction wildcard, whose size is
+// unknown.
+void RegexFromBasicBlockAlignment(const PackedByteString& bb_cs,
+                                  const SubsequenceAlignment& alignment,
+                                  BasicBlockBytes* bb_bytes,
+                                  PackedByteString* regex) {
+  // Number of wildcards in front of each position of each sequence.
+  const auto& sequences = bb_bytes->sequences;
+  std::vector<std::vector<int>> wildcards_before(sequences.size());
+  for (int i = 0; i < sequences.size(); ++i) {
+    auto& counts = wildcards_before[i];
+    counts.reserve(sequences[i].size() + 1);
+    counts.push_back(0);
+    for (const auto& byte : sequences[i]) {
+      counts.push_back(counts.back() + (byte == kPackedWildcardByte));
+    }
+  }
+
+  regex->reserve(bb_cs.size());
+  for (int k = 0; k < bb_cs.size(); ++k) {
+    if (k > 0) {
+      int min_gap = std::numeric_limits<int>::max();
+      int max_gap = 0;
+      bool unbounded = false;
+      for (int i = 0; i < sequences.size(); ++i) {
+        const size_t gap_begin = alignment[i][k - 1] + 1;
+        const size_t gap_end = alignment[i][k];
+        const int num_wildcards =
+            wildcards_before[i][gap_end] - wildcards_before[i][gap_begin];
+        const int num_bytes = gap_end - gap_begin - num_wildcards;
+        min_gap = std::min(min_gap, num_bytes);
+        max_gap = std::max(max_gap, num_bytes);
+        unbounded |= num_wildcards > 0;
+      }
+      if (unbounded || max_gap > 0) {
+        bb_bytes->AddWildcard(min_gap, unbounded ? -1 : max_gap, regex);
+      }
+    }
+    regex->push_back(bb_cs[k]);
+  }
+}
+
+// Builds the regular expression for a single basic block candidate from the
+// instruction bytes of the basic block in all columns of the table.
+absl::Status BasicBlockRegexFromMatches(const MatchChainTable& table,
+                                        Ident bb_id,
+                                        bool disable_nibble_masking,
+                                        ThreadPool* pool,
+                                        ByteWithExtraString* per_bb_regex) {
+  BasicBlockBytes bb_bytes;
+  auto& bb_sequences = bb_bytes.sequences;
+  bb_sequences.reserve(table.size());
+
+  // Iterate over all columns of the table.
+  for (const auto& column : table) {
+    const auto& bb = *ABSL_DIE_IF_NULL(column->FindBasicBlockById(bb_id));
+
+    PackedByteString bb_sequence;
+    MemoryAddress last_address = 0;
+    size_t last_size = 0;
+
+    // Gather the instruction bytes for the current basic block.
+    for (const auto& instr : bb.instructions) {
+      DCHECK_LE(last_address + last_size, instr->match.address);
+
+      // Count non-continuous instructions and insert inter-instruction
+      // wildcards.
+      if (!bb_sequence.empty() && bb_sequence.back() != kPackedWildcardByte &&
+          last_address + last_size < instr->match.address) {
+        // We need to insert a wildcard here, since otherwise we generate
+        // signatures containing non-consecutive bytes.
+        bb_sequence.push_back(kPackedWildcardByte);
+      }
+
+      if (instr->raw_instruction_bytes.empty()) {
+        return absl::InternalError(absl::StrCat(
+            "No bytes for instruction in ", column->filename(), " at ",
+            absl::Hex(instr->match.address, absl::kZeroPad8),
+            " (from basic block at ",
+            absl::Hex(bb.match.address, absl::kZeroPad8), ")"));
+      }
+      AddInstructionBytes(bb, *instr, disable_nibble_masking, &bb_bytes,
+                          &bb_sequence);
+
+      last_address = instr->match.address;
+      last_size = instr->raw_instruction_bytes.size();
+    }
+    bb_sequences.push_back(std::move(bb_sequence));
+  }
+
+  PackedByteString bb_cs;
+  CommonSubsequence(bb_sequences, std::back_inserter(bb_cs), pool);
+
+  SubsequenceAlignment alignment;
+  if (!SubsequencePositions(bb_cs.begin(), bb_cs.end(), bb_sequences,
+                            &alignment)) {
+    return absl::InternalError(
+        absl::StrCat("Invalid common subsequence for basic block ", bb_id));
+  }
+  PackedByteString packed_regex;
+  RegexFromBasicBlockAlignment(bb_cs, alignment, &bb_bytes, &packed_regex);
+  per_bb_regex->reserve(packed_regex.size());
+  for (const auto& byte : packed_regex) {
+    per_bb_regex->push_back(bb_bytes.Unpack(byte));
+  }
+  return absl::OkStatus();
+}
+
 not_absl::StatusOr<RawSignature> GenericSignatureFromMatches(
     const MatchChainTable& table, const IdentSequence& bb_candidate_ids,
-    bool disable_nibble_masking, int min_piece_length) {
+    bool disable_nibble_masking, int min_piece_length, ThreadPool* pool) {
   if (bb_candidate_ids.empty()) {
     return absl::InvalidArgumentError("Empty basic block candidate list");
   }
@@ -215,68 +408,27 @@ not_absl::StatusOr<RawSignature> GenericSignatureFromMatches(
         "Minimum piece length must be at least 1");
   }
 
+  // The basic blocks are independent of each other, so each of them becomes a
+  // task of its own. Only if there are fewer basic blocks than threads, the
+  // common subsequence computations are split up further.
+  ThreadPool* bb_pool =
+      pool && bb_candidate_ids.size() < pool->num_threads() ? pool : nullptr;
+  std::vector<ByteWithExtraString> per_bb_regexes(bb_candidate_ids.size());
+  NA_RETURN_IF_ERROR(ParallelForWithStatus(
+      bb_candidate_ids.size(), pool,
+      [&table, &bb_candidate_ids, disable_nibble_masking, bb_pool,
+       &per_bb_regexes](int i) -> absl::Status {
+        return BasicBlockRegexFromMatches(table, bb_candidate_ids[i],
+                                          disable_nibble_masking, bb_pool,
+                                          &per_bb_regexes[i]);
+      }));
+
+  // Append per-basic block candidates to result, in candidate order.
   ByteWithExtraString regex;
-
-  // Helper function to insert bounded inter-basic-block wildcards into the raw
-  // signature. Currently, bounded wildcards are not used.
-  WildcardInserter<ByteWithExtraStringBackInserter> insert_wildcard([](
-      size_t /*min_qualifier*/, size_t /*max_qualifier*/,
-      ByteWithExtraStringBackInserter result) { *result++ = kWildcardByte; });
-
-  // Iterate over all basic block candidates.
-  for (const auto& bb_id : bb_candidate_ids) {
-    std::vector<ByteWithExtraString> bb_sequences;
-    bb_sequences.reserve(table.size());
-
-    // Iterate over all columns of the table.
-    for (const auto& column : table) {
-      const auto& bb = *ABSL_DIE_IF_NULL(column->FindBasicBlockById(bb_id));
-
-      ByteWithExtraString bb_sequence;
-      MemoryAddress last_address = 0;
-      size_t last_size = 0;
-
-      // Gather the instruction bytes for the current basic block.
-      for (const auto& instr : bb.instructions) {
-        DCHECK_LE(last_address + last_size, instr->match.address);
-
-        // Count non-continuous instructions and insert inter-instruction
-        // wildcards.
-        if (!bb_sequence.empty() &&
-            bb_sequence.back().type != ByteWithExtra::kWildcard &&
-            last_address + last_size < instr->match.address) {
-          // We need to insert a wildcard here, since otherwise we generate
-          // signatures containing non-consecutive bytes.
-          bb_sequence.push_back(kWildcardByte);
-        }
-
-        if (instr->raw_instruction_bytes.empty()) {
-          return absl::InternalError(absl::StrCat(
-              "No bytes for instruction in ", column->filename(), " at ",
-              absl::Hex(instr->match.address, absl::kZeroPad8),
-              " (from basic block at ",
-              absl::Hex(bb.match.address, absl::kZeroPad8), ")"));
-        }
-        AddInstructionBytes(bb, *instr, disable_nibble_masking, &bb_sequence);
-
-        last_address = instr->match.address;
-        last_size = instr->raw_instruction_bytes.size();
-      }
-      bb_sequences.push_back(bb_sequence);
-    }
-
-    ByteWithExtraString bb_cs;
-    CommonSubsequence(bb_sequences, std::back_inserter(bb_cs));
-
-    ByteWithExtraString per_bb_regex;
-    RegexFromSubsequence(bb_cs.begin(), bb_cs.end(), bb_sequences,
-                         insert_wildcard, std::back_inserter(per_bb_regex));
-
+  for (const auto& per_bb_regex : per_bb_regexes) {
     if (!regex.empty() && regex.back().type != ByteWithExtra::kWildcard) {
       regex.push_back(kWildcardByte);
     }
-
-    // Append per-basic block candidates to result.
     regex.insert(regex.end(), per_bb_regex.begin(), per_bb_regex.end());
   }
 
@@ -284,4 +436,12 @@ not_absl::StatusOr<RawSignature> GenericSignatureFromMatches(
   return ToRawSignatureProto(regex);
 }
 
+not_absl::StatusOr<RawSignature> GenericSignatureFromMatches(
+    const MatchChainTable& table, const IdentSequence& bb_candidate_ids,
+    bool disable_nibble_masking, int min_piece_length) {
+  return GenericSignatureFromMatches(table, bb_candidate_ids,
+                                     disable_nibble_masking, min_piece_length,
+                                     /*pool=*/nullptr);
+}
+
 }  // namespace security::vxsig
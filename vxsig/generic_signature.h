@@ -20,6 +20,7 @@
 
 #include "third_party/zynamics/binexport/util/statusor.h"
 #include "vxsig/match_chain_table.h"
+#include "vxsig/thread_pool.h"
 #include "vxsig/types.h"
 #include "vxsig/vxsig.pb.h"
 
@@ -36,6 +37,11 @@ namespace security::vxsig {
 // setting their respective weights to zero. This is done, so that constructs
 // like "[-] XX ?? ?? ?? ??" (Yara syntax) are less likely to be included in the
 // final signature.
+// If pool is non-null, the basic block candidates are processed on it
+// concurrently. The result is the same as without a pool.
+not_absl::StatusOr<RawSignature> GenericSignatureFromMatches(
+    const MatchChainTable& table, const IdentSequence& bb_candidate_ids,
+    bool disable_nibble_masking, int min_piece_length, ThreadPool* pool);
 not_absl::StatusOr<RawSignature> GenericSignatureFromMatches(
     const MatchChainTable& table, const IdentSequence& bb_candidate_ids,
     bool disable_nibble_masking, int min_piece_length);
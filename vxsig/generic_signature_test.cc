@@ -18,13 +18,16 @@
 #include <utility>
 
 #include "absl/memory/memory.h"
+#include "absl/strings/string_view.h"
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 #include "third_party/zynamics/binexport/util/status_matchers.h"
+#include "vxsig/thread_pool.h"
 #include "vxsig/vxsig.pb.h"
 
 using not_absl::IsOk;
 using testing::Eq;
+using testing::HasSubstr;
 using testing::SizeIs;
 
 namespace security::vxsig {
@@ -85,6 +88,8 @@ class GenericSignatureTest : public ::testing::Test {
     auto* new_instr = col->InsertInstructionMatch(bb, match);
     new_instr->raw_instruction_bytes = "XX0000";
     new_instr->immediates.emplace_back(0x30303030 /* Four zeroes */, kDWord);
+    new_instr->immediate_mask = ImmediateMask(new_instr->raw_instruction_bytes,
+                                              new_instr->immediates);
 
     // We just inserted six instruction bytes, so we add additional bytes
     // starting at this offset.
@@ -97,7 +102,8 @@ class GenericSignatureTest : public ::testing::Test {
       ++address_offset;
       // Each instruction gets filled with a unique value as its raw
       // instruction byte string, so we can test more easily later.
-      new_instr->raw_instruction_bytes.push_back(*cur_instr_byte);
+      new_instr->raw_instruction_bytes = col->intern_pool()->Intern(
+          absl::string_view(reinterpret_cast<const char*>(cur_instr_byte), 1));
       ++*cur_instr_byte;
     }
   }
@@ -153,4 +159,65 @@ TEST_F(GenericSignatureTest,
   }
 }
 
+TEST_F(GenericSignatureTest, BoundedWildcards) {
+  // End all basic blocks with the same instruction, so that the common
+  // subsequence has a gap of two bytes in each column.
+  for (auto& column : table_) {
+    for (const auto& bb : column->basic_blocks_by_address()) {
+      column->FindInstructionByAddress(bb.first + 8)->raw_instruction_bytes =
+          "YY";
+    }
+  }
+  IdentSequence bb_cand_ids{1, 2, 3, 4, 5};
+  auto signature_or = GenericSignatureFromMatches(
+      table_, bb_cand_ids, /*disable_nibble_masking=*/true,
+      /*min_piece_length=*/1);
+  ASSERT_THAT(signature_or, IsOk());
+  auto signature_regex(std::move(signature_or).ValueOrDie());
+
+  ASSERT_THAT(signature_regex.piece(), SizeIs(10));
+  for (int i = 0; i < signature_regex.piece_size(); i += 2) {
+    const auto& piece = signature_regex.piece(i);
+    EXPECT_THAT(piece.bytes(), Eq("XX0000"));
+    EXPECT_THAT(piece.min_qualifier(), Eq(2));
+    EXPECT_THAT(piece.max_qualifier(), Eq(2));
+
+    // Basic blocks are separated by unbounded wildcards.
+    const auto& next_piece = signature_regex.piece(i + 1);
+    EXPECT_THAT(next_piece.bytes(), Eq("YY"));
+    EXPECT_THAT(next_piece.min_qualifier(), Eq(0));
+    EXPECT_THAT(next_piece.max_qualifier(), Eq(-1));
+  }
+}
+
+TEST_F(GenericSignatureTest, ParallelMatchesSerial) {
+  IdentSequence bb_cand_ids{1, 2, 3, 4, 5};
+  ThreadPool pool(3);
+  for (const bool disable_nibble_masking : {false, true}) {
+    auto expected_or = GenericSignatureFromMatches(
+        table_, bb_cand_ids, disable_nibble_masking, /*min_piece_length=*/4);
+    ASSERT_THAT(expected_or, IsOk());
+    auto actual_or =
+        GenericSignatureFromMatches(table_, bb_cand_ids, disable_nibble_masking,
+                                    /*min_piece_length=*/4, &pool);
+    ASSERT_THAT(actual_or, IsOk());
+    EXPECT_THAT(actual_or.ValueOrDie().SerializeAsString(),
+                Eq(expected_or.ValueOrDie().SerializeAsString()));
+  }
+}
+
+TEST_F(GenericSignatureTest, ParallelReportsFirstError) {
+  // Remove the instruction bytes of basic blocks 2 and 4 in the last column.
+  for (const MemoryAddress address : {0x20002000, 0x20004000}) {
+    table_.back()->FindInstructionByAddress(address)->raw_instruction_bytes =
+        absl::string_view();
+  }
+  IdentSequence bb_cand_ids{1, 2, 3, 4, 5};
+  ThreadPool pool(3);
+  auto signature_or = GenericSignatureFromMatches(
+      table_, bb_cand_ids, /*disable_nibble_masking=*/false,
+      /*min_piece_length=*/4, &pool);
+  EXPECT_THAT(signature_or.status().message(), HasSubstr("at 20002000"));
+}
+
 }  // namespace security::vxsig
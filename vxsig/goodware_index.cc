@@ -0,0 +1,205 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "vxsig/goodware_index.h"
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+
+#include "absl/base/internal/endian.h"
+#include "absl/memory/memory.h"
+#include "absl/strings/str_cat.h"
+#include "base/logging.h"
+#include "third_party/zynamics/binexport/util/status_macros.h"
+#include "vxsig/atomic_file.h"
+
+namespace security::vxsig {
+namespace {
+
+// Bump this when changing the file layout or the hash functions.
+constexpr absl::string_view kIndexMagic = "VXSIGGW1";
+
+// Magic, n-gram size, number of hash functions and number of bits.
+constexpr size_t kHeaderSize = 8 + 4 + 4 + 8;
+
+constexpr int kMaxNumHashes = 16;
+
+constexpr double kLn2 = 0.693147180559945309417;
+
+// Finalizer of MurmurHash3, spreads the n-gram bits over the whole word.
+uint64_t Mix(uint64_t value) {
+  value ^= value >> 33;
+  value *= 0xff51afd7ed558ccdULL;
+  value ^= value >> 33;
+  value *= 0xc4ceb9fe1a85ec53ULL;
+  value ^= value >> 33;
+  return value;
+}
+
+// Calls callback with the bit index of each of the num_hashes probes for the
+// specified n-gram. Uses double hashing to derive the probes.
+template <typename CallbackT>
+void ForEachProbe(uint64_t ngram, int num_hashes, uint64_t num_bits,
+                  CallbackT callback) {
+  const uint64_t h1 = Mix(ngram);
+  const uint64_t h2 = Mix(ngram + 0x9e3779b97f4a7c15ULL) | 1;
+  for (int i = 0; i < num_hashes; ++i) {
+    if (!callback((h1 + i * h2) % num_bits)) {
+      break;
+    }
+  }
+}
+
+// Calls callback with each n-gram of data, encoded as a little-endian integer.
+// Stops early if callback returns false and returns whether it did not.
+// Positions for which skip returns true are not part of any n-gram.
+template <typename SkipT, typename CallbackT>
+bool ForEachNgram(absl::string_view data, int ngram_size, SkipT skip,
+                  CallbackT callback) {
+  // The window is shifted in from the top, so that its last ngram_size bytes
+  // end up in the low bits after shifting it back down.
+  const int shift = 8 * (sizeof(uint64_t) - ngram_size);
+  uint64_t window = 0;
+  int run = 0;  // Number of consecutive usable bytes
+  for (size_t i = 0; i < data.size(); ++i) {
+    if (skip(i)) {
+      run = 0;
+      continue;
+    }
+    window = (window >> 8) |
+             (uint64_t{static_cast<uint8_t>(data[i])} << (8 * 7));
+    if (++run >= ngram_size && !callback(window >> shift)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
+not_absl::StatusOr<std::unique_ptr<GoodwareIndex>> GoodwareIndex::Open(
+    absl::string_view filename) {
+  NA_ASSIGN_OR_RETURN(auto file, MappedFile::Open(filename));
+  const absl::string_view data = file->data();
+  if (data.size() < kHeaderSize || data.substr(0, 8) != kIndexMagic) {
+    return absl::DataLossError(
+        absl::StrCat("not a goodware index: ", filename));
+  }
+  auto index = absl::WrapUnique(new GoodwareIndex());
+  index->ngram_size_ = absl::little_endian::Load32(data.data() + 8);
+  index->num_hashes_ = absl::little_endian::Load32(data.data() + 12);
+  index->num_bits_ = absl::little_endian::Load64(data.data() + 16);
+  if (index->ngram_size_ < 1 || index->ngram_size_ > 8 ||
+      index->num_hashes_ < 1 || index->num_hashes_ > kMaxNumHashes ||
+      index->num_bits_ == 0 || index->num_bits_ % 64 != 0 ||
+      index->num_bits_ / 8 != data.size() - kHeaderSize) {
+    return absl::DataLossError(
+        absl::StrCat("corrupt goodware index: ", filename));
+  }
+  index->words_ = data.data() + kHeaderSize;
+  index->file_ = std::move(file);
+  return index;
+}
+
+bool GoodwareIndex::MayContainNgram(uint64_t ngram) const {
+  bool found = true;
+  ForEachProbe(ngram, num_hashes_, num_bits_, [this, &found](uint64_t bit) {
+    const uint64_t word =
+        absl::little_endian::Load64(words_ + (bit / 64) * sizeof(uint64_t));
+    found = (word >> (bit % 64)) & 1;
+    return found;
+  });
+  return found;
+}
+
+bool GoodwareIndex::MayContain(absl::string_view ngram) const {
+  DCHECK_EQ(ngram.size(), ngram_size_);
+  bool found = false;
+  ForEachNgram(
+      ngram, ngram_size_, [](size_t) { return false; },
+      [this, &found](uint64_t value) {
+        found = MayContainNgram(value);
+        return false;
+      });
+  return found;
+}
+
+bool GoodwareIndex::MayContainPiece(const RawSignature::Piece& piece) const {
+  const absl::string_view bytes = piece.bytes();
+  std::vector<bool> masked(bytes.size());
+  for (const int nibble : piece.masked_nibble()) {
+    if (nibble >= 0 && nibble / 2 < bytes.size()) {
+      masked[nibble / 2] = true;
+    }
+  }
+  bool checked = false;
+  const bool all_found = ForEachNgram(
+      bytes, ngram_size_, [&masked](size_t i) { return masked[i]; },
+      [this, &checked](uint64_t ngram) {
+        checked = true;
+        return MayContainNgram(ngram);
+      });
+  return checked && all_found;
+}
+
+GoodwareIndexBuilder::GoodwareIndexBuilder(uint64_t expected_ngrams,
+                                           double false_positive_rate,
+                                           int ngram_size)
+    : ngram_size_(std::min(std::max(ngram_size, 1), 8)) {
+  // Standard Bloom filter sizing: m = -n ln(p) / ln(2)^2, k = m / n ln(2).
+  const double p = std::min(std::max(false_positive_rate, 1e-9), 0.5);
+  const double n = std::max<uint64_t>(expected_ngrams, 1);
+  const double num_bits = std::ceil(-n * std::log(p) / (kLn2 * kLn2));
+  words_.resize(std::max<uint64_t>((num_bits + 63) / 64, 1));
+  const int num_hashes = std::round(words_.size() * 64 / n * kLn2);
+  num_hashes_ = std::min(std::max(num_hashes, 1), kMaxNumHashes);
+}
+
+void GoodwareIndexBuilder::AddData(absl::string_view data) {
+  const uint64_t num_bits = words_.size() * 64;
+  ForEachNgram(
+      data, ngram_size_, [](size_t) { return false; },
+      [this, num_bits](uint64_t ngram) {
+        ForEachProbe(ngram, num_hashes_, num_bits, [this](uint64_t bit) {
+          words_[bit / 64] |= uint64_t{1} << (bit % 64);
+          return true;
+        });
+        return true;
+      });
+}
+
+absl::Status GoodwareIndexBuilder::AddFile(absl::string_view filename) {
+  NA_ASSIGN_OR_RETURN(auto file, MappedFile::Open(filename));
+  AddData(file->data());
+  return absl::OkStatus();
+}
+
+absl::Status GoodwareIndexBuilder::Write(absl::string_view filename) const {
+  std::string buffer(kHeaderSize + words_.size() * sizeof(uint64_t), '\0');
+  char* out = &buffer[0];
+  std::copy(kIndexMagic.begin(), kIndexMagic.end(), out);
+  absl::little_endian::Store32(out + 8, ngram_size_);
+  absl::little_endian::Store32(out + 12, num_hashes_);
+  absl::little_endian::Store64(out + 16, words_.size() * 64);
+  out += kHeaderSize;
+  for (const uint64_t word : words_) {
+    absl::little_endian::Store64(out, word);
+    out += sizeof(uint64_t);
+  }
+
+  return WriteFileAtomically(filename, {buffer});
+}
+
+}  // namespace security::vxsig
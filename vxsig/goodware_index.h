@@ -0,0 +1,103 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// A Bloom filter over the byte n-grams of a corpus of clean software. It is
+// used to recognize signature pieces that likely also occur in goodware and
+// would thus lead to false positives, without having to scan the corpus with
+// the formatted signature.
+//
+// Index files consist of a small header followed by the bit array of the
+// filter, stored as little-endian 64-bit words. The file is memory-mapped and
+// queried in place, so a single index can be shared by all formatters.
+
+#ifndef VXSIG_GOODWARE_INDEX_H_
+#define VXSIG_GOODWARE_INDEX_H_
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/strings/string_view.h"
+#include "third_party/zynamics/binexport/util/statusor.h"
+#include "vxsig/mapped_file.h"
+#include "vxsig/vxsig.pb.h"
+
+namespace security::vxsig {
+
+// A read-only goodware n-gram index. Safe to use concurrently.
+class GoodwareIndex {
+ public:
+  // Maps the specified index file, as written by GoodwareIndexBuilder::Write(),
+  // into memory. Returns a DataLoss error if the file is not a valid index.
+  static not_absl::StatusOr<std::unique_ptr<GoodwareIndex>> Open(
+      absl::string_view filename);
+
+  GoodwareIndex(const GoodwareIndex&) = delete;
+  GoodwareIndex& operator=(const GoodwareIndex&) = delete;
+
+  int ngram_size() const { return ngram_size_; }
+
+  // Returns whether the specified n-gram, which must be ngram_size() bytes
+  // long, may occur in the corpus. As for all Bloom filters, false positives
+  // are possible, false negatives are not.
+  bool MayContain(absl::string_view ngram) const;
+
+  // Returns whether all n-grams of the piece's bytes may occur in the corpus.
+  // N-grams that overlap masked nibbles are not checked. Returns false if the
+  // piece does not have any n-gram to check.
+  bool MayContainPiece(const RawSignature::Piece& piece) const;
+
+ private:
+  GoodwareIndex() = default;
+
+  bool MayContainNgram(uint64_t ngram) const;
+
+  std::unique_ptr<MappedFile> file_;
+  const char* words_ = nullptr;
+  uint64_t num_bits_ = 0;
+  int ngram_size_ = 0;
+  int num_hashes_ = 0;
+};
+
+// Builds a goodware index from the contents of a corpus of files.
+class GoodwareIndexBuilder {
+ public:
+  enum { kDefaultNgramSize = 8 };
+
+  // Sizes the filter so that an index of expected_ngrams distinct n-grams has
+  // the specified false positive rate per n-gram. The n-gram size needs to be
+  // between 1 and 8 bytes.
+  explicit GoodwareIndexBuilder(uint64_t expected_ngrams,
+                                double false_positive_rate = 0.01,
+                                int ngram_size = kDefaultNgramSize);
+
+  // Adds all n-grams of the specified data.
+  void AddData(absl::string_view data);
+
+  // Adds all n-grams of the specified file.
+  absl::Status AddFile(absl::string_view filename);
+
+  // Writes the index to the specified file.
+  absl::Status Write(absl::string_view filename) const;
+
+ private:
+  std::vector<uint64_t> words_;
+  int ngram_size_;
+  int num_hashes_;
+};
+
+}  // namespace security::vxsig
+
+#endif  // VXSIG_GOODWARE_INDEX_H_
@@ -0,0 +1,91 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// A program that builds a goodware n-gram index from a corpus of clean files.
+// The index is used by the signature formatters to drop signature pieces that
+// would likely cause false positives, see the --goodware_index flag of siggen.
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "absl/base/internal/raw_logging.h"
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "absl/flags/usage.h"
+#include "absl/strings/str_cat.h"
+#include "vxsig/goodware_index.h"
+#include "vxsig/mapped_file.h"
+
+ABSL_FLAG(std::string, output, "", "Filename of the index to write");
+ABSL_FLAG(int32_t, ngram_size,
+          security::vxsig::GoodwareIndexBuilder::kDefaultNgramSize,
+          "Length of the indexed byte n-grams, between 1 and 8");
+ABSL_FLAG(double, false_positive_rate, 0.01,
+          "False positive rate of the index per n-gram");
+
+namespace security::vxsig {
+namespace {
+
+void GoodwareIndexMain(int argc, char* argv[]) {
+  ABSL_RAW_CHECK(argc >= 2, "Need at least one file to index");
+  const std::string output = absl::GetFlag(FLAGS_output);
+  ABSL_RAW_CHECK(!output.empty(), "Need an output filename");
+
+  // Each byte starts at most one n-gram, so the total size of the corpus
+  // bounds the number of distinct n-grams.
+  uint64_t corpus_size = 0;
+  std::vector<std::string> filenames;
+  for (int i = 1; i < argc; ++i) {
+    auto file_or = MappedFile::Open(argv[i]);
+    if (!file_or.ok()) {
+      fprintf(stderr, "Skipping %s: %s\n", argv[i],
+              std::string(file_or.status().message()).c_str());
+      continue;
+    }
+    corpus_size += file_or.ValueOrDie()->data().size();
+    filenames.push_back(argv[i]);
+  }
+
+  GoodwareIndexBuilder builder(corpus_size,
+                               absl::GetFlag(FLAGS_false_positive_rate),
+                               absl::GetFlag(FLAGS_ngram_size));
+  for (const auto& filename : filenames) {
+    absl::Status status = builder.AddFile(filename);
+    ABSL_RAW_CHECK(status.ok(), absl::StrCat("Failed to index ", filename,
+                                             ": ", status.message())
+                                    .c_str());
+  }
+  absl::Status status = builder.Write(output);
+  ABSL_RAW_CHECK(
+      status.ok(),
+      absl::StrCat("Failed to write index: ", status.message()).c_str());
+  printf("Indexed %zu files, %llu bytes\n", filenames.size(),
+         static_cast<unsigned long long>(corpus_size));  // NOLINT(runtime/int)
+}
+
+}  // namespace
+}  // namespace security::vxsig
+
+int main(int argc, char* argv[]) {
+  absl::SetProgramUsageMessage(absl::StrCat(
+      "Build a goodware n-gram index from a corpus of clean files.\n"
+      "usage:\n",
+      argv[0], " --output=INDEX FILE..."));
+  std::vector<char*> args = absl::ParseCommandLine(argc, argv);
+  security::vxsig::GoodwareIndexMain(args.size(), &args[0]);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,105 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "vxsig/goodware_index.h"
+
+#include <cstdlib>
+#include <fstream>
+#include <string>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "third_party/zynamics/binexport/util/filesystem.h"
+#include "third_party/zynamics/binexport/util/status_matchers.h"
+
+using not_absl::IsOk;
+using testing::Eq;
+using testing::IsFalse;
+using testing::IsTrue;
+using testing::Not;
+
+namespace security::vxsig {
+namespace {
+
+constexpr char kGoodware[] = "this is goodware, nothing to see here";
+
+std::unique_ptr<GoodwareIndex> BuildIndex(absl::string_view name,
+                                          int ngram_size) {
+  GoodwareIndexBuilder builder(/*expected_ngrams=*/100,
+                               /*false_positive_rate=*/1e-6, ngram_size);
+  builder.AddData(kGoodware);
+  const std::string filename = JoinPath(getenv("TEST_TMPDIR"), name);
+  EXPECT_THAT(builder.Write(filename), IsOk());
+  auto index_or = GoodwareIndex::Open(filename);
+  EXPECT_THAT(index_or.status(), IsOk());
+  return index_or.ok() ? std::move(index_or).ValueOrDie() : nullptr;
+}
+
+RawSignature::Piece MakePiece(absl::string_view bytes) {
+  RawSignature::Piece piece;
+  piece.set_bytes(std::string(bytes));
+  return piece;
+}
+
+TEST(GoodwareIndexTest, MayContain) {
+  auto index = BuildIndex("goodware_index", 8);
+  ASSERT_THAT(index, Not(Eq(nullptr)));
+  EXPECT_THAT(index->ngram_size(), Eq(8));
+  EXPECT_THAT(index->MayContain("this is "), IsTrue());
+  EXPECT_THAT(index->MayContain("see here"), IsTrue());
+  EXPECT_THAT(index->MayContain("malware!"), IsFalse());
+}
+
+TEST(GoodwareIndexTest, MayContainPiece) {
+  auto index = BuildIndex("goodware_index", 8);
+  ASSERT_THAT(index, Not(Eq(nullptr)));
+  EXPECT_THAT(index->MayContainPiece(MakePiece("is goodware, nothing")),
+              IsTrue());
+  // Only some of the n-grams occur in the corpus.
+  EXPECT_THAT(index->MayContainPiece(MakePiece("is goodware, or not")),
+              IsFalse());
+  // Too short to check.
+  EXPECT_THAT(index->MayContainPiece(MakePiece("is good")), IsFalse());
+
+  // N-grams that overlap masked bytes are skipped.
+  auto piece = MakePiece("this is ?goodware");
+  EXPECT_THAT(index->MayContainPiece(piece), IsFalse());
+  piece.add_masked_nibble(16);
+  piece.add_masked_nibble(17);
+  EXPECT_THAT(index->MayContainPiece(piece), IsTrue());
+}
+
+TEST(GoodwareIndexTest, ShortNgrams) {
+  auto index = BuildIndex("goodware_index_short", 4);
+  ASSERT_THAT(index, Not(Eq(nullptr)));
+  EXPECT_THAT(index->MayContainPiece(MakePiece("good")), IsTrue());
+  EXPECT_THAT(index->MayContainPiece(MakePiece("goodwill")), IsFalse());
+}
+
+TEST(GoodwareIndexTest, RejectsInvalidFiles) {
+  const std::string filename =
+      JoinPath(getenv("TEST_TMPDIR"), "not_a_goodware_index");
+  {
+    std::ofstream file(filename, std::ios_base::binary);
+    file << "VXSIGGW1 with a truncated header";
+  }
+  EXPECT_THAT(GoodwareIndex::Open(filename).status(), Not(IsOk()));
+  EXPECT_THAT(GoodwareIndex::Open(
+                  JoinPath(getenv("TEST_TMPDIR"), "does_not_exist"))
+                  .status(),
+              Not(IsOk()));
+}
+
+}  // namespace
+}  // namespace security::vxsig
@@ -0,0 +1,181 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "vxsig/hamming.h"
+
+#include <cstdint>
+#include <cstring>
+
+#include "absl/base/internal/raw_logging.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define VXSIG_HAMMING_X86 1
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define VXSIG_HAMMING_NEON 1
+#endif
+
+namespace security::vxsig {
+namespace detail {
+namespace {
+
+// Signature of the kernels below. They compare num_bytes bytes, which is a
+// multiple of the element size.
+using CountMismatchesFn = size_t (*)(const char* first, const char* second,
+                                     size_t num_bytes);
+
+template <int kElementSize>
+size_t CountMismatchesScalar(const char* first, const char* second,
+                             size_t num_bytes) {
+  size_t result = 0;
+  for (size_t i = 0; i < num_bytes; i += kElementSize) {
+    result += std::memcmp(first + i, second + i, kElementSize) != 0;
+  }
+  return result;
+}
+
+#ifdef VXSIG_HAMMING_X86
+// Returns the number of differing elements in a block, given a mask with the
+// bits of all differing bytes set. An element differs if any of its bytes
+// does, so the bits of each element are folded into its lowest bit.
+template <int kElementSize>
+inline int CountElementMismatches(uint32_t byte_mask) {
+  if constexpr (kElementSize >= 2) {
+    byte_mask |= byte_mask >> 1;
+  }
+  if constexpr (kElementSize >= 4) {
+    byte_mask |= byte_mask >> 2;
+  }
+  if constexpr (kElementSize >= 8) {
+    byte_mask |= byte_mask >> 4;
+  }
+  constexpr uint32_t kLowestBytes = kElementSize == 1   ? 0xFFFFFFFF
+                                    : kElementSize == 2 ? 0x55555555
+                                    : kElementSize == 4 ? 0x11111111
+                                                        : 0x01010101;
+  return __builtin_popcount(byte_mask & kLowestBytes);
+}
+
+template <int kElementSize>
+__attribute__((target("sse2"))) size_t CountMismatchesSse2(
+    const char* first, const char* second, size_t num_bytes) {
+  size_t result = 0;
+  size_t i = 0;
+  for (; i + 16 <= num_bytes; i += 16) {
+    const __m128i a =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(first + i));
+    const __m128i b =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(second + i));
+    const uint32_t equal = _mm_movemask_epi8(_mm_cmpeq_epi8(a, b));
+    result += CountElementMismatches<kElementSize>(~equal & 0xFFFF);
+  }
+  return result + CountMismatchesScalar<kElementSize>(first + i, second + i,
+                                                      num_bytes - i);
+}
+
+template <int kElementSize>
+__attribute__((target("avx2,popcnt"))) size_t CountMismatchesAvx2(
+    const char* first, const char* second, size_t num_bytes) {
+  size_t result = 0;
+  size_t i = 0;
+  for (; i + 32 <= num_bytes; i += 32) {
+    const __m256i a =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(first + i));
+    const __m256i b =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(second + i));
+    const uint32_t equal = _mm256_movemask_epi8(_mm256_cmpeq_epi8(a, b));
+    result += CountElementMismatches<kElementSize>(~equal);
+  }
+  return result + CountMismatchesScalar<kElementSize>(first + i, second + i,
+                                                      num_bytes - i);
+}
+#endif  // VXSIG_HAMMING_X86
+
+#ifdef VXSIG_HAMMING_NEON
+template <int kElementSize>
+size_t CountMismatchesNeon(const char* first, const char* second,
+                           size_t num_bytes) {
+  size_t result = 0;
+  size_t i = 0;
+  for (; i + 16 <= num_bytes; i += 16) {
+    const uint8x16_t a = vld1q_u8(reinterpret_cast<const uint8_t*>(first + i));
+    const uint8x16_t b =
+        vld1q_u8(reinterpret_cast<const uint8_t*>(second + i));
+    // Compare lanes of the element size, then count the equal lanes.
+    size_t equal;
+    if constexpr (kElementSize == 1) {
+      equal = vaddvq_u8(vshrq_n_u8(vceqq_u8(a, b), 7));
+    } else if constexpr (kElementSize == 2) {
+      equal = vaddvq_u16(vshrq_n_u16(
+          vceqq_u16(vreinterpretq_u16_u8(a), vreinterpretq_u16_u8(b)), 15));
+    } else if constexpr (kElementSize == 4) {
+      equal = vaddvq_u32(vshrq_n_u32(
+          vceqq_u32(vreinterpretq_u32_u8(a), vreinterpretq_u32_u8(b)), 31));
+    } else {
+      equal = vaddvq_u64(vshrq_n_u64(
+          vceqq_u64(vreinterpretq_u64_u8(a), vreinterpretq_u64_u8(b)), 63));
+    }
+    result += 16 / kElementSize - equal;
+  }
+  return result + CountMismatchesScalar<kElementSize>(first + i, second + i,
+                                                      num_bytes - i);
+}
+#endif  // VXSIG_HAMMING_NEON
+
+template <int kElementSize>
+CountMismatchesFn SelectKernel() {
+#if defined(VXSIG_HAMMING_X86)
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt")) {
+    return CountMismatchesAvx2<kElementSize>;
+  }
+  if (__builtin_cpu_supports("sse2")) {
+    return CountMismatchesSse2<kElementSize>;
+  }
+#elif defined(VXSIG_HAMMING_NEON)
+  return CountMismatchesNeon<kElementSize>;
+#endif
+  return CountMismatchesScalar<kElementSize>;
+}
+
+template <int kElementSize>
+size_t CountMismatchesDispatch(const void* first, const void* second,
+                               size_t size) {
+  static const CountMismatchesFn kernel = SelectKernel<kElementSize>();
+  return kernel(static_cast<const char*>(first),
+                static_cast<const char*>(second), size * kElementSize);
+}
+
+}  // namespace
+
+size_t CountMismatches(const void* first, const void* second, size_t size,
+                       int element_size) {
+  switch (element_size) {
+    case 1:
+      return CountMismatchesDispatch<1>(first, second, size);
+    case 2:
+      return CountMismatchesDispatch<2>(first, second, size);
+    case 4:
+      return CountMismatchesDispatch<4>(first, second, size);
+    case 8:
+      return CountMismatchesDispatch<8>(first, second, size);
+    default:
+      ABSL_RAW_LOG(FATAL, "Unsupported element size: %d", element_size);
+      return 0;
+  }
+}
+
+}  // namespace detail
+}  // namespace security::vxsig
@@ -13,17 +13,56 @@
 // limitations under the License.
 
 // Function templates that calculate Hamming distances of iterator ranges,
-// element-wise.
+// element-wise. Contiguous ranges of integral element types are compared with
+// SIMD kernels that are selected at runtime.
 
 #ifndef VXSIG_HAMMING_H_
 #define VXSIG_HAMMING_H_
 
+#include <algorithm>
 #include <cstddef>
 #include <cstdlib>
 #include <iterator>
 #include <string>
+#include <type_traits>
+#include <utility>
 
 namespace security::vxsig {
+namespace detail {
+
+// Returns whether equality of values of type T is the same as equality of
+// their object representations and the SIMD kernels support their size.
+template <typename T>
+constexpr bool IsBitwiseComparable() {
+  return (std::is_integral<T>::value || std::is_enum<T>::value) &&
+         (sizeof(T) == 1 || sizeof(T) == 2 || sizeof(T) == 4 ||
+          sizeof(T) == 8);
+}
+
+// Element type of containers that store bitwise comparable elements
+// contiguously, like std::vector and std::basic_string.
+template <typename ContT, typename = void>
+struct ContiguousElement {
+  static constexpr bool kBitwiseComparable = false;
+};
+
+template <typename ContT>
+struct ContiguousElement<
+    ContT, std::void_t<decltype(std::declval<const ContT&>().data()),
+                       decltype(std::declval<const ContT&>().size())>> {
+  using DataType = decltype(std::declval<const ContT&>().data());
+  using Type = std::remove_cv_t<std::remove_pointer_t<DataType>>;
+  static constexpr bool kBitwiseComparable =
+      std::is_pointer<DataType>::value && IsBitwiseComparable<Type>();
+};
+
+// Returns the number of elements that differ in the arrays first and second,
+// which both hold size elements of element_size bytes. element_size must be
+// 1, 2, 4 or 8. Uses the widest SIMD instruction set supported by the CPU.
+size_t CountMismatches(const void* first, const void* second, size_t size,
+                       int element_size);
+
+}  // namespace detail
 
 // Returns the number of different elements in a specified iterator range.
 //
@@ -34,6 +73,19 @@ namespace security::vxsig {
 template <typename Iterator1T, typename Iterator2T>
 size_t HammingDistance(Iterator1T first1, Iterator1T last1, Iterator2T first2,
                        Iterator2T last2) {
+  if constexpr (std::is_pointer<Iterator1T>::value &&
+                std::is_pointer<Iterator2T>::value) {
+    using Value1T = std::remove_cv_t<std::remove_pointer_t<Iterator1T>>;
+    using Value2T = std::remove_cv_t<std::remove_pointer_t<Iterator2T>>;
+    if constexpr (std::is_same<Value1T, Value2T>::value &&
+                  detail::IsBitwiseComparable<Value1T>()) {
+      const size_t size1 = last1 - first1;
+      const size_t size2 = last2 - first2;
+      return (size1 > size2 ? size1 - size2 : size2 - size1) +
+             detail::CountMismatches(first1, first2, std::min(size1, size2),
+                                     sizeof(Value1T));
+    }
+  }
   auto result =
       std::abs(std::distance(first2, last2) - std::distance(first1, last1));
   for (; first1 != last1 && first2 != last2; ++first1, ++first2)
@@ -47,6 +99,16 @@ size_t HammingDistance(Iterator1T first1, Iterator1T last1, Iterator2T first2,
 // standard containers.
 template <typename Cont1T, typename Cont2T>
 size_t HammingDistance(const Cont1T& first, const Cont2T& second) {
+  using Element1 = detail::ContiguousElement<Cont1T>;
+  using Element2 = detail::ContiguousElement<Cont2T>;
+  if constexpr (Element1::kBitwiseComparable &&
+                Element2::kBitwiseComparable) {
+    if constexpr (std::is_same<typename Element1::Type,
+                               typename Element2::Type>::value) {
+      return HammingDistance(first.data(), first.data() + first.size(),
+                             second.data(), second.data() + second.size());
+    }
+  }
   return HammingDistance(first.begin(), first.end(), second.begin(),
                          second.end());
 }
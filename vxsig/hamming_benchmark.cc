@@ -0,0 +1,65 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// Benchmarks for the Hamming distance of contiguous sequences, compared to
+// the generic element-wise loop that is used for other iterator types.
+
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "vxsig/benchmark_util.h"
+#include "vxsig/hamming.h"
+#include "vxsig/types.h"
+
+namespace security::vxsig {
+namespace {
+
+template <typename T>
+void BM_HammingDistanceGeneric(benchmark::State& state) {
+  std::mt19937 rng(1);
+  const auto first =
+      RandomSequence<T>(state.range(0), /*alphabet_size=*/4, &rng);
+  const auto second =
+      RandomSequence<T>(state.range(0), /*alphabet_size=*/4, &rng);
+  for (auto _ : state) {
+    // Vector iterators are not pointers, so this uses the generic loop.
+    benchmark::DoNotOptimize(HammingDistance(first.begin(), first.end(),
+                                             second.begin(), second.end()));
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+template <typename T>
+void BM_HammingDistanceContiguous(benchmark::State& state) {
+  std::mt19937 rng(1);
+  const auto first =
+      RandomSequence<T>(state.range(0), /*alphabet_size=*/4, &rng);
+  const auto second =
+      RandomSequence<T>(state.range(0), /*alphabet_size=*/4, &rng);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(HammingDistance(first, second));
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+BENCHMARK_TEMPLATE(BM_HammingDistanceGeneric, uint8_t)->Range(64, 1 << 16);
+BENCHMARK_TEMPLATE(BM_HammingDistanceContiguous, uint8_t)->Range(64, 1 << 16);
+BENCHMARK_TEMPLATE(BM_HammingDistanceGeneric, Ident)->Range(64, 1 << 16);
+BENCHMARK_TEMPLATE(BM_HammingDistanceContiguous, Ident)->Range(64, 1 << 16);
+
+}  // namespace
+}  // namespace security::vxsig
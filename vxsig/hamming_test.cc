@@ -14,7 +14,11 @@
 
 #include "vxsig/hamming.h"
 
+#include <cstdint>
+#include <deque>
+#include <random>
 #include <string>
+#include <vector>
 
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
@@ -70,5 +74,65 @@ TEST(HammingTest, OperateOnIterators) {
       Eq(6));
 }
 
+enum class Opcode : uint16_t { kNop, kMov, kJmp };
+
+// Compares the result for contiguous sequences with the one of the generic
+// element-wise loop, which is used for non-pointer iterators.
+template <typename T>
+void ExpectSameAsGeneric(std::mt19937* rng) {
+  std::uniform_int_distribution<int> value(0, 2);
+  for (int size1 = 0; size1 < 80; size1 += 7) {
+    for (int size2 : {size1, size1 + 1, size1 + 33}) {
+      std::vector<T> first(size1);
+      std::vector<T> second(size2);
+      for (auto& element : first) {
+        element = static_cast<T>(value(*rng));
+      }
+      for (auto& element : second) {
+        element = static_cast<T>(value(*rng));
+      }
+      const std::deque<T> first_deque(first.begin(), first.end());
+      const std::deque<T> second_deque(second.begin(), second.end());
+      const size_t expected = HammingDistance(first_deque, second_deque);
+      EXPECT_THAT(HammingDistance(first, second), Eq(expected));
+      EXPECT_THAT(HammingDistance(second, first), Eq(expected));
+      // Unaligned start.
+      if (size1 > 0 && size2 > 0) {
+        EXPECT_THAT(HammingDistance(first.data() + 1, first.data() + size1,
+                                    second.data() + 1, second.data() + size2),
+                    Eq(HammingDistance(first_deque.begin() + 1,
+                                       first_deque.end(),
+                                       second_deque.begin() + 1,
+                                       second_deque.end())));
+      }
+    }
+  }
+}
+
+TEST(HammingTest, ContiguousMatchesGeneric) {
+  std::mt19937 rng(17);
+  ExpectSameAsGeneric<char>(&rng);
+  ExpectSameAsGeneric<uint8_t>(&rng);
+  ExpectSameAsGeneric<Opcode>(&rng);
+  ExpectSameAsGeneric<int32_t>(&rng);
+  ExpectSameAsGeneric<uint32_t>(&rng);
+  ExpectSameAsGeneric<uint64_t>(&rng);
+}
+
+TEST(HammingTest, DifferInSingleByteOfWideElements) {
+  std::vector<uint64_t> first(40, 0x0102030405060708);
+  std::vector<uint64_t> second = first;
+  second[3] ^= uint64_t{1} << 60;
+  second[17] ^= 1;
+  second[39] ^= uint64_t{1} << 33;
+  EXPECT_THAT(HammingDistance(first, second), Eq(3));
+
+  std::vector<uint32_t> first32(40, 0xAABBCCDD);
+  std::vector<uint32_t> second32 = first32;
+  second32[0] = 0xAABBCCDC;
+  second32[8] = 0xABBBCCDD;
+  EXPECT_THAT(HammingDistance(first32, second32), Eq(2));
+}
+
 }  // namespace
 }  // namespace security::vxsig
@@ -0,0 +1,202 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "vxsig/instruction_masking.h"
+
+#include <utility>
+
+#include "absl/base/internal/endian.h"
+#include "absl/strings/match.h"
+
+namespace security::vxsig {
+namespace {
+
+constexpr int kMaxMaskedBytes = 64;
+
+int ImmediateBytes(ImmediateSize size) {
+  switch (size) {
+    case kByte:
+      return 1;
+    case kWord:
+      return 2;
+    case kDWord:
+      return 4;
+    case kQWord:
+      return 8;
+  }
+  return 0;
+}
+
+// Returns the byte mask for the bits of a four byte instruction word.
+uint64_t FieldBytes(uint32_t field, bool big_endian) {
+  uint64_t mask = 0;
+  for (int i = 0; i < 4; ++i) {
+    if ((field >> (8 * i)) & 0xff) {
+      mask |= uint64_t{1} << (big_endian ? 3 - i : i);
+    }
+  }
+  return mask;
+}
+
+bool MatchesImmediate(const InstructionMaskingTable::FieldRule& rule,
+                      uint32_t word, const Immediates& immediates) {
+  for (const auto& immediate : immediates) {
+    if (((immediate.first >> rule.immediate_shift) & rule.field) ==
+        (word & rule.field)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+}  // namespace
+
+uint64_t ImmediateMask(absl::string_view raw_bytes,
+                       const Immediates& immediates) {
+  return InstructionMaskingTable::ForArchitecture("x86-32").Mask(raw_bytes,
+                                                                 immediates);
+}
+
+InstructionMaskingTable::InstructionMaskingTable(
+    absl::string_view name, std::vector<ImmediateSize> literal_sizes,
+    int instruction_size, std::vector<FieldRule> rules)
+    : name_(name),
+      literal_sizes_(std::move(literal_sizes)),
+      instruction_size_(instruction_size),
+      rules_(std::move(rules)) {}
+
+const InstructionMaskingTable& InstructionMaskingTable::ForArchitecture(
+    absl::string_view architecture_name) {
+  static const auto* x86_32 =
+      new InstructionMaskingTable("x86-32", {kDWord}, 0, {});
+  static const auto* x86_64 =
+      new InstructionMaskingTable("x86-64", {kDWord, kQWord}, 0, {});
+  // ARM mode, plus the 32-bit Thumb BL, whose halfwords are stored in
+  // little endian order, too.
+  static const auto* arm_32 = new InstructionMaskingTable(
+      "ARM-32", {}, 4,
+      {
+          {0x0e000000, 0x0a000000, 0x00ffffff, -1},  // B, BL, BLX
+          {0x0fb00000, 0x03000000, 0x000f0fff, -1},  // MOVW, MOVT
+          {0x0f7f0000, 0x051f0000, 0x00000fff, -1},  // LDR (literal)
+          {0xd000f800, 0xd000f000, 0x07ff03ff, -1},  // Thumb BL
+      });
+  static const auto* arm_64 = new InstructionMaskingTable(
+      "ARM-64", {}, 4,
+      {
+          {0x7c000000, 0x14000000, 0x00ffffff, -1},  // B, BL
+          {0xff000010, 0x54000000, 0x00ffffe0, -1},  // B.cond
+          {0x7e000000, 0x34000000, 0x00ffffe0, -1},  // CBZ, CBNZ
+          {0x7e000000, 0x36000000, 0x0007ffe0, -1},  // TBZ, TBNZ
+          {0x1f000000, 0x10000000, 0x00ffffe0, -1},  // ADR, ADRP
+          {0x3b000000, 0x18000000, 0x00ffffe0, -1},  // LDR (literal)
+      });
+  // BinExport does not record the byte order, so the MIPS rules check the
+  // field against the instruction's immediates.
+  static const auto* mips = new InstructionMaskingTable(
+      "MIPS", {}, 4,
+      {
+          {0xf8000000, 0x08000000, 0x03ffffff, 2},  // J, JAL
+          {0xffe00000, 0x3c000000, 0x0000ffff, 0},  // LUI
+      });
+
+  if (absl::StartsWithIgnoreCase(architecture_name, "x86")) {
+    return absl::EndsWith(architecture_name, "64") ? *x86_64 : *x86_32;
+  }
+  if (absl::StartsWithIgnoreCase(architecture_name, "AArch64") ||
+      absl::StartsWithIgnoreCase(architecture_name, "ARM-64") ||
+      absl::StartsWithIgnoreCase(architecture_name, "ARM64")) {
+    return *arm_64;
+  }
+  if (absl::StartsWithIgnoreCase(architecture_name, "ARM")) {
+    return *arm_32;
+  }
+  if (absl::StartsWithIgnoreCase(architecture_name, "MIPS")) {
+    return *mips;
+  }
+  return *x86_32;
+}
+
+uint64_t InstructionMaskingTable::Mask(absl::string_view raw_bytes,
+                                       const Immediates& immediates) const {
+  uint64_t mask = MaskFixedWidth(raw_bytes, immediates);
+  if (literal_sizes_.empty()) {
+    return mask;
+  }
+
+  int lengths[kMaxMaskedBytes] = {};
+  uint64_t starts = 0;
+  char immediate[8];
+  for (const auto& immediate_value : immediates) {
+    bool wanted = false;
+    for (const ImmediateSize size : literal_sizes_) {
+      wanted |= immediate_value.second == size;
+    }
+    if (!wanted) {
+      continue;
+    }
+    // Only look for little endian encoded immediates.
+    const int num_bytes = ImmediateBytes(immediate_value.second);
+    absl::little_endian::Store64(immediate, immediate_value.first);
+    const auto found = raw_bytes.rfind(absl::string_view(immediate, num_bytes));
+    if (found != absl::string_view::npos &&
+        found + num_bytes <= kMaxMaskedBytes) {
+      starts |= uint64_t{1} << found;
+      if (num_bytes > lengths[found]) {
+        lengths[found] = num_bytes;
+      }
+    }
+  }
+
+  // Expand the start positions in ascending order, skipping the ones that
+  // overlap an immediate that was masked before.
+  for (int i = 0; i < kMaxMaskedBytes;) {
+    if (!((starts >> i) & 1)) {
+      ++i;
+      continue;
+    }
+    mask |= ((uint64_t{1} << lengths[i]) - 1) << i;
+    i += lengths[i];
+  }
+  return mask;
+}
+
+uint64_t InstructionMaskingTable::MaskFixedWidth(
+    absl::string_view raw_bytes, const Immediates& immediates) const {
+  if (rules_.empty() || raw_bytes.size() != instruction_size_) {
+    return 0;
+  }
+  const uint32_t little_endian = absl::little_endian::Load32(raw_bytes.data());
+  const uint32_t big_endian = absl::big_endian::Load32(raw_bytes.data());
+  for (const auto& rule : rules_) {
+    if (rule.immediate_shift < 0) {
+      if ((little_endian & rule.opcode_mask) == rule.opcode) {
+        return FieldBytes(rule.field, /*big_endian=*/false);
+      }
+      continue;
+    }
+    if ((little_endian & rule.opcode_mask) == rule.opcode &&
+        MatchesImmediate(rule, little_endian, immediates)) {
+      return FieldBytes(rule.field, /*big_endian=*/false);
+    }
+    if ((big_endian & rule.opcode_mask) == rule.opcode &&
+        MatchesImmediate(rule, big_endian, immediates)) {
+      return FieldBytes(rule.field, /*big_endian=*/true);
+    }
+  }
+  return 0;
+}
+
+}  // namespace security::vxsig
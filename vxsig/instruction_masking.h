@@ -0,0 +1,98 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// Per-architecture rules for masking the instruction bytes that encode
+// addresses and other values that change when a binary is rebuilt or
+// relocated. Masked bytes become wildcards in the generated signatures.
+
+#ifndef VXSIG_INSTRUCTION_MASKING_H_
+#define VXSIG_INSTRUCTION_MASKING_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+#include "vxsig/binexport_reader.h"
+
+namespace security::vxsig {
+
+// Computes the immediate mask on x86. For each 32-bit immediate, the last
+// little endian occurrence in raw_bytes is masked. A match that starts inside
+// an already masked immediate is ignored, and bytes beyond the width of the
+// mask are never masked.
+uint64_t ImmediateMask(absl::string_view raw_bytes,
+                       const Immediates& immediates);
+
+// Masking rules for a single architecture. For architectures with a
+// variable-length encoding, the encoded immediates are found by searching
+// the instruction bytes for their little endian representation. For
+// fixed-width encodings, the instruction word is matched against a list of
+// opcode patterns instead.
+class InstructionMaskingTable {
+ public:
+  // Matches a class of fixed-width instructions by opcode bits and names the
+  // bits of the instruction word that get masked.
+  struct FieldRule {
+    uint32_t opcode_mask;
+    uint32_t opcode;
+
+    // Bits of the instruction word that are masked. A byte gets masked as
+    // soon as one of its bits is part of the field.
+    uint32_t field;
+
+    // If non-negative, the field holds one of the instruction's immediates,
+    // shifted right by this many bits, starting at bit 0 of the instruction
+    // word. The rule then only applies to instructions where the field
+    // matches an immediate, which also selects the byte order of the
+    // instruction. Otherwise, the field is masked whenever the opcode
+    // matches and the instruction is little endian.
+    int immediate_shift;
+  };
+
+  // Returns the table for the specified BinExport architecture name, as
+  // found in meta_information().architecture_name(). Unknown architectures
+  // use the x86-32 table. The returned reference stays valid forever.
+  static const InstructionMaskingTable& ForArchitecture(
+      absl::string_view architecture_name);
+
+  // Returns the mask of the bytes in raw_bytes that should be replaced with
+  // wildcards. Bit i is set if byte i is masked.
+  uint64_t Mask(absl::string_view raw_bytes,
+                const Immediates& immediates) const;
+
+  absl::string_view name() const { return name_; }
+
+ private:
+  InstructionMaskingTable(absl::string_view name,
+                          std::vector<ImmediateSize> literal_sizes,
+                          int instruction_size, std::vector<FieldRule> rules);
+
+  uint64_t MaskFixedWidth(absl::string_view raw_bytes,
+                          const Immediates& immediates) const;
+
+  absl::string_view name_;
+
+  // Sizes of the immediates that are searched for as little endian literals.
+  std::vector<ImmediateSize> literal_sizes_;
+
+  // Size of the instructions the field rules apply to, zero if there are
+  // no field rules.
+  int instruction_size_;
+  std::vector<FieldRule> rules_;
+};
+
+}  // namespace security::vxsig
+
+#endif  // VXSIG_INSTRUCTION_MASKING_H_
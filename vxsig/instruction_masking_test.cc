@@ -0,0 +1,128 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "vxsig/instruction_masking.h"
+
+#include <cstddef>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+using testing::Eq;
+
+namespace security::vxsig {
+namespace {
+
+// Takes the instruction bytes as an array, as they may contain zero bytes.
+template <size_t N>
+uint64_t MaskFor(absl::string_view architecture_name, const char (&raw)[N],
+                 const Immediates& immediates = {}) {
+  return InstructionMaskingTable::ForArchitecture(architecture_name)
+      .Mask(absl::string_view(raw, N - 1), immediates);
+}
+
+TEST(InstructionMaskingTest, ImmediateMask) {
+  // mov eax, 0x12345678
+  EXPECT_THAT(ImmediateMask("\xb8\x78\x56\x34\x12", {{0x12345678, kDWord}}),
+              Eq(0b11110));
+  // Only 32-bit immediates are masked.
+  EXPECT_THAT(ImmediateMask("\xb0\x78", {{0x78, kByte}}), Eq(0));
+  // Immediates that are not found are ignored.
+  EXPECT_THAT(ImmediateMask("\xb8\x78\x56\x34\x12", {{0x1234, kDWord}}),
+              Eq(0));
+  // The last occurrence is masked.
+  EXPECT_THAT(ImmediateMask("AAAAxAAAA", {{0x41414141, kDWord}}),
+              Eq(0b111100000));
+  // Overlapping occurrences are masked in ascending order of their offsets.
+  EXPECT_THAT(ImmediateMask("xABCDEF",
+                            {{0x46454443, kDWord}, {0x44434241, kDWord}}),
+              Eq(0b11110));
+}
+
+TEST(InstructionMaskingTest, ForArchitecture) {
+  EXPECT_THAT(InstructionMaskingTable::ForArchitecture("x86-32").name(),
+              Eq("x86-32"));
+  EXPECT_THAT(InstructionMaskingTable::ForArchitecture("x86-64").name(),
+              Eq("x86-64"));
+  EXPECT_THAT(InstructionMaskingTable::ForArchitecture("ARM-32").name(),
+              Eq("ARM-32"));
+  EXPECT_THAT(InstructionMaskingTable::ForArchitecture("ARM-64").name(),
+              Eq("ARM-64"));
+  EXPECT_THAT(InstructionMaskingTable::ForArchitecture("AArch64").name(),
+              Eq("ARM-64"));
+  EXPECT_THAT(InstructionMaskingTable::ForArchitecture("MIPS-32").name(),
+              Eq("MIPS"));
+  // Unknown architectures fall back to x86-32.
+  EXPECT_THAT(InstructionMaskingTable::ForArchitecture("PowerPC-32").name(),
+              Eq("x86-32"));
+  EXPECT_THAT(InstructionMaskingTable::ForArchitecture("").name(),
+              Eq("x86-32"));
+}
+
+TEST(InstructionMaskingTest, X86) {
+  // movabs rax, 0x1122334455667788
+  constexpr char kMovabs[] =
+      "\x48\xb8\x88\x77\x66\x55\x44\x33\x22\x11";
+  const Immediates immediates = {{0x1122334455667788, kQWord}};
+  EXPECT_THAT(MaskFor("x86-64", kMovabs, immediates), Eq(0b1111111100));
+  // 64-bit immediates are left alone in 32-bit code.
+  EXPECT_THAT(MaskFor("x86-32", kMovabs, immediates), Eq(0));
+}
+
+TEST(InstructionMaskingTest, Arm32) {
+  // bl #0x48d0
+  EXPECT_THAT(MaskFor("ARM-32", "\x32\x12\x00\xeb"), Eq(0b0111));
+  // movw r0, #0x1234
+  EXPECT_THAT(MaskFor("ARM-32", "\x34\x02\x01\xe3"), Eq(0b0111));
+  // ldr r0, [pc, #8]
+  EXPECT_THAT(MaskFor("ARM-32", "\x08\x00\x9f\xe5"), Eq(0b0011));
+  // add r0, r0, r1
+  EXPECT_THAT(MaskFor("ARM-32", "\x01\x00\x80\xe0"), Eq(0));
+  // Thumb bl, the offset is spread over both halfwords.
+  EXPECT_THAT(MaskFor("ARM-32", "\x00\xf0\x00\xf8"), Eq(0b1111));
+  // 16-bit Thumb instructions are never masked.
+  EXPECT_THAT(MaskFor("ARM-32", "\x00\xe0"), Eq(0));
+}
+
+TEST(InstructionMaskingTest, Arm64) {
+  // bl #0x40
+  EXPECT_THAT(MaskFor("ARM-64", "\x10\x00\x00\x94"), Eq(0b0111));
+  // adrp x0, #0
+  EXPECT_THAT(MaskFor("ARM-64", "\x00\x00\x00\x90"), Eq(0b0111));
+  // cbz x0, #0x10
+  EXPECT_THAT(MaskFor("ARM-64", "\x80\x00\x00\xb4"), Eq(0b0111));
+  // b.eq #0x10
+  EXPECT_THAT(MaskFor("ARM-64", "\x80\x00\x00\x54"), Eq(0b0111));
+  // ret
+  EXPECT_THAT(MaskFor("ARM-64", "\xc0\x03\x5f\xd6"), Eq(0));
+}
+
+TEST(InstructionMaskingTest, Mips) {
+  // lui v0, 0x1234 in both byte orders.
+  const Immediates immediates = {{0x1234, kWord}};
+  EXPECT_THAT(MaskFor("MIPS-32", "\x3c\x02\x12\x34", immediates),
+              Eq(0b1100));
+  EXPECT_THAT(MaskFor("MIPS-32", "\x34\x12\x02\x3c", immediates),
+              Eq(0b0011));
+  // The field must hold the immediate.
+  EXPECT_THAT(MaskFor("MIPS-32", "\x3c\x02\x12\x34", {{0x4321, kWord}}),
+              Eq(0));
+  // jal 0x400100
+  EXPECT_THAT(MaskFor("MIPS-32", "\x0c\x10\x00\x40", {{0x400100, kDWord}}),
+              Eq(0b1111));
+}
+
+}  // namespace
+}  // namespace security::vxsig
@@ -0,0 +1,101 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "vxsig/instruction_spill.h"
+
+#ifndef _WIN32
+#include <stdlib.h>
+#include <unistd.h>
+#endif
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <utility>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "third_party/zynamics/binexport/util/filesystem.h"
+
+namespace security::vxsig {
+
+not_absl::StatusOr<std::unique_ptr<MappedFile>> SpillInstructionPayloads(
+    absl::string_view directory, MatchChainTable* table) {
+#ifdef _WIN32
+  return absl::UnimplementedError("Spilling is not supported on Windows");
+#else
+  std::string filename = JoinPath(directory, "vxsig_spill_XXXXXX");
+  const int fd = mkstemp(&filename[0]);
+  if (fd == -1) {
+    return absl::InternalError(
+        absl::StrCat("cannot create spill file in ", directory));
+  }
+  FILE* file = fdopen(fd, "wb");
+  if (!file) {
+    close(fd);
+    unlink(filename.c_str());
+    return absl::InternalError(absl::StrCat("cannot open ", filename));
+  }
+
+  // Payloads are interned, so identical strings very likely share their
+  // storage already. Deduplicate by content anyway, columns from different
+  // pools may hold copies of the same string.
+  absl::flat_hash_map<absl::string_view, uint64_t> offsets;
+  uint64_t size = 0;
+  bool write_ok = true;
+  auto add = [file, &offsets, &size, &write_ok](absl::string_view data) {
+    if (data.empty() || !offsets.emplace(data, size).second) {
+      return;
+    }
+    write_ok &= fwrite(data.data(), 1, data.size(), file) == data.size();
+    size += data.size();
+  };
+  for (const auto& column : *table) {
+    for (const auto& entry : column->instructions_by_address()) {
+      add(entry.second->raw_instruction_bytes);
+      add(entry.second->disassembly);
+    }
+  }
+  write_ok &= fclose(file) == 0;
+  if (!write_ok) {
+    unlink(filename.c_str());
+    return absl::InternalError(absl::StrCat("cannot write ", filename));
+  }
+  auto mapped_or = MappedFile::Open(filename);
+  unlink(filename.c_str());
+  if (!mapped_or.ok()) {
+    return mapped_or.status();
+  }
+  auto mapped = std::move(mapped_or).ValueOrDie();
+
+  const absl::string_view data = mapped->data();
+  auto relocate = [data, &offsets](absl::string_view* payload) {
+    if (!payload->empty()) {
+      *payload = data.substr(offsets.find(*payload)->second, payload->size());
+    }
+  };
+  for (auto& column : *table) {
+    for (const auto& entry : column->instructions_by_address()) {
+      relocate(&entry.second->raw_instruction_bytes);
+      relocate(&entry.second->disassembly);
+    }
+    column->set_intern_pool(nullptr);
+  }
+  return mapped;
+#endif
+}
+
+}  // namespace security::vxsig
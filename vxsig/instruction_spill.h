@@ -0,0 +1,44 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// Moves the instruction payloads of a match chain table out of the heap and
+// into a memory-mapped file. The kernel can drop the pages of the file at any
+// time and reads them back on access, so the payloads only count towards the
+// resident set while the signature is constructed from them.
+
+#ifndef VXSIG_INSTRUCTION_SPILL_H_
+#define VXSIG_INSTRUCTION_SPILL_H_
+
+#include <memory>
+
+#include "absl/strings/string_view.h"
+#include "third_party/zynamics/binexport/util/statusor.h"
+#include "vxsig/mapped_file.h"
+#include "vxsig/match_chain_table.h"
+
+namespace security::vxsig {
+
+// Writes the distinct instruction bytes and disassembly strings of all
+// columns of the table to a new file in the specified directory and points
+// the instructions at a read-only mapping of that file. The file is removed
+// right away, its contents live as long as the returned mapping, which needs
+// to outlive the table. Afterwards, the columns no longer reference their
+// intern pools, so these can be released.
+not_absl::StatusOr<std::unique_ptr<MappedFile>> SpillInstructionPayloads(
+    absl::string_view directory, MatchChainTable* table);
+
+}  // namespace security::vxsig
+
+#endif  // VXSIG_INSTRUCTION_SPILL_H_
@@ -0,0 +1,84 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "vxsig/instruction_spill.h"
+
+#include <cstdlib>
+#include <memory>
+
+#include "absl/memory/memory.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "third_party/zynamics/binexport/util/filesystem.h"
+#include "third_party/zynamics/binexport/util/status_matchers.h"
+
+using not_absl::IsOk;
+using testing::Eq;
+using testing::IsEmpty;
+using testing::IsFalse;
+using testing::StrEq;
+
+namespace security::vxsig {
+namespace {
+
+TEST(InstructionSpillTest, MovesPayloadsToMapping) {
+  auto pool = absl::make_unique<InternPool>();
+  MatchChainTable table;
+  for (int i = 0; i < 2; ++i) {
+    table.push_back(absl::make_unique<MatchChainColumn>());
+    auto* column = table.back().get();
+    column->set_intern_pool(pool.get());
+    auto* func = column->InsertFunctionMatch({0x1000, 0x1000});
+    auto* bb = column->InsertBasicBlockMatch(func, {0x1000, 0x1000});
+    auto* instr = column->InsertInstructionMatch(bb, {0x1000, 0x1000});
+    instr->raw_instruction_bytes = pool->Intern("\x6a\x01");
+    instr->disassembly = pool->Intern("push 0x1");
+    // No disassembly for this one.
+    column->InsertInstructionMatch(bb, {0x1002, 0x1002})
+        ->raw_instruction_bytes = pool->Intern("\xc3");
+    column->Compact();
+  }
+
+  const std::string directory = getenv("TEST_TMPDIR");
+  auto spilled_or = SpillInstructionPayloads(directory, &table);
+  ASSERT_THAT(spilled_or.status(), IsOk());
+  const auto spilled = std::move(spilled_or).ValueOrDie();
+  // Each distinct string is stored once.
+  EXPECT_THAT(spilled->data().size(), Eq(2 + 8 + 1));
+  pool.reset();
+
+  for (const auto& column : table) {
+    const auto* first = column->FindInstructionByAddress(0x1000);
+    EXPECT_THAT(first->raw_instruction_bytes, StrEq("\x6a\x01"));
+    EXPECT_THAT(first->disassembly, StrEq("push 0x1"));
+    const auto* second = column->FindInstructionByAddress(0x1002);
+    EXPECT_THAT(second->raw_instruction_bytes, StrEq("\xc3"));
+    EXPECT_THAT(second->disassembly, IsEmpty());
+  }
+  spilled->DropPages();
+  EXPECT_THAT(table[0]->FindInstructionByAddress(0x1000)->disassembly,
+              StrEq("push 0x1"));
+}
+
+TEST(InstructionSpillTest, MissingDirectory) {
+  MatchChainTable table;
+  EXPECT_THAT(SpillInstructionPayloads(
+                  JoinPath(getenv("TEST_TMPDIR"), "does_not_exist"), &table)
+                  .ok(),
+              IsFalse());
+}
+
+}  // namespace
+}  // namespace security::vxsig
@@ -0,0 +1,76 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "vxsig/intern_pool.h"
+
+#include <cstring>
+
+#include "absl/hash/hash.h"
+
+namespace security::vxsig {
+
+absl::string_view InternPool::Intern(absl::string_view data) {
+  if (data.empty()) {
+    return absl::string_view();
+  }
+  auto& shard = shards_[absl::Hash<absl::string_view>()(data) % kNumShards];
+  absl::MutexLock lock(&shard.mutex);
+  auto found = shard.strings.find(data);
+  if (found != shard.strings.end()) {
+    return *found;
+  }
+
+  char* storage;
+  if (data.size() > kBlockSize / 4) {
+    // Large strings get a block of their own, so that they do not waste the
+    // remainder of the current block.
+    shard.blocks.emplace_back(new char[data.size()]);
+    storage = shard.blocks.back().get();
+  } else {
+    if (data.size() > shard.remaining) {
+      shard.blocks.emplace_back(new char[kBlockSize]);
+      shard.next = shard.blocks.back().get();
+      shard.remaining = kBlockSize;
+    }
+    storage = shard.next;
+    shard.next += data.size();
+    shard.remaining -= data.size();
+  }
+  std::memcpy(storage, data.data(), data.size());
+  shard.bytes += data.size();
+
+  absl::string_view interned(storage, data.size());
+  shard.strings.insert(interned);
+  return interned;
+}
+
+size_t InternPool::size() const {
+  size_t result = 0;
+  for (const auto& shard : shards_) {
+    absl::MutexLock lock(&shard.mutex);
+    result += shard.strings.size();
+  }
+  return result;
+}
+
+size_t InternPool::bytes() const {
+  size_t result = 0;
+  for (const auto& shard : shards_) {
+    absl::MutexLock lock(&shard.mutex);
+    result += shard.bytes;
+  }
+  return result;
+}
+
+}  // namespace security::vxsig
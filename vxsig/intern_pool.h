@@ -0,0 +1,73 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// A pool of interned byte strings. The binaries in a match chain are usually
+// very similar, so most of their instruction bytes and disassembly are the
+// same. The pool stores each distinct string only once.
+
+#ifndef VXSIG_INTERN_POOL_H_
+#define VXSIG_INTERN_POOL_H_
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/container/flat_hash_set.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+
+namespace security::vxsig {
+
+// Stores byte strings in large, contiguous blocks of memory and hands out
+// views into them. Interning the same data more than once returns a view of
+// the same stored copy. Views stay valid for the lifetime of the pool.
+// This class is thread-safe. Work is distributed over several independently
+// locked shards, so that multiple columns can be loaded concurrently.
+class InternPool {
+ public:
+  InternPool() = default;
+
+  InternPool(const InternPool&) = delete;
+  InternPool& operator=(const InternPool&) = delete;
+
+  // Returns a view of the pooled copy of data, adding it to the pool if it is
+  // not present yet.
+  absl::string_view Intern(absl::string_view data);
+
+  // Returns the number of distinct strings in the pool.
+  size_t size() const;
+
+  // Returns the total number of bytes used by the distinct strings.
+  size_t bytes() const;
+
+ private:
+  static constexpr int kNumShards = 16;
+  static constexpr size_t kBlockSize = 64 << 10;
+
+  struct Shard {
+    mutable absl::Mutex mutex;
+    absl::flat_hash_set<absl::string_view> strings ABSL_GUARDED_BY(mutex);
+    std::vector<std::unique_ptr<char[]>> blocks ABSL_GUARDED_BY(mutex);
+    char* next ABSL_GUARDED_BY(mutex) = nullptr;
+    size_t remaining ABSL_GUARDED_BY(mutex) = 0;
+    size_t bytes ABSL_GUARDED_BY(mutex) = 0;
+  };
+
+  Shard shards_[kNumShards];
+};
+
+}  // namespace security::vxsig
+
+#endif  // VXSIG_INTERN_POOL_H_
@@ -0,0 +1,70 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "vxsig/intern_pool.h"
+
+#include <string>
+
+#include "absl/strings/str_cat.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "vxsig/thread_pool.h"
+
+using testing::Eq;
+using testing::Ne;
+
+namespace security::vxsig {
+namespace {
+
+TEST(InternPoolTest, IdenticalDataIsStoredOnce) {
+  InternPool pool;
+  std::string first("\x55\x8b\xec", 3);
+  std::string second(first);
+  auto first_view = pool.Intern(first);
+  auto second_view = pool.Intern(second);
+  EXPECT_THAT(first_view, Eq(first));
+  EXPECT_THAT(first_view.data(), Eq(second_view.data()));
+  EXPECT_THAT(first_view.data(), Ne(first.data()));
+
+  auto other_view = pool.Intern("push ebp");
+  EXPECT_THAT(other_view, Eq("push ebp"));
+  EXPECT_THAT(pool.size(), Eq(2));
+  EXPECT_THAT(pool.bytes(), Eq(3 + 8));
+
+  EXPECT_TRUE(pool.Intern("").empty());
+  EXPECT_THAT(pool.size(), Eq(2));
+}
+
+TEST(InternPoolTest, LargeStrings) {
+  InternPool pool;
+  std::string large(1 << 20, 'x');
+  auto large_view = pool.Intern(large);
+  EXPECT_THAT(large_view, Eq(large));
+  auto small_view = pool.Intern("x");
+  EXPECT_THAT(small_view, Eq("x"));
+  EXPECT_THAT(pool.Intern(large).data(), Eq(large_view.data()));
+}
+
+TEST(InternPoolTest, ConcurrentInterning) {
+  InternPool pool;
+  ThreadPool threads(4);
+  ParallelFor(4000, &threads,
+              [&pool](int i) { pool.Intern(absl::StrCat("item ", i % 1000)); });
+  EXPECT_THAT(pool.size(), Eq(1000));
+  EXPECT_THAT(pool.Intern("item 42").data(),
+              Eq(pool.Intern(std::string("item 42")).data()));
+}
+
+}  // namespace
+}  // namespace security::vxsig
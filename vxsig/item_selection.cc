@@ -0,0 +1,102 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "vxsig/item_selection.h"
+
+#include <string>
+#include <utility>
+
+#include "absl/container/flat_hash_set.h"
+
+namespace security::vxsig {
+namespace {
+
+// Runs the greedy selection for the specified root binary. Returns the total
+// similarity of the selected diffs in total_similarity.
+std::vector<int> SelectFromRoot(absl::Span<const BinDiffSummary> diffs,
+                                double min_similarity, const std::string& root,
+                                double* total_similarity) {
+  absl::flat_hash_set<std::string> selected_binaries = {root};
+  std::vector<int> selected;
+  *total_similarity = 0;
+
+  // Returns the most similar diff from a selected binary that adds a new
+  // one. If tail is non-null, only diffs from that binary are considered.
+  auto find_best = [&](const std::string* tail) {
+    int best = -1;
+    for (int i = 0; i < diffs.size(); ++i) {
+      const auto& diff = diffs[i];
+      if (diff.similarity < min_similarity ||
+          (tail ? diff.primary.filename != *tail
+                : !selected_binaries.contains(diff.primary.filename)) ||
+          selected_binaries.contains(diff.secondary.filename)) {
+        continue;
+      }
+      if (best == -1 || diff.similarity > diffs[best].similarity) {
+        best = i;
+      }
+    }
+    return best;
+  };
+  auto select = [&](int index) {
+    selected.push_back(index);
+    selected_binaries.insert(diffs[index].secondary.filename);
+    *total_similarity += diffs[index].similarity;
+  };
+
+  // Extend the path from its tail first, then attach what is left.
+  for (int best = find_best(&root); best != -1;
+       best = find_best(&diffs[best].secondary.filename)) {
+    select(best);
+  }
+  for (int best = find_best(nullptr); best != -1; best = find_best(nullptr)) {
+    select(best);
+  }
+  return selected;
+}
+
+}  // namespace
+
+std::vector<int> SelectSimilarDiffs(absl::Span<const BinDiffSummary> diffs,
+                                    double min_similarity, bool keep_root) {
+  std::vector<int> best_selection;
+  if (diffs.empty()) {
+    return best_selection;
+  }
+  double best_similarity = 0;
+  absl::flat_hash_set<std::string> tried_roots;
+  for (const auto& diff : diffs) {
+    const std::string& root = diff.primary.filename;
+    if (!tried_roots.insert(root).second) {
+      continue;
+    }
+    double total_similarity;
+    std::vector<int> selection =
+        SelectFromRoot(diffs, min_similarity, root, &total_similarity);
+    if (tried_roots.size() == 1 ||
+        selection.size() > best_selection.size() ||
+        (selection.size() == best_selection.size() &&
+         total_similarity > best_similarity)) {
+      best_selection = std::move(selection);
+      best_similarity = total_similarity;
+    }
+    if (keep_root) {
+      break;
+    }
+  }
+  return best_selection;
+}
+
+}  // namespace security::vxsig
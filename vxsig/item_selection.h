@@ -0,0 +1,48 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// Selection of the BinDiff results to generate a signature from, based on the
+// similarity scores that BinDiff stores with each result.
+
+#ifndef VXSIG_ITEM_SELECTION_H_
+#define VXSIG_ITEM_SELECTION_H_
+
+#include <vector>
+
+#include "absl/types/span.h"
+#include "vxsig/diff_result_reader.h"
+
+namespace security::vxsig {
+
+// Orders and filters diffs for the ITEMS_SIMILAR item selection and returns
+// the indices of the selected diffs in order. Diffs with a similarity below
+// min_similarity are dropped. Starting at the root binary, the remaining
+// diffs are chained greedily, each time continuing with the most similar
+// binary that is not part of the chain yet. This is the nearest-neighbor
+// heuristic for a minimum spanning path, with a distance of one minus the
+// similarity, and keeps the chain of matches as long as possible before
+// candidates get lost. Binaries the path does not reach are then attached to
+// the most similar binary that is already selected, which makes the result a
+// tree. Diffs that would add a binary a second time or that do not connect to
+// the root are dropped.
+// If keep_root is true, the root is the primary binary of the first diff, as
+// function filters refer to it. Otherwise, the root is chosen such that the
+// most binaries are selected, preferring a higher total similarity.
+std::vector<int> SelectSimilarDiffs(absl::Span<const BinDiffSummary> diffs,
+                                    double min_similarity, bool keep_root);
+
+}  // namespace security::vxsig
+
+#endif  // VXSIG_ITEM_SELECTION_H_
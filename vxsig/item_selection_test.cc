@@ -0,0 +1,90 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "vxsig/item_selection.h"
+
+#include <string>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+using testing::ElementsAre;
+using testing::IsEmpty;
+
+namespace security::vxsig {
+namespace {
+
+BinDiffSummary Diff(const std::string& primary, const std::string& secondary,
+                    double similarity) {
+  BinDiffSummary summary;
+  summary.primary.filename = primary;
+  summary.secondary.filename = secondary;
+  summary.similarity = similarity;
+  return summary;
+}
+
+TEST(ItemSelectionTest, EmptyInput) {
+  EXPECT_THAT(SelectSimilarDiffs({}, 0.0, /*keep_root=*/false), IsEmpty());
+}
+
+TEST(ItemSelectionTest, ChainIsKept) {
+  const std::vector<BinDiffSummary> diffs = {Diff("a", "b", 0.5),
+                                             Diff("b", "c", 0.9)};
+  EXPECT_THAT(SelectSimilarDiffs(diffs, 0.0, /*keep_root=*/false),
+              ElementsAre(0, 1));
+  EXPECT_THAT(SelectSimilarDiffs(diffs, 0.0, /*keep_root=*/true),
+              ElementsAre(0, 1));
+}
+
+TEST(ItemSelectionTest, ChainIsReordered) {
+  const std::vector<BinDiffSummary> diffs = {
+      Diff("c", "d", 0.7), Diff("a", "b", 0.5), Diff("b", "c", 0.9)};
+  EXPECT_THAT(SelectSimilarDiffs(diffs, 0.0, /*keep_root=*/false),
+              ElementsAre(1, 2, 0));
+  // The root cannot reach the other binaries.
+  EXPECT_THAT(SelectSimilarDiffs(diffs, 0.0, /*keep_root=*/true),
+              ElementsAre(0));
+}
+
+TEST(ItemSelectionTest, DropsDissimilarDiffs) {
+  const std::vector<BinDiffSummary> diffs = {
+      Diff("a", "b", 0.9), Diff("b", "c", 0.2), Diff("a", "d", 0.8)};
+  EXPECT_THAT(SelectSimilarDiffs(diffs, 0.5, /*keep_root=*/true),
+              ElementsAre(0, 2));
+  EXPECT_THAT(SelectSimilarDiffs(diffs, 0.95, /*keep_root=*/true), IsEmpty());
+}
+
+TEST(ItemSelectionTest, FollowsMostSimilarPath) {
+  // All pairs diffed. The path continues with the most similar binary each
+  // time and skips the redundant diffs.
+  const std::vector<BinDiffSummary> diffs = {
+      Diff("a", "b", 0.6), Diff("a", "c", 0.9), Diff("b", "c", 0.5),
+      Diff("c", "b", 0.8), Diff("a", "d", 0.7)};
+  EXPECT_THAT(SelectSimilarDiffs(diffs, 0.0, /*keep_root=*/true),
+              ElementsAre(1, 3, 4));
+}
+
+TEST(ItemSelectionTest, PrefersRootWithMostBinaries) {
+  const std::vector<BinDiffSummary> diffs = {
+      Diff("b", "c", 0.9), Diff("a", "b", 0.3), Diff("a", "d", 0.4)};
+  // Starting at "a" reaches all binaries, with "d" on the path and "b"
+  // attached to the root afterwards.
+  EXPECT_THAT(SelectSimilarDiffs(diffs, 0.0, /*keep_root=*/false),
+              ElementsAre(2, 1, 0));
+}
+
+}  // namespace
+}  // namespace security::vxsig
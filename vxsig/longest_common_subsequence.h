@@ -13,13 +13,18 @@
 // limitations under the License.
 
 // A templated version of the longest-common-subsequence algorithm that works
-// on iterator ranges. The implementation below uses the Hirschberg algorithm
-// parallelized using a ManagedQueue.
+// on iterator ranges. The implementation below uses the Hirschberg algorithm,
+// optionally parallelized on a ThreadPool. For element types with a small
+// alphabet (see LcsAlphabet below), the LCS lengths are computed bit-parallel,
+// 64 cells at a time. For sequences without repeated elements, like the match
+// ids of functions and basic blocks, they are computed from the matching
+// positions (see LcsElements below).
 
 #ifndef VXSIG_LONGEST_COMMON_SUBSEQUENCE_H_
 #define VXSIG_LONGEST_COMMON_SUBSEQUENCE_H_
 
 #include <algorithm>
+#include <any>
 #include <cstddef>
 #include <cstdint>
 #include <cstring>
@@ -27,32 +32,348 @@
 #include <iterator>
 #include <memory>
 #include <string>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
+#include "absl/container/flat_hash_map.h"
 #include "absl/memory/memory.h"
 #include "absl/strings/string_view.h"
+#include "vxsig/thread_pool.h"
 
 namespace security::vxsig {
 
+// Maps sequence elements to a dense alphabet index, which enables the
+// bit-parallel LCS kernel. Specializations must define kEnabled = true, the
+// alphabet size kSize and a static Index() function that returns values in
+// [0, kSize) that are equal if and only if the elements compare equal. Element
+// types without a specialization use the cell-by-cell dynamic program.
+template <typename T, typename Enable = void>
+struct LcsAlphabet {
+  static constexpr bool kEnabled = false;
+};
+
+// Single byte integer types, like char and uint8_t.
+template <typename T>
+struct LcsAlphabet<
+    T, typename std::enable_if<std::is_integral<T>::value &&
+                               sizeof(T) == 1>::type> {
+  static constexpr bool kEnabled = true;
+  static constexpr int kSize = 256;
+  static int Index(T value) { return static_cast<uint8_t>(value); }
+};
+
+// Position of an element of the LCS, as the offsets of its matching
+// occurrences in the first and the second sequence.
+using LcsAlignment = std::pair<ptrdiff_t, ptrdiff_t>;
+
+// Properties of the input sequences that LongestCommonSubsequence() and
+// CommonSubsequence() can make use of.
+enum class LcsElements {
+  // No restrictions.
+  kAny,
+  // No element occurs more than once within the same sequence, as is the
+  // case for permutations. The LCS is then a longest increasing subsequence
+  // of the matching positions, and its rows take O((n + m) log n) instead of
+  // O(n * m) time to compute. The result is the same as for kAny.
+  kDistinct,
+};
+
 namespace detail {
 
 using LcsRowVector = std::vector<int32_t>;
 
-// Internal function that computes a single row of the LCS length matrix.
+// Memory for computing a single row of the LCS length matrix. The result is
+// stored in row, the other members are scratch space for the kernels below.
+struct LcsRowScratch {
+  LcsRowVector row;
+  LcsRowVector prev_row;
+  std::vector<int32_t> symbol_ids;
+  std::vector<int32_t> symbols;
+  std::vector<uint64_t> masks;
+  std::vector<uint64_t> state;
+  // Positions of the elements of the second sequence, an
+  // absl::flat_hash_map<ValueType, int32_t> for the element type of the last
+  // kDistinct input.
+  std::any positions;
+};
+
+}  // namespace detail
+
+// Reusable scratch memory for LongestCommonSubsequence(). The LCS rows of a
+// divide step are only needed until the split position is known, so a single
+// pair of rows serves the whole recursion. Keeping a workspace across calls
+// avoids allocations altogether once it has grown to the largest input size.
+// The members are implementation details.
+struct LcsWorkspace {
+  detail::LcsRowScratch forward;
+  detail::LcsRowScratch reverse;
+};
+
+// Returns a workspace that is private to the calling thread.
+inline LcsWorkspace* ThreadLocalLcsWorkspace() {
+  static thread_local LcsWorkspace workspace;
+  return &workspace;
+}
+
+namespace detail {
+
+// Computes a single row of the LCS length matrix using the classic dynamic
+// program, one cell at a time. Works for all element types.
 template <typename IteratorT>
-void ComputeSingleLcsRow(IteratorT first1, IteratorT last1, IteratorT first2,
-                         IteratorT last2, LcsRowVector* result) {
+void ComputeSingleLcsRowGeneric(IteratorT first1, IteratorT last1,
+                                IteratorT first2, IteratorT last2,
+                                LcsRowScratch* scratch) {
   ptrdiff_t size2 = std::distance(first2, last2);
-  result->resize(size2 + 1);
-  LcsRowVector prev(*result);
+  LcsRowVector* result = &scratch->row;
+  LcsRowVector* prev = &scratch->prev_row;
+  result->assign(size2 + 1, 0);
+  prev->assign(size2 + 1, 0);
   for (auto it1 = first1; it1 != last1; ++it1) {
-    prev = *result;
+    // Every cell but the first is overwritten, so there is no need to copy.
+    prev->swap(*result);
     size_t i = 0;
     for (auto it2 = first2; it2 != last2; ++it2, ++i) {
-      (*result)[i + 1] =
-          (*it1 == *it2) ? prev[i] + 1 : std::max((*result)[i], prev[i + 1]);
+      (*result)[i + 1] = (*it1 == *it2)
+                             ? (*prev)[i] + 1
+                             : std::max((*result)[i], (*prev)[i + 1]);
+    }
+  }
+}
+
+// Computes a single row of the LCS length matrix with the bit-parallel
+// algorithm from H. Hyyro, "Bit-Parallel LCS-length Computation Revisited"
+// (2004), which is a variant of the one by Allison and Dix. Each bit of the
+// state vector corresponds to a position in the second sequence and the LCS
+// lengths are the prefix counts of its zero bits. Requires a specialization
+// of LcsAlphabet for the element type.
+template <typename IteratorT>
+void ComputeSingleLcsRowBitParallel(IteratorT first1, IteratorT last1,
+                                    IteratorT first2, IteratorT last2,
+                                    LcsRowScratch* scratch) {
+  using Alphabet =
+      LcsAlphabet<typename std::iterator_traits<IteratorT>::value_type>;
+  constexpr int kWordBits = 64;
+  const ptrdiff_t size2 = std::distance(first2, last2);
+  const size_t num_words = (size2 + kWordBits - 1) / kWordBits;
+
+  // Match masks, only for symbols that occur in the second sequence. Symbols
+  // of the first sequence that are not in there never match. The symbol ids
+  // are reset at the end, so that they can be reused without clearing the
+  // whole alphabet.
+  auto& symbol_ids = scratch->symbol_ids;
+  auto& symbols = scratch->symbols;
+  auto& masks = scratch->masks;
+  if (symbol_ids.size() < Alphabet::kSize) {
+    symbol_ids.resize(Alphabet::kSize, -1);
+  }
+  symbols.clear();
+  masks.clear();
+  size_t pos = 0;
+  for (auto it2 = first2; it2 != last2; ++it2, ++pos) {
+    const int symbol = Alphabet::Index(*it2);
+    int32_t& id = symbol_ids[symbol];
+    if (id == -1) {
+      id = symbols.size();
+      symbols.push_back(symbol);
+      masks.resize(masks.size() + num_words);
+    }
+    masks[id * num_words + pos / kWordBits] |=
+        uint64_t{1} << (pos % kWordBits);
+  }
+
+  auto& state = scratch->state;
+  state.assign(num_words, ~uint64_t{0});
+  for (auto it1 = first1; it1 != last1; ++it1) {
+    const int32_t id = symbol_ids[Alphabet::Index(*it1)];
+    if (id == -1) {
+      continue;
+    }
+    // state = (state + (state & mask)) | (state & ~mask), with the addition
+    // carrying across words.
+    const uint64_t* mask = &masks[id * num_words];
+    uint64_t carry = 0;
+    for (size_t i = 0; i < num_words; ++i) {
+      const uint64_t word = state[i];
+      const uint64_t matches = word & mask[i];
+      const uint64_t sum = word + matches;
+      const uint64_t sum_with_carry = sum + carry;
+      carry = (sum < word) | (sum_with_carry < sum);
+      state[i] = sum_with_carry | (word & ~mask[i]);
+    }
+  }
+
+  for (const int symbol : symbols) {
+    symbol_ids[symbol] = -1;
+  }
+
+  LcsRowVector& result = scratch->row;
+  result.resize(size2 + 1);
+  result[0] = 0;
+  for (pos = 0; pos < size2; ++pos) {
+    result[pos + 1] =
+        result[pos] + ((~state[pos / kWordBits] >> (pos % kWordBits)) & 1);
+  }
+}
+
+// Computes a single row of the LCS length matrix for a second sequence without
+// repeated elements. Each element of the first sequence then matches at most
+// one position of the second one, and the LCS of the first sequence and a
+// prefix of the second is the longest strictly increasing subsequence of the
+// matching positions that lie inside the prefix. Uses patience sorting, after
+// which tails[k] is the smallest position at which an increasing subsequence
+// of length k + 1 ends. The LCS length for a prefix is the number of tails
+// inside of it.
+template <typename IteratorT>
+void ComputeSingleLcsRowDistinct(IteratorT first1, IteratorT last1,
+                                 IteratorT first2, IteratorT last2,
+                                 LcsRowScratch* scratch) {
+  using ValueType = typename std::iterator_traits<IteratorT>::value_type;
+  using PositionMap = absl::flat_hash_map<ValueType, int32_t>;
+  const ptrdiff_t size2 = std::distance(first2, last2);
+  auto* positions = std::any_cast<PositionMap>(&scratch->positions);
+  if (!positions) {
+    positions = &scratch->positions.emplace<PositionMap>();
+  }
+  positions->clear();
+  positions->reserve(size2);
+  int32_t pos = 0;
+  for (auto it2 = first2; it2 != last2; ++it2, ++pos) {
+    positions->emplace(*it2, pos);
+  }
+
+  LcsRowVector& tails = scratch->prev_row;
+  tails.clear();
+  for (auto it1 = first1; it1 != last1; ++it1) {
+    auto found = positions->find(*it1);
+    if (found == positions->end()) {
+      continue;
+    }
+    auto tail = std::lower_bound(tails.begin(), tails.end(), found->second);
+    if (tail == tails.end()) {
+      tails.push_back(found->second);
+    } else {
+      *tail = found->second;
+    }
+  }
+
+  LcsRowVector& result = scratch->row;
+  result.resize(size2 + 1);
+  size_t num_tails = 0;
+  for (pos = 0; pos <= size2; ++pos) {
+    while (num_tails < tails.size() && tails[num_tails] < pos) {
+      ++num_tails;
+    }
+    result[pos] = num_tails;
+  }
+}
+
+// Internal function that computes a single row of the LCS length matrix. The
+// Hirschberg algorithm below calls this for the forward and, using reverse
+// iterators, for the reverse row.
+template <LcsElements kElements, typename IteratorT>
+void ComputeSingleLcsRow(IteratorT first1, IteratorT last1, IteratorT first2,
+                         IteratorT last2, LcsRowScratch* scratch) {
+  if constexpr (kElements == LcsElements::kDistinct) {
+    ComputeSingleLcsRowDistinct(first1, last1, first2, last2, scratch);
+  } else if constexpr (LcsAlphabet<typename std::iterator_traits<
+                           IteratorT>::value_type>::kEnabled) {
+    ComputeSingleLcsRowBitParallel(first1, last1, first2, last2, scratch);
+  } else {
+    ComputeSingleLcsRowGeneric(first1, last1, first2, last2, scratch);
+  }
+}
+
+// An output iterator that writes to the iterator pointed to by position and
+// advances it. Like std::back_insert_iterator, copies share the position, which
+// is what the recursive LCS implementation relies upon.
+template <typename IteratorT>
+class PositionOutputIterator {
+ public:
+  using iterator_category = std::output_iterator_tag;
+  using value_type = void;
+  using difference_type = ptrdiff_t;
+  using pointer = void;
+  using reference = void;
+
+  explicit PositionOutputIterator(IteratorT* position) : position_(position) {}
+
+  template <typename T>
+  PositionOutputIterator& operator=(T&& value) {
+    *(*position_)++ = std::forward<T>(value);
+    return *this;
+  }
+  PositionOutputIterator& operator*() { return *this; }
+  PositionOutputIterator& operator++() { return *this; }
+  PositionOutputIterator& operator++(int) { return *this; }
+
+ private:
+  IteratorT* position_;
+};
+
+// Strips the common prefix and suffix of two sequences. Copies the prefix to
+// result, moves first1 and first2 past it and sets nlast1 and nlast2 to the
+// start of the common suffix.
+template <typename IteratorT, typename OutputIteratorT>
+void StripCommonAffixes(IteratorT* first1, IteratorT last1,
+                        IteratorT* first2, IteratorT last2,
+                        IteratorT* nlast1, IteratorT* nlast2,
+                        OutputIteratorT* result) {
+  while (*first1 != last1 && *first2 != last2 && **first1 == **first2) {
+    *(*result)++ = **first1;
+    ++*first1;
+    ++*first2;
+  }
+  *nlast1 = last1;
+  *nlast2 = last2;
+  while (*nlast1 != *first1 && *nlast2 != *first2 &&
+         *std::prev(*nlast1) == *std::prev(*nlast2)) {
+    --*nlast1;
+    --*nlast2;
+  }
+}
+
+// Divide step of the Hirschberg algorithm: Splits the first sequence in the
+// middle at mid1 and finds the position in the second sequence where to split
+// it so that the LCS lengths of both halves add up to the maximum. The forward
+// and reverse rows are computed concurrently if pool is non-null. Returns the
+// split offset into the second sequence and stores the LCS length of the left
+// halves in left_size and that of the complete sequences in total_size. The
+// rows in workspace are free to be reused once this function returns.
+template <LcsElements kElements, typename IteratorT>
+ptrdiff_t FindLcsSplit(IteratorT first1, IteratorT mid1, IteratorT last1,
+                       IteratorT first2, IteratorT last2,
+                       LcsWorkspace* workspace, ThreadPool* pool,
+                       ptrdiff_t* left_size, ptrdiff_t* total_size) {
+  using ReverseIteratorT = std::reverse_iterator<IteratorT>;
+  const ptrdiff_t size2 = std::distance(first2, last2);
+
+  ParallelFor(2, pool, [&](int i) {
+    if (i == 0) {
+      ComputeSingleLcsRow<kElements>(first1, mid1, first2, last2,
+                                     &workspace->forward);
+    } else {
+      ComputeSingleLcsRow<kElements>(
+          ReverseIteratorT(last1), ReverseIteratorT(mid1),
+          ReverseIteratorT(last2), ReverseIteratorT(first2),
+          &workspace->reverse);
+    }
+  });
+  const LcsRowVector& ll_left = workspace->forward.row;
+  const LcsRowVector& ll_right = workspace->reverse.row;
+
+  ptrdiff_t ll_max = -1;
+  ptrdiff_t pivot = 0;
+  for (ptrdiff_t i = 0; i < size2 + 1; ++i) {
+    ptrdiff_t ll_cur = ll_left[i] + ll_right[size2 - i];
+    if (ll_max < ll_cur) {
+      ll_max = ll_cur;
+      pivot = i;
     }
   }
+  *left_size = ll_left[pivot];
+  *total_size = ll_max;
+  return pivot;
 }
 
 // Calculates the longest common subsequence (LCS) of two sequences specified
@@ -64,45 +385,18 @@ void ComputeSingleLcsRow(IteratorT first1, IteratorT last1, IteratorT first2,
 // lengths of the sequences.
 //
 // Returns the longest common subsequence of the given sequences in an output
-// iterator.
-template <typename IteratorT, typename OutputIteratorT>
+// iterator. All recursion levels share the rows in workspace.
+template <LcsElements kElements, typename IteratorT, typename OutputIteratorT>
 void LongestCommonSubsequence(IteratorT first1, IteratorT last1,
                               IteratorT first2, IteratorT last2,
-                              OutputIteratorT result) {
-  using detail::LcsRowVector;
-  using detail::ComputeSingleLcsRow;
-  using ReverseIteratorT = std::reverse_iterator<IteratorT>;
-
-  // If both sequences have the same prefix, add it to the resulting LCS.
-  // This reduces the space needed for the opt array.
-  ptrdiff_t size1 = std::distance(first1, last1);
-  ptrdiff_t size2 = std::distance(first2, last2);
-  while (size1 > 0 && size2 > 0 && *first1 == *first2) {
-    *result++ = *first1;
-    ++first1;
-    ++first2;
-    --size1;
-    --size2;
-  }
-
-  // Empty sequences have an empty longest common subsequence.
-  if (size1 == 0 || size2 == 0) {
-    return;
-  }
-
-  // Optimize for same suffixes.
-  auto nlast1 = last1;
-  auto nlast2 = last2;
-  --nlast1;
-  --nlast2;
-  while (size1 > 0 && size2 > 0 && *nlast1 == *nlast2) {
-    --nlast1;
-    --nlast2;
-    --size1;
-    --size2;
-  }
-  ++nlast1;
-  ++nlast2;
+                              OutputIteratorT result, LcsWorkspace* workspace) {
+  // If both sequences have the same prefix or suffix, add it to the resulting
+  // LCS. This reduces the space needed for the opt array.
+  IteratorT nlast1;
+  IteratorT nlast2;
+  StripCommonAffixes(&first1, last1, &first2, last2, &nlast1, &nlast2,
+                     &result);
+  const ptrdiff_t size1 = std::distance(first1, nlast1);
 
   if (size1 == 1) {
     // Recursion end, simple case with one sequence consisting of one
@@ -111,56 +405,211 @@ void LongestCommonSubsequence(IteratorT first1, IteratorT last1,
     if (it != nlast2) {
       *result++ = *first1;
     }
-  } else if (size1 > 1) {
+  } else if (size1 > 1 && first2 != nlast2) {
     auto mid1 = first1 + size1 / 2;
 
-    LcsRowVector ll_left;
-    LcsRowVector ll_right;
-
-    // If the input size is rather small, avoid the overhead of parallelization.
-    // The choice is rather arbitrary, but empirically resulted in good
-    // subjective performance.
-    if (size1 + size2 > 1000) {
-      // TODO(cblichmann): Compute LCS lengths in parallel using OpenMP
-      ComputeSingleLcsRow(first1, mid1, first2, nlast2, &ll_left);
-      ComputeSingleLcsRow(ReverseIteratorT(nlast1), ReverseIteratorT(mid1),
-                          ReverseIteratorT(nlast2), ReverseIteratorT(first2),
-                          &ll_right);
-    } else {
-      // Small input, avoid overhead of ManagedQueue.
-      ComputeSingleLcsRow(first1, mid1, first2, nlast2, &ll_left);
-      ComputeSingleLcsRow(ReverseIteratorT(nlast1), ReverseIteratorT(mid1),
-                          ReverseIteratorT(nlast2), ReverseIteratorT(first2),
-                          &ll_right);
-    }
-
     // Divide: Find optimal position where to split the input sequences.
-    ptrdiff_t ll_max = -1;
-    size_t pivot = 0;
-    for (size_t i = 0; i < size2 + 1; ++i) {
-      ptrdiff_t ll_cur = ll_left[i] + ll_right[size2 - i];
-      if (ll_max < ll_cur) {
-        ll_max = ll_cur;
-        pivot = i;
-      }
-    }
+    ptrdiff_t left_size;
+    ptrdiff_t total_size;
+    const ptrdiff_t pivot =
+        FindLcsSplit<kElements>(first1, mid1, nlast1, first2, nlast2,
+                                workspace, /*pool=*/nullptr, &left_size,
+                                &total_size);
 
     // Conquer: Continue recursively.
-    LongestCommonSubsequence(first1, mid1, first2, first2 + pivot, result);
-    LongestCommonSubsequence(mid1, nlast1, first2 + pivot, nlast2, result);
+    detail::LongestCommonSubsequence<kElements>(
+        first1, mid1, first2, first2 + pivot, result, workspace);
+    detail::LongestCommonSubsequence<kElements>(
+        mid1, nlast1, first2 + pivot, nlast2, result, workspace);
   }
 
   // Add common suffixes to result.
   std::copy(nlast1, last1, result);
 }
 
+// Like LongestCommonSubsequence() above, but instead of the elements of the
+// LCS, outputs an LcsAlignment for each of them. Offsets are relative to base1
+// and base2, respectively. The recursion is the same, so the elements are
+// aligned exactly as the ones in the LCS returned by the function above.
+template <LcsElements kElements, typename IteratorT, typename OutputIteratorT>
+void LongestCommonSubsequenceAlignment(IteratorT base1, IteratorT first1,
+                                       IteratorT last1, IteratorT base2,
+                                       IteratorT first2, IteratorT last2,
+                                       OutputIteratorT result,
+                                       LcsWorkspace* workspace) {
+  while (first1 != last1 && first2 != last2 && *first1 == *first2) {
+    *result++ = LcsAlignment(first1++ - base1, first2++ - base2);
+  }
+  IteratorT nlast1 = last1;
+  IteratorT nlast2 = last2;
+  while (nlast1 != first1 && nlast2 != first2 &&
+         *std::prev(nlast1) == *std::prev(nlast2)) {
+    --nlast1;
+    --nlast2;
+  }
+  const ptrdiff_t size1 = std::distance(first1, nlast1);
+
+  if (size1 == 1) {
+    auto it = std::find(first2, nlast2, *first1);
+    if (it != nlast2) {
+      *result++ = LcsAlignment(first1 - base1, it - base2);
+    }
+  } else if (size1 > 1 && first2 != nlast2) {
+    auto mid1 = first1 + size1 / 2;
+    ptrdiff_t left_size;
+    ptrdiff_t total_size;
+    const ptrdiff_t pivot =
+        FindLcsSplit<kElements>(first1, mid1, nlast1, first2, nlast2,
+                                workspace, /*pool=*/nullptr, &left_size,
+                                &total_size);
+    detail::LongestCommonSubsequenceAlignment<kElements>(
+        base1, first1, mid1, base2, first2, first2 + pivot, result, workspace);
+    detail::LongestCommonSubsequenceAlignment<kElements>(
+        base1, mid1, nlast1, base2, first2 + pivot, nlast2, result, workspace);
+  }
+
+  for (; nlast1 != last1; ++nlast1, ++nlast2) {
+    *result++ = LcsAlignment(nlast1 - base1, nlast2 - base2);
+  }
+}
+
+// Task-parallel version of the function above. Since the LCS lengths of both
+// halves are known after the divide step, each half writes its part of the
+// LCS directly to its final position, starting at out. Inputs with a combined
+// size of at most grain_size are handled by the serial version. Each task uses
+// the workspace of the thread it runs on. Returns the length of the LCS.
+template <LcsElements kElements, typename IteratorT,
+          typename RandomAccessIteratorT>
+ptrdiff_t ParallelLongestCommonSubsequence(IteratorT first1, IteratorT last1,
+                                           IteratorT first2, IteratorT last2,
+                                           RandomAccessIteratorT out,
+                                           ThreadPool* pool,
+                                           ptrdiff_t grain_size) {
+  if (std::distance(first1, last1) + std::distance(first2, last2) <=
+      grain_size) {
+    RandomAccessIteratorT end = out;
+    detail::LongestCommonSubsequence<kElements>(
+        first1, last1, first2, last2,
+        PositionOutputIterator<RandomAccessIteratorT>(&end),
+        ThreadLocalLcsWorkspace());
+    return end - out;
+  }
+
+  IteratorT nlast1;
+  IteratorT nlast2;
+  const RandomAccessIteratorT start = out;
+  StripCommonAffixes(&first1, last1, &first2, last2, &nlast1, &nlast2, &out);
+  const ptrdiff_t size1 = std::distance(first1, nlast1);
+
+  if (size1 == 1) {
+    auto it = std::find(first2, nlast2, *first1);
+    if (it != nlast2) {
+      *out++ = *first1;
+    }
+  } else if (size1 > 1 && first2 != nlast2) {
+    auto mid1 = first1 + size1 / 2;
+    ptrdiff_t left_size;
+    ptrdiff_t total_size;
+    const ptrdiff_t pivot =
+        FindLcsSplit<kElements>(first1, mid1, nlast1, first2, nlast2,
+                                ThreadLocalLcsWorkspace(), pool, &left_size,
+                                &total_size);
+    ParallelFor(2, pool, [&](int i) {
+      if (i == 0) {
+        ParallelLongestCommonSubsequence<kElements>(
+            first1, mid1, first2, first2 + pivot, out, pool, grain_size);
+      } else {
+        ParallelLongestCommonSubsequence<kElements>(
+            mid1, nlast1, first2 + pivot, nlast2, out + left_size, pool,
+            grain_size);
+      }
+    });
+    out += total_size;
+  }
+  out = std::copy(nlast1, last1, out);
+  return out - start;
+}
+
 }  // namespace detail
 
-template <typename IteratorT, typename OutputIteratorT>
+// Combined input size below which the parallel version of
+// LongestCommonSubsequence() no longer splits the work into tasks. The choice
+// is rather arbitrary, but empirically resulted in good performance.
+constexpr int kDefaultLcsGrainSize = 1000;
+
+// Calculates the longest common subsequence of two sequences specified by
+// iterator ranges and writes it to result. If kElements is
+// LcsElements::kDistinct, none of the sequences may contain an element more
+// than once.
+template <LcsElements kElements = LcsElements::kAny, typename IteratorT,
+          typename OutputIteratorT>
 void LongestCommonSubsequence(IteratorT first1, IteratorT last1,
                               IteratorT first2, IteratorT last2,
                               OutputIteratorT result) {
-  detail::LongestCommonSubsequence(first1, last1, first2, last2, result);
+  LcsWorkspace workspace;
+  detail::LongestCommonSubsequence<kElements>(first1, last1, first2, last2,
+                                              result, &workspace);
+}
+
+// Like above, but uses the specified workspace for all intermediate rows. Use
+// this to avoid allocations when computing many LCS, for example with the
+// workspace returned by ThreadLocalLcsWorkspace().
+template <LcsElements kElements = LcsElements::kAny, typename IteratorT,
+          typename OutputIteratorT>
+void LongestCommonSubsequence(IteratorT first1, IteratorT last1,
+                              IteratorT first2, IteratorT last2,
+                              OutputIteratorT result, LcsWorkspace* workspace) {
+  detail::LongestCommonSubsequence<kElements>(first1, last1, first2, last2,
+                                              result, workspace);
+}
+
+// Like above, but computes the LCS on the specified thread pool. The rows of
+// the divide steps and the two halves of each conquer step run as separate
+// tasks, down to inputs with a combined size of grain_size. The result is the
+// same as for the serial version. If pool is nullptr, this is the same as the
+// serial version.
+template <LcsElements kElements = LcsElements::kAny, typename IteratorT,
+          typename OutputIteratorT>
+void LongestCommonSubsequence(IteratorT first1, IteratorT last1,
+                              IteratorT first2, IteratorT last2,
+                              OutputIteratorT result, ThreadPool* pool,
+                              int grain_size = kDefaultLcsGrainSize) {
+  if (!pool) {
+    detail::LongestCommonSubsequence<kElements>(
+        first1, last1, first2, last2, result, ThreadLocalLcsWorkspace());
+    return;
+  }
+  std::vector<typename std::iterator_traits<IteratorT>::value_type> lcs(
+      std::min(std::distance(first1, last1), std::distance(first2, last2)));
+  lcs.resize(detail::ParallelLongestCommonSubsequence<kElements>(
+      first1, last1, first2, last2, lcs.begin(), pool, grain_size));
+  std::copy(lcs.begin(), lcs.end(), result);
+}
+
+// Calculates the longest common subsequence of two sequences like
+// LongestCommonSubsequence(), but writes the offsets of its elements into both
+// sequences to result, as LcsAlignment pairs in ascending order. This saves
+// searching for the elements again when building a regular expression from the
+// LCS, see RegexFromAlignment(). Requires random access iterators.
+template <LcsElements kElements = LcsElements::kAny, typename IteratorT,
+          typename OutputIteratorT>
+void LongestCommonSubsequenceAlignment(IteratorT first1, IteratorT last1,
+                                       IteratorT first2, IteratorT last2,
+                                       OutputIteratorT result,
+                                       LcsWorkspace* workspace) {
+  detail::LongestCommonSubsequenceAlignment<kElements>(
+      first1, first1, last1, first2, first2, last2, result, workspace);
+}
+
+// Like above, but uses the workspace of the calling thread.
+template <LcsElements kElements = LcsElements::kAny, typename IteratorT,
+          typename OutputIteratorT>
+void LongestCommonSubsequenceAlignment(IteratorT first1, IteratorT last1,
+                                       IteratorT first2, IteratorT last2,
+                                       OutputIteratorT result) {
+  detail::LongestCommonSubsequenceAlignment<kElements>(
+      first1, first1, last1, first2, first2, last2, result,
+      ThreadLocalLcsWorkspace());
 }
 
 // Convenience version of LongestCommonSubsequence() that operates on
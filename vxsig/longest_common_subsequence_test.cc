@@ -14,13 +14,19 @@
 
 #include "vxsig/longest_common_subsequence.h"
 
+#include <algorithm>
 #include <cstdint>
+#include <iterator>
+#include <random>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
+#include "vxsig/thread_pool.h"
 
+using testing::ElementsAreArray;
 using testing::Eq;
 using testing::IsEmpty;
 using testing::ElementsAre;
@@ -158,4 +164,216 @@ TEST(LongestCommonSubsequenceTest, OperateOnVectors) {
   TestLongestCommonSubsequenceOnVectors<int64_t>();
 }
 
+// An element type with a custom alphabet, where only part of the element is
+// relevant for equality.
+struct TaggedByte {
+  uint8_t value;
+  int tag;  // Ignored for equality
+};
+
+bool operator==(const TaggedByte& lhs, const TaggedByte& rhs) {
+  return lhs.value == rhs.value;
+}
+
+template <>
+struct LcsAlphabet<TaggedByte> {
+  static constexpr bool kEnabled = true;
+  static constexpr int kSize = 256;
+  static int Index(const TaggedByte& byte) { return byte.value; }
+};
+
+TEST(LongestCommonSubsequenceTest, BitParallelRowsMatchGenericRows) {
+  std::mt19937 rng(42);
+  for (const int alphabet_size : {2, 4, 256}) {
+    std::uniform_int_distribution<int> symbol(0, alphabet_size - 1);
+    for (const int size2 : {0, 1, 63, 64, 65, 200}) {
+      std::string first(size2 / 2 + 37, '\0');
+      std::string second(size2, '\0');
+      for (auto& c : first) {
+        c = symbol(rng);
+      }
+      for (auto& c : second) {
+        c = symbol(rng);
+      }
+      detail::LcsRowScratch expected;
+      detail::LcsRowScratch actual;
+      detail::ComputeSingleLcsRowGeneric(first.begin(), first.end(),
+                                         second.begin(), second.end(),
+                                         &expected);
+      detail::ComputeSingleLcsRowBitParallel(first.begin(), first.end(),
+                                             second.begin(), second.end(),
+                                             &actual);
+      EXPECT_THAT(actual.row, ElementsAreArray(expected.row));
+
+      // Reverse rows, as used by the Hirschberg split. This also reuses the
+      // scratch space of the previous call.
+      detail::ComputeSingleLcsRowGeneric(first.rbegin(), first.rend(),
+                                         second.rbegin(), second.rend(),
+                                         &expected);
+      detail::ComputeSingleLcsRowBitParallel(first.rbegin(), first.rend(),
+                                             second.rbegin(), second.rend(),
+                                             &actual);
+      EXPECT_THAT(actual.row, ElementsAreArray(expected.row));
+    }
+  }
+}
+
+TEST(LongestCommonSubsequenceTest, CustomAlphabet) {
+  const std::vector<TaggedByte> first = {{1, 0}, {2, 0}, {3, 0}, {4, 0}};
+  const std::vector<TaggedByte> second = {{9, 1}, {2, 1}, {4, 1}, {3, 1}};
+  std::vector<TaggedByte> result;
+  LongestCommonSubsequence(first.begin(), first.end(), second.begin(),
+                           second.end(), std::back_inserter(result));
+  ASSERT_THAT(result.size(), Eq(2));
+  EXPECT_THAT(result[0].value, Eq(2));
+  // Elements are taken from the first sequence.
+  EXPECT_THAT(result[0].tag, Eq(0));
+}
+
+TEST(LongestCommonSubsequenceTest, ReusedWorkspace) {
+  LcsWorkspace workspace;
+  for (const auto& inputs : std::vector<std::pair<std::string, std::string>>{
+           {"ABcoCDmmEFonGH", "IJKLcoMNmmOPonQRSTUV"},
+           {"pAcBCDEFGHIJKs", "pcs"},
+           {"", "somestr"},
+           {"ABCDcommonEFGH", "IJKLMNOPcommonQRST"}}) {
+    std::string result;
+    LongestCommonSubsequence(inputs.first.begin(), inputs.first.end(),
+                             inputs.second.begin(), inputs.second.end(),
+                             std::back_inserter(result), &workspace);
+    EXPECT_THAT(result,
+                Eq(LongestCommonSubsequence(inputs.first, inputs.second)));
+  }
+}
+
+TEST(LongestCommonSubsequenceTest, ParallelMatchesSerial) {
+  std::mt19937 rng(7);
+  std::uniform_int_distribution<int> symbol(0, 3);
+  ThreadPool pool(3);
+  for (const int size : {0, 1, 10, 500, 3000}) {
+    std::vector<uint32_t> first(size);
+    std::vector<uint32_t> second(size + size / 3);
+    for (auto& value : first) {
+      value = symbol(rng);
+    }
+    for (auto& value : second) {
+      value = symbol(rng);
+    }
+    std::vector<uint32_t> expected;
+    LongestCommonSubsequence(first.begin(), first.end(), second.begin(),
+                             second.end(), std::back_inserter(expected));
+    for (const int grain_size : {1, 64, kDefaultLcsGrainSize}) {
+      std::vector<uint32_t> actual;
+      LongestCommonSubsequence(first.begin(), first.end(), second.begin(),
+                               second.end(), std::back_inserter(actual), &pool,
+                               grain_size);
+      EXPECT_THAT(actual, ElementsAreArray(expected));
+    }
+  }
+}
+
+// Returns a shuffled sample of size distinct values from [0, 2 * size).
+std::vector<uint32_t> DistinctSequence(int size, std::mt19937* rng) {
+  std::vector<uint32_t> values(2 * size);
+  for (int i = 0; i < values.size(); ++i) {
+    values[i] = i;
+  }
+  std::shuffle(values.begin(), values.end(), *rng);
+  values.resize(size);
+  // Keep some runs sorted, so that there are longer common subsequences.
+  std::sort(values.begin(), values.begin() + size / 2);
+  return values;
+}
+
+TEST(LongestCommonSubsequenceTest, DistinctRowsMatchGenericRows) {
+  std::mt19937 rng(5);
+  for (const int size : {0, 1, 2, 17, 150}) {
+    const auto first = DistinctSequence(size + 3, &rng);
+    const auto second = DistinctSequence(size, &rng);
+    detail::LcsRowScratch expected;
+    detail::LcsRowScratch actual;
+    detail::ComputeSingleLcsRowGeneric(first.begin(), first.end(),
+                                       second.begin(), second.end(),
+                                       &expected);
+    detail::ComputeSingleLcsRowDistinct(first.begin(), first.end(),
+                                        second.begin(), second.end(),
+                                        &actual);
+    EXPECT_THAT(actual.row, ElementsAreArray(expected.row));
+
+    detail::ComputeSingleLcsRowGeneric(first.rbegin(), first.rend(),
+                                       second.rbegin(), second.rend(),
+                                       &expected);
+    detail::ComputeSingleLcsRowDistinct(first.rbegin(), first.rend(),
+                                        second.rbegin(), second.rend(),
+                                        &actual);
+    EXPECT_THAT(actual.row, ElementsAreArray(expected.row));
+  }
+}
+
+TEST(LongestCommonSubsequenceTest, DistinctMatchesAny) {
+  std::mt19937 rng(9);
+  ThreadPool pool(3);
+  for (const int size : {0, 1, 10, 500, 3000}) {
+    const auto first = DistinctSequence(size, &rng);
+    const auto second = DistinctSequence(size + size / 3, &rng);
+    std::vector<uint32_t> expected;
+    LongestCommonSubsequence(first.begin(), first.end(), second.begin(),
+                             second.end(), std::back_inserter(expected));
+
+    std::vector<uint32_t> actual;
+    LongestCommonSubsequence<LcsElements::kDistinct>(
+        first.begin(), first.end(), second.begin(), second.end(),
+        std::back_inserter(actual));
+    EXPECT_THAT(actual, ElementsAreArray(expected));
+
+    actual.clear();
+    LongestCommonSubsequence<LcsElements::kDistinct>(
+        first.begin(), first.end(), second.begin(), second.end(),
+        std::back_inserter(actual), &pool, /*grain_size=*/64);
+    EXPECT_THAT(actual, ElementsAreArray(expected));
+  }
+}
+
+TEST(LongestCommonSubsequenceTest, Alignment) {
+  std::vector<LcsAlignment> alignment;
+  const std::string first = "ABCDcommonEFGH";
+  const std::string second = "IcJKoLmmonMNOP";
+  LongestCommonSubsequenceAlignment(first.begin(), first.end(), second.begin(),
+                                    second.end(),
+                                    std::back_inserter(alignment));
+  EXPECT_THAT(alignment, ElementsAre(LcsAlignment(4, 1), LcsAlignment(5, 4),
+                                     LcsAlignment(6, 6), LcsAlignment(7, 7),
+                                     LcsAlignment(8, 8), LcsAlignment(9, 9)));
+
+  std::mt19937 rng(13);
+  std::uniform_int_distribution<int> dist('a', 'd');
+  for (const int size : {0, 1, 2, 33, 400}) {
+    std::string a(size, '\0');
+    std::string b(size + 7, '\0');
+    for (char& c : a) {
+      c = dist(rng);
+    }
+    for (char& c : b) {
+      c = dist(rng);
+    }
+    std::string expected;
+    LongestCommonSubsequence(a.begin(), a.end(), b.begin(), b.end(),
+                             std::back_inserter(expected));
+
+    alignment.clear();
+    LongestCommonSubsequenceAlignment(a.begin(), a.end(), b.begin(), b.end(),
+                                      std::back_inserter(alignment));
+    std::string actual;
+    LcsAlignment previous(-1, -1);
+    for (const auto& aligned : alignment) {
+      EXPECT_THAT(a[aligned.first], Eq(b[aligned.second]));
+      EXPECT_GT(aligned.first, previous.first);
+      EXPECT_GT(aligned.second, previous.second);
+      previous = aligned;
+      actual.push_back(a[aligned.first]);
+    }
+    EXPECT_THAT(actual, Eq(expected));
+  }
+}
+
 }  // namespace security::vxsig
@@ -0,0 +1,93 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "vxsig/mapped_file.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <fstream>
+#include <iterator>
+
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+
+namespace security::vxsig {
+
+not_absl::StatusOr<std::unique_ptr<MappedFile>> MappedFile::Open(
+    absl::string_view filename) {
+  std::unique_ptr<MappedFile> result(new MappedFile());
+  const std::string filename_str(filename);
+#ifndef _WIN32
+  const int fd = open(filename_str.c_str(), O_RDONLY);
+  if (fd == -1) {
+    return absl::NotFoundError(absl::StrCat("cannot open ", filename));
+  }
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) == -1) {
+    close(fd);
+    return absl::InternalError(absl::StrCat("cannot stat ", filename));
+  }
+  result->size_ = file_stat.st_size;
+  if (result->size_ > 0) {
+    void* mapping =
+        mmap(nullptr, result->size_, PROT_READ, MAP_PRIVATE, fd, /*offset=*/0);
+    if (mapping != MAP_FAILED) {
+      // Parsers read front to back, so let the kernel read ahead.
+      madvise(mapping, result->size_, MADV_SEQUENTIAL);
+      result->data_ = static_cast<const char*>(mapping);
+      result->mapped_ = true;
+    }
+  }
+  close(fd);
+  if (result->mapped_ || result->size_ == 0) {
+    return result;
+  }
+#endif
+  // Fall back to reading the whole file.
+  std::ifstream file(filename_str, std::ios_base::binary);
+  if (!file) {
+    return absl::NotFoundError(absl::StrCat("cannot open ", filename));
+  }
+  result->fallback_.assign(std::istreambuf_iterator<char>(file),
+                           std::istreambuf_iterator<char>());
+  if (file.bad()) {
+    return absl::InternalError(absl::StrCat("cannot read ", filename));
+  }
+  result->data_ = result->fallback_.data();
+  result->size_ = result->fallback_.size();
+  return result;
+}
+
+MappedFile::~MappedFile() {
+#ifndef _WIN32
+  if (mapped_) {
+    munmap(const_cast<char*>(data_), size_);
+  }
+#endif
+}
+
+void MappedFile::DropPages() const {
+#ifndef _WIN32
+  if (mapped_) {
+    madvise(const_cast<char*>(data_), size_, MADV_DONTNEED);
+  }
+#endif
+}
+
+}  // namespace security::vxsig
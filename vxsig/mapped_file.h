@@ -0,0 +1,64 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Read-only access to the contents of a file without copying it into memory
+// first.
+
+#ifndef VXSIG_MAPPED_FILE_H_
+#define VXSIG_MAPPED_FILE_H_
+
+#include <cstddef>
+#include <memory>
+#include <string>
+
+#include "absl/strings/string_view.h"
+#include "third_party/zynamics/binexport/util/statusor.h"
+
+namespace security::vxsig {
+
+// A read-only, memory-mapped file. On platforms without mmap(), the file
+// contents are read into memory instead.
+class MappedFile {
+ public:
+  // Maps the specified file into memory.
+  static not_absl::StatusOr<std::unique_ptr<MappedFile>> Open(
+      absl::string_view filename);
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  ~MappedFile();
+
+  // Returns the contents of the file. Only valid for the lifetime of this
+  // object.
+  absl::string_view data() const { return absl::string_view(data_, size_); }
+
+  // Tells the kernel that the contents are not needed for now, so that the
+  // mapped pages no longer count towards the resident set of the process.
+  // They are read from the file again on the next access. Does nothing if the
+  // file could not be mapped.
+  void DropPages() const;
+
+ private:
+  MappedFile() = default;
+
+  const char* data_ = nullptr;
+  size_t size_ = 0;
+  bool mapped_ = false;
+  std::string fallback_;  // Used if the file could not be mapped
+};
+
+}  // namespace security::vxsig
+
+#endif  // VXSIG_MAPPED_FILE_H_
@@ -0,0 +1,69 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "vxsig/mapped_file.h"
+
+#include <cstdlib>
+#include <fstream>
+#include <string>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "third_party/zynamics/binexport/util/filesystem.h"
+#include "third_party/zynamics/binexport/util/status_matchers.h"
+
+using not_absl::IsOk;
+using testing::Eq;
+
+namespace security::vxsig {
+namespace {
+
+std::string WriteTestFile(absl::string_view name, absl::string_view contents) {
+  std::string filename = JoinPath(getenv("TEST_TMPDIR"), name);
+  std::ofstream file(filename, std::ios_base::binary | std::ios_base::trunc);
+  file.write(contents.data(), contents.size());
+  return filename;
+}
+
+TEST(MappedFileTest, MapsFileContents) {
+  const std::string contents("\x0A\x04vxsig\x00\xFF", 9);
+  auto mapped_or = MappedFile::Open(WriteTestFile("mapped", contents));
+  ASSERT_THAT(mapped_or.status(), IsOk());
+  EXPECT_THAT(mapped_or.ValueOrDie()->data(), Eq(contents));
+}
+
+TEST(MappedFileTest, ContentsSurviveDroppingPages) {
+  const std::string contents(3 * 4096, 'x');
+  auto mapped_or = MappedFile::Open(WriteTestFile("dropped", contents));
+  ASSERT_THAT(mapped_or.status(), IsOk());
+  const auto& mapped = *mapped_or.ValueOrDie();
+  EXPECT_THAT(mapped.data(), Eq(contents));
+  mapped.DropPages();
+  EXPECT_THAT(mapped.data(), Eq(contents));
+}
+
+TEST(MappedFileTest, EmptyFile) {
+  auto mapped_or = MappedFile::Open(WriteTestFile("empty", ""));
+  ASSERT_THAT(mapped_or.status(), IsOk());
+  EXPECT_TRUE(mapped_or.ValueOrDie()->data().empty());
+}
+
+TEST(MappedFileTest, MissingFile) {
+  EXPECT_FALSE(
+      MappedFile::Open(JoinPath(getenv("TEST_TMPDIR"), "does_not_exist"))
+          .ok());
+}
+
+}  // namespace
+}  // namespace security::vxsig
@@ -0,0 +1,440 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "vxsig/match_chain_cache.h"
+
+#include <sys/stat.h>
+
+#include <memory>
+#include <vector>
+
+#include "absl/base/internal/endian.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/memory/memory.h"
+#include "absl/strings/str_cat.h"
+#include "third_party/zynamics/binexport/util/status_macros.h"
+#include "vxsig/atomic_file.h"
+#include "vxsig/mapped_file.h"
+
+namespace security::vxsig {
+namespace {
+
+// Bump this when changing the file layout.
+constexpr absl::string_view kCacheMagic = "VXSIGMC3";
+
+// Minimum sizes of the variable-length records, used for sanity checks.
+constexpr size_t kMinDependencySize = 4 + 8 + 8;
+constexpr size_t kMinColumnSize = 3 * 4 + 3 * 4;
+constexpr size_t kMinFunctionSize = 8 + 8 + 4 + 4 + 8 + 4;
+constexpr size_t kMinBasicBlockSize = 8 + 8 + 4 + 4 + 4;
+constexpr size_t kMinInstructionSize = 8 + 8 + 8 + 4 + 8 + 4 + 8 + 4;
+constexpr size_t kImmediateSize = 8 + 1;
+
+// Appends little-endian encoded values to a string.
+class CacheWriter {
+ public:
+  void PutU8(uint8_t value) { buffer_.push_back(static_cast<char>(value)); }
+  void PutU32(uint32_t value) {
+    char bytes[sizeof(value)];
+    absl::little_endian::Store32(bytes, value);
+    buffer_.append(bytes, sizeof(bytes));
+  }
+  void PutU64(uint64_t value) {
+    char bytes[sizeof(value)];
+    absl::little_endian::Store64(bytes, value);
+    buffer_.append(bytes, sizeof(bytes));
+  }
+  void PutString(absl::string_view value) {
+    PutU32(value.size());
+    buffer_.append(value.data(), value.size());
+  }
+
+  const std::string& buffer() const { return buffer_; }
+
+ private:
+  std::string buffer_;
+};
+
+// Reads little-endian encoded values written by CacheWriter. Reads past the
+// end of the data fail and set an error flag instead.
+class CacheReader {
+ public:
+  explicit CacheReader(absl::string_view data) : data_(data) {}
+
+  uint8_t GetU8() {
+    return Available(sizeof(uint8_t)) ? static_cast<uint8_t>(Advance(1)[0])
+                                      : 0;
+  }
+  uint32_t GetU32() {
+    return Available(sizeof(uint32_t))
+               ? absl::little_endian::Load32(Advance(sizeof(uint32_t)))
+               : 0;
+  }
+  uint64_t GetU64() {
+    return Available(sizeof(uint64_t))
+               ? absl::little_endian::Load64(Advance(sizeof(uint64_t)))
+               : 0;
+  }
+  absl::string_view GetString() { return GetBytes(GetU32()); }
+
+  // Reads the number of records that follow. Each record occupies at least
+  // min_record_size bytes, which guards against huge allocations for corrupt
+  // files.
+  uint32_t GetCount(size_t min_record_size) {
+    const uint32_t count = GetU32();
+    return Available(static_cast<uint64_t>(count) * min_record_size) ? count
+                                                                      : 0;
+  }
+  absl::string_view GetBytes(size_t size) {
+    return Available(size) ? absl::string_view(Advance(size), size)
+                           : absl::string_view();
+  }
+
+  bool ok() const { return ok_; }
+
+ private:
+  bool Available(size_t size) {
+    if (!ok_ || data_.size() - pos_ < size) {
+      ok_ = false;
+    }
+    return ok_;
+  }
+  const char* Advance(size_t size) {
+    const char* result = data_.data() + pos_;
+    pos_ += size;
+    return result;
+  }
+
+  absl::string_view data_;
+  size_t pos_ = 0;
+  bool ok_ = true;
+};
+
+// Collects the instruction payload strings of a table into a single blob,
+// storing each distinct string only once.
+class BlobBuilder {
+ public:
+  // Returns the offset of data in the blob.
+  uint64_t Add(absl::string_view data) {
+    if (data.empty()) {
+      return 0;
+    }
+    // Interned strings with the same contents share their storage, so
+    // deduplicating by pointer is sufficient.
+    auto inserted = offsets_.emplace(data.data(), blob_.size());
+    if (inserted.second) {
+      blob_.append(data.data(), data.size());
+    }
+    return inserted.first->second;
+  }
+
+  const std::string& blob() const { return blob_; }
+
+ private:
+  absl::flat_hash_map<const char*, uint64_t> offsets_;
+  std::string blob_;
+};
+
+void WriteColumn(const MatchChainColumn& column, BlobBuilder* blob,
+                 CacheWriter* writer) {
+  writer->PutString(column.filename());
+  writer->PutString(column.sha256());
+  writer->PutString(column.diff_directory());
+
+  // Number records in address order, children are stored as record indices.
+  absl::flat_hash_map<const MatchedBasicBlock*, uint32_t> bb_indices;
+  for (const auto& entry : column.basic_blocks_by_address()) {
+    bb_indices.emplace(entry.second, bb_indices.size());
+  }
+  absl::flat_hash_map<const MatchedInstruction*, uint32_t> instr_indices;
+  for (const auto& entry : column.instructions_by_address()) {
+    instr_indices.emplace(entry.second, instr_indices.size());
+  }
+
+  const auto& functions = column.functions_by_address();
+  writer->PutU32(functions.size());
+  for (const auto& entry : functions) {
+    const MatchedFunction& function = *entry.second;
+    writer->PutU64(function.match.address);
+    writer->PutU64(function.match.address_in_next);
+    writer->PutU32(function.match.id);
+    writer->PutU32(function.type);
+    writer->PutU64(function.function_hash);
+    writer->PutU32(function.basic_blocks.size());
+    for (const auto* bb : function.basic_blocks) {
+      writer->PutU32(bb_indices[bb]);
+    }
+  }
+
+  const auto& basic_blocks = column.basic_blocks_by_address();
+  writer->PutU32(basic_blocks.size());
+  for (const auto& entry : basic_blocks) {
+    const MatchedBasicBlock& bb = *entry.second;
+    writer->PutU64(bb.match.address);
+    writer->PutU64(bb.match.address_in_next);
+    writer->PutU32(bb.match.id);
+    writer->PutU32(bb.weight);
+    writer->PutU32(bb.instructions.size());
+    for (const auto* instr : bb.instructions) {
+      writer->PutU32(instr_indices[instr]);
+    }
+  }
+
+  const auto& instructions = column.instructions_by_address();
+  writer->PutU32(instructions.size());
+  for (const auto& entry : instructions) {
+    const MatchedInstruction& instr = *entry.second;
+    writer->PutU64(instr.match.address);
+    writer->PutU64(instr.match.address_in_next);
+    writer->PutU64(blob->Add(instr.raw_instruction_bytes));
+    writer->PutU32(instr.raw_instruction_bytes.size());
+    writer->PutU64(blob->Add(instr.disassembly));
+    writer->PutU32(instr.disassembly.size());
+    // The mask depends on the architecture of the original file, so store it
+    // instead of recomputing it from the immediates.
+    writer->PutU64(instr.immediate_mask);
+    writer->PutU32(instr.immediates.size());
+    for (const auto& immediate : instr.immediates) {
+      writer->PutU64(immediate.first);
+      writer->PutU8(immediate.second);
+    }
+  }
+}
+
+// Reads a column section. Payload offsets are resolved against blob, which is
+// only available after all columns have been read. Instructions are returned
+// along with their payload offsets for this reason.
+struct PendingPayload {
+  MatchedInstruction* instr;
+  uint64_t bytes_offset;
+  uint32_t bytes_size;
+  uint64_t disassembly_offset;
+  uint32_t disassembly_size;
+};
+
+absl::Status ReadColumn(CacheReader* reader, MatchChainColumn* column,
+                        std::vector<PendingPayload>* payloads) {
+  column->set_filename(reader->GetString());
+  column->set_sha256(reader->GetString());
+  column->set_diff_directory(reader->GetString());
+
+  // Functions reference basic blocks by index, which are only read later.
+  struct FunctionRecord {
+    MatchedFunction* function;
+    std::vector<uint32_t> children;
+  };
+  std::vector<FunctionRecord> function_records(
+      reader->GetCount(kMinFunctionSize));
+  for (auto& record : function_records) {
+    const MemoryAddress address = reader->GetU64();
+    const MemoryAddress address_in_next = reader->GetU64();
+    record.function = column->InsertFunctionMatch({address, address_in_next});
+    if (!record.function) {
+      return absl::DataLossError("Filtered function in cache");
+    }
+    record.function->match.id = reader->GetU32();
+    record.function->type =
+        static_cast<BinExport2::CallGraph::Vertex::Type>(reader->GetU32());
+    record.function->function_hash = reader->GetU64();
+    record.children.resize(reader->GetCount(sizeof(uint32_t)));
+    for (auto& child : record.children) {
+      child = reader->GetU32();
+    }
+    if (!reader->ok()) {
+      return absl::DataLossError("Truncated function records");
+    }
+  }
+
+  // Basic blocks do not exist on their own, so insert them into their first
+  // parent function right away.
+  struct BasicBlockRecord {
+    MemoryAddressPair match;
+    Ident id;
+    int weight;
+    std::vector<uint32_t> children;
+  };
+  std::vector<BasicBlockRecord> bb_records(
+      reader->GetCount(kMinBasicBlockSize));
+  for (auto& record : bb_records) {
+    record.match.first = reader->GetU64();
+    record.match.second = reader->GetU64();
+    record.id = reader->GetU32();
+    record.weight = static_cast<int32_t>(reader->GetU32());
+    record.children.resize(reader->GetCount(sizeof(uint32_t)));
+    for (auto& child : record.children) {
+      child = reader->GetU32();
+    }
+    if (!reader->ok()) {
+      return absl::DataLossError("Truncated basic block records");
+    }
+  }
+  std::vector<MatchedBasicBlock*> basic_blocks(bb_records.size());
+  for (const auto& function_record : function_records) {
+    for (const uint32_t child : function_record.children) {
+      if (child >= bb_records.size()) {
+        return absl::DataLossError("Invalid basic block index");
+      }
+      const auto& record = bb_records[child];
+      auto* bb =
+          column->InsertBasicBlockMatch(function_record.function, record.match);
+      bb->match.id = record.id;
+      bb->weight = record.weight;
+      basic_blocks[child] = bb;
+    }
+  }
+
+  const uint32_t num_instructions = reader->GetCount(kMinInstructionSize);
+  std::vector<MemoryAddressPair> instr_matches(num_instructions);
+  std::vector<Immediates> instr_immediates(num_instructions);
+  std::vector<uint64_t> instr_masks(num_instructions);
+  const size_t first_payload = payloads->size();
+  for (uint32_t i = 0; i < num_instructions; ++i) {
+    instr_matches[i].first = reader->GetU64();
+    instr_matches[i].second = reader->GetU64();
+    PendingPayload payload;
+    payload.instr = nullptr;
+    payload.bytes_offset = reader->GetU64();
+    payload.bytes_size = reader->GetU32();
+    payload.disassembly_offset = reader->GetU64();
+    payload.disassembly_size = reader->GetU32();
+    payloads->push_back(payload);
+    instr_masks[i] = reader->GetU64();
+    instr_immediates[i].resize(reader->GetCount(kImmediateSize));
+    for (auto& immediate : instr_immediates[i]) {
+      immediate.first = reader->GetU64();
+      immediate.second = static_cast<ImmediateSize>(reader->GetU8());
+    }
+    if (!reader->ok()) {
+      return absl::DataLossError("Truncated instruction records");
+    }
+  }
+  for (size_t bb_index = 0; bb_index < bb_records.size(); ++bb_index) {
+    auto* bb = basic_blocks[bb_index];
+    if (!bb) {
+      return absl::DataLossError("Basic block without function");
+    }
+    for (const uint32_t child : bb_records[bb_index].children) {
+      if (child >= num_instructions) {
+        return absl::DataLossError("Invalid instruction index");
+      }
+      auto& payload = (*payloads)[first_payload + child];
+      payload.instr = column->InsertInstructionMatch(bb, instr_matches[child]);
+      payload.instr->immediates = instr_immediates[child];
+      payload.instr->immediate_mask = instr_masks[child];
+    }
+  }
+  return absl::OkStatus();
+}
+
+}  // namespace
+
+absl::Status GetFileStamp(const std::string& filename, FileStamp* stamp) {
+  struct stat file_stat;
+  if (stat(filename.c_str(), &file_stat) != 0) {
+    return absl::NotFoundError(absl::StrCat("cannot stat ", filename));
+  }
+  stamp->size = file_stat.st_size;
+  stamp->mtime = file_stat.st_mtime;
+  return absl::OkStatus();
+}
+
+absl::Status WriteMatchChainCache(absl::string_view filename,
+                                  absl::string_view key,
+                                  absl::Span<const std::string> dependencies,
+                                  const MatchChainTable& table) {
+  CacheWriter writer;
+  writer.PutString(kCacheMagic);
+  writer.PutString(key);
+  writer.PutU32(dependencies.size());
+  for (const auto& dependency : dependencies) {
+    FileStamp stamp;
+    NA_RETURN_IF_ERROR(GetFileStamp(dependency, &stamp));
+    writer.PutString(dependency);
+    writer.PutU64(stamp.size);
+    writer.PutU64(stamp.mtime);
+  }
+
+  BlobBuilder blob;
+  writer.PutU32(table.size());
+  for (const auto& column : table) {
+    WriteColumn(*column, &blob, &writer);
+  }
+  writer.PutU64(blob.blob().size());
+
+  return WriteFileAtomically(filename, {writer.buffer(), blob.blob()});
+}
+
+absl::Status ReadMatchChainCache(absl::string_view filename,
+                                 absl::string_view key,
+                                 InternPool* intern_pool,
+                                 MatchChainTable* table) {
+  NA_ASSIGN_OR_RETURN(auto file, MappedFile::Open(filename));
+  CacheReader reader(file->data());
+  if (reader.GetString() != kCacheMagic) {
+    return absl::FailedPreconditionError(
+        absl::StrCat("not a match chain cache: ", filename));
+  }
+  if (reader.GetString() != key) {
+    return absl::FailedPreconditionError("cache key mismatch");
+  }
+  for (uint32_t num_dependencies = reader.GetCount(kMinDependencySize);
+       num_dependencies > 0; --num_dependencies) {
+    const std::string dependency(reader.GetString());
+    FileStamp expected;
+    expected.size = reader.GetU64();
+    expected.mtime = reader.GetU64();
+    FileStamp actual;
+    if (!reader.ok() || !GetFileStamp(dependency, &actual).ok() ||
+        actual.size != expected.size || actual.mtime != expected.mtime) {
+      return absl::FailedPreconditionError(
+          absl::StrCat("cache dependency changed: ", dependency));
+    }
+  }
+
+  MatchChainTable new_table;
+  std::vector<PendingPayload> payloads;
+  new_table.resize(reader.GetCount(kMinColumnSize));
+  for (auto& column : new_table) {
+    column = absl::make_unique<MatchChainColumn>();
+    column->set_intern_pool(intern_pool);
+    NA_RETURN_IF_ERROR(ReadColumn(&reader, column.get(), &payloads));
+  }
+  const absl::string_view blob = reader.GetBytes(reader.GetU64());
+  if (!reader.ok()) {
+    return absl::DataLossError(absl::StrCat("truncated cache: ", filename));
+  }
+  for (const auto& payload : payloads) {
+    if (!payload.instr) {
+      return absl::DataLossError("Instruction without basic block");
+    }
+    if (payload.bytes_offset > blob.size() ||
+        payload.bytes_size > blob.size() - payload.bytes_offset ||
+        payload.disassembly_offset > blob.size() ||
+        payload.disassembly_size > blob.size() - payload.disassembly_offset) {
+      return absl::DataLossError("Invalid payload offset");
+    }
+    payload.instr->raw_instruction_bytes = intern_pool->Intern(
+        blob.substr(payload.bytes_offset, payload.bytes_size));
+    payload.instr->disassembly = intern_pool->Intern(
+        blob.substr(payload.disassembly_offset, payload.disassembly_size));
+  }
+  for (auto& column : new_table) {
+    column->Compact();
+  }
+  *table = std::move(new_table);
+  return absl::OkStatus();
+}
+
+}  // namespace security::vxsig
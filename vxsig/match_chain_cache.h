@@ -0,0 +1,77 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// An on-disk cache for fully loaded match chain tables. Loading a table from
+// the BinDiff and BinExport files it was built from is expensive, while
+// generating signatures with different trimming settings only needs the
+// loaded table.
+//
+// Cache files store one section per table column. Each section consists of
+// arrays of fixed-size little-endian records for the functions, basic blocks
+// and instructions of the column. Children are referenced by their record
+// index. Instruction bytes and disassembly are deduplicated into a single
+// blob at the end of the file.
+
+#ifndef VXSIG_MATCH_CHAIN_CACHE_H_
+#define VXSIG_MATCH_CHAIN_CACHE_H_
+
+#include <cstdint>
+#include <string>
+
+#include "absl/status/status.h"
+#include "absl/strings/string_view.h"
+#include "absl/types/span.h"
+#include "vxsig/intern_pool.h"
+#include "vxsig/match_chain_table.h"
+
+namespace security::vxsig {
+
+// Size and modification time of a file, used to detect whether a cached
+// result is stale.
+struct FileStamp {
+  uint64_t size = 0;
+  int64_t mtime = 0;
+
+  bool operator==(const FileStamp& other) const {
+    return size == other.size && mtime == other.mtime;
+  }
+  bool operator!=(const FileStamp& other) const { return !(*this == other); }
+};
+
+// Retrieves the stamp of the specified file. Returns a NotFound error if the
+// file cannot be accessed.
+absl::Status GetFileStamp(const std::string& filename, FileStamp* stamp);
+
+// Writes the specified table to a cache file. The key identifies the inputs
+// and the options that were used to load the table. The cache stays valid for
+// as long as none of the dependencies change their size or modification time.
+absl::Status WriteMatchChainCache(absl::string_view filename,
+                                  absl::string_view key,
+                                  absl::Span<const std::string> dependencies,
+                                  const MatchChainTable& table);
+
+// Reads a table from a cache file written by WriteMatchChainCache(), replacing
+// the contents of table. Instruction bytes and disassembly are stored in
+// intern_pool, which needs to outlive the table. Returns a NotFound error if
+// the cache file does not exist and a FailedPrecondition error if the cache is
+// stale, i.e. the key does not match or one of the dependencies changed.
+absl::Status ReadMatchChainCache(absl::string_view filename,
+                                 absl::string_view key,
+                                 InternPool* intern_pool,
+                                 MatchChainTable* table);
+
+}  // namespace security::vxsig
+
+#endif  // VXSIG_MATCH_CHAIN_CACHE_H_
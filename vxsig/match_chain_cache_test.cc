@@ -0,0 +1,161 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "vxsig/match_chain_cache.h"
+
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "absl/memory/memory.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "third_party/zynamics/binexport/util/filesystem.h"
+#include "third_party/zynamics/binexport/util/status_matchers.h"
+
+using not_absl::IsOk;
+using testing::Eq;
+using testing::NotNull;
+using testing::SizeIs;
+
+namespace security::vxsig {
+namespace {
+
+class MatchChainCacheTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    cache_file_ = JoinPath(getenv("TEST_TMPDIR"), "match_chain_cache_test");
+    dependency_ = JoinPath(getenv("TEST_TMPDIR"), "match_chain_cache_dep");
+    std::ofstream(dependency_) << "input";
+
+    // Two columns with a basic block that is shared by two functions.
+    for (int i = 0; i < 2; ++i) {
+      table_.emplace_back(absl::make_unique<MatchChainColumn>());
+    }
+    auto* column = table_[0].get();
+    column->set_filename("first");
+    column->set_sha256("0123");
+    column->set_diff_directory("/tmp");
+    auto* func = column->InsertFunctionMatch({0x1000, 0x5000});
+    func->type = BinExport2::CallGraph::Vertex::LIBRARY;
+    func->function_hash = 0x0123456789abcdef;
+    auto* bb = column->InsertBasicBlockMatch(func, {0x1000, 0x5000});
+    bb->weight = 42;
+    auto* instr = column->InsertInstructionMatch(bb, {0x1000, 0x5000});
+    instr->raw_instruction_bytes =
+        column->intern_pool()->Intern(absl::string_view("\x68\0\0\0", 4));
+    instr->disassembly = column->intern_pool()->Intern("push 0x0");
+    instr->immediates.emplace_back(0, kDWord);
+    // Not what ImmediateMask() computes, masks are stored as they are.
+    instr->immediate_mask = 0b1110;
+    auto* shared_bb = column->InsertBasicBlockMatch(func, {0x1100, 0x5100});
+    column->InsertInstructionMatch(shared_bb, {0x1100, 0x5100})
+        ->raw_instruction_bytes = column->intern_pool()->Intern("\xc3");
+    func = column->InsertFunctionMatch({0x2000, 0x6000});
+    column->InsertBasicBlockMatch(func, {0x1100, 0x5100});
+    table_[1]->set_filename("second");
+    table_[1]->FinishChain(column);
+  }
+
+  std::string cache_file_;
+  std::string dependency_;
+  MatchChainTable table_;
+};
+
+TEST_F(MatchChainCacheTest, RoundTrip) {
+  ASSERT_THAT(WriteMatchChainCache(cache_file_, "key", {dependency_}, table_),
+              IsOk());
+
+  InternPool pool;
+  MatchChainTable table;
+  ASSERT_THAT(ReadMatchChainCache(cache_file_, "key", &pool, &table), IsOk());
+  ASSERT_THAT(table, SizeIs(2));
+
+  auto* column = table[0].get();
+  EXPECT_THAT(column->filename(), Eq("first"));
+  EXPECT_THAT(column->sha256(), Eq("0123"));
+  EXPECT_THAT(column->diff_directory(), Eq("/tmp"));
+  EXPECT_THAT(column->functions_by_address(), SizeIs(2));
+  EXPECT_THAT(column->basic_blocks_by_address(), SizeIs(2));
+
+  auto* func = column->FindFunctionByAddress(0x1000);
+  ASSERT_THAT(func, NotNull());
+  EXPECT_THAT(func->match.address_in_next, Eq(0x5000));
+  EXPECT_THAT(func->type, Eq(BinExport2::CallGraph::Vertex::LIBRARY));
+  EXPECT_THAT(func->function_hash, Eq(0x0123456789abcdef));
+  ASSERT_THAT(func->basic_blocks, SizeIs(2));
+  EXPECT_THAT((*func->basic_blocks.begin())->weight, Eq(42));
+
+  auto* shared_bb = column->FindBasicBlockByAddress(0x1100);
+  ASSERT_THAT(shared_bb, NotNull());
+  EXPECT_THAT(*column->FindFunctionByAddress(0x2000)->basic_blocks.begin(),
+              Eq(shared_bb));
+
+  auto* instr = column->FindInstructionByAddress(0x1000);
+  ASSERT_THAT(instr, NotNull());
+  EXPECT_THAT(instr->raw_instruction_bytes,
+              Eq(absl::string_view("\x68\0\0\0", 4)));
+  EXPECT_THAT(instr->disassembly, Eq("push 0x0"));
+  ASSERT_THAT(instr->immediates, SizeIs(1));
+  EXPECT_THAT(instr->immediates[0].second, Eq(kDWord));
+  EXPECT_THAT(instr->immediate_mask, Eq(0b1110));
+  EXPECT_THAT(column->FindInstructionByAddress(0x1100)->raw_instruction_bytes,
+              Eq("\xc3"));
+
+  column = table[1].get();
+  EXPECT_THAT(column->filename(), Eq("second"));
+  EXPECT_THAT(column->functions_by_address(), SizeIs(2));
+  EXPECT_THAT(column->FindInstructionByAddress(0x5100), NotNull());
+}
+
+TEST_F(MatchChainCacheTest, StaleCache) {
+  InternPool pool;
+  MatchChainTable table;
+  std::remove(cache_file_.c_str());
+  EXPECT_THAT(ReadMatchChainCache(cache_file_, "key", &pool, &table).code(),
+              Eq(absl::StatusCode::kNotFound));
+
+  ASSERT_THAT(WriteMatchChainCache(cache_file_, "key", {dependency_}, table_),
+              IsOk());
+  EXPECT_THAT(ReadMatchChainCache(cache_file_, "other", &pool, &table).code(),
+              Eq(absl::StatusCode::kFailedPrecondition));
+
+  std::ofstream(dependency_, std::ios_base::app) << "changed";
+  EXPECT_THAT(ReadMatchChainCache(cache_file_, "key", &pool, &table).code(),
+              Eq(absl::StatusCode::kFailedPrecondition));
+  EXPECT_THAT(table, SizeIs(0));
+}
+
+TEST_F(MatchChainCacheTest, TruncatedCache) {
+  ASSERT_THAT(WriteMatchChainCache(cache_file_, "key", {dependency_}, table_),
+              IsOk());
+  std::string contents;
+  {
+    std::ifstream file(cache_file_, std::ios_base::binary);
+    contents.assign(std::istreambuf_iterator<char>(file),
+                    std::istreambuf_iterator<char>());
+  }
+  std::ofstream(cache_file_, std::ios_base::binary | std::ios_base::trunc)
+      << contents.substr(0, contents.size() - 3);
+
+  InternPool pool;
+  MatchChainTable table;
+  EXPECT_THAT(ReadMatchChainCache(cache_file_, "key", &pool, &table).code(),
+              Eq(absl::StatusCode::kDataLoss));
+}
+
+}  // namespace
+}  // namespace security::vxsig
@@ -14,7 +14,10 @@
 
 #include "vxsig/match_chain_table.h"
 
+#include <algorithm>
+#include <atomic>
 #include <memory>
+#include <type_traits>
 #include <utility>
 #include <vector>
 
@@ -55,12 +58,7 @@ MatchedFunction* MatchChainColumn::InsertFunctionMatch(
 
   // Insert into index, id mappings will be propagated later by calling
   // PropagateIds().
-  auto function = functions_by_address_.find(match.first);
-  if (function == functions_by_address_.end()) {
-    function = functions_by_address_.emplace_hint(
-        function, match.first, absl::make_unique<MatchedFunction>(match));
-  }
-  return function->second.get();
+  return functions_by_address_.FindOrInsert(match);
 }
 
 MatchedBasicBlock* MatchChainColumn::InsertBasicBlockMatch(
@@ -74,16 +72,12 @@ MatchedBasicBlock* MatchChainColumn::InsertBasicBlockMatch(
   //       blocks.
   // Insert into index, id mappings will be propagated later by calling
   // PropagateIds().
-  auto basic_block = basic_blocks_by_address_.find(match.first);
-  if (basic_block == basic_blocks_by_address_.end()) {
-    basic_block = basic_blocks_by_address_.emplace_hint(
-        basic_block, match.first, absl::make_unique<MatchedBasicBlock>(match));
-  }
+  auto* basic_block = basic_blocks_by_address_.FindOrInsert(match);
 
   // Add basic block to function
-  function->basic_blocks.insert(basic_block->second.get());
+  function->basic_blocks.insert(basic_block);
 
-  return basic_block->second.get();
+  return basic_block;
 }
 
 MatchedInstruction* MatchChainColumn::InsertInstructionMatch(
@@ -109,48 +103,35 @@ MatchedInstruction* MatchChainColumn::InsertInstructionMatch(
   //       Those can legitimately be rewritten to jump to a shared block of
   //       code. Thus, the instructions of the second call to memset are part
   //       of both functions.
-  auto instruction = instructions_by_address_.find(match.first);
-  if (instruction == instructions_by_address_.end()) {
-    instruction = instructions_by_address_.emplace_hint(
-        instruction, match.first, absl::make_unique<MatchedInstruction>(match));
-  }
+  auto* instruction = instructions_by_address_.FindOrInsert(match);
 
   // Add instruction to basic block
-  basic_block->instructions.insert(instruction->second.get());
+  basic_block->instructions.insert(instruction);
 
-  return instruction->second.get();
-}
-
-template <typename IndexT>
-typename IndexT::value_type::second_type::pointer FindByAddress(
-    IndexT* index, MemoryAddress address) {
-  auto found = index->find(address);
-  return found != index->end() ? found->second.get() : nullptr;
+  return instruction;
 }
 
 MatchedFunction* MatchChainColumn::FindFunctionByAddress(
     MemoryAddress address) {
-  return FindByAddress(&functions_by_address_, address);
+  return functions_by_address_.Find(address);
 }
 
 MatchedBasicBlock* MatchChainColumn::FindBasicBlockByAddress(
     MemoryAddress address) {
-  return FindByAddress(&basic_blocks_by_address_, address);
+  return basic_blocks_by_address_.Find(address);
 }
 
 MatchedInstruction* MatchChainColumn::FindInstructionByAddress(
     MemoryAddress address) {
-  return FindByAddress(&instructions_by_address_, address);
+  return instructions_by_address_.Find(address);
 }
 
 MatchedFunction* MatchChainColumn::FindFunctionById(Ident id) {
-  auto it = functions_by_id_.find(id);
-  return it == functions_by_id_.end() ? nullptr : it->second;
+  return functions_by_id_.Find(id);
 }
 
 MatchedBasicBlock* MatchChainColumn::FindBasicBlockById(Ident id) {
-  auto it = basic_blocks_by_id_.find(id);
-  return it == basic_blocks_by_id_.end() ? nullptr : it->second;
+  return basic_blocks_by_id_.Find(id);
 }
 
 class MatchChainInserter {
@@ -187,7 +168,17 @@ void MatchChainInserter::AddInstructionMatch(const MemoryAddressPair& match) {
   }
 }
 
-void MatchChainColumn::FinishChain(MatchChainColumn* prev) {
+InternPool* MatchChainColumn::intern_pool() {
+  if (intern_pool_) {
+    return intern_pool_;
+  }
+  if (!owned_intern_pool_) {
+    owned_intern_pool_ = std::make_shared<InternPool>();
+  }
+  return owned_intern_pool_.get();
+}
+
+void MatchChainColumn::FinishChain(const MatchChainColumn* prev) {
   auto& functions = prev->functions_by_address_;
   for (const auto& function_match : functions) {
     CHECK(function_match.second);
@@ -213,30 +204,134 @@ void MatchChainColumn::FinishChain(MatchChainColumn* prev) {
   }
 }
 
-template<typename AddressIndexT, typename IdentIndexT>
-void BuildIdIndexFromAddressIndex(const AddressIndexT& address_index,
-                                  IdentIndexT* id_index) {
-  for (const auto& match : address_index) {
-    id_index->emplace(match.second->match.id, match.second.get());
+std::unique_ptr<MatchChainColumn> MatchChainColumn::Clone() const {
+  return CloneImpl(/*bb_ids=*/nullptr);
+}
+
+std::unique_ptr<MatchChainColumn> MatchChainColumn::CloneBasicBlocks(
+    const absl::flat_hash_set<Ident>& bb_ids) const {
+  auto clone = CloneImpl(&bb_ids);
+  clone->BuildIdIndices();
+  return clone;
+}
+
+std::unique_ptr<MatchChainColumn> MatchChainColumn::CloneImpl(
+    const absl::flat_hash_set<Ident>* bb_ids) const {
+  auto clone = absl::make_unique<MatchChainColumn>();
+  clone->filename_ = filename_;
+  clone->sha256_ = sha256_;
+  clone->diff_directory_ = diff_directory_;
+  clone->intern_pool_ = intern_pool_;
+  clone->owned_intern_pool_ = owned_intern_pool_;
+
+  // Shared basic blocks and instructions are inserted multiple times, which
+  // just adds them to the respective parent again.
+  for (const auto& function_match : functions_by_address_) {
+    const MatchedFunction& func = *function_match.second;
+    if (bb_ids && std::none_of(func.basic_blocks.begin(),
+                               func.basic_blocks.end(),
+                               [bb_ids](const MatchedBasicBlock* bb) {
+                                 return bb_ids->contains(bb->match.id);
+                               })) {
+      continue;
+    }
+    auto* new_function = clone->InsertFunctionMatch(
+        {func.match.address, func.match.address_in_next});
+    new_function->match.id = func.match.id;
+    new_function->type = func.type;
+    new_function->function_hash = func.function_hash;
+    for (const auto* bb : func.basic_blocks) {
+      if (bb_ids && !bb_ids->contains(bb->match.id)) {
+        continue;
+      }
+      auto* new_basic_block = clone->InsertBasicBlockMatch(
+          new_function, {bb->match.address, bb->match.address_in_next});
+      new_basic_block->match.id = bb->match.id;
+      new_basic_block->weight = bb->weight;
+      for (const auto* instr : bb->instructions) {
+        auto* new_instruction =
+            clone->InsertInstructionMatch(new_basic_block,
+                                          {instr->match.address,
+                                           instr->match.address_in_next});
+        new_instruction->raw_instruction_bytes = instr->raw_instruction_bytes;
+        new_instruction->disassembly = instr->disassembly;
+        new_instruction->immediates = instr->immediates;
+        new_instruction->immediate_mask = instr->immediate_mask;
+      }
+    }
   }
+  clone->function_filter_ = function_filter_;
+  clone->filtered_functions_ = filtered_functions_;
+  clone->Compact();
+  return clone;
+}
+
+void MatchChainColumn::Compact() {
+  functions_by_address_.Compact();
+  basic_blocks_by_address_.Compact();
+  instructions_by_address_.Compact();
+
+  // Fill new pools first, as the children might still reference the current
+  // ones.
+  size_t num_basic_blocks = 0;
+  for (const auto& function : functions_by_address_) {
+    num_basic_blocks += function.second->basic_blocks.size();
+  }
+  std::vector<MatchedBasicBlock*> basic_block_pool;
+  basic_block_pool.reserve(num_basic_blocks);
+  for (const auto& function : functions_by_address_) {
+    function.second->basic_blocks.MoveTo(&basic_block_pool);
+  }
+  basic_block_pool_.swap(basic_block_pool);
+
+  size_t num_instructions = 0;
+  for (const auto& basic_block : basic_blocks_by_address_) {
+    num_instructions += basic_block.second->instructions.size();
+  }
+  std::vector<MatchedInstruction*> instruction_pool;
+  instruction_pool.reserve(num_instructions);
+  for (const auto& basic_block : basic_blocks_by_address_) {
+    basic_block.second->instructions.MoveTo(&instruction_pool);
+  }
+  instruction_pool_.swap(instruction_pool);
 }
 
 void MatchChainColumn::BuildIdIndices() {
-  BuildIdIndexFromAddressIndex(functions_by_address_, &functions_by_id_);
-  BuildIdIndexFromAddressIndex(basic_blocks_by_address_, &basic_blocks_by_id_);
+  functions_by_id_.Build(functions_by_address_);
+  basic_blocks_by_id_.Build(basic_blocks_by_address_);
 }
 
-absl::Status AddDiffResult(
-    absl::string_view filename, bool last, MatchChainColumn* column,
-    MatchChainColumn* next,
-    std::vector<std::pair<std::string, std::string>>* diffs) {
+absl::Status AddDiffResult(absl::string_view filename, BinDiffReader* reader,
+                           MatchChainColumn* column,
+                           std::pair<std::string, std::string>* diff) {
   namespace arg = ::std::placeholders;
 
   MatchChainInserter match_inserter(column);
   std::pair<FileMetaData, FileMetaData> metadata;
 
+  // Let the reader skip filtered functions. InsertFunctionMatch() still checks
+  // the filter, so this is purely an optimization.
+  BinDiffFunctionFilter filter;
+  switch (column->function_filter()) {
+    case SignatureDefinition::FILTER_WHITELIST:
+      filter.mode = BinDiffFunctionFilter::kWhitelist;
+      break;
+    case SignatureDefinition::FILTER_BLACKLIST:
+      filter.mode = BinDiffFunctionFilter::kBlacklist;
+      break;
+    default:
+      break;
+  }
+  filter.addresses.assign(column->filtered_functions().begin(),
+                          column->filtered_functions().end());
+
+  std::unique_ptr<BinDiffReader> owned_reader;
+  if (!reader) {
+    NA_ASSIGN_OR_RETURN(owned_reader, BinDiffReader::Create());
+    reader = owned_reader.get();
+  }
   NA_RETURN_IF_ERROR(
-      ParseBinDiff(filename,
+      reader->Read(filename, filter,
                    std::bind(&MatchChainInserter::AddFunctionMatch,
                              &match_inserter, arg::_1),
                    std::bind(&MatchChainInserter::AddBasicBlockMatch,
@@ -245,20 +340,15 @@ absl::Status AddDiffResult(
                              &match_inserter, arg::_1),
                    &metadata));
 
-  const std::string diff_directory = Dirname(filename);
   column->set_filename(metadata.first.filename);
-  column->set_diff_directory(diff_directory);
-  if (last) {
-    next->set_filename(metadata.second.filename);
-    next->set_diff_directory(diff_directory);
-    next->FinishChain(column);
-  }
-  diffs->emplace_back(metadata.first.filename, metadata.second.filename);
+  column->set_diff_directory(Dirname(filename));
+  *diff = {metadata.first.filename, metadata.second.filename};
   return absl::OkStatus();
 }
 
 absl::Status AddFunctionData(absl::string_view filename,
-                                 MatchChainColumn* column) {
+                             MatchChainColumn* column, bool load_disassembly,
+                             bool load_function_hashes) {
   auto metadata_callback(
       [column](const std::string& sha256, MemoryAddress address,
                BinExport2::CallGraph::Vertex::Type type, double /*md_index*/) {
@@ -279,11 +369,16 @@ absl::Status AddFunctionData(absl::string_view filename,
         }
       });
 
-  auto basic_block_callback([column](MemoryAddress bb_address,
-                                     MemoryAddress instr_address,
-                                     const std::string& instr_bytes,
-                                     const std::string& disassembly,
-                                     const Immediates& immediates) {
+  // Updated from the file's meta information before the first instruction.
+  const InstructionMaskingTable* masking =
+      &InstructionMaskingTable::ForArchitecture("");
+  auto* intern_pool = column->intern_pool();
+  auto basic_block_callback([column, intern_pool, load_disassembly, &masking](
+                                MemoryAddress bb_address,
+                                MemoryAddress instr_address,
+                                const std::string& instr_bytes,
+                                const std::string& disassembly,
+                                const Immediates& immediates) {
     // Note: We used to check whether the instruction's parent basic block was
     // present in this column. However, loading all instruction bytes makes the
     // logic a bit simpler and also gracefully handles instructions that are
@@ -295,9 +390,13 @@ absl::Status AddFunctionData(absl::string_view filename,
     }
 
     if (instr->raw_instruction_bytes.empty()) {
-      instr->raw_instruction_bytes = instr_bytes;
-      instr->disassembly = disassembly;
+      instr->raw_instruction_bytes = intern_pool->Intern(instr_bytes);
+      if (load_disassembly) {
+        instr->disassembly = intern_pool->Intern(disassembly);
+      }
       instr->immediates = immediates;
+      instr->immediate_mask =
+          masking->Mask(instr->raw_instruction_bytes, immediates);
     } else {
       // Make sure that if the instruction is added multiple times, the
       // instruction bytes stay the same.
@@ -308,55 +407,310 @@ absl::Status AddFunctionData(absl::string_view filename,
     }
   });
 
-  return ParseBinExport(filename, metadata_callback, basic_block_callback);
+  // Most instructions in a BinExport file are not part of any match, so skip
+  // decoding them altogether.
+  BinExportReaderOptions options;
+  options.wanted_instruction = [column](MemoryAddress instr_address) {
+    return column->FindInstructionByAddress(instr_address) != nullptr;
+  };
+  options.render_disassembly = load_disassembly;
+  options.architecture_receiver = [&masking](absl::string_view architecture) {
+    masking = &InstructionMaskingTable::ForArchitecture(architecture);
+  };
+  if (load_function_hashes) {
+    options.function_hash_receiver = [column](MemoryAddress address,
+                                              uint64_t function_hash) {
+      if (auto* func = column->FindFunctionByAddress(address)) {
+        func->function_hash = function_hash;
+      }
+    };
+  }
+  return ParseBinExport(filename, metadata_callback, basic_block_callback,
+                        options);
 }
 
 template <typename IndexT>
 void PropagateIds(MatchChainTable* table,
-                  std::function<IndexT*(MatchChainColumn*)> index_from_column) {
-  auto* first_column_idx = index_from_column(table->begin()->get());
-  Ident chain_id = 1;  // Ids start at 1.
-  for (auto first_col_it = first_column_idx->begin();
-       first_col_it != first_column_idx->end(); ++first_col_it, ++chain_id) {
-    // Set ids of matches in the first column in ascending order of their
-    // memory addresses.
-    first_col_it->second->match.id = chain_id;
-
-    // Once a match has been assigned an id, the corresponding matches in the
-    // other columns have to be assigned the same id.
-
-    MemoryAddress match_address_in_next =
-        first_col_it->second->match.address_in_next;
-    for (auto column_it = table->begin() + 1; column_it != table->end();
-         ++column_it) {
-      auto* index = index_from_column(column_it->get());
-      auto found = index->find(match_address_in_next);
-      if (found == index->end()) {  // Match chain broken.
+                  std::function<IndexT*(MatchChainColumn*)> index_from_column,
+                  ThreadPool* pool, std::vector<int>* histogram) {
+  using MatchEntityT =
+      typename std::remove_pointer<typename IndexT::value_type::second_type>::
+          type;
+  const int num_columns = table->size();
+
+  // Number the matches of each column by ascending address and map their
+  // addresses to these slots.
+  std::vector<std::vector<MatchEntityT*>> matches(num_columns);
+  std::vector<absl::flat_hash_map<MemoryAddress, int32_t>> slots(num_columns);
+  ParallelFor(num_columns, pool, [&](int column) {
+    const auto& index = *index_from_column((*table)[column].get());
+    auto& column_matches = matches[column];
+    auto& column_slots = slots[column];
+    column_matches.reserve(index.size());
+    column_slots.reserve(index.size());
+    for (const auto& entry : index) {
+      column_slots.emplace(entry.first, column_matches.size());
+      column_matches.push_back(entry.second);
+    }
+  });
+
+  // Resolve the links to the next column into slot numbers, -1 where a chain
+  // breaks.
+  std::vector<std::vector<int32_t>> next_slots(num_columns);
+  ParallelFor(num_columns - 1, pool, [&](int column) {
+    const auto& next_column_slots = slots[column + 1];
+    auto& column_next_slots = next_slots[column];
+    column_next_slots.reserve(matches[column].size());
+    for (const auto* match : matches[column]) {
+      auto found = next_column_slots.find(match->match.address_in_next);
+      column_next_slots.push_back(
+          found != next_column_slots.end() ? found->second : -1);
+    }
+  });
+  slots.clear();
+
+  // Walk the chains from the first column. Matches in the first column are
+  // assigned ids in ascending order of their addresses. A match that is
+  // reached by multiple chains gets the largest of their ids, which is the
+  // same as walking them one after the other. Zero marks matches that no
+  // chain reaches.
+  std::vector<std::vector<std::atomic<Ident>>> ids;
+  ids.reserve(num_columns);
+  for (const auto& column_matches : matches) {
+    ids.emplace_back(column_matches.size());
+  }
+  const int num_chains = matches.front().size();
+  std::vector<int32_t> chain_lengths(num_chains);
+  ParallelFor(num_chains, pool, [&](int chain) {
+    const Ident chain_id = chain + 1;  // Ids start at 1.
+    int32_t slot = chain;
+    int column = 0;
+    while (true) {
+      auto& id = ids[column][slot];
+      Ident current = id.load(std::memory_order_relaxed);
+      while (current < chain_id &&
+             !id.compare_exchange_weak(current, chain_id,
+                                       std::memory_order_relaxed)) {
+      }
+      if (column + 1 == num_columns || next_slots[column][slot] < 0) {
         break;
       }
+      slot = next_slots[column][slot];
+      ++column;
+    }
+    chain_lengths[chain] = column + 1;
+  });
+
+  ParallelFor(num_columns, pool, [&](int column) {
+    for (int i = 0; i < matches[column].size(); ++i) {
+      const Ident id = ids[column][i].load(std::memory_order_relaxed);
+      if (id != 0) {
+        matches[column][i]->match.id = id;
+      }
+    }
+  });
 
-      // Continuous chain, set id on current item and follow.
-      found->second->match.id = chain_id;
-      match_address_in_next = found->second->match.address_in_next;
+  if (histogram) {
+    histogram->assign(num_columns, 0);
+    for (const int32_t length : chain_lengths) {
+      ++(*histogram)[length - 1];
     }
   }
 }
 
-void PropagateIds(MatchChainTable* table) {
+template <typename IndexT>
+void PropagateTreeIds(
+    MatchChainTable* table, const MatchChainTopology& topology,
+    std::function<IndexT*(MatchChainColumn*)> index_from_column,
+    ThreadPool* pool, std::vector<int>* histogram) {
+  using MatchEntityT =
+      typename std::remove_pointer<typename IndexT::value_type::second_type>::
+          type;
+  const int num_columns = table->size();
+
+  // Number the matches of each column, like for chains.
+  std::vector<std::vector<MatchEntityT*>> matches(num_columns);
+  std::vector<absl::flat_hash_map<MemoryAddress, int32_t>> slots(num_columns);
+  ParallelFor(num_columns, pool, [&](int column) {
+    const auto& index = *index_from_column((*table)[column].get());
+    auto& column_matches = matches[column];
+    auto& column_slots = slots[column];
+    column_matches.reserve(index.size());
+    column_slots.reserve(index.size());
+    for (const auto& entry : index) {
+      column_slots.emplace(entry.first, column_matches.size());
+      column_matches.push_back(entry.second);
+    }
+  });
+
+  // Columns of the same depth only read the ids of their parents, so each
+  // level of the tree is processed concurrently.
+  std::vector<std::vector<int>> levels(1, {0});
+  std::vector<int> depths(num_columns, 0);
+  for (int column = 1; column < num_columns; ++column) {
+    const int parent = topology.parents[column];
+    CHECK(parent >= 0 && parent < column) << "Invalid parent of " << column;
+    depths[column] = depths[parent] + 1;
+    if (depths[column] == levels.size()) {
+      levels.emplace_back();
+    }
+    levels[depths[column]].push_back(column);
+  }
+
+  // Matches in the root column are assigned ids in ascending order of their
+  // addresses. Like for chains, a match that is reached by more than one
+  // match of its parent gets the largest of their ids.
+  std::vector<std::vector<Ident>> ids(num_columns);
+  for (int column = 0; column < num_columns; ++column) {
+    ids[column].assign(matches[column].size(), 0);
+  }
+  for (int slot = 0; slot < ids[0].size(); ++slot) {
+    ids[0][slot] = slot + 1;  // Ids start at 1.
+  }
+  for (int level = 1; level < levels.size(); ++level) {
+    const auto& columns = levels[level];
+    ParallelFor(columns.size(), pool, [&](int i) {
+      const int column = columns[i];
+      const int parent = topology.parents[column];
+      const auto& column_slots = slots[column];
+      auto& column_ids = ids[column];
+      auto propagate = [&column_slots, &column_ids](Ident id,
+                                                    MemoryAddress address) {
+        if (id == 0) {
+          return;
+        }
+        auto found = column_slots.find(address);
+        if (found != column_slots.end()) {
+          column_ids[found->second] = std::max(column_ids[found->second], id);
+        }
+      };
+      auto* link = column < topology.links.size()
+                       ? topology.links[column].get()
+                       : nullptr;
+      if (!link) {
+        for (int slot = 0; slot < matches[parent].size(); ++slot) {
+          propagate(ids[parent][slot],
+                    matches[parent][slot]->match.address_in_next);
+        }
+        return;
+      }
+      const auto& parent_slots = slots[parent];
+      for (const auto& entry : *index_from_column(link)) {
+        auto found = parent_slots.find(entry.first);
+        if (found != parent_slots.end()) {
+          propagate(ids[parent][found->second],
+                    entry.second->match.address_in_next);
+        }
+      }
+    });
+  }
+
+  ParallelFor(num_columns, pool, [&](int column) {
+    for (int i = 0; i < matches[column].size(); ++i) {
+      if (ids[column][i] != 0) {
+        matches[column][i]->match.id = ids[column][i];
+      }
+    }
+  });
+
+  if (histogram) {
+    std::vector<int32_t> num_columns_reached(ids[0].size());
+    for (const auto& column_ids : ids) {
+      for (const Ident id : column_ids) {
+        if (id != 0) {
+          ++num_columns_reached[id - 1];
+        }
+      }
+    }
+    histogram->assign(num_columns, 0);
+    for (const int32_t reached : num_columns_reached) {
+      ++(*histogram)[reached - 1];
+    }
+  }
+}
+
+void PropagateIds(MatchChainTable* table, ThreadPool* pool,
+                  ChainLengthHistogram* histogram) {
+  CHECK(table);
+  if (table->empty()) {
+    return;
+  }
   PropagateIds(
       table,
       std::function<MatchChainColumn::FunctionAddressIndex*(MatchChainColumn*)>(
-          MatchChainColumn::GetFunctionIndexFromColumn));
+          MatchChainColumn::GetFunctionIndexFromColumn),
+      pool, histogram ? &histogram->functions : nullptr);
   PropagateIds(table, std::function<MatchChainColumn::BasicBlockAddressIndex*(
                           MatchChainColumn*)>(
-                          MatchChainColumn::GetBasicBlockIndexFromColumn));
+                          MatchChainColumn::GetBasicBlockIndexFromColumn),
+               pool, histogram ? &histogram->basic_blocks : nullptr);
 }
 
-void BuildIdIndices(MatchChainTable* table) {
+void PropagateIds(MatchChainTable* table) {
+  PropagateIds(table, /*pool=*/nullptr, /*histogram=*/nullptr);
+}
+
+void PropagateIds(MatchChainTable* table, const MatchChainTopology& topology,
+                  ThreadPool* pool, ChainLengthHistogram* histogram) {
   CHECK(table);
-  for (auto& column : *table) {
-    column->BuildIdIndices();
+  if (topology.parents.empty()) {
+    PropagateIds(table, pool, histogram);
+    return;
   }
+  CHECK_EQ(topology.parents.size(), table->size());
+  PropagateTreeIds(
+      table, topology,
+      std::function<MatchChainColumn::FunctionAddressIndex*(MatchChainColumn*)>(
+          MatchChainColumn::GetFunctionIndexFromColumn),
+      pool, histogram ? &histogram->functions : nullptr);
+  PropagateTreeIds(
+      table, topology,
+      std::function<MatchChainColumn::BasicBlockAddressIndex*(
+          MatchChainColumn*)>(MatchChainColumn::GetBasicBlockIndexFromColumn),
+      pool, histogram ? &histogram->basic_blocks : nullptr);
+}
+
+void ExtendIds(const MatchChainColumn& prev, MatchChainColumn* column,
+               MatchChainColumn* next) {
+  CHECK(column);
+  CHECK(next);
+  auto extend = [](const auto& prev_index, const auto& index,
+                   const auto& next_index) {
+    for (const auto& entry : index) {
+      auto& match = entry.second->match;
+      const auto* prev_match = prev_index.Find(entry.first);
+      match.id = prev_match ? prev_match->match.id : 0;
+      if (match.id == 0) {
+        continue;
+      }
+      if (auto* next_match = next_index.Find(match.address_in_next)) {
+        next_match->match.id = std::max(next_match->match.id, match.id);
+      }
+    }
+  };
+  extend(prev.functions_by_address(), column->functions_by_address(),
+         next->functions_by_address());
+  extend(prev.basic_blocks_by_address(), column->basic_blocks_by_address(),
+         next->basic_blocks_by_address());
+}
+
+void BuildIdIndices(MatchChainTable* table, ThreadPool* pool) {
+  CHECK(table);
+  ParallelFor(table->size(), pool,
+              [table](int i) { (*table)[i]->BuildIdIndices(); });
+}
+
+void BuildIdIndices(MatchChainTable* table) {
+  BuildIdIndices(table, /*pool=*/nullptr);
+}
+
+void PruneMatchChainTable(const IdentSequence& bb_ids, MatchChainTable* table,
+                          ThreadPool* pool) {
+  CHECK(table);
+  const absl::flat_hash_set<Ident> bb_id_set(bb_ids.begin(), bb_ids.end());
+  ParallelFor(table->size(), pool, [table, &bb_id_set](int i) {
+    (*table)[i] = (*table)[i]->CloneBasicBlocks(bb_id_set);
+  });
 }
 
 }  // namespace security::vxsig
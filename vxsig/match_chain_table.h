@@ -37,18 +37,26 @@
 #ifndef VXSIG_MATCH_CHAIN_TABLE_H_
 #define VXSIG_MATCH_CHAIN_TABLE_H_
 
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
 #include <functional>
-#include <map>
 #include <memory>
-#include <set>
 #include <string>
+#include <utility>
 #include <vector>
 
+#include "absl/container/flat_hash_map.h"
 #include "absl/container/flat_hash_set.h"
 #include "absl/strings/string_view.h"
 #include "third_party/zynamics/binexport/binexport2.pb.h"
 #include "absl/status/status.h"
 #include "vxsig/binexport_reader.h"
+#include "vxsig/diff_result_reader.h"
+#include "vxsig/instruction_masking.h"
+#include "vxsig/intern_pool.h"
+#include "vxsig/thread_pool.h"
 #include "vxsig/types.h"
 #include "vxsig/vxsig.pb.h"
 
@@ -70,11 +78,68 @@ struct MatchedMemoryAddress {
 // MatchedBasicBlock by their primary address.
 template <typename MatchEntityT>
 struct MatchCompare {
-  bool operator()(MatchEntityT* first, MatchEntityT* second) const {
+  bool operator()(const MatchEntityT* first,
+                  const MatchEntityT* second) const {
     return first->match.address < second->match.address;
   }
 };
 
+// A container for the child matches of a function or basic block, i.e. the
+// basic blocks of a function or the instructions of a basic block. Children
+// are kept sorted by their primary address. While a column is being filled,
+// each parent owns a small sorted vector. MatchChainColumn::Compact() then
+// moves the children of all parents into a single contiguous pool per column,
+// so that each parent only references a span of that pool.
+template <typename MatchEntityT>
+class MatchedChildren {
+ public:
+  using value_type = MatchEntityT*;
+  using size_type = size_t;
+  using const_iterator = MatchEntityT* const*;
+  using iterator = const_iterator;
+
+  MatchedChildren() = default;
+
+  MatchedChildren(const MatchedChildren&) = delete;
+  MatchedChildren& operator=(const MatchedChildren&) = delete;
+
+  const_iterator begin() const { return data_; }
+  const_iterator end() const { return data_ + size_; }
+  size_type size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+  // Inserts a child, keeping the children sorted by address. Inserting the
+  // same child more than once has no effect.
+  void insert(MatchEntityT* child) {
+    if (data_ != owned_.data()) {
+      // Children live in a column pool, copy them back before modifying.
+      owned_.assign(begin(), end());
+    }
+    auto it = std::lower_bound(owned_.begin(), owned_.end(), child,
+                               MatchCompare<MatchEntityT>());
+    if (it == owned_.end() || *it != child) {
+      owned_.insert(it, child);
+    }
+    data_ = owned_.data();
+    size_ = owned_.size();
+  }
+
+  // Appends the children to pool and references them from there afterwards.
+  // The caller must make sure that pool has enough capacity so that it does
+  // not need to reallocate.
+  void MoveTo(std::vector<MatchEntityT*>* pool) {
+    const auto offset = pool->size();
+    pool->insert(pool->end(), begin(), end());
+    std::vector<MatchEntityT*>().swap(owned_);
+    data_ = pool->data() + offset;
+  }
+
+ private:
+  std::vector<MatchEntityT*> owned_;
+  MatchEntityT* const* data_ = nullptr;
+  uint32_t size_ = 0;
+};
+
 // Represents an instruction that has been matched by BinDiff. The associated
 // instruction bytes and disassembly only get populated if the instruction is
 // part of a match chain.
@@ -83,13 +148,20 @@ struct MatchedInstruction {
 
   MatchedMemoryAddress match;
 
-  std::string raw_instruction_bytes;
-  std::string disassembly;
+  // Views into the intern pool of the column, see
+  // MatchChainColumn::intern_pool(). The disassembly is empty if it was not
+  // loaded.
+  absl::string_view raw_instruction_bytes;
+  absl::string_view disassembly;
   Immediates immediates;
+
+  // Bit i is set if byte i of raw_instruction_bytes is part of an immediate
+  // that gets masked during signature generation. See
+  // InstructionMaskingTable::Mask().
+  uint64_t immediate_mask = 0;
 };
 
-using MatchedInstructions =
-    std::set<MatchedInstruction*, MatchCompare<MatchedInstruction>>;
+using MatchedInstructions = MatchedChildren<MatchedInstruction>;
 
 struct MatchedBasicBlock {
   explicit MatchedBasicBlock(const MemoryAddressPair& from_match);
@@ -101,8 +173,7 @@ struct MatchedBasicBlock {
   int weight = 0;
 };
 
-using MatchedBasicBlocks =
-    std::set<MatchedBasicBlock*, MatchCompare<MatchedBasicBlock>>;
+using MatchedBasicBlocks = MatchedChildren<MatchedBasicBlock>;
 
 struct MatchedFunction {
   explicit MatchedFunction(const MemoryAddressPair& from_match);
@@ -111,6 +182,164 @@ struct MatchedFunction {
   MatchedBasicBlocks basic_blocks;
   BinExport2::CallGraph::Vertex::Type type =
       BinExport2::CallGraph::Vertex::NORMAL;
+
+  // Normalized hash of the function as computed by the BinExport reader, used
+  // to look up how common the function is. Zero if unknown.
+  uint64_t function_hash = 0;
+};
+
+// Primary index of a column, mapping memory addresses to match objects. The
+// match objects are allocated from a per-index arena, so their addresses stay
+// stable. Iteration is in ascending order of addresses.
+// While a column is being filled, lookups go through a hash map. Once
+// Compact() has been called, the index only consists of a sorted, contiguous
+// vector of (address, match) entries and lookups use binary search.
+// Note: Iterating an index that has not been compacted may need to sort its
+//       entries first. Concurrent access is only safe after Compact().
+template <typename MatchEntityT>
+class MatchAddressIndex {
+ public:
+  using value_type = std::pair<MemoryAddress, MatchEntityT*>;
+  using size_type = size_t;
+  using const_iterator = typename std::vector<value_type>::const_iterator;
+  using iterator = const_iterator;
+
+  MatchAddressIndex() = default;
+
+  MatchAddressIndex(const MatchAddressIndex&) = delete;
+  MatchAddressIndex& operator=(const MatchAddressIndex&) = delete;
+
+  // Returns the match object for the primary address of the specified match.
+  // If there is none yet, a new one is created from match.
+  MatchEntityT* FindOrInsert(const MemoryAddressPair& match) {
+    if (compacted_) {
+      // Rare, only happens if matches are added after compaction.
+      for (const auto& entry : entries_) {
+        lookup_.emplace(entry.first, entry.second);
+      }
+      compacted_ = false;
+    }
+    auto inserted = lookup_.emplace(match.first, nullptr);
+    if (inserted.second) {
+      arena_.emplace_back(match);
+      inserted.first->second = &arena_.back();
+      if (!entries_.empty() && entries_.back().first > match.first) {
+        sorted_ = false;
+      }
+      entries_.emplace_back(match.first, &arena_.back());
+    }
+    return inserted.first->second;
+  }
+
+  // Returns the match object for the specified address or nullptr if there is
+  // none.
+  MatchEntityT* Find(MemoryAddress address) const {
+    if (!compacted_) {
+      auto found = lookup_.find(address);
+      return found != lookup_.end() ? found->second : nullptr;
+    }
+    auto found = std::lower_bound(
+        entries_.begin(), entries_.end(), address,
+        [](const value_type& entry, MemoryAddress address) {
+          return entry.first < address;
+        });
+    return found != entries_.end() && found->first == address ? found->second
+                                                              : nullptr;
+  }
+
+  const_iterator begin() const {
+    SortEntries();
+    return entries_.begin();
+  }
+  const_iterator end() const { return entries_.end(); }
+  const_iterator cbegin() const { return begin(); }
+  const_iterator cend() const { return end(); }
+  size_type size() const { return entries_.size(); }
+  bool empty() const { return entries_.empty(); }
+
+  void clear() {
+    arena_.clear();
+    lookup_.clear();
+    entries_.clear();
+    sorted_ = true;
+    compacted_ = false;
+  }
+
+  // Sorts the index entries by address and releases the hash map used during
+  // insertion.
+  void Compact() {
+    SortEntries();
+    entries_.shrink_to_fit();
+    absl::flat_hash_map<MemoryAddress, MatchEntityT*>().swap(lookup_);
+    compacted_ = true;
+  }
+
+ private:
+  void SortEntries() const {
+    if (!sorted_) {
+      std::sort(entries_.begin(), entries_.end(),
+                [](const value_type& a, const value_type& b) {
+                  return a.first < b.first;
+                });
+      sorted_ = true;
+    }
+  }
+
+  std::deque<MatchEntityT> arena_;
+  absl::flat_hash_map<MemoryAddress, MatchEntityT*> lookup_;
+  mutable std::vector<value_type> entries_;
+  mutable bool sorted_ = true;
+  bool compacted_ = false;
+};
+
+// Index that maps the artificial match identifiers assigned by PropagateIds()
+// to match objects. Since ids are handed out densely starting at 1, this is a
+// vector indexed by id. If the ids turn out to be sparse, a hash map is used
+// instead. If multiple matches share an id, the one with the lowest address
+// is found.
+template <typename MatchEntityT>
+class MatchIdentIndex {
+ public:
+  // Largest id per indexed match for which the vector representation is
+  // used.
+  static constexpr size_t kMaxDenseIdsPerMatch = 4;
+
+  // Replaces the contents with the matches of the specified address index.
+  void Build(const MatchAddressIndex<MatchEntityT>& address_index) {
+    dense_.clear();
+    sparse_.clear();
+    Ident max_id = 0;
+    for (const auto& entry : address_index) {
+      max_id = std::max(max_id, entry.second->match.id);
+    }
+    if (max_id <= kMaxDenseIdsPerMatch * address_index.size()) {
+      dense_.resize(static_cast<size_t>(max_id) + 1);
+      for (const auto& entry : address_index) {
+        auto& match = dense_[entry.second->match.id];
+        if (!match) {
+          match = entry.second;
+        }
+      }
+    } else {
+      sparse_.reserve(address_index.size());
+      for (const auto& entry : address_index) {
+        sparse_.emplace(entry.second->match.id, entry.second);
+      }
+    }
+  }
+
+  // Returns the match object for the specified id or nullptr if there is none.
+  MatchEntityT* Find(Ident id) const {
+    if (!sparse_.empty()) {
+      auto found = sparse_.find(id);
+      return found != sparse_.end() ? found->second : nullptr;
+    }
+    return id < dense_.size() ? dense_[id] : nullptr;
+  }
+
+ private:
+  std::vector<MatchEntityT*> dense_;
+  absl::flat_hash_map<Ident, MatchEntityT*> sparse_;
 };
 
 // This class represents a single column in a table of match chains. Match
@@ -121,16 +350,13 @@ class MatchChainColumn {
  public:
   // Primary index mapping memory addresses in binaries to their respective
   // match objects. Owns the objects.
-  using FunctionAddressIndex =
-      std::map<MemoryAddress, std::unique_ptr<MatchedFunction>>;
-  using BasicBlockAddressIndex =
-      std::map<MemoryAddress, std::unique_ptr<MatchedBasicBlock>>;
-  using InstructionAddressIndex =
-      std::map<MemoryAddress, std::unique_ptr<MatchedInstruction>>;
+  using FunctionAddressIndex = MatchAddressIndex<MatchedFunction>;
+  using BasicBlockAddressIndex = MatchAddressIndex<MatchedBasicBlock>;
+  using InstructionAddressIndex = MatchAddressIndex<MatchedInstruction>;
 
   // Secondary index to support fast lookups by an artificial match identifier.
-  using FunctionIdentIndex = std::map<Ident, MatchedFunction*>;
-  using BasicBlockIdentIndex = std::map<Ident, MatchedBasicBlock*>;
+  using FunctionIdentIndex = MatchIdentIndex<MatchedFunction>;
+  using BasicBlockIdentIndex = MatchIdentIndex<MatchedBasicBlock>;
 
   MatchChainColumn() = default;
   MatchChainColumn(const MatchChainColumn&) = delete;
@@ -167,6 +393,14 @@ class MatchChainColumn {
   }
   const std::string& diff_directory() const { return diff_directory_; }
 
+  // Getter/setter for the pool that stores instruction bytes and disassembly.
+  // Columns of the same table can share a pool, so that payloads that are the
+  // same across binaries are only stored once. The pool is not owned and must
+  // outlive the column. If no pool was set, the getter returns a pool owned by
+  // this column, which is shared with its clones.
+  void set_intern_pool(InternPool* pool) { intern_pool_ = pool; }
+  InternPool* intern_pool();
+
   // Getter/setter for the function filter mode
   void set_function_filter(SignatureDefinition::FunctionFilterMode value) {
     function_filter_ = value;
@@ -180,11 +414,20 @@ class MatchChainColumn {
   void AddFilteredFunction(MemoryAddress address) {
     filtered_functions_.insert(address);
   }
+  const absl::flat_hash_set<MemoryAddress>& filtered_functions() const {
+    return filtered_functions_;
+  }
 
   // Accessor functions to return function, basic block and instruction indices.
   const FunctionAddressIndex& functions_by_address() const {
     return functions_by_address_;
   }
+  const BasicBlockAddressIndex& basic_blocks_by_address() const {
+    return basic_blocks_by_address_;
+  }
+  const InstructionAddressIndex& instructions_by_address() const {
+    return instructions_by_address_;
+  }
   static FunctionAddressIndex* GetFunctionIndexFromColumn(
       MatchChainColumn* column) {
     return &column->functions_by_address_;
@@ -209,14 +452,39 @@ class MatchChainColumn {
   // Terminate the match chain table by propagating the next to last column's
   // address_in_next to this column's address and adding mappings to address
   // zero. This is done because we have one more binary than BinDiff results.
-  void FinishChain(MatchChainColumn* prev);
+  void FinishChain(const MatchChainColumn* prev);
+
+  // Returns a compacted deep copy of this column, including the function
+  // filter. Instruction payloads are not copied, the copy references the same
+  // intern pool. A pool that was set with set_intern_pool() must outlive the
+  // copy, a pool owned by this column is kept alive by the copy.
+  std::unique_ptr<MatchChainColumn> Clone() const;
+
+  // Like Clone(), but only copies the basic blocks with the specified ids,
+  // together with their instructions and the functions that contain them.
+  // Functions without any of these basic blocks are dropped. The id indices
+  // of the copy are built already.
+  std::unique_ptr<MatchChainColumn> CloneBasicBlocks(
+      const absl::flat_hash_set<Ident>& bb_ids) const;
+
+  // Compacts the storage of this column. Should be called after all matches
+  // have been added to this column. Sorts the address indices into contiguous
+  // vectors and moves the children of all functions and basic blocks into
+  // per-column pools. Matches can still be added afterwards, but this is
+  // slower.
+  void Compact();
 
   // Build id indices for functions and basic blocks to support the Find*ById
   // family of functions. Should be called after all functions and basic blocks
-  // have been added to this column.
+  // have been added to this column. Calling this again rebuilds the indices.
   void BuildIdIndices();
 
  private:
+  // Implements Clone() and CloneBasicBlocks(). Copies all basic blocks if
+  // bb_ids is nullptr.
+  std::unique_ptr<MatchChainColumn> CloneImpl(
+      const absl::flat_hash_set<Ident>* bb_ids) const;
+
   // If set to FILTER_BLACKLIST, filtered_functions_ will serve as a function
   // blacklist. Set to FILTER_WHITELIST, _only_ the functions listed in
   // filtered_functions_ will be used.
@@ -230,6 +498,11 @@ class MatchChainColumn {
   BasicBlockAddressIndex basic_blocks_by_address_;
   InstructionAddressIndex instructions_by_address_;
 
+  // Contiguous storage for the children of all functions and basic blocks in
+  // this column. Filled by Compact().
+  std::vector<MatchedBasicBlock*> basic_block_pool_;
+  std::vector<MatchedInstruction*> instruction_pool_;
+
   // Indices that get build on demand for calculating candidates.
   FunctionIdentIndex functions_by_id_;
   BasicBlockIdentIndex basic_blocks_by_id_;
@@ -237,21 +510,41 @@ class MatchChainColumn {
   std::string filename_;
   std::string sha256_;
   std::string diff_directory_;
+
+  InternPool* intern_pool_ = nullptr;
+  std::shared_ptr<InternPool> owned_intern_pool_;
 };
 
 // Multiple MatchChainColumns make up the match chain table.
 using MatchChainTable = std::vector<std::unique_ptr<MatchChainColumn>>;
 
-// Adds a diff result file to the table in the specified column.
-absl::Status AddDiffResult(
-    absl::string_view filename, bool last, MatchChainColumn* column,
-    MatchChainColumn* next,
-    std::vector<std::pair<std::string, std::string>>* diffs);
+// Adds a diff result file to the table in the specified column. The filenames
+// of the primary and secondary binaries of the diff are stored in diff. The
+// function filter of the column is already applied when reading the diff
+// result. If reader is non-null, it is used to read the file, otherwise a new
+// reader is created. Only touches the specified column, so that multiple
+// columns can be filled concurrently. The last column of a table needs to be
+// terminated by calling MatchChainColumn::FinishChain() once all diff results
+// have been added.
+absl::Status AddDiffResult(absl::string_view filename, BinDiffReader* reader,
+                           MatchChainColumn* column,
+                           std::pair<std::string, std::string>* diff);
 
 // Loads function metadata and raw instruction bytes from the specified
-// .BinExport file and adds it to the table in the specified column.
+// .BinExport file and adds it to the table in the specified column. The
+// instruction disassembly is only stored if load_disassembly is true, and the
+// function hashes are only computed if load_function_hashes is true.
 absl::Status AddFunctionData(absl::string_view filename,
-                                 MatchChainColumn* column);
+                             MatchChainColumn* column, bool load_disassembly,
+                             bool load_function_hashes);
+
+// Number of match chains by length, as computed by PropagateIds(). The length
+// of a chain is the number of consecutive columns, starting with the first,
+// that it spans. Element i holds the number of chains of length i + 1.
+struct ChainLengthHistogram {
+  std::vector<int> functions;
+  std::vector<int> basic_blocks;
+};
 
 // Imposes an order on the matches of each column/binary in the table. The
 // first column is used as the "master column", i.e. the matches of the
@@ -259,12 +552,63 @@ absl::Status AddFunctionData(absl::string_view filename,
 // respective position is stored in the id member. This function then tries
 // to build chains for each id so that the ids of each column are
 // permutations of the ids of the first column.
+// The links between neighboring columns are first resolved into slot numbers,
+// so that following the chains only needs array lookups. If pool is non-null,
+// the columns and chains are processed on it. If histogram is non-null, it
+// receives the lengths of the function and basic block chains.
+void PropagateIds(MatchChainTable* table, ThreadPool* pool,
+                  ChainLengthHistogram* histogram);
 void PropagateIds(MatchChainTable* table);
 
+// Describes how the columns of a table are connected if the diff results do
+// not form a chain, but a tree. The first column is the binary at the root.
+// Each other column is the secondary binary of a diff whose primary binary is
+// its parent. The matches of that diff are stored in the parent column if the
+// column is the first child of its parent, just like in a chain. Otherwise,
+// they are stored in a separate link column, which is keyed by the addresses
+// of the parent binary and only used to propagate ids.
+struct MatchChainTopology {
+  // Column index of the parent of each column, -1 for the root. Parents come
+  // before their children.
+  std::vector<int> parents;
+
+  // Link column for each column, null if the parent column holds its matches.
+  std::vector<std::unique_ptr<MatchChainColumn>> links;
+};
+
+// Like above, but propagates the ids from the root column along the edges of
+// the specified tree. An empty topology stands for a chain. For trees, the
+// "length" of a chain in the histogram is the number of columns that the id
+// of a root match ends up in.
+void PropagateIds(MatchChainTable* table, const MatchChainTopology& topology,
+                  ThreadPool* pool, ChainLengthHistogram* histogram);
+
+// Extends the id chains of a table to the columns of a diff that is appended
+// to it. prev is the last column of the table, which gets replaced by column.
+// Both hold the same binary: prev as terminated by FinishChain(), column with
+// the matches of the new diff. next terminates column. Matches in column get
+// the ids of the matches at the same address in prev, and matches in next the
+// largest id of the matches in column that link to them. This assigns the
+// same ids as PropagateIds() on the whole extended table, as ids only ever
+// flow towards the end of the chain.
+void ExtendIds(const MatchChainColumn& prev, MatchChainColumn* column,
+               MatchChainColumn* next);
+
 // Builds id indices for all columns of the specified MatchChainTable by
-// calling the method of the same name on its columns.
+// calling the method of the same name on its columns. If pool is non-null,
+// the columns are processed on it concurrently.
+void BuildIdIndices(MatchChainTable* table, ThreadPool* pool);
 void BuildIdIndices(MatchChainTable* table);
 
+// Replaces the columns of the table with copies that only contain the basic
+// blocks with the specified ids, as returned by
+// MatchChainColumn::CloneBasicBlocks(). Used to release the memory of
+// everything that cannot become part of the signature once the basic block
+// candidates are known. If pool is non-null, the columns are processed on it
+// concurrently.
+void PruneMatchChainTable(const IdentSequence& bb_ids, MatchChainTable* table,
+                          ThreadPool* pool);
+
 }  // namespace security::vxsig
 
 #endif  // VXSIG_MATCH_CHAIN_TABLE_H_
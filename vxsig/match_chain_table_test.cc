@@ -14,14 +14,19 @@
 
 #include "vxsig/match_chain_table.h"
 
+#include <set>
 #include <utility>
+#include <vector>
 
 #include "absl/memory/memory.h"
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
+#include "vxsig/thread_pool.h"
 
 using testing::Contains;
+using testing::ElementsAre;
 using testing::Eq;
+using testing::Ne;
 using testing::NotNull;
 using testing::SizeIs;
 
@@ -116,6 +121,113 @@ TEST(MatchChainColumnTest, FilteredInsertion) {
   }
 }
 
+TEST(MatchChainColumnTest, Compact) {
+  MatchChainColumn column;
+  // Insert out of order and add a second basic block to the last function.
+  for (int i = 2 * kNumSimpleMatches - 2; i >= 0; i -= 2) {
+    MemoryAddressPair match(kSimpleMatches[i], kSimpleMatches[i + 1]);
+    auto* new_bb = column.InsertBasicBlockMatch(
+        column.InsertFunctionMatch(match), match);
+    column.InsertInstructionMatch(new_bb, match);
+  }
+  auto* last_func = column.FindFunctionByAddress(0x00005000);
+  ASSERT_THAT(last_func, NotNull());
+  column.InsertBasicBlockMatch(last_func, {0x00005100, 0x30005100});
+  column.Compact();
+
+  auto* functions = MatchChainColumn::GetFunctionIndexFromColumn(&column);
+  ASSERT_THAT(*functions, SizeIs(kNumSimpleMatches));
+  int i = 0;
+  for (const auto& entry : *functions) {
+    EXPECT_THAT(entry.first, Eq(kSimpleMatches[i]));
+    EXPECT_THAT(column.FindFunctionByAddress(entry.first), Eq(entry.second));
+    const MatchedBasicBlock* bb = *entry.second->basic_blocks.begin();
+    EXPECT_THAT(bb->match.address, Eq(kSimpleMatches[i]));
+    ASSERT_THAT(bb->instructions, SizeIs(1));
+    EXPECT_THAT(
+        column.FindInstructionByAddress(kSimpleMatches[i]),
+        Eq(*bb->instructions.begin()));
+    i += 2;
+  }
+  EXPECT_THAT(column.FindFunctionByAddress(0x00001001), Eq(nullptr));
+  EXPECT_THAT(last_func->basic_blocks, SizeIs(2));
+
+  // Adding matches after compaction should still work.
+  auto* new_bb =
+      column.InsertBasicBlockMatch(last_func, {0x00005080, 0x30005080});
+  ASSERT_THAT(last_func->basic_blocks, SizeIs(3));
+  EXPECT_THAT(*(last_func->basic_blocks.begin() + 1), Eq(new_bb));
+  EXPECT_THAT(column.FindBasicBlockByAddress(0x00005080), Eq(new_bb));
+  column.Compact();
+  EXPECT_THAT(last_func->basic_blocks, SizeIs(3));
+  EXPECT_THAT(column.FindBasicBlockByAddress(0x00005100), NotNull());
+}
+
+TEST(MatchChainColumnTest, SharedInternPool) {
+  MatchChainColumn column;
+  MatchChainColumn other_column;
+  EXPECT_THAT(column.intern_pool(), NotNull());
+  EXPECT_THAT(column.intern_pool(), Ne(other_column.intern_pool()));
+
+  InternPool pool;
+  column.set_intern_pool(&pool);
+  other_column.set_intern_pool(&pool);
+  EXPECT_THAT(column.intern_pool(), Eq(&pool));
+  EXPECT_THAT(column.intern_pool()->Intern("\x90").data(),
+              Eq(other_column.intern_pool()->Intern("\x90").data()));
+}
+
+TEST(MatchChainColumnTest, Clone) {
+  InternPool pool;
+  MatchChainColumn column;
+  column.set_intern_pool(&pool);
+  column.set_filename("column");
+  column.set_function_filter(SignatureDefinition::FILTER_BLACKLIST);
+  column.AddFilteredFunction(0x00003000);
+  InsertSimpleMatches(&column);
+  // Share a basic block between two functions.
+  auto* shared_bb = column.InsertBasicBlockMatch(
+      column.FindFunctionByAddress(0x00002000), {0x00001000, 0x50001000});
+  shared_bb->weight = 7;
+  auto* instr = column.FindInstructionByAddress(0x00001000);
+  instr->raw_instruction_bytes = pool.Intern("\x90");
+  instr->immediates.emplace_back(0x1000, kDWord);
+  column.Compact();
+
+  auto clone = column.Clone();
+  EXPECT_THAT(clone->filename(), Eq("column"));
+  EXPECT_THAT(clone->intern_pool(), Eq(&pool));
+  EXPECT_THAT(clone->filtered_functions(), SizeIs(1));
+  EXPECT_THAT(clone->functions_by_address(), SizeIs(kNumSimpleMatches - 1));
+  EXPECT_THAT(clone->basic_blocks_by_address(), SizeIs(kNumSimpleMatches - 1));
+
+  auto* cloned_bb = clone->FindBasicBlockByAddress(0x00001000);
+  ASSERT_THAT(cloned_bb, NotNull());
+  EXPECT_THAT(cloned_bb, Ne(shared_bb));
+  EXPECT_THAT(cloned_bb->weight, Eq(7));
+  EXPECT_THAT(clone->FindFunctionByAddress(0x00002000)->basic_blocks,
+              Contains(cloned_bb));
+  auto* cloned_instr = *cloned_bb->instructions.begin();
+  EXPECT_THAT(cloned_instr->raw_instruction_bytes.data(),
+              Eq(instr->raw_instruction_bytes.data()));
+  EXPECT_THAT(cloned_instr->immediates, SizeIs(1));
+}
+
+TEST(MatchChainColumnTest, CloneKeepsOwnedInternPool) {
+  auto column = absl::make_unique<MatchChainColumn>();
+  InsertSimpleMatches(column.get());
+  auto* instr = column->FindInstructionByAddress(0x00001000);
+  instr->raw_instruction_bytes = column->intern_pool()->Intern("\x90\xc3");
+  column->Compact();
+
+  auto clone = column->Clone();
+  EXPECT_THAT(clone->intern_pool(), Eq(column->intern_pool()));
+  column.reset();
+  auto* cloned_instr = clone->FindInstructionByAddress(0x00001000);
+  ASSERT_THAT(cloned_instr, NotNull());
+  EXPECT_THAT(cloned_instr->raw_instruction_bytes, Eq("\x90\xc3"));
+}
+
 TEST(MatchChainColumnTest, FinishChain) {
   MatchChainColumn column;
   InsertSimpleMatches(&column);
@@ -177,5 +289,199 @@ TEST(MatchChainColumnTest, PropagateIdsAndBuildIndices) {
   }
 }
 
+TEST(MatchChainColumnTest, IdIndexWithSparseIds) {
+  MatchChainColumn column;
+  InsertSimpleMatches(&column);
+
+  // Assign ids that are too sparse for a dense index, with the first id used
+  // twice.
+  auto* functions = MatchChainColumn::GetFunctionIndexFromColumn(&column);
+  std::vector<MatchedFunction*> funcs;
+  for (const auto& entry : *functions) {
+    funcs.push_back(entry.second);
+  }
+  funcs[0]->match.id = 1;
+  funcs[1]->match.id = 1;
+  for (int i = 2; i < funcs.size(); ++i) {
+    funcs[i]->match.id = i * 100000;
+  }
+  column.BuildIdIndices();
+  EXPECT_THAT(column.FindFunctionById(1), Eq(funcs[0]));
+  EXPECT_THAT(column.FindFunctionById(200000), Eq(funcs[2]));
+  EXPECT_THAT(column.FindFunctionById(400000), Eq(funcs[4]));
+  EXPECT_THAT(column.FindFunctionById(2), Eq(nullptr));
+
+  // Rebuilding with dense ids replaces the previous contents.
+  for (int i = 0; i < funcs.size(); ++i) {
+    funcs[i]->match.id = i + 1;
+  }
+  column.BuildIdIndices();
+  for (int i = 0; i < funcs.size(); ++i) {
+    EXPECT_THAT(column.FindFunctionById(i + 1), Eq(funcs[i]));
+  }
+  EXPECT_THAT(column.FindFunctionById(200000), Eq(nullptr));
+}
+
+TEST(MatchChainColumnTest, PropagateIdsWithBrokenAndMergingChains) {
+  // Three columns of function matches:
+  //   0x100 -> 0x200 -> 0x300 -> 0
+  //   0x110 -> 0x210 -> 0x300 (merges into the first chain)
+  //   0x120 -> 0x999 (broken)
+  //   0x130 -> 0x230 -> 0x330 (broken)
+  auto insert = [](MatchChainColumn* column, MemoryAddress address,
+                   MemoryAddress address_in_next) {
+    column->InsertFunctionMatch(MemoryAddressPair(address, address_in_next));
+  };
+  MatchChainTable table;
+  for (int i = 0; i < 3; ++i) {
+    table.emplace_back(absl::make_unique<MatchChainColumn>());
+  }
+  insert(table[0].get(), 0x100, 0x200);
+  insert(table[0].get(), 0x110, 0x210);
+  insert(table[0].get(), 0x120, 0x999);
+  insert(table[0].get(), 0x130, 0x230);
+  insert(table[1].get(), 0x200, 0x300);
+  insert(table[1].get(), 0x210, 0x300);
+  insert(table[1].get(), 0x230, 0x330);
+  insert(table[2].get(), 0x300, 0);
+  insert(table[2].get(), 0x310, 0);
+
+  ThreadPool pool(2);
+  for (ThreadPool* p : {static_cast<ThreadPool*>(nullptr), &pool}) {
+    ChainLengthHistogram histogram;
+    PropagateIds(&table, p, &histogram);
+    EXPECT_THAT(table[0]->FindFunctionByAddress(0x100)->match.id, Eq(1));
+    EXPECT_THAT(table[0]->FindFunctionByAddress(0x130)->match.id, Eq(4));
+    EXPECT_THAT(table[1]->FindFunctionByAddress(0x200)->match.id, Eq(1));
+    EXPECT_THAT(table[1]->FindFunctionByAddress(0x210)->match.id, Eq(2));
+    EXPECT_THAT(table[1]->FindFunctionByAddress(0x230)->match.id, Eq(4));
+    // The later chain wins.
+    EXPECT_THAT(table[2]->FindFunctionByAddress(0x300)->match.id, Eq(2));
+    EXPECT_THAT(table[2]->FindFunctionByAddress(0x310)->match.id, Eq(0));
+    EXPECT_THAT(histogram.functions, ElementsAre(1, 1, 2));
+    EXPECT_THAT(histogram.basic_blocks, ElementsAre(0, 0, 0));
+  }
+}
+
+TEST(MatchChainColumnTest, PropagateIdsInStar) {
+  // A root binary diffed against two others. The matches of the first diff
+  // are stored in the root column, those of the second one in a link column.
+  //   0x100 -> 0x200, 0x100 -> 0x300
+  //   0x110 -> 0x210, 0x110 -> (not matched)
+  //   0x120 -> 0x220, 0x120 -> 0x320
+  auto insert = [](MatchChainColumn* column, MemoryAddress address,
+                   MemoryAddress address_in_next) {
+    column->InsertFunctionMatch(MemoryAddressPair(address, address_in_next));
+  };
+  MatchChainTable table;
+  for (int i = 0; i < 3; ++i) {
+    table.emplace_back(absl::make_unique<MatchChainColumn>());
+  }
+  insert(table[0].get(), 0x100, 0x200);
+  insert(table[0].get(), 0x110, 0x210);
+  insert(table[0].get(), 0x120, 0x220);
+  insert(table[1].get(), 0x200, 0);
+  insert(table[1].get(), 0x210, 0);
+  insert(table[1].get(), 0x220, 0);
+  insert(table[2].get(), 0x300, 0);
+  insert(table[2].get(), 0x320, 0);
+
+  MatchChainTopology topology;
+  topology.parents = {-1, 0, 0};
+  topology.links.resize(3);
+  topology.links[2] = absl::make_unique<MatchChainColumn>();
+  insert(topology.links[2].get(), 0x100, 0x300);
+  insert(topology.links[2].get(), 0x120, 0x320);
+
+  ThreadPool pool(2);
+  for (ThreadPool* p : {static_cast<ThreadPool*>(nullptr), &pool}) {
+    ChainLengthHistogram histogram;
+    PropagateIds(&table, topology, p, &histogram);
+    EXPECT_THAT(table[1]->FindFunctionByAddress(0x200)->match.id, Eq(1));
+    EXPECT_THAT(table[1]->FindFunctionByAddress(0x210)->match.id, Eq(2));
+    EXPECT_THAT(table[1]->FindFunctionByAddress(0x220)->match.id, Eq(3));
+    EXPECT_THAT(table[2]->FindFunctionByAddress(0x300)->match.id, Eq(1));
+    EXPECT_THAT(table[2]->FindFunctionByAddress(0x320)->match.id, Eq(3));
+    EXPECT_THAT(histogram.functions, ElementsAre(0, 1, 2));
+  }
+}
+
+TEST(MatchChainColumnTest, PropagateIdsWithEmptyTopologyIsChain) {
+  auto insert = [](MatchChainColumn* column, MemoryAddress address,
+                   MemoryAddress address_in_next) {
+    column->InsertFunctionMatch(MemoryAddressPair(address, address_in_next));
+  };
+  MatchChainTable table;
+  for (int i = 0; i < 2; ++i) {
+    table.emplace_back(absl::make_unique<MatchChainColumn>());
+  }
+  insert(table[0].get(), 0x100, 0x200);
+  insert(table[1].get(), 0x200, 0);
+  PropagateIds(&table, MatchChainTopology(), /*pool=*/nullptr,
+               /*histogram=*/nullptr);
+  EXPECT_THAT(table[1]->FindFunctionByAddress(0x200)->match.id, Eq(1));
+}
+
+TEST(MatchChainColumnTest, ExtendIdsMatchesPropagateIds) {
+  // A chain of two diffs, 0x1?? -> 0x2?? -> 0x3??. The second diff is
+  // appended to a table of the first one.
+  auto insert = [](MatchChainColumn* column, MemoryAddress address,
+                   MemoryAddress address_in_next) {
+    const MemoryAddressPair match(address, address_in_next);
+    column->InsertBasicBlockMatch(column->InsertFunctionMatch(match), match);
+  };
+  auto fill_first = [&insert](MatchChainColumn* column) {
+    insert(column, 0x100, 0x200);
+    insert(column, 0x110, 0x210);
+    insert(column, 0x120, 0x220);
+  };
+  auto fill_second = [&insert](MatchChainColumn* column) {
+    insert(column, 0x200, 0x300);
+    insert(column, 0x210, 0x300);  // Merges into the first chain
+    insert(column, 0x230, 0x330);  // Not reached by any chain
+  };
+
+  MatchChainTable table;
+  for (int i = 0; i < 2; ++i) {
+    table.emplace_back(absl::make_unique<MatchChainColumn>());
+  }
+  fill_first(table[0].get());
+  table[1]->FinishChain(table[0].get());
+  PropagateIds(&table);
+  MatchChainColumn column;
+  fill_second(&column);
+  MatchChainColumn next;
+  next.FinishChain(&column);
+  ExtendIds(*table[1], &column, &next);
+
+  MatchChainTable expected;
+  for (int i = 0; i < 3; ++i) {
+    expected.emplace_back(absl::make_unique<MatchChainColumn>());
+  }
+  fill_first(expected[0].get());
+  fill_second(expected[1].get());
+  expected[2]->FinishChain(expected[1].get());
+  PropagateIds(&expected);
+
+  for (const auto& pair : {std::make_pair(&column, expected[1].get()),
+                           std::make_pair(&next, expected[2].get())}) {
+    ASSERT_THAT(pair.first->functions_by_address().size(),
+                Eq(pair.second->functions_by_address().size()));
+    for (const auto& entry : pair.second->functions_by_address()) {
+      const auto* function = pair.first->FindFunctionByAddress(entry.first);
+      ASSERT_THAT(function, NotNull());
+      EXPECT_THAT(function->match.id, Eq(entry.second->match.id));
+      const auto* basic_block =
+          pair.first->FindBasicBlockByAddress(entry.first);
+      ASSERT_THAT(basic_block, NotNull());
+      EXPECT_THAT(
+          basic_block->match.id,
+          Eq(pair.second->FindBasicBlockByAddress(entry.first)->match.id));
+    }
+  }
+  EXPECT_THAT(next.FindFunctionByAddress(0x300)->match.id, Eq(2));
+  EXPECT_THAT(column.FindFunctionByAddress(0x230)->match.id, Eq(0));
+}
+
 }  // namespace
 }  // namespace security::vxsig
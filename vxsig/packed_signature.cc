@@ -0,0 +1,323 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "vxsig/packed_signature.h"
+
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+#include "absl/base/internal/endian.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/memory/memory.h"
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "third_party/zynamics/binexport/util/status_macros.h"
+
+namespace security::vxsig {
+namespace {
+
+// Bump this when changing the layout.
+constexpr absl::string_view kPackedMagic = "VXSIGRS1";
+
+// Magic, number of pieces, strings and references, byte and string data size.
+// Serialized protos are limited to 2 GiB, so 32-bit sizes are enough.
+constexpr size_t kHeaderSize = 8 + 4 + 4 + 4 + 4 + 4;
+
+// End of the piece's bytes and of its references, weight, minimum and maximum
+// qualifier. Each piece starts where the previous one ends.
+constexpr size_t kPieceEntrySize = 4 + 4 + 4 + 8 + 8;
+
+uint64_t MaskSize(uint64_t bytes_size) { return (2 * bytes_size + 7) / 8; }
+
+}  // namespace
+
+void PackRawSignature(const RawSignature& raw_sig, std::string* packed) {
+  absl::flat_hash_map<absl::string_view, uint32_t> string_indices;
+  std::vector<absl::string_view> strings;
+  std::vector<uint32_t> references;
+  uint64_t bytes_size = 0;
+  uint64_t strings_size = 0;
+  for (const auto& piece : raw_sig.piece()) {
+    bytes_size += piece.bytes().size();
+    for (const auto& line : piece.origin_disassembly()) {
+      auto [it, inserted] = string_indices.emplace(line, strings.size());
+      if (inserted) {
+        strings.push_back(line);
+        strings_size += line.size();
+      }
+      references.push_back(it->second);
+    }
+  }
+
+  packed->assign(kHeaderSize + raw_sig.piece_size() * kPieceEntrySize +
+                     references.size() * sizeof(uint32_t) +
+                     (strings.size() + 1) * sizeof(uint32_t) + bytes_size +
+                     MaskSize(bytes_size) + strings_size,
+                 '\0');
+  char* out = &(*packed)[0];
+  std::copy(kPackedMagic.begin(), kPackedMagic.end(), out);
+  absl::little_endian::Store32(out + 8, raw_sig.piece_size());
+  absl::little_endian::Store32(out + 12, strings.size());
+  absl::little_endian::Store32(out + 16, references.size());
+  absl::little_endian::Store32(out + 20, bytes_size);
+  absl::little_endian::Store32(out + 24, strings_size);
+
+  char* entry = out + kHeaderSize;
+  char* reference = entry + raw_sig.piece_size() * kPieceEntrySize;
+  char* string_offset = reference + references.size() * sizeof(uint32_t);
+  char* const bytes = string_offset + (strings.size() + 1) * sizeof(uint32_t);
+  char* const mask = bytes + bytes_size;
+  char* string_data = mask + MaskSize(bytes_size);
+
+  uint64_t bytes_offset = 0;
+  uint32_t references_end = 0;
+  for (const auto& piece : raw_sig.piece()) {
+    const auto& piece_bytes = piece.bytes();
+    std::copy(piece_bytes.begin(), piece_bytes.end(), bytes + bytes_offset);
+    for (const int32_t nibble : piece.masked_nibble()) {
+      if (nibble < 0 || nibble >= 2 * piece_bytes.size()) {
+        continue;
+      }
+      const uint64_t bit = 2 * bytes_offset + nibble;
+      mask[bit / 8] |= 1 << (bit % 8);
+    }
+    bytes_offset += piece_bytes.size();
+    references_end += piece.origin_disassembly_size();
+
+    absl::little_endian::Store32(entry, bytes_offset);
+    absl::little_endian::Store32(entry + 4, references_end);
+    absl::little_endian::Store32(entry + 8, piece.weight());
+    absl::little_endian::Store64(entry + 12, piece.min_qualifier());
+    absl::little_endian::Store64(entry + 20, piece.max_qualifier());
+    entry += kPieceEntrySize;
+  }
+  for (const uint32_t index : references) {
+    absl::little_endian::Store32(reference, index);
+    reference += sizeof(uint32_t);
+  }
+  uint32_t offset = 0;
+  for (const absl::string_view line : strings) {
+    absl::little_endian::Store32(string_offset, offset);
+    string_offset += sizeof(uint32_t);
+    std::copy(line.begin(), line.end(), string_data + offset);
+    offset += line.size();
+  }
+  absl::little_endian::Store32(string_offset, offset);
+}
+
+not_absl::StatusOr<PackedRawSignature> PackedRawSignature::Parse(
+    absl::string_view data) {
+  if (data.size() < kHeaderSize || data.substr(0, 8) != kPackedMagic) {
+    return absl::DataLossError("not a packed raw signature");
+  }
+  const auto corrupt = [] {
+    return absl::DataLossError("corrupt packed raw signature");
+  };
+  const uint64_t num_pieces = absl::little_endian::Load32(data.data() + 8);
+  const uint64_t num_strings = absl::little_endian::Load32(data.data() + 12);
+  const uint64_t num_references = absl::little_endian::Load32(data.data() + 16);
+  const uint64_t bytes_size = absl::little_endian::Load32(data.data() + 20);
+  const uint64_t strings_size = absl::little_endian::Load32(data.data() + 24);
+  if (num_pieces > std::numeric_limits<int>::max() ||
+      kHeaderSize + num_pieces * kPieceEntrySize +
+              num_references * sizeof(uint32_t) +
+              (num_strings + 1) * sizeof(uint32_t) + bytes_size +
+              MaskSize(bytes_size) + strings_size !=
+          data.size()) {
+    return corrupt();
+  }
+
+  PackedRawSignature packed;
+  packed.num_pieces_ = num_pieces;
+  packed.pieces_ = data.data() + kHeaderSize;
+  packed.references_ = packed.pieces_ + num_pieces * kPieceEntrySize;
+  packed.string_offsets_ =
+      packed.references_ + num_references * sizeof(uint32_t);
+  packed.bytes_ = packed.string_offsets_ + (num_strings + 1) * sizeof(uint32_t);
+  packed.mask_ = packed.bytes_ + bytes_size;
+  packed.strings_ = packed.mask_ + MaskSize(bytes_size);
+
+  // Check all offsets once, so that the accessors do not need to.
+  uint64_t bytes_end = 0;
+  uint64_t references_end = 0;
+  for (int i = 0; i < packed.num_pieces_; ++i) {
+    const char* entry = packed.piece_entry(i);
+    const uint64_t piece_bytes_end = absl::little_endian::Load32(entry);
+    const uint64_t piece_references_end =
+        absl::little_endian::Load32(entry + 4);
+    if (piece_bytes_end < bytes_end ||
+        piece_references_end < references_end) {
+      return corrupt();
+    }
+    bytes_end = piece_bytes_end;
+    references_end = piece_references_end;
+  }
+  if (bytes_end != bytes_size || references_end != num_references) {
+    return corrupt();
+  }
+  for (uint64_t i = 0; i < num_references; ++i) {
+    if (absl::little_endian::Load32(packed.references_ +
+                                    i * sizeof(uint32_t)) >= num_strings) {
+      return corrupt();
+    }
+  }
+  uint64_t previous_offset = 0;
+  for (uint64_t i = 0; i <= num_strings; ++i) {
+    const uint64_t offset = absl::little_endian::Load32(
+        packed.string_offsets_ + i * sizeof(uint32_t));
+    if (offset < previous_offset || (i == 0 && offset != 0) ||
+        (i == num_strings && offset != strings_size)) {
+      return corrupt();
+    }
+    previous_offset = offset;
+  }
+  return packed;
+}
+
+const char* PackedRawSignature::piece_entry(int i) const {
+  return pieces_ + static_cast<size_t>(i) * kPieceEntrySize;
+}
+
+uint32_t PackedRawSignature::bytes_begin(int i) const {
+  return i == 0 ? 0 : absl::little_endian::Load32(piece_entry(i - 1));
+}
+
+uint32_t PackedRawSignature::references_begin(int i) const {
+  return i == 0 ? 0 : absl::little_endian::Load32(piece_entry(i - 1) + 4);
+}
+
+absl::string_view PackedRawSignature::string(uint32_t index) const {
+  const char* offsets = string_offsets_ + index * sizeof(uint32_t);
+  const uint32_t begin = absl::little_endian::Load32(offsets);
+  const uint32_t end = absl::little_endian::Load32(offsets + sizeof(uint32_t));
+  return absl::string_view(strings_ + begin, end - begin);
+}
+
+absl::string_view PackedRawSignature::piece_bytes(int i) const {
+  const uint32_t begin = bytes_begin(i);
+  return absl::string_view(
+      bytes_ + begin, absl::little_endian::Load32(piece_entry(i)) - begin);
+}
+
+int32_t PackedRawSignature::weight(int i) const {
+  return absl::little_endian::Load32(piece_entry(i) + 8);
+}
+
+int64_t PackedRawSignature::min_qualifier(int i) const {
+  return absl::little_endian::Load64(piece_entry(i) + 12);
+}
+
+int64_t PackedRawSignature::max_qualifier(int i) const {
+  return absl::little_endian::Load64(piece_entry(i) + 20);
+}
+
+bool PackedRawSignature::masked_nibble(int i, int nibble) const {
+  const uint64_t begin = bytes_begin(i);
+  const uint64_t size = absl::little_endian::Load32(piece_entry(i)) - begin;
+  if (nibble < 0 || nibble >= 2 * size) {
+    return false;
+  }
+  const uint64_t bit = 2 * begin + nibble;
+  return (mask_[bit / 8] >> (bit % 8)) & 1;
+}
+
+int PackedRawSignature::disassembly_size(int i) const {
+  return absl::little_endian::Load32(piece_entry(i) + 4) - references_begin(i);
+}
+
+absl::string_view PackedRawSignature::disassembly(int i, int line) const {
+  return string(absl::little_endian::Load32(
+      references_ + (references_begin(i) + line) * sizeof(uint32_t)));
+}
+
+void PackedRawSignature::AppendPiece(int i, RawSignature* raw_sig) const {
+  auto* piece = raw_sig->add_piece();
+  const absl::string_view bytes = piece_bytes(i);
+  piece->set_bytes(bytes.data(), bytes.size());
+  if (const int64_t min = min_qualifier(i); min != 0) {
+    piece->set_min_qualifier(min);
+  }
+  if (const int64_t max = max_qualifier(i); max != -1) {
+    piece->set_max_qualifier(max);
+  }
+  if (const int32_t piece_weight = weight(i); piece_weight != 0) {
+    piece->set_weight(piece_weight);
+  }
+  for (int line = 0; line < disassembly_size(i); ++line) {
+    const absl::string_view disassembly_line = disassembly(i, line);
+    piece->add_origin_disassembly(disassembly_line.data(),
+                                  disassembly_line.size());
+  }
+  for (int nibble = 0; nibble < 2 * bytes.size(); ++nibble) {
+    if (masked_nibble(i, nibble)) {
+      piece->add_masked_nibble(nibble);
+    }
+  }
+}
+
+void UnpackRawSignature(const PackedRawSignature& packed,
+                        RawSignature* raw_sig) {
+  UnpackRawSignature(packed, /*min_piece_len=*/0, /*skip_zero_weight=*/false,
+                     raw_sig);
+}
+
+void UnpackRawSignature(const PackedRawSignature& packed, int min_piece_len,
+                        bool skip_zero_weight, RawSignature* raw_sig) {
+  raw_sig->Clear();
+  // The wildcard covering the pieces left out since the last unpacked piece.
+  bool skipped = false;
+  int64_t skipped_min = 0;
+  int64_t skipped_max = 0;
+  for (int i = 0; i < packed.piece_size(); ++i) {
+    const int64_t size = packed.piece_bytes(i).size();
+    if (size < min_piece_len || (skip_zero_weight && packed.weight(i) == 0)) {
+      // Pieces before the first unpacked one are dropped without a wildcard.
+      if (raw_sig->piece_size() > 0) {
+        skipped = true;
+        skipped_min += size + packed.min_qualifier(i);
+        skipped_max = skipped_max < 0 || packed.max_qualifier(i) < 0
+                          ? -1
+                          : skipped_max + size + packed.max_qualifier(i);
+      }
+      continue;
+    }
+    if (skipped) {
+      auto* last = raw_sig->mutable_piece(raw_sig->piece_size() - 1);
+      last->set_min_qualifier(last->min_qualifier() + skipped_min);
+      last->set_max_qualifier(last->max_qualifier() < 0 || skipped_max < 0
+                                  ? -1
+                                  : last->max_qualifier() + skipped_max);
+      skipped = false;
+      skipped_min = 0;
+      skipped_max = 0;
+    }
+    packed.AppendPiece(i, raw_sig);
+  }
+}
+
+not_absl::StatusOr<std::unique_ptr<PackedRawSignatureFile>>
+PackedRawSignatureFile::Open(absl::string_view filename) {
+  NA_ASSIGN_OR_RETURN(auto file, MappedFile::Open(filename));
+  auto signature_or = PackedRawSignature::Parse(file->data());
+  if (!signature_or.ok()) {
+    return absl::DataLossError(
+        absl::StrCat(signature_or.status().message(), ": ", filename));
+  }
+  return absl::WrapUnique(new PackedRawSignatureFile(
+      std::move(file), std::move(signature_or).ValueOrDie()));
+}
+
+}  // namespace security::vxsig
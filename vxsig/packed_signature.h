@@ -0,0 +1,135 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// A compact binary representation of RawSignature for passing large,
+// untrimmed signatures between processes. Compared to the serialized proto,
+// the piece bytes are stored contiguously, masked nibbles are a bitmap over
+// them and disassembly lines are interned. The packed form can be used in
+// place, for example from a memory-mapped file, without parsing it first.
+//
+// All integers are little-endian. The layout is:
+//   Header:            magic, number of pieces, number of interned strings,
+//                      number of disassembly references, byte and string
+//                      data sizes
+//   Piece table:       end of the bytes and of the disassembly references,
+//                      weight and qualifiers of each piece
+//   References:        string index of each disassembly line, by piece
+//   String offsets:    start of each interned string, plus the end
+//   Byte data:         the bytes of all pieces
+//   Mask bitmap:       one bit per nibble of the byte data, set if masked
+//   String data:       the interned disassembly lines
+
+#ifndef VXSIG_PACKED_SIGNATURE_H_
+#define VXSIG_PACKED_SIGNATURE_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include "absl/strings/string_view.h"
+#include "third_party/zynamics/binexport/util/statusor.h"
+#include "vxsig/mapped_file.h"
+#include "vxsig/vxsig.pb.h"
+
+namespace security::vxsig {
+
+// Packs raw_sig into the format described above and replaces the contents of
+// packed with it. As the masked nibbles are stored as a bitmap, their order is
+// not kept and entries outside of the bytes of their piece are dropped.
+void PackRawSignature(const RawSignature& raw_sig, std::string* packed);
+
+// A read-only view of a packed raw signature. Does not copy the data, which
+// needs to outlive the view.
+class PackedRawSignature {
+ public:
+  // Checks that data is a valid packed raw signature and returns a view of
+  // it. Returns a DataLoss error otherwise.
+  static not_absl::StatusOr<PackedRawSignature> Parse(absl::string_view data);
+
+  int piece_size() const { return num_pieces_; }
+
+  absl::string_view piece_bytes(int i) const;
+  int64_t min_qualifier(int i) const;
+  int64_t max_qualifier(int i) const;
+  int32_t weight(int i) const;
+
+  // Returns whether the nibble of piece i is masked. Nibbles are indexed like
+  // in RawSignature::Piece::masked_nibble.
+  bool masked_nibble(int i, int nibble) const;
+
+  int disassembly_size(int i) const;
+  absl::string_view disassembly(int i, int line) const;
+
+  // Appends piece i to raw_sig.
+  void AppendPiece(int i, RawSignature* raw_sig) const;
+
+ private:
+  PackedRawSignature() = default;
+
+  const char* piece_entry(int i) const;
+  uint32_t bytes_begin(int i) const;
+  uint32_t references_begin(int i) const;
+  absl::string_view string(uint32_t index) const;
+
+  int num_pieces_ = 0;
+  const char* pieces_ = nullptr;
+  const char* references_ = nullptr;
+  const char* string_offsets_ = nullptr;
+  const char* bytes_ = nullptr;
+  const char* mask_ = nullptr;
+  const char* strings_ = nullptr;
+};
+
+// Replaces the contents of raw_sig with the unpacked signature.
+void UnpackRawSignature(const PackedRawSignature& packed,
+                        RawSignature* raw_sig);
+
+// Like above, but only unpacks the pieces that are at least min_piece_len
+// bytes long and, if skip_zero_weight is true, that have a non-zero weight.
+// The wildcards are widened to cover the left out pieces, in the same way as
+// GetRelevantSignatureSubset() does it. As the left out pieces are never part
+// of a trimmed signature, the result trims to the same signature as the full
+// one.
+void UnpackRawSignature(const PackedRawSignature& packed, int min_piece_len,
+                        bool skip_zero_weight, RawSignature* raw_sig);
+
+// A memory-mapped file containing a packed raw signature.
+class PackedRawSignatureFile {
+ public:
+  // Maps the specified file, which was written with the output of
+  // PackRawSignature(), into memory. Returns a DataLoss error if it is not a
+  // packed raw signature.
+  static not_absl::StatusOr<std::unique_ptr<PackedRawSignatureFile>> Open(
+      absl::string_view filename);
+
+  PackedRawSignatureFile(const PackedRawSignatureFile&) = delete;
+  PackedRawSignatureFile& operator=(const PackedRawSignatureFile&) = delete;
+
+  // Only valid for the lifetime of this object.
+  const PackedRawSignature& signature() const { return signature_; }
+
+ private:
+  PackedRawSignatureFile(std::unique_ptr<MappedFile> file,
+                         PackedRawSignature signature)
+      : file_(std::move(file)), signature_(signature) {}
+
+  std::unique_ptr<MappedFile> file_;
+  PackedRawSignature signature_;
+};
+
+}  // namespace security::vxsig
+
+#endif  // VXSIG_PACKED_SIGNATURE_H_
@@ -0,0 +1,154 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "vxsig/packed_signature.h"
+
+#include <cstdlib>
+#include <fstream>
+#include <string>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "third_party/zynamics/binexport/util/filesystem.h"
+#include "third_party/zynamics/binexport/util/status_matchers.h"
+#include "vxsig/signature_formatter.h"
+#include "vxsig/vxsig.pb.h"
+
+using not_absl::IsOk;
+using testing::Eq;
+using testing::IsFalse;
+using testing::IsTrue;
+using testing::Lt;
+using testing::Not;
+
+namespace security::vxsig {
+namespace {
+
+RawSignature MakeTestSignature() {
+  RawSignature raw_sig;
+  auto* piece = raw_sig.add_piece();
+  piece->set_bytes("\x8b\x45\x0c\x33");
+  piece->set_min_qualifier(4);
+  piece->set_max_qualifier(4);
+  piece->set_weight(3);
+  piece->add_origin_disassembly("mov eax, [ebp+0x0c]");
+  piece->add_origin_disassembly("xor eax, eax");
+  piece = raw_sig.add_piece();
+  piece->set_bytes("\x55");
+  piece->set_min_qualifier(1);
+  piece->add_origin_disassembly("push ebp");
+  piece = raw_sig.add_piece();
+  piece->set_bytes("\xe8\x12\x34\x56\x78");
+  piece->set_min_qualifier(2);
+  piece->set_max_qualifier(8);
+  piece->set_weight(1);
+  piece->add_origin_disassembly("xor eax, eax");
+  for (int nibble = 2; nibble < 10; ++nibble) {
+    piece->add_masked_nibble(nibble);
+  }
+  raw_sig.add_piece()->set_bytes(std::string("\x00\x00", 2));
+  return raw_sig;
+}
+
+TEST(PackedSignatureTest, RoundTrip) {
+  const RawSignature raw_sig = MakeTestSignature();
+  std::string data;
+  PackRawSignature(raw_sig, &data);
+  auto packed_or = PackedRawSignature::Parse(data);
+  ASSERT_THAT(packed_or.status(), IsOk());
+  const PackedRawSignature& packed = packed_or.ValueOrDie();
+  ASSERT_THAT(packed.piece_size(), Eq(4));
+  EXPECT_THAT(packed.piece_bytes(2), Eq("\xe8\x12\x34\x56\x78"));
+  EXPECT_THAT(packed.max_qualifier(1), Eq(-1));
+  EXPECT_THAT(packed.masked_nibble(2, 1), IsFalse());
+  EXPECT_THAT(packed.masked_nibble(2, 2), IsTrue());
+  EXPECT_THAT(packed.masked_nibble(2, 10), IsFalse());
+  EXPECT_THAT(packed.disassembly_size(0), Eq(2));
+  EXPECT_THAT(packed.disassembly(2, 0), Eq("xor eax, eax"));
+
+  RawSignature unpacked;
+  UnpackRawSignature(packed, &unpacked);
+  EXPECT_THAT(unpacked.SerializeAsString(), Eq(raw_sig.SerializeAsString()));
+
+  // Disassembly lines are only stored once.
+  RawSignature repeated;
+  for (int i = 0; i < 100; ++i) {
+    *repeated.add_piece() = raw_sig.piece(0);
+  }
+  PackRawSignature(repeated, &data);
+  EXPECT_THAT(data.size(), Lt(repeated.SerializeAsString().size()));
+}
+
+TEST(PackedSignatureTest, RejectsCorruptData) {
+  std::string data;
+  PackRawSignature(MakeTestSignature(), &data);
+  EXPECT_THAT(PackedRawSignature::Parse("not packed").status(), Not(IsOk()));
+  EXPECT_THAT(PackedRawSignature::Parse(data.substr(0, data.size() - 1)),
+              Not(IsOk()));
+
+  // Let the first piece end past the second one.
+  data[28] = '\x7f';
+  EXPECT_THAT(PackedRawSignature::Parse(data).status(), Not(IsOk()));
+}
+
+TEST(PackedSignatureTest, OpenFile) {
+  std::string data;
+  PackRawSignature(MakeTestSignature(), &data);
+  const std::string filename =
+      JoinPath(getenv("TEST_TMPDIR"), "packed_signature");
+  std::ofstream(filename, std::ios_base::binary) << data;
+  auto file_or = PackedRawSignatureFile::Open(filename);
+  ASSERT_THAT(file_or.status(), IsOk());
+  EXPECT_THAT(file_or.ValueOrDie()->signature().piece_size(), Eq(4));
+
+  EXPECT_THAT(PackedRawSignatureFile::Open(
+                  JoinPath(getenv("TEST_TMPDIR"), "does_not_exist"))
+                  .status(),
+              Not(IsOk()));
+}
+
+TEST(PackedSignatureTest, FormatPacked) {
+  std::string data;
+  PackRawSignature(MakeTestSignature(), &data);
+  auto packed_or = PackedRawSignature::Parse(data);
+  ASSERT_THAT(packed_or.status(), IsOk());
+
+  for (const auto algorithm : {SignatureDefinition::TRIM_NONE,
+                               SignatureDefinition::TRIM_WEIGHTED_GREEDY}) {
+    for (const auto type : {SignatureType::CLAMAV, SignatureType::YARA}) {
+      Signature expected;
+      auto* definition = expected.mutable_definition();
+      definition->set_detection_name("test_malware");
+      definition->set_min_piece_length(2);
+      definition->set_trim_algorithm(algorithm);
+      definition->set_trim_length(16);
+      Signature signature(expected);
+      *expected.mutable_raw_signature() = MakeTestSignature();
+
+      auto formatter = SignatureFormatter::Create(type);
+      ASSERT_THAT(formatter->Format(&expected), IsOk());
+      ASSERT_THAT(formatter->FormatPacked(packed_or.ValueOrDie(), &signature),
+                  IsOk());
+      EXPECT_THAT(signature.has_raw_signature(), IsFalse());
+      EXPECT_THAT(signature.clam_av_signature().data(),
+                  Eq(expected.clam_av_signature().data()));
+      EXPECT_THAT(signature.yara_signature().data(),
+                  Eq(expected.yara_signature().data()));
+    }
+  }
+}
+
+}  // namespace
+}  // namespace security::vxsig
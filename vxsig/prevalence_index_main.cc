@@ -0,0 +1,69 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// A program that builds a function prevalence index from a corpus of
+// BinExport files. The index is used by siggen to avoid common library code
+// in signatures, see the --function_prevalence_index flag.
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "absl/base/internal/raw_logging.h"
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "absl/flags/usage.h"
+#include "absl/strings/str_cat.h"
+#include "vxsig/function_prevalence.h"
+
+ABSL_FLAG(std::string, output, "", "Filename of the index to write");
+
+namespace security::vxsig {
+namespace {
+
+void PrevalenceIndexMain(int argc, char* argv[]) {
+  ABSL_RAW_CHECK(argc >= 2, "Need at least one .BinExport file");
+  const std::string output = absl::GetFlag(FLAGS_output);
+  ABSL_RAW_CHECK(!output.empty(), "Need an output filename");
+
+  FunctionPrevalenceIndexBuilder builder;
+  for (int i = 1; i < argc; ++i) {
+    absl::Status status = builder.AddBinExport(argv[i]);
+    if (!status.ok()) {
+      // Corpora are large and usually contain a few broken files, so skip
+      // them instead of giving up.
+      fprintf(stderr, "Skipping %s: %s\n", argv[i],
+              std::string(status.message()).c_str());
+    }
+  }
+  absl::Status status = builder.Write(output);
+  ABSL_RAW_CHECK(
+      status.ok(),
+      absl::StrCat("Failed to write index: ", status.message()).c_str());
+  printf("Indexed %u binaries\n", builder.num_binaries());
+}
+
+}  // namespace
+}  // namespace security::vxsig
+
+int main(int argc, char* argv[]) {
+  absl::SetProgramUsageMessage(absl::StrCat(
+      "Build a function prevalence index from a corpus of binaries.\n"
+      "usage:\n",
+      argv[0], " --output=INDEX BINEXPORT..."));
+  std::vector<char*> args = absl::ParseCommandLine(argc, argv);
+  security::vxsig::PrevalenceIndexMain(args.size(), &args[0]);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,146 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// Benchmarks for the sequence algorithms that signature generation is built
+// on, over synthetic sequences of varying size, alphabet size and similarity.
+// Similarity is given in percent, see MutateSequence().
+
+#include <cstdint>
+#include <initializer_list>
+#include <iterator>
+#include <random>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "vxsig/benchmark_util.h"
+#include "vxsig/common_subsequence.h"
+#include "vxsig/longest_common_subsequence.h"
+#include "vxsig/subsequence_regex.h"
+#include "vxsig/types.h"
+
+namespace security::vxsig {
+namespace {
+
+// Arguments: sequence size, alphabet size, similarity.
+void SequenceArguments(benchmark::internal::Benchmark* benchmark,
+                       std::initializer_list<int> alphabet_sizes) {
+  for (const int size : {256, 4096, 1 << 14}) {
+    for (const int alphabet_size : alphabet_sizes) {
+      for (const int similarity : {50, 90, 99}) {
+        benchmark->Args({size, alphabet_size, similarity});
+      }
+    }
+  }
+}
+
+void ByteSequenceArguments(benchmark::internal::Benchmark* benchmark) {
+  SequenceArguments(benchmark, {4, 256});
+}
+
+void IdentSequenceArguments(benchmark::internal::Benchmark* benchmark) {
+  SequenceArguments(benchmark, {4, 256, 1 << 16});
+}
+
+// Arguments: number of sequences, sequence size, similarity.
+void ChainArguments(benchmark::internal::Benchmark* benchmark) {
+  for (const int num_sequences : {2, 8, 32}) {
+    for (const int size : {256, 4096}) {
+      for (const int similarity : {50, 90, 99}) {
+        benchmark->Args({num_sequences, size, similarity});
+      }
+    }
+  }
+}
+
+template <typename T>
+void BM_LongestCommonSubsequence(benchmark::State& state) {
+  std::mt19937 rng(1);
+  const auto sequences =
+      RelatedSequences<T>(/*num_sequences=*/2, state.range(0), state.range(1),
+                          state.range(2) / 100.0, &rng);
+  std::vector<T> lcs;
+  for (auto _ : state) {
+    lcs.clear();
+    LongestCommonSubsequence(sequences[0].begin(), sequences[0].end(),
+                             sequences[1].begin(), sequences[1].end(),
+                             std::back_inserter(lcs),
+                             ThreadLocalLcsWorkspace());
+    benchmark::DoNotOptimize(lcs.data());
+  }
+  state.SetItemsProcessed(state.iterations() *
+                          (sequences[0].size() + sequences[1].size()));
+}
+
+template <typename T>
+void BM_CommonSubsequence(benchmark::State& state) {
+  std::mt19937 rng(1);
+  // Basic block ids of related binaries come from a large alphabet.
+  const auto sequences = RelatedSequences<T>(
+      state.range(0), state.range(1), /*alphabet_size=*/1 << 16,
+      state.range(2) / 100.0, &rng);
+  int64_t num_elements = 0;
+  for (const auto& sequence : sequences) {
+    num_elements += sequence.size();
+  }
+  std::vector<T> common;
+  for (auto _ : state) {
+    common.clear();
+    CommonSubsequence(sequences, std::back_inserter(common));
+    benchmark::DoNotOptimize(common.data());
+  }
+  state.SetItemsProcessed(state.iterations() * num_elements);
+}
+
+void BM_RegexFromSubsequence(benchmark::State& state) {
+  std::mt19937 rng(1);
+  const auto sequences = RelatedSequences<Ident>(
+      state.range(0), state.range(1), /*alphabet_size=*/1 << 16,
+      state.range(2) / 100.0, &rng);
+  int64_t num_elements = 0;
+  for (const auto& sequence : sequences) {
+    num_elements += sequence.size();
+  }
+  IdentSequence common;
+  CommonSubsequence(sequences, std::back_inserter(common));
+  using OutputIteratorT = std::back_insert_iterator<std::vector<int64_t>>;
+  const WildcardInserter<OutputIteratorT> wildcard_inserter =
+      [](size_t min_qualifier, size_t max_qualifier, OutputIteratorT result) {
+        result = -static_cast<int64_t>(max_qualifier - min_qualifier) - 1;
+      };
+  std::vector<int64_t> regex;
+  for (auto _ : state) {
+    regex.clear();
+    RegexFromSubsequence(common.begin(), common.end(), sequences,
+                         wildcard_inserter, std::back_inserter(regex));
+    benchmark::DoNotOptimize(regex.data());
+  }
+  state.SetItemsProcessed(state.iterations() * num_elements);
+}
+
+BENCHMARK_TEMPLATE(BM_LongestCommonSubsequence, uint8_t)
+    ->ArgNames({"size", "alphabet", "similarity"})
+    ->Apply(ByteSequenceArguments);
+BENCHMARK_TEMPLATE(BM_LongestCommonSubsequence, Ident)
+    ->ArgNames({"size", "alphabet", "similarity"})
+    ->Apply(IdentSequenceArguments);
+BENCHMARK_TEMPLATE(BM_CommonSubsequence, Ident)
+    ->ArgNames({"sequences", "size", "similarity"})
+    ->Apply(ChainArguments);
+BENCHMARK(BM_RegexFromSubsequence)
+    ->ArgNames({"sequences", "size", "similarity"})
+    ->Apply(ChainArguments);
+
+}  // namespace
+}  // namespace security::vxsig
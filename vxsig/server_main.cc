@@ -0,0 +1,218 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// A long-running signature generation service. Reads GenerationRequest
+// messages from stdin and writes a GenerationResponse for each of them to
+// stdout. Messages are length-delimited, i.e. each one is preceded by its
+// size as a varint. Requests run concurrently, so responses may be written in
+// a different order than the requests were read.
+// Loaded columns are kept in an in-memory cache, so that requests sharing
+// BinDiff results or binaries with earlier requests do not need to read them
+// again. Progress output goes to stderr.
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <thread>  // NOLINT(build/c++11)
+#include <vector>
+
+#include "absl/base/internal/raw_logging.h"
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "absl/flags/usage.h"
+#include "absl/memory/memory.h"
+#include "absl/strings/str_cat.h"
+#include "absl/synchronization/mutex.h"
+#include "google/protobuf/io/zero_copy_stream_impl.h"
+#include "google/protobuf/util/delimited_message_util.h"
+#include "third_party/zynamics/binexport/util/status_macros.h"
+#include "vxsig/column_cache.h"
+#include "vxsig/function_prevalence.h"
+#include "vxsig/goodware_index.h"
+#include "vxsig/siggen.h"
+#include "vxsig/signature_formatter.h"
+#include "vxsig/thread_pool.h"
+#include "vxsig/vxsig.pb.h"
+
+ABSL_FLAG(int64_t, memory_budget_mb, 4096,
+          "Memory budget of the column cache in MiB. Least recently used "
+          "columns are evicted once the cache grows beyond it.");
+ABSL_FLAG(int32_t, num_workers, std::thread::hardware_concurrency(),
+          "Number of requests to process concurrently");
+ABSL_FLAG(int32_t, num_threads, 1,
+          "Number of worker threads to use for each request");
+ABSL_FLAG(bool, load_disassembly, true,
+          "Whether to annotate signatures with the disassembly of the "
+          "instructions they were generated from");
+ABSL_FLAG(std::string, function_prevalence_index, "",
+          "Function prevalence index of a goodware corpus, as written by "
+          "vxsig_prevalence_index. Used for all requests.");
+ABSL_FLAG(std::string, goodware_index, "",
+          "Goodware n-gram index, as written by vxsig_goodware_index. Used "
+          "for all requests.");
+
+namespace security::vxsig {
+namespace {
+
+// State that is shared by all requests.
+struct ServerContext {
+  std::shared_ptr<ColumnCache> column_cache;
+  std::shared_ptr<const FunctionPrevalenceIndex> function_prevalence_index;
+  std::shared_ptr<const GoodwareIndex> goodware_index;
+};
+
+// Writes responses to a file descriptor. This class is thread-safe.
+class ResponseWriter {
+ public:
+  explicit ResponseWriter(int fd) : fd_(fd) {}
+
+  void Write(const GenerationResponse& response) {
+    absl::MutexLock lock(&mutex_);
+    ABSL_RAW_CHECK(
+        google::protobuf::util::SerializeDelimitedToFileDescriptor(response,
+                                                                   fd_),
+        "Failed to write response");
+  }
+
+ private:
+  absl::Mutex mutex_;
+  const int fd_;
+};
+
+absl::Status GenerateSignature(const GenerationRequest& request,
+                               const ServerContext& context,
+                               GenerationResponse* response) {
+  if (request.diff_result().empty()) {
+    return absl::InvalidArgumentError("Need at least one diff result");
+  }
+  for (const int format : request.format()) {
+    if (format != RAW && format != CLAMAV && format != YARA) {
+      return absl::InvalidArgumentError(
+          absl::StrCat("Invalid signature format: ", format));
+    }
+  }
+
+  AvSignatureGenerator siggen;
+  siggen.set_num_threads(absl::GetFlag(FLAGS_num_threads))
+      .set_load_disassembly(absl::GetFlag(FLAGS_load_disassembly))
+      .set_column_cache(context.column_cache)
+      .set_function_prevalence_index(context.function_prevalence_index);
+  siggen.AddDiffResults(request.diff_result().begin(),
+                        request.diff_result().end());
+
+  Signature signature;
+  *signature.mutable_definition() = request.definition();
+  absl::Status status = siggen.Generate(&signature);
+  *response->mutable_stats() = siggen.stats();
+  if (!status.ok()) {
+    return status;
+  }
+  for (const int format : request.format()) {
+    if (format == RAW) {
+      continue;
+    }
+    auto formatter =
+        SignatureFormatter::Create(static_cast<SignatureType>(format));
+    formatter->set_goodware_index(context.goodware_index);
+    NA_RETURN_IF_ERROR(formatter->Format(&signature));
+  }
+  *response->mutable_signature() = std::move(signature);
+  return absl::OkStatus();
+}
+
+void ServerMain() {
+  ServerContext context;
+  context.column_cache = std::make_shared<ColumnCache>(
+      static_cast<size_t>(absl::GetFlag(FLAGS_memory_budget_mb)) << 20);
+  const std::string index_filename =
+      absl::GetFlag(FLAGS_function_prevalence_index);
+  if (!index_filename.empty()) {
+    auto index_or = MappedFunctionPrevalenceIndex::Open(index_filename);
+    ABSL_RAW_CHECK(index_or.ok(),
+                   absl::StrCat("Failed to open function prevalence index: ",
+                                index_or.status().message())
+                       .c_str());
+    context.function_prevalence_index = std::move(index_or).ValueOrDie();
+  }
+  const std::string goodware_filename = absl::GetFlag(FLAGS_goodware_index);
+  if (!goodware_filename.empty()) {
+    auto goodware_index_or = GoodwareIndex::Open(goodware_filename);
+    ABSL_RAW_CHECK(goodware_index_or.ok(),
+                   absl::StrCat("Failed to open goodware index: ",
+                                goodware_index_or.status().message())
+                       .c_str());
+    context.goodware_index = std::move(goodware_index_or).ValueOrDie();
+  }
+
+  // The signature generator prints its progress to stdout. Keep the original
+  // stdout for the responses and send everything else to stderr.
+  const int response_fd = dup(STDOUT_FILENO);
+  ABSL_RAW_CHECK(response_fd != -1 && dup2(STDERR_FILENO, STDOUT_FILENO) != -1,
+                 "Failed to redirect stdout");
+  ResponseWriter writer(response_fd);
+
+  google::protobuf::io::FileInputStream input(STDIN_FILENO);
+  {
+    // Destroying the pool waits for all outstanding requests.
+    ThreadPool pool(std::max(absl::GetFlag(FLAGS_num_workers), 1));
+    while (true) {
+      auto request = std::make_shared<GenerationRequest>();
+      bool clean_eof = false;
+      if (!google::protobuf::util::ParseDelimitedFromZeroCopyStream(
+              request.get(), &input, &clean_eof)) {
+        ABSL_RAW_CHECK(clean_eof, "Failed to parse request");
+        break;
+      }
+      pool.Schedule([request, &context, &writer]() {
+        GenerationResponse response;
+        response.set_request_id(request->request_id());
+        absl::Status status = GenerateSignature(*request, context, &response);
+        if (!status.ok()) {
+          response.clear_signature();
+          response.set_error(std::string(status.message()));
+        }
+        writer.Write(response);
+      });
+    }
+  }
+  const ColumnCache::Stats stats = context.column_cache->stats();
+  fprintf(stderr,
+          "Column cache: %lld hits, %lld misses, %lld evictions, %lld "
+          "entries, %lld bytes\n",
+          static_cast<long long>(stats.hits),         // NOLINT
+          static_cast<long long>(stats.misses),       // NOLINT
+          static_cast<long long>(stats.evictions),    // NOLINT
+          static_cast<long long>(stats.num_entries),  // NOLINT
+          static_cast<long long>(stats.bytes));       // NOLINT
+  close(response_fd);
+}
+
+}  // namespace
+}  // namespace security::vxsig
+
+int main(int argc, char* argv[]) {
+  absl::SetProgramUsageMessage(absl::StrCat(
+      "Generates signatures for requests read from stdin.\n"
+      "usage:\n",
+      argv[0], " [OPTION]"));
+  absl::ParseCommandLine(argc, argv);
+  security::vxsig::ServerMain();
+  return EXIT_SUCCESS;
+}
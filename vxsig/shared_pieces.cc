@@ -0,0 +1,198 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "vxsig/shared_pieces.h"
+
+#include <algorithm>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/container/flat_hash_set.h"
+#include "absl/hash/internal/city.h"
+#include "third_party/zynamics/binexport/util/status_macros.h"
+#include "vxsig/signature_formatter.h"
+
+namespace security::vxsig {
+namespace {
+
+using PieceCounts = absl::flat_hash_map<uint64_t, int>;
+
+// Trims all signatures that have a raw signature. Signatures without one are
+// left empty in trimmed.
+absl::Status TrimSignatures(const SharedPieceOptions& options,
+                            const Signatures& signatures,
+                            std::vector<RawSignature>* trimmed) {
+  trimmed->clear();
+  trimmed->resize(signatures.signature_size());
+  return ParallelForWithStatus(
+      signatures.signature_size(), options.pool,
+      [&options, &signatures, trimmed](int i) -> absl::Status {
+        const auto& signature = signatures.signature(i);
+        if (signature.raw_signature().piece_size() == 0) {
+          return absl::OkStatus();
+        }
+        return GetRelevantSignatureSubset(signature,
+                                          options.engine_min_piece_len,
+                                          options.goodware_index,
+                                          &(*trimmed)[i]);
+      });
+}
+
+// Counts the number of signatures each distinct piece occurs in.
+PieceCounts CountPieces(const std::vector<RawSignature>& trimmed) {
+  PieceCounts counts;
+  absl::flat_hash_set<uint64_t> seen;
+  for (const auto& raw_sig : trimmed) {
+    seen.clear();
+    for (const auto& piece : raw_sig.piece()) {
+      const uint64_t fingerprint = PieceFingerprint(piece);
+      if (seen.insert(fingerprint).second) {
+        ++counts[fingerprint];
+      }
+    }
+  }
+  return counts;
+}
+
+void FillOverlapStats(const SharedPieceOptions& options,
+                      const std::vector<RawSignature>& trimmed,
+                      const PieceCounts& counts, PieceOverlapStats* stats) {
+  *stats = PieceOverlapStats();
+  stats->num_distinct_pieces = counts.size();
+  for (const auto& [fingerprint, count] : counts) {
+    if (count > options.max_signatures_per_piece) {
+      ++stats->num_shared_pieces;
+    }
+    stats->max_signatures_per_piece =
+        std::max(stats->max_signatures_per_piece, count);
+  }
+  for (const auto& raw_sig : trimmed) {
+    if (raw_sig.piece_size() == 0) {
+      continue;
+    }
+    ++stats->num_signatures;
+    for (const auto& piece : raw_sig.piece()) {
+      ++stats->num_pieces;
+      stats->num_bytes += piece.bytes().size();
+      if (counts.at(PieceFingerprint(piece)) >
+          options.max_signatures_per_piece) {
+        ++stats->num_shared_occurrences;
+        stats->num_shared_bytes += piece.bytes().size();
+      }
+    }
+  }
+}
+
+// Fills the indices of the pieces of raw_sig that are not shared.
+void GetUnsharedPieces(const SharedPieceOptions& options,
+                       const RawSignature& raw_sig, const PieceCounts& counts,
+                       std::vector<int>* piece_indices) {
+  piece_indices->clear();
+  for (int i = 0; i < raw_sig.piece_size(); ++i) {
+    auto found = counts.find(PieceFingerprint(raw_sig.piece(i)));
+    if (found == counts.end() ||
+        found->second <= options.max_signatures_per_piece) {
+      piece_indices->push_back(i);
+    }
+  }
+}
+
+}  // namespace
+
+uint64_t PieceFingerprint(const RawSignature::Piece& piece) {
+  // Use the rendered pattern, so that masked nibbles do not matter.
+  std::string pattern;
+  AppendMaskedHex(piece.bytes(), piece.masked_nibble(), &pattern);
+  return absl::hash_internal::CityHash64(pattern.data(), pattern.size());
+}
+
+absl::Status ComputePieceOverlap(const SharedPieceOptions& options,
+                                 const Signatures& signatures,
+                                 PieceOverlapStats* stats) {
+  std::vector<RawSignature> trimmed;
+  NA_RETURN_IF_ERROR(TrimSignatures(options, signatures, &trimmed));
+  FillOverlapStats(options, trimmed, CountPieces(trimmed), stats);
+  return absl::OkStatus();
+}
+
+absl::Status DeduplicateSharedPieces(const SharedPieceOptions& options,
+                                     Signatures* signatures,
+                                     SharedPieceStats* stats) {
+  *stats = SharedPieceStats();
+  std::vector<RawSignature> trimmed;
+  NA_RETURN_IF_ERROR(TrimSignatures(options, *signatures, &trimmed));
+  const PieceCounts counts = CountPieces(trimmed);
+  FillOverlapStats(options, trimmed, counts, &stats->before);
+  if (options.action == SharedPieceOptions::kReport ||
+      stats->before.num_shared_pieces == 0) {
+    stats->after = stats->before;
+    return absl::OkStatus();
+  }
+
+  // Whether a signature was changed or skipped because it only has shared
+  // pieces.
+  std::vector<char> changed(trimmed.size());
+  std::vector<char> skipped(trimmed.size());
+  ParallelFor(
+      signatures->signature_size(), options.pool,
+      [&options, &counts, &trimmed, &changed, &skipped, signatures](int i) {
+        auto& raw_sig = trimmed[i];
+        std::vector<int> piece_indices;
+        GetUnsharedPieces(options, raw_sig, counts, &piece_indices);
+        if (piece_indices.size() == raw_sig.piece_size()) {
+          return;
+        }
+        auto* signature = signatures->mutable_signature(i);
+        RawSignature unshared;
+        if (options.action == SharedPieceOptions::kDrop) {
+          CopySignaturePieces(raw_sig, piece_indices, &unshared);
+        } else {
+          // Prune the shared pieces from the untrimmed signature, then trim
+          // what remains to fill the budget again.
+          Signature untrimmed;
+          *untrimmed.mutable_definition() = signature->definition();
+          GetUnsharedPieces(options, signature->raw_signature(), counts,
+                            &piece_indices);
+          CopySignaturePieces(signature->raw_signature(), piece_indices,
+                              untrimmed.mutable_raw_signature());
+          // The definition was already checked by the first trimming, so this
+          // only fails if no piece is left.
+          if (!piece_indices.empty() &&
+              !GetRelevantSignatureSubset(untrimmed,
+                                          options.engine_min_piece_len,
+                                          options.goodware_index, &unshared)
+                   .ok()) {
+            unshared.Clear();
+          }
+        }
+        if (unshared.piece_size() == 0) {
+          skipped[i] = true;
+          return;
+        }
+        raw_sig = unshared;
+        *signature->mutable_raw_signature() = std::move(unshared);
+        changed[i] = true;
+      });
+  stats->num_changed_signatures =
+      std::count(changed.begin(), changed.end(), true);
+  stats->num_skipped_signatures =
+      std::count(skipped.begin(), skipped.end(), true);
+  FillOverlapStats(options, trimmed, CountPieces(trimmed), &stats->after);
+  return absl::OkStatus();
+}
+
+}  // namespace security::vxsig
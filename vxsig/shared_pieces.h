@@ -0,0 +1,109 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// Database-level deduplication of signature pieces. Signatures for different
+// malware families often end up with the same pieces, for example from shared
+// packers, compiler runtime stubs or statically linked libraries. These pieces
+// do not help to tell the families apart, but bloat the atom tables of the
+// scanning engine and slow down scanning. The pass in this file finds the
+// pieces that occur in too many signatures of a database and drops them
+// before the database is formatted.
+
+#ifndef VXSIG_SHARED_PIECES_H_
+#define VXSIG_SHARED_PIECES_H_
+
+#include <cstdint>
+
+#include "absl/status/status.h"
+#include "vxsig/goodware_index.h"
+#include "vxsig/thread_pool.h"
+#include "vxsig/vxsig.pb.h"
+
+namespace security::vxsig {
+
+// Returns a fingerprint of the pattern that the piece matches. Pieces that
+// only differ in the values of masked nibbles have the same fingerprint.
+uint64_t PieceFingerprint(const RawSignature::Piece& piece);
+
+struct SharedPieceOptions {
+  enum Action {
+    // Only compute statistics, leave the signatures unchanged.
+    kReport,
+    // Drop the shared pieces from the trimmed signatures. The signatures get
+    // shorter by the bytes of their shared pieces.
+    kDrop,
+    // Drop the shared pieces from the untrimmed signatures and trim them
+    // again, so that other pieces fill up the byte budget of the signature.
+    kDropAndRetrim,
+  };
+
+  // Pieces that occur in more than this many signatures are shared.
+  int max_signatures_per_piece = 1;
+  Action action = kDrop;
+
+  // Like the arguments to GetRelevantSignatureSubset(). These should be the
+  // same as for the formatter the database is formatted with, so that the
+  // statistics reflect the pieces that end up in its output.
+  int engine_min_piece_len = 0;
+  const GoodwareIndex* goodware_index = nullptr;
+
+  // If non-null, signatures are trimmed on this pool concurrently.
+  ThreadPool* pool = nullptr;
+};
+
+// Overlap of the pieces in the trimmed signatures of a database.
+struct PieceOverlapStats {
+  int num_signatures = 0;
+  // Number and total length of the pieces of all signatures.
+  int64_t num_pieces = 0;
+  int64_t num_bytes = 0;
+  int64_t num_distinct_pieces = 0;
+  // Distinct pieces that occur in more than max_signatures_per_piece
+  // signatures, and the number and total length of their occurrences.
+  int64_t num_shared_pieces = 0;
+  int64_t num_shared_occurrences = 0;
+  int64_t num_shared_bytes = 0;
+  // The largest number of signatures that have a piece in common.
+  int max_signatures_per_piece = 0;
+};
+
+struct SharedPieceStats {
+  PieceOverlapStats before;
+  PieceOverlapStats after;
+  // Signatures that had shared pieces removed.
+  int num_changed_signatures = 0;
+  // Signatures that consist only of shared pieces. These are left unchanged,
+  // as they would not be usable otherwise.
+  int num_skipped_signatures = 0;
+};
+
+// Computes the piece overlap of the trimmed signatures in the database.
+// Signatures without a raw signature are ignored.
+absl::Status ComputePieceOverlap(const SharedPieceOptions& options,
+                                 const Signatures& signatures,
+                                 PieceOverlapStats* stats);
+
+// Finds the pieces that the trimmed signatures have in common and, depending
+// on the action, drops them. Changed signatures have their raw signature
+// replaced by the trimmed one, so that formatting them trims nothing further.
+// The remaining pieces are only counted once, so dropping and re-trimming may
+// still leave some pieces that are shared, see stats->after.
+absl::Status DeduplicateSharedPieces(const SharedPieceOptions& options,
+                                     Signatures* signatures,
+                                     SharedPieceStats* stats);
+
+}  // namespace security::vxsig
+
+#endif  // VXSIG_SHARED_PIECES_H_
@@ -0,0 +1,150 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "vxsig/shared_pieces.h"
+
+#include <string>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "third_party/zynamics/binexport/util/status_matchers.h"
+#include "vxsig/signature_test_util.h"
+#include "vxsig/thread_pool.h"
+#include "vxsig/vxsig.pb.h"
+
+using not_absl::IsOk;
+using testing::Eq;
+using testing::IsTrue;
+using testing::Ne;
+
+namespace security::vxsig {
+namespace {
+
+class SharedPiecesTest : public ::testing::Test {
+ protected:
+  Signature* AddSignature(const std::vector<std::string>& pieces) {
+    auto* signature = signatures_.add_signature();
+    *signature->mutable_raw_signature() = *MakeRawSignature(pieces);
+    return signature;
+  }
+
+  Signatures signatures_;
+  SharedPieceOptions options_;
+  SharedPieceStats stats_;
+};
+
+TEST(PieceFingerprintTest, IgnoresMaskedNibbleValues) {
+  RawSignature::Piece piece;
+  piece.set_bytes("\x12\x34");
+  RawSignature::Piece other(piece);
+  other.set_bytes("\x12\x35");
+  EXPECT_THAT(PieceFingerprint(piece), Ne(PieceFingerprint(other)));
+
+  piece.add_masked_nibble(3);
+  other.add_masked_nibble(3);
+  EXPECT_THAT(PieceFingerprint(piece), Eq(PieceFingerprint(other)));
+}
+
+TEST_F(SharedPiecesTest, OverlapStats) {
+  AddSignature({"aaaa", "bbbb", "cccc"});
+  AddSignature({"aaaa", "dddd", "dddd"});
+  AddSignature({"aaaa", "eeee"});
+  AddSignature({"eeee"});
+  signatures_.add_signature();  // No raw signature, ignored.
+  options_.max_signatures_per_piece = 2;
+  PieceOverlapStats overlap;
+  ASSERT_THAT(ComputePieceOverlap(options_, signatures_, &overlap), IsOk());
+  EXPECT_THAT(overlap.num_signatures, Eq(4));
+  EXPECT_THAT(overlap.num_pieces, Eq(9));
+  EXPECT_THAT(overlap.num_bytes, Eq(36));
+  EXPECT_THAT(overlap.num_distinct_pieces, Eq(5));
+  EXPECT_THAT(overlap.num_shared_pieces, Eq(1));
+  EXPECT_THAT(overlap.num_shared_occurrences, Eq(3));
+  EXPECT_THAT(overlap.num_shared_bytes, Eq(12));
+  EXPECT_THAT(overlap.max_signatures_per_piece, Eq(3));
+
+  // Reporting gives the same statistics and changes nothing.
+  const Signatures expected(signatures_);
+  options_.action = SharedPieceOptions::kReport;
+  ASSERT_THAT(DeduplicateSharedPieces(options_, &signatures_, &stats_),
+              IsOk());
+  EXPECT_THAT(stats_.before.num_shared_bytes, Eq(12));
+  EXPECT_THAT(stats_.after.num_shared_bytes, Eq(12));
+  EXPECT_THAT(stats_.num_changed_signatures, Eq(0));
+  EXPECT_THAT(signatures_.SerializeAsString(),
+              Eq(expected.SerializeAsString()));
+}
+
+TEST_F(SharedPiecesTest, DropSharedPieces) {
+  AddSignature({"aaaa", "bbbb", "cccc"});
+  AddSignature({"dddd", "aaaa"});
+  AddSignature({"aaaa"});
+  ThreadPool pool(2);
+  options_.pool = &pool;
+  options_.max_signatures_per_piece = 2;
+  ASSERT_THAT(DeduplicateSharedPieces(options_, &signatures_, &stats_),
+              IsOk());
+  EXPECT_THAT(stats_.num_changed_signatures, Eq(2));
+  // The last signature would be empty without the shared piece.
+  EXPECT_THAT(stats_.num_skipped_signatures, Eq(1));
+  EXPECT_THAT(stats_.after.num_pieces, Eq(4));
+  EXPECT_THAT(stats_.after.num_shared_pieces, Eq(0));
+
+  const auto& first = signatures_.signature(0).raw_signature();
+  EXPECT_THAT(EquivRawSignature(first, *MakeRawSignature({"bbbb", "cccc"})),
+              IsTrue());
+  EXPECT_THAT(EquivRawSignature(signatures_.signature(1).raw_signature(),
+                                *MakeRawSignature({"dddd"})),
+              IsTrue());
+  EXPECT_THAT(EquivRawSignature(signatures_.signature(2).raw_signature(),
+                                *MakeRawSignature({"aaaa"})),
+              IsTrue());
+}
+
+TEST_F(SharedPiecesTest, RetrimRestoresBudget) {
+  for (auto* signature : {AddSignature({"aaaa", "bbbb", "cccc", "dddd"}),
+                          AddSignature({"aaaa", "eeee"})}) {
+    auto* definition = signature->mutable_definition();
+    definition->set_trim_algorithm(SignatureDefinition::TRIM_LAST);
+    definition->set_trim_length(8);
+  }
+  options_.max_signatures_per_piece = 1;
+  Signatures dropped(signatures_);
+  ASSERT_THAT(DeduplicateSharedPieces(options_, &dropped, &stats_), IsOk());
+  EXPECT_THAT(EquivRawSignature(dropped.signature(0).raw_signature(),
+                                *MakeRawSignature({"bbbb"})),
+              IsTrue());
+  EXPECT_THAT(stats_.after.num_bytes, Eq(8));
+
+  options_.action = SharedPieceOptions::kDropAndRetrim;
+  ASSERT_THAT(DeduplicateSharedPieces(options_, &signatures_, &stats_),
+              IsOk());
+  EXPECT_THAT(stats_.before.num_bytes, Eq(16));
+  EXPECT_THAT(stats_.after.num_bytes, Eq(12));
+  EXPECT_THAT(stats_.num_changed_signatures, Eq(2));
+  const auto& first = signatures_.signature(0).raw_signature();
+  EXPECT_THAT(EquivRawSignature(first, *MakeRawSignature({"bbbb", "cccc"})),
+              IsTrue());
+  // The wildcard between the pieces is unchanged, the dropped piece came
+  // before them.
+  EXPECT_THAT(first.piece(0).min_qualifier(), Eq(0));
+  EXPECT_THAT(EquivRawSignature(signatures_.signature(1).raw_signature(),
+                                *MakeRawSignature({"eeee"})),
+              IsTrue());
+}
+
+}  // namespace
+}  // namespace security::vxsig
@@ -14,23 +14,41 @@
 
 #include "vxsig/siggen.h"
 
+#include <algorithm>
 #include <cmath>
+#include <cstdlib>
 #include <cstddef>
+#include <cstdint>
 #include <iterator>
+#include <limits>
 #include <memory>
+#include <utility>
+#include <vector>
 
 #include "absl/base/internal/raw_logging.h"
 #include "absl/container/flat_hash_map.h"
+#include "absl/container/flat_hash_set.h"
+#include "absl/hash/internal/city.h"
 #include "absl/memory/memory.h"
+#include "absl/strings/ascii.h"
+#include "absl/strings/match.h"
 #include "absl/strings/numbers.h"
 #include "absl/strings/str_cat.h"
 #include "absl/strings/str_format.h"
+#include "absl/strings/str_join.h"
+#include "absl/strings/str_split.h"
 #include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
 #include "absl/time/time.h"
 #include "third_party/zynamics/binexport/util/filesystem.h"
 #include "third_party/zynamics/binexport/util/status_macros.h"
 #include "vxsig/candidates.h"
+#include "vxsig/diff_result_reader.h"
+#include "vxsig/generation_stats.h"
 #include "vxsig/generic_signature.h"
+#include "vxsig/instruction_spill.h"
+#include "vxsig/item_selection.h"
+#include "vxsig/match_chain_cache.h"
 #include "vxsig/match_chain_table.h"
 
 namespace security::vxsig {
@@ -91,6 +109,103 @@ void DumpMatchChainTable(const MatchChainTable& table,
   }
 }
 
+// Returns the columns of the specified table as raw pointers.
+std::vector<MatchChainColumn*> ColumnPointers(const MatchChainTable& table) {
+  std::vector<MatchChainColumn*> columns;
+  columns.reserve(table.size());
+  for (const auto& column : table) {
+    columns.push_back(column.get());
+  }
+  return columns;
+}
+
+// Returns a string that identifies the function filter of the specified
+// signature definition.
+std::string FunctionFilterKey(const SignatureDefinition& definition) {
+  std::vector<MemoryAddress> filtered(
+      definition.filtered_function_address().begin(),
+      definition.filtered_function_address().end());
+  std::sort(filtered.begin(), filtered.end());
+  return absl::StrCat(definition.function_filter(), ":",
+                      absl::StrJoin(filtered, ","));
+}
+
+// Returns a string that identifies a loaded match chain table. It covers
+// everything that influences the table, apart from the contents of the input
+// files, which are tracked as cache dependencies.
+std::string MatchChainTableKey(absl::Span<const std::string> diff_results,
+                               const SignatureDefinition& definition,
+                               bool load_disassembly,
+                               bool load_function_hashes) {
+  return absl::StrCat("diffs:", absl::StrJoin(diff_results, "|"),
+                      "\nfilter:", FunctionFilterKey(definition),
+                      "\ndisassembly:", load_disassembly,
+                      "\nfunction_hashes:", load_function_hashes);
+}
+
+// How the diffs of a table connect the diffed binaries, see
+// MatchChainTopology. Binaries are numbered in the order the diffs add them.
+struct DiffTree {
+  std::vector<std::string> binaries;
+  std::vector<int> parents;
+  std::vector<int> incoming_diffs;  // Diff that added each binary
+  std::vector<int> outgoing_diffs;  // First diff with the binary as primary
+
+  // Whether the matches of the diff that added the binary are stored in a
+  // link column instead of in the column of its parent.
+  bool is_link(int binary) const {
+    return binary > 0 &&
+           outgoing_diffs[parents[binary]] != incoming_diffs[binary];
+  }
+  bool is_chain() const {
+    for (int i = 1; i < binaries.size(); ++i) {
+      if (is_link(i)) {
+        return false;
+      }
+    }
+    return true;
+  }
+};
+
+// Builds the tree of the diffs with the specified primary and secondary
+// binaries. Each diff has to add its secondary binary as a child of a binary
+// that is already part of the tree. For a chain, each diff adds a child of
+// the binary added last.
+absl::Status BuildDiffTree(
+    absl::Span<const std::pair<std::string, std::string>> diff_file_pairs,
+    DiffTree* tree) {
+  *tree = DiffTree();
+  absl::flat_hash_map<std::string, int> binary_indices;
+  auto add_binary = [tree, &binary_indices](const std::string& filename,
+                                            int parent, int diff) {
+    binary_indices.emplace(filename, tree->binaries.size());
+    tree->binaries.push_back(filename);
+    tree->parents.push_back(parent);
+    tree->incoming_diffs.push_back(diff);
+    tree->outgoing_diffs.push_back(-1);
+  };
+  add_binary(diff_file_pairs[0].first, /*parent=*/-1, /*diff=*/-1);
+  for (int i = 0; i < diff_file_pairs.size(); ++i) {
+    const auto& pair = diff_file_pairs[i];
+    auto parent = binary_indices.find(pair.first);
+    if (parent == binary_indices.end()) {
+      return absl::FailedPreconditionError(absl::StrCat(
+          "Input files do not form a chain of diffs: ", pair.first,
+          " is not part of an earlier diff"));
+    }
+    if (binary_indices.contains(pair.second)) {
+      return absl::FailedPreconditionError(absl::StrCat(
+          "Input files do not form a chain of diffs: ", pair.second,
+          " is part of more than one diff as secondary binary or of a cycle"));
+    }
+    if (tree->outgoing_diffs[parent->second] == -1) {
+      tree->outgoing_diffs[parent->second] = i;
+    }
+    add_binary(pair.second, parent->second, i);
+  }
+  return absl::OkStatus();
+}
+
 void FillSignatureMetadata(Signature* signature) {
   CHECK(signature);
   auto& signature_definition = *signature->mutable_definition();
@@ -115,8 +230,53 @@ void FillSignatureMetadata(Signature* signature) {
   }
 }
 
+void SetCommonSubsequenceStats(const CommonSubsequenceStats& stats,
+                               GenerationStats::CommonSubsequence* output) {
+  output->set_num_sequences(stats.num_sequences);
+  output->set_total_input_size(stats.total_input_size);
+  output->set_max_input_size(stats.max_input_size);
+  output->set_output_size(stats.output_size);
+  output->set_wall_time_us(absl::ToInt64Microseconds(stats.time));
+}
+
 }  // namespace
 
+absl::Status ParseSignatureManifest(absl::string_view manifest,
+                                    const SignatureDefinition& base_definition,
+                                    std::vector<SignatureRequest>* requests) {
+  if (!requests) {
+    return absl::InvalidArgumentError("Need non-null requests");
+  }
+  absl::flat_hash_set<std::string> detection_names;
+  int line_number = 0;
+  for (absl::string_view line : absl::StrSplit(manifest, '\n')) {
+    ++line_number;
+    line = absl::StripAsciiWhitespace(line);
+    if (line.empty() || absl::StartsWith(line, "#")) {
+      continue;
+    }
+    std::vector<std::string> fields =
+        absl::StrSplit(line, absl::ByAnyChar(" \t"), absl::SkipEmpty());
+    if (fields.size() < 2) {
+      return absl::InvalidArgumentError(absl::StrCat(
+          "Need detection name and diff results in manifest line ",
+          line_number));
+    }
+    if (!detection_names.insert(fields[0]).second) {
+      return absl::InvalidArgumentError(
+          absl::StrCat("Duplicate detection name in manifest line ",
+                       line_number, ": ", fields[0]));
+    }
+    SignatureRequest request;
+    request.definition = base_definition;
+    request.definition.set_detection_name(fields[0]);
+    request.diff_results.assign(std::make_move_iterator(fields.begin() + 1),
+                                std::make_move_iterator(fields.end()));
+    requests->push_back(std::move(request));
+  }
+  return absl::OkStatus();
+}
+
 void AvSignatureGenerator::AddDiffResultsFromCommandLineArguments(
     int argc, char* argv[]) {
   AddDiffResults(&argv[0], &argv[argc]);
@@ -126,93 +286,236 @@ void AvSignatureGenerator::AddDiffResults(absl::Span<const std::string> files) {
   AddDiffResults(files.begin(), files.end());
 }
 
-absl::Status AvSignatureGenerator::LoadColumnData() {
+absl::Status AvSignatureGenerator::LoadColumnData(
+    absl::Span<MatchChainColumn* const> columns) {
   absl::PrintF("Loading function metadata and instruction data\n");
-  for (const auto& column : match_chain_table_) {
-    NA_RETURN_IF_ERROR(
-        AddFunctionData(JoinPath(column->diff_directory(), column->filename())
-                            .append(".BinExport"),
-                        column.get()));
+  stats_.set_num_loaded_columns(stats_.num_loaded_columns() + columns.size());
+  return ParallelForWithStatus(
+      columns.size(), thread_pool_.get(), [this, columns](int i) {
+        auto* column = columns[i];
+        return AddFunctionData(
+            JoinPath(column->diff_directory(), column->filename())
+                .append(".BinExport"),
+            column, load_disassembly_,
+            /*load_function_hashes=*/function_prevalence_index_ != nullptr);
+      });
+}
+
+absl::Status AvSignatureGenerator::ParseDiffColumns(
+    absl::Span<const std::string> files,
+    absl::Span<MatchChainColumn* const> columns,
+    std::vector<std::pair<std::string, std::string>>* diff_file_pairs,
+    std::vector<int64_t>* num_rows) {
+  absl::PrintF("Parsing diff results\n");
+  // Each diff result only touches its own column, so they can be parsed
+  // independently.
+  diff_file_pairs->assign(files.size(), {});
+  if (num_rows) {
+    num_rows->assign(files.size(), 0);
   }
+  // Readers keep their connection and prepared statements, so hand idle ones
+  // to the next task instead of creating one per file.
+  absl::Mutex readers_mutex;
+  std::vector<std::unique_ptr<BinDiffReader>> idle_readers;
+  BinDiffReadStats read_stats;
+  NA_RETURN_IF_ERROR(ParallelForWithStatus(
+      files.size(), thread_pool_.get(),
+      [files, columns, diff_file_pairs, num_rows, &readers_mutex,
+       &idle_readers, &read_stats](int i) -> absl::Status {
+        std::unique_ptr<BinDiffReader> reader;
+        {
+          absl::MutexLock lock(&readers_mutex);
+          if (!idle_readers.empty()) {
+            reader = std::move(idle_readers.back());
+            idle_readers.pop_back();
+          }
+        }
+        if (!reader) {
+          NA_ASSIGN_OR_RETURN(reader, BinDiffReader::Create());
+        }
+        absl::Status status = AddDiffResult(files[i], reader.get(), columns[i],
+                                            &(*diff_file_pairs)[i]);
+        if (num_rows) {
+          (*num_rows)[i] = reader->last_stats().num_rows;
+        }
+        absl::MutexLock lock(&readers_mutex);
+        read_stats.Add(reader->last_stats());
+        idle_readers.push_back(std::move(reader));
+        return status;
+      }));
+  absl::PrintF(
+      "  Read %d rows from %d files (open: %s, metadata: %s, matches: %s)\n",
+      read_stats.num_rows, read_stats.num_files,
+      absl::FormatDuration(read_stats.open_time),
+      absl::FormatDuration(read_stats.metadata_time),
+      absl::FormatDuration(read_stats.match_time));
   return absl::OkStatus();
 }
 
 absl::Status AvSignatureGenerator::ParseDiffResults() {
-  const auto num_diffs = diff_results_.size();
+  const auto num_diffs = table_diff_results_.size();
 
-  absl::PrintF("Parsing diff results\n");
+  // Each diff is parsed into a column of its own first, the diffed binaries
+  // are only known afterwards.
+  std::vector<std::unique_ptr<MatchChainColumn>> diff_columns(
+      std::make_move_iterator(match_chain_table_.begin()),
+      std::make_move_iterator(match_chain_table_.begin() + num_diffs));
+  match_chain_table_.clear();
   std::vector<std::pair<std::string, std::string>> diff_file_pairs;
-  auto column = match_chain_table_.begin();
-  for (int i = 0; i < num_diffs; ++i, ++column) {
-    auto next = column + 1;
-    NA_RETURN_IF_ERROR(
-        AddDiffResult(diff_results_[i], i == num_diffs - 1 /* Last column */,
-                      column->get(), next->get(), &diff_file_pairs));
+  NA_RETURN_IF_ERROR(ParseDiffColumns(table_diff_results_,
+                                      ColumnPointers(diff_columns),
+                                      &diff_file_pairs, &diff_rows_));
+
+  DiffTree tree;
+  NA_RETURN_IF_ERROR(BuildDiffTree(diff_file_pairs, &tree));
+  const auto& binaries = tree.binaries;
+  const auto& parents = tree.parents;
+
+  // A binary with children uses the column of its first diff, like in a
+  // chain. The columns of further diffs of the same binary become links.
+  // Binaries without children are terminated like the end of a chain.
+  topology_ = MatchChainTopology();
+  topology_.parents = parents;
+  topology_.links.resize(binaries.size());
+  for (int i = 1; i < binaries.size(); ++i) {
+    if (tree.is_link(i)) {
+      topology_.links[i] = std::move(diff_columns[tree.incoming_diffs[i]]);
+    }
   }
-  for (int i = 0; i < diff_file_pairs.size(); ++i) {
-    const auto& pair = diff_file_pairs[i];
-    if (match_chain_table_[i]->filename() != pair.first ||
-        match_chain_table_[i + 1]->filename() != pair.second) {
-      return absl::FailedPreconditionError(
-          "Input files do not form a chain of diffs");
+  for (int i = 0; i < binaries.size(); ++i) {
+    std::unique_ptr<MatchChainColumn> column;
+    if (tree.outgoing_diffs[i] != -1) {
+      column = std::move(diff_columns[tree.outgoing_diffs[i]]);
+    } else {
+      const int parent = parents[i];
+      const MatchChainColumn* prev =
+          topology_.links[i] ? topology_.links[i].get()
+                             : match_chain_table_[parent].get();
+      column = absl::make_unique<MatchChainColumn>();
+      column->set_intern_pool(intern_pool_.get());
+      column->set_filename(binaries[i]);
+      column->set_diff_directory(prev->diff_directory());
+      // Only the address_in_next of prev is used, which is still valid in
+      // the parent column if that was already moved to the table.
+      column->FinishChain(prev);
+    }
+    match_chain_table_.push_back(std::move(column));
+  }
+  if (tree.is_chain()) {
+    topology_ = MatchChainTopology();
+  } else {
+    absl::PrintF("  Diffs form a tree of %d binaries\n", binaries.size());
+    // Each table column reports the rows of the diff it holds, the rows of
+    // the link columns are not reported.
+    std::vector<int64_t> diff_rows(binaries.size(), 0);
+    for (int i = 0; i < binaries.size(); ++i) {
+      if (tree.outgoing_diffs[i] != -1) {
+        diff_rows[i] = diff_rows_[tree.outgoing_diffs[i]];
+      }
     }
+    diff_rows_ = std::move(diff_rows);
   }
+
+  // All matches are known now, switch the columns to their compact storage.
+  ParallelFor(match_chain_table_.size(), thread_pool_.get(),
+              [this](int i) { match_chain_table_[i]->Compact(); });
+  ParallelFor(topology_.links.size(), thread_pool_.get(), [this](int i) {
+    if (topology_.links[i]) {
+      topology_.links[i]->Compact();
+    }
+  });
   return absl::OkStatus();
 }
 
 absl::Status AvSignatureGenerator::SetFunctionWeights(
     const IdentSequence& func_candidate_ids) {
-  // TODO(cblichmann): Query for function occurrence counts and fill the map.
-  using FunctionId = std::pair<std::string, Address>;
-  absl::flat_hash_map<FunctionId, uint32_t> occurrence_counts;
-  if (occurrence_counts.size() == 0) {
+  if (!function_prevalence_index_) {
     return absl::OkStatus();
   }
-  for (int i = 0; i < func_candidate_ids.size(); ++i) {
+  std::vector<MatchedFunction*> functions;
+  std::vector<uint64_t> hashes;
+  functions.reserve(func_candidate_ids.size() * match_chain_table_.size());
+  hashes.reserve(functions.capacity());
+  for (const auto& id : func_candidate_ids) {
     for (const auto& column : match_chain_table_) {
-      auto* function = column->FindFunctionById(func_candidate_ids[i]);
-
-      auto found = occurrence_counts.find(
-          FunctionId{column->sha256(), function->match.address});
-      if (found == occurrence_counts.end()) {
-        continue;
-      }
-      for (auto& basic_block : function->basic_blocks) {
-        basic_block->weight = kuint32max - found->second;
+      auto* function = column->FindFunctionById(id);
+      if (function && function->function_hash != 0) {
+        functions.push_back(function);
+        hashes.push_back(function->function_hash);
       }
     }
   }
+  std::vector<uint32_t> counts(hashes.size());
+  function_prevalence_index_->Lookup(hashes, absl::MakeSpan(counts));
+
+  const uint32_t num_binaries = function_prevalence_index_->num_binaries();
+  for (int i = 0; i < functions.size(); ++i) {
+    const int weight = std::min<uint32_t>(
+        num_binaries - std::min(counts[i], num_binaries),
+        std::numeric_limits<int>::max());
+    for (auto& basic_block : functions[i]->basic_blocks) {
+      basic_block->weight = weight;
+    }
+  }
   return absl::OkStatus();
 }
 
-absl::Status AvSignatureGenerator::ComputeCandidates() {
+absl::Status AvSignatureGenerator::ComputeCandidateIds() {
   absl::PrintF("Building id chains and indices\n");
-  PropagateIds(&match_chain_table_);
-  BuildIdIndices(&match_chain_table_);
+  ChainLengthHistogram chain_lengths;
+  {
+    StageTimer timer("build_id_chains", &stats_);
+    PropagateIds(&match_chain_table_, topology_, thread_pool_.get(),
+                 &chain_lengths);
+    BuildIdIndices(&match_chain_table_, thread_pool_.get());
+  }
+  if (debug_match_chain_) {
+    absl::PrintF("  Chain length  Functions  Basic blocks\n");
+    for (int i = 0; i < chain_lengths.functions.size(); ++i) {
+      absl::PrintF("  %12d  %9d  %12d\n", i + 1, chain_lengths.functions[i],
+                   chain_lengths.basic_blocks[i]);
+    }
+  }
 
   absl::PrintF("Computing function candidates\n");
-  IdentSequence func_candidate_ids;
-  ComputeFunctionCandidates(match_chain_table_, &func_candidate_ids);
-  if (func_candidate_ids.empty()) {
+  func_candidate_ids_.clear();
+  CommonSubsequenceStats lcs_stats;
+  {
+    StageTimer timer("function_candidates", &stats_);
+    ComputeFunctionCandidates(match_chain_table_, candidate_pruning_,
+                              &func_candidate_ids_, thread_pool_.get(),
+                              &lcs_stats);
+  }
+  SetCommonSubsequenceStats(lcs_stats, stats_.mutable_function_candidates());
+  if (func_candidate_ids_.empty()) {
     if (debug_match_chain_) {
       // Report if we couldn't find any function candidates. This won't help the
       // user directly, but it'll at least allow to examine the logs to figure
       // out what was wrong.
-      DumpMatchChainTable(match_chain_table_, func_candidate_ids);
+      DumpMatchChainTable(match_chain_table_, func_candidate_ids_);
     }
     return absl::FailedPreconditionError("No function candidates found");
   }
-  absl::PrintF("  Function candidates found: %d\n", func_candidate_ids.size());
+  absl::PrintF("  Function candidates found: %d\n", func_candidate_ids_.size());
   if (debug_match_chain_) {
-    DumpMatchChainTable(match_chain_table_, func_candidate_ids);
+    DumpMatchChainTable(match_chain_table_, func_candidate_ids_);
   }
 
   absl::PrintF("  Querying for function prevalence per candidate\n");
-  NA_RETURN_IF_ERROR(SetFunctionWeights(func_candidate_ids));
+  {
+    StageTimer timer("function_weights", &stats_);
+    NA_RETURN_IF_ERROR(SetFunctionWeights(func_candidate_ids_));
+  }
 
   absl::PrintF("Computing basic block candidates\n");
-  ComputeBasicBlockCandidates(match_chain_table_, func_candidate_ids,
-                              &bb_candidate_ids_);
+  {
+    StageTimer timer("basic_block_candidates", &stats_);
+    ComputeBasicBlockCandidates(match_chain_table_, candidate_pruning_,
+                                func_candidate_ids_, &bb_candidate_ids_,
+                                thread_pool_.get(), &lcs_stats);
+  }
+  SetCommonSubsequenceStats(lcs_stats,
+                            stats_.mutable_basic_block_candidates());
   if (bb_candidate_ids_.empty()) {
     return absl::FailedPreconditionError("No basic block candidates found");
   }
@@ -221,40 +524,441 @@ absl::Status AvSignatureGenerator::ComputeCandidates() {
   return absl::OkStatus();
 }
 
-absl::Status AvSignatureGenerator::Generate(Signature* signature) {
-  if (!signature) {
-    return absl::InvalidArgumentError("Need non-null signature object");
+absl::Status AvSignatureGenerator::SelectDiffResults(
+    const SignatureDefinition& definition,
+    absl::Span<const std::string> diff_results,
+    std::vector<std::string>* selected) {
+  selected->clear();
+  if (definition.item_selection() != SignatureDefinition::ITEMS_SIMILAR) {
+    selected->assign(diff_results.begin(), diff_results.end());
+    return absl::OkStatus();
   }
-  const auto& signature_definition = signature->definition();
+  std::unique_ptr<BinDiffReader> reader;
+  std::vector<BinDiffSummary> summaries(diff_results.size());
+  for (int i = 0; i < diff_results.size(); ++i) {
+    auto found = diff_summaries_.find(diff_results[i]);
+    if (found != diff_summaries_.end()) {
+      summaries[i] = found->second;
+      continue;
+    }
+    if (!reader) {
+      NA_ASSIGN_OR_RETURN(reader, BinDiffReader::Create());
+    }
+    NA_RETURN_IF_ERROR(reader->ReadSummary(diff_results[i], &summaries[i]));
+    diff_summaries_.emplace(diff_results[i], summaries[i]);
+  }
+  const double min_similarity = definition.items_min_similarity();
+  for (const int index : SelectSimilarDiffs(
+           summaries, min_similarity,
+           /*keep_root=*/definition.function_filter() !=
+               SignatureDefinition::FILTER_NONE)) {
+    selected->push_back(diff_results[index]);
+  }
+  absl::PrintF("Selected %d of %d diff results with similarity >= %g\n",
+               selected->size(), diff_results.size(), min_similarity);
+  if (selected->empty()) {
+    return absl::FailedPreconditionError(absl::StrCat(
+        "No diff results with a similarity of at least ", min_similarity));
+  }
+  return absl::OkStatus();
+}
+
+std::vector<std::string> AvSignatureGenerator::SharedColumnKeys(
+    absl::Span<const std::string> diff_results,
+    const SignatureDefinition& definition) const {
+  const int num_diffs = diff_results.size();
+  std::vector<std::string> keys;
+  keys.reserve(2 * num_diffs);
+  for (int i = 0; i < num_diffs; ++i) {
+    const bool filtered = i == 0 && definition.function_filter() !=
+                                        SignatureDefinition::FILTER_NONE;
+    keys.push_back(absl::StrCat(
+        filtered ? absl::StrCat("filtered:", FunctionFilterKey(definition))
+                 : "diff",
+        "\ndisassembly:", load_disassembly_,
+        "\nfunction_hashes:", function_prevalence_index_ != nullptr, "\n",
+        diff_results[i]));
+  }
+  for (int i = 0; i < num_diffs; ++i) {
+    keys.push_back(absl::StrCat("last:", keys[i]));
+  }
+  return keys;
+}
+
+absl::Status AvSignatureGenerator::LoadMatchChainTableFromSharedColumns(
+    const SignatureDefinition& definition) {
+  const int num_diffs = table_diff_results_.size();
+  const std::vector<std::string> keys =
+      SharedColumnKeys(table_diff_results_, definition);
+  // By key index, like keys.
+  std::vector<std::shared_ptr<const CachedColumn>> entries(keys.size());
+  int num_columns = 0;
+  int num_cached = 0;
+
+  // Columns are loaded in two rounds, first the ones of the diffs, then the
+  // ones of the binaries without children, which are derived from the diffs
+  // that added them. In each round, the columns that another job of the batch
+  // claimed are waited for only after publishing the ones claimed here.
+  std::vector<int> claimed;
+  std::vector<int> pending;
+  std::vector<int> missing;
+  // The columns loaded for missing, in the same order.
+  std::vector<std::shared_ptr<CachedColumn>> loaded;
+  auto lookup = [this, &keys, &entries, &num_columns, &num_cached, &claimed,
+                 &pending, &missing](int index) {
+    ++num_columns;
+    if (column_batch_ && !column_batch_->Claim(keys[index])) {
+      ++num_cached;
+      pending.push_back(index);
+      return;
+    }
+    claimed.push_back(index);
+    if (column_cache_) {
+      entries[index] = column_cache_->Lookup(keys[index]);
+    }
+    if (entries[index]) {
+      ++num_cached;
+    } else {
+      missing.push_back(index);
+    }
+  };
+  auto share = [this, &keys, &entries, &claimed, &pending, &missing,
+                &loaded](const absl::Status& status) -> absl::Status {
+    if (status.ok() && column_cache_) {
+      for (int i = 0; i < loaded.size(); ++i) {
+        column_cache_->Insert(keys[missing[i]], loaded[i]);
+      }
+    }
+    if (column_batch_) {
+      for (const int index : claimed) {
+        column_batch_->Publish(keys[index], status, entries[index]);
+      }
+    }
+    NA_RETURN_IF_ERROR(status);
+    for (const int index : pending) {
+      NA_RETURN_IF_ERROR(column_batch_->Wait(keys[index], &entries[index]));
+    }
+    claimed.clear();
+    pending.clear();
+    missing.clear();
+    loaded.clear();
+    return absl::OkStatus();
+  };
+  // Loads the column data of the missing columns. The BinExport stamps are
+  // taken before reading, so that files that change while they are read
+  // invalidate the entry.
+  auto load_column_data = [this, &entries, &missing,
+                           &loaded]() -> absl::Status {
+    std::vector<MatchChainColumn*> columns;
+    columns.reserve(loaded.size());
+    for (int i = 0; i < loaded.size(); ++i) {
+      auto& entry = *loaded[i];
+      const std::string binexport =
+          JoinPath(entry.column->diff_directory(), entry.column->filename())
+              .append(".BinExport");
+      FileStamp stamp;
+      NA_RETURN_IF_ERROR(GetFileStamp(binexport, &stamp));
+      entry.dependencies.emplace_back(binexport, stamp);
+      columns.push_back(entry.column.get());
+    }
+    ParallelFor(columns.size(), thread_pool_.get(),
+                [&columns](int i) { columns[i]->Compact(); });
+    StageTimer timer("load_column_data", &stats_);
+    NA_RETURN_IF_ERROR(LoadColumnData(columns));
+    for (int i = 0; i < loaded.size(); ++i) {
+      entries[missing[i]] = loaded[i];
+    }
+    return absl::OkStatus();
+  };
+  auto new_entry = [&loaded]() {
+    auto entry = std::make_shared<CachedColumn>();
+    entry->intern_pool = absl::make_unique<InternPool>();
+    entry->column = absl::make_unique<MatchChainColumn>();
+    entry->column->set_intern_pool(entry->intern_pool.get());
+    loaded.push_back(entry);
+    return entry.get();
+  };
+
+  // Parse the missing diff columns. Stamps are taken before reading, like
+  // the ones of the BinExport files.
+  for (int i = 0; i < num_diffs; ++i) {
+    lookup(i);
+  }
+  NA_RETURN_IF_ERROR(share([&]() -> absl::Status {
+    if (missing.empty()) {
+      return absl::OkStatus();
+    }
+    std::vector<std::string> files;
+    std::vector<MatchChainColumn*> columns;
+    for (const int i : missing) {
+      auto& entry = *new_entry();
+      if (i == 0) {
+        entry.column->set_function_filter(definition.function_filter());
+        for (const auto& address : definition.filtered_function_address()) {
+          entry.column->AddFilteredFunction(address);
+        }
+      }
+      FileStamp stamp;
+      NA_RETURN_IF_ERROR(GetFileStamp(table_diff_results_[i], &stamp));
+      entry.dependencies.emplace_back(table_diff_results_[i], stamp);
+      files.push_back(table_diff_results_[i]);
+      columns.push_back(entry.column.get());
+    }
+    {
+      StageTimer timer("parse_diff_results", &stats_);
+      std::vector<std::pair<std::string, std::string>> diff_file_pairs;
+      std::vector<int64_t> num_rows;
+      NA_RETURN_IF_ERROR(
+          ParseDiffColumns(files, columns, &diff_file_pairs, &num_rows));
+      for (int i = 0; i < loaded.size(); ++i) {
+        loaded[i]->secondary_filename = diff_file_pairs[i].second;
+        loaded[i]->num_diff_rows = num_rows[i];
+      }
+    }
+    return load_column_data();
+  }()));
+
+  std::vector<std::pair<std::string, std::string>> diff_file_pairs;
+  diff_file_pairs.reserve(num_diffs);
+  for (int i = 0; i < num_diffs; ++i) {
+    diff_file_pairs.emplace_back(entries[i]->column->filename(),
+                                 entries[i]->secondary_filename);
+  }
+  DiffTree tree;
+  NA_RETURN_IF_ERROR(BuildDiffTree(diff_file_pairs, &tree));
+  const int num_binaries = tree.binaries.size();
+
+  // Binaries with children use the column of their first diff, like in
+  // ParseDiffResults(). The others terminate a chain and are keyed by the
+  // diff that added them, as they only depend on that.
+  for (int i = 0; i < num_binaries; ++i) {
+    if (tree.outgoing_diffs[i] == -1) {
+      lookup(num_diffs + tree.incoming_diffs[i]);
+    }
+  }
+  NA_RETURN_IF_ERROR(share([&]() -> absl::Status {
+    if (missing.empty()) {
+      return absl::OkStatus();
+    }
+    for (const int index : missing) {
+      const CachedColumn& prev = *entries[index - num_diffs];
+      auto& entry = *new_entry();
+      entry.column->set_filename(prev.secondary_filename);
+      entry.column->set_diff_directory(prev.column->diff_directory());
+      entry.column->FinishChain(prev.column.get());
+      // Depends on the diff result of the column before it, not on its
+      // BinExport file.
+      entry.dependencies.push_back(prev.dependencies.front());
+    }
+    return load_column_data();
+  }()));
+  absl::PrintF("Reusing %d of %d shared columns\n", num_cached, num_columns);
+
+  // Later stages store chain specific ids in the columns, so the table gets
+  // its own copies. For trees, the diffs that are not stored in the column of
+  // their primary binary become links.
+  const bool is_chain = tree.is_chain();
+  if (!is_chain) {
+    absl::PrintF("  Diffs form a tree of %d binaries\n", num_binaries);
+    topology_.parents = tree.parents;
+    topology_.links.resize(num_binaries);
+  }
+  std::vector<std::shared_ptr<const CachedColumn>> binary_entries(
+      num_binaries);
+  match_chain_table_.reserve(num_binaries);
+  for (int i = 0; i < num_binaries; ++i) {
+    binary_entries[i] = tree.outgoing_diffs[i] != -1
+                            ? entries[tree.outgoing_diffs[i]]
+                            : entries[num_diffs + tree.incoming_diffs[i]];
+    match_chain_table_.push_back(binary_entries[i]->column->Clone());
+    // Zero for binaries without children.
+    diff_rows_.push_back(binary_entries[i]->num_diff_rows);
+    if (tree.is_link(i)) {
+      topology_.links[i] = entries[tree.incoming_diffs[i]]->column->Clone();
+    }
+  }
+  if (is_chain) {
+    diff_rows_.pop_back();
+  }
+  cached_columns_ = std::move(binary_entries);
+  cached_columns_.insert(cached_columns_.end(), entries.begin(),
+                         entries.begin() + num_diffs);
+  return absl::OkStatus();
+}
+
+void AvSignatureGenerator::Reset() {
+  ResetTable();
+  diff_summaries_.clear();
+}
+
+void AvSignatureGenerator::ResetTable() {
+  candidates_computed_ = false;
+  func_candidate_ids_.clear();
+  bb_common_ids_.clear();
+  bb_candidate_ids_.clear();
+  loaded_table_key_.clear();
+  loaded_table_definition_.Clear();
+  match_chain_table_.clear();
+  topology_ = MatchChainTopology();
+  table_diff_results_.clear();
+  diff_rows_.clear();
+  spill_file_.reset();
+  table_pruned_ = false;
+  cached_columns_.clear();
+  intern_pool_.reset();
+}
 
+void AvSignatureGenerator::UpdateThreadPool() {
+  if (num_threads_ == 1) {
+    thread_pool_.reset();
+  } else if (!thread_pool_ || thread_pool_->num_threads() != num_threads_) {
+    thread_pool_ = absl::make_unique<ThreadPool>(num_threads_);
+  }
+}
+
+absl::Status AvSignatureGenerator::LoadMatchChainTable(
+    const SignatureDefinition& definition) {
   if (diff_results_.empty()) {
     return absl::FailedPreconditionError(
         "Need to call one of the methods from the AddDiffResults*() family "
         "first");
   }
+  std::vector<std::string> diff_results;
+  if (definition.item_selection() == SignatureDefinition::ITEMS_SIMILAR) {
+    StageTimer timer("select_items", &stats_);
+    NA_RETURN_IF_ERROR(
+        SelectDiffResults(definition, diff_results_, &diff_results));
+  } else {
+    diff_results = diff_results_;
+  }
+  // The key covers all inputs of this stage, so it doubles as the check
+  // whether the table is up to date.
+  std::string cache_key =
+      MatchChainTableKey(diff_results, definition, load_disassembly_,
+                         function_prevalence_index_ != nullptr);
+  // A pruned table only holds the candidates it was pruned to, so it cannot
+  // be used to compute new ones.
+  if (cache_key == loaded_table_key_ &&
+      (candidates_computed_ || !table_pruned_)) {
+    absl::PrintF("Reusing loaded match chain table\n");
+    return absl::OkStatus();
+  }
+  ResetTable();
+  table_diff_results_ = std::move(diff_results);
+  loaded_table_definition_ = definition;
+  intern_pool_ = absl::make_unique<InternPool>();
 
-  match_chain_table_.clear();
-  auto num_diffs = diff_results_.size();
+  if (column_cache_ || column_batch_) {
+    absl::Status status = LoadMatchChainTableFromSharedColumns(definition);
+    if (!status.ok()) {
+      ResetTable();
+      return status;
+    }
+    loaded_table_key_ = std::move(cache_key);
+    return absl::OkStatus();
+  }
+
+  std::string cache_filename;
+  if (!cache_directory_.empty()) {
+    cache_filename = JoinPath(
+        cache_directory_,
+        absl::StrCat(absl::Hex(absl::hash_internal::CityHash64(
+                                   cache_key.data(), cache_key.size()),
+                               absl::kZeroPad16),
+                     ".vxsigcache"));
+    absl::Status status;
+    {
+      StageTimer timer("read_cache", &stats_);
+      status = ReadMatchChainCache(cache_filename, cache_key,
+                                   intern_pool_.get(), &match_chain_table_);
+    }
+    if (status.ok()) {
+      absl::PrintF("Loaded match chain table from %s\n", cache_filename);
+      loaded_table_key_ = std::move(cache_key);
+      return absl::OkStatus();
+    }
+    if (status.code() != absl::StatusCode::kNotFound) {
+      absl::PrintF("Ignoring match chain cache: %s\n", status.message());
+    }
+    match_chain_table_.clear();
+  }
+
+  auto num_diffs = table_diff_results_.size();
   // One more binary than there are diffs.
   match_chain_table_.reserve(num_diffs + 1);
   for (int i = 0; i < num_diffs + 1; ++i) {
     match_chain_table_.emplace_back(absl::make_unique<MatchChainColumn>());
+    match_chain_table_.back()->set_intern_pool(intern_pool_.get());
   }
 
   // Apply function filter
   auto* column = match_chain_table_[0].get();
-  column->set_function_filter(signature_definition.function_filter());
-  for (const auto& address : signature_definition.filtered_function_address()) {
+  column->set_function_filter(definition.function_filter());
+  for (const auto& address : definition.filtered_function_address()) {
     column->AddFilteredFunction(address);
   }
 
-  NA_RETURN_IF_ERROR(ParseDiffResults());
-  NA_RETURN_IF_ERROR(LoadColumnData());
-  NA_RETURN_IF_ERROR(ComputeCandidates());
+  absl::Status status;
+  {
+    StageTimer timer("parse_diff_results", &stats_);
+    status = ParseDiffResults();
+  }
+  if (status.ok()) {
+    StageTimer timer("load_column_data", &stats_);
+    status = LoadColumnData(ColumnPointers(match_chain_table_));
+  }
+  if (!status.ok()) {
+    // Do not keep a partially loaded table around.
+    ResetTable();
+    return status;
+  }
+  loaded_table_key_ = cache_key;
+
+  if (!topology_.parents.empty()) {
+    // The cache only stores chains.
+    cache_filename.clear();
+  }
+  if (!cache_filename.empty()) {
+    std::vector<std::string> dependencies(table_diff_results_);
+    for (const auto& column : match_chain_table_) {
+      dependencies.push_back(
+          JoinPath(column->diff_directory(), column->filename())
+              .append(".BinExport"));
+    }
+    // Failing to write the cache is not fatal, the next run just has to
+    // load the table again.
+    StageTimer timer("write_cache", &stats_);
+    absl::Status status = WriteMatchChainCache(
+        cache_filename, cache_key, dependencies, match_chain_table_);
+    if (!status.ok()) {
+      absl::PrintF("Failed to write match chain cache: %s\n",
+                   status.message());
+    }
+  }
+  return absl::OkStatus();
+}
+
+absl::Status AvSignatureGenerator::ComputeCandidates() {
+  if (loaded_table_key_.empty()) {
+    return absl::FailedPreconditionError(
+        "Need to load the match chain table first");
+  }
+  if (candidates_computed_) {
+    absl::PrintF("Reusing %d basic block candidates\n",
+                 bb_candidate_ids_.size());
+    return absl::OkStatus();
+  }
+  bb_candidate_ids_.clear();
+  NA_RETURN_IF_ERROR(ComputeCandidateIds());
 
+  bb_common_ids_ = bb_candidate_ids_;
   absl::PrintF("Filtering basic block overlaps and removing gaps\n");
   size_t size_before = bb_candidate_ids_.size();
-  FilterBasicBlockOverlaps(match_chain_table_, &bb_candidate_ids_);
+  {
+    StageTimer timer("filter_overlaps", &stats_);
+    FilterBasicBlockOverlaps(match_chain_table_, &bb_candidate_ids_,
+                             thread_pool_.get());
+  }
   absl::PrintF("  Removed %d, %d remain\n",
                size_before - bb_candidate_ids_.size(),
                bb_candidate_ids_.size());
@@ -262,13 +966,192 @@ absl::Status AvSignatureGenerator::Generate(Signature* signature) {
     return absl::FailedPreconditionError(
         "All basic blocks overlap, input data is probably bad");
   }
+  candidates_computed_ = true;
+  if (rss_target_ > 0) {
+    ReduceMemoryUse();
+  }
+  return absl::OkStatus();
+}
+
+absl::Status AvSignatureGenerator::AppendDiffResult(
+    const std::string& diff_result) {
+  if (!candidates_computed_) {
+    return absl::FailedPreconditionError("Need to compute candidates first");
+  }
+  if (!topology_.parents.empty()) {
+    return absl::FailedPreconditionError(
+        "Can only append to a chain of diffs");
+  }
+  UpdateThreadPool();
+  stats_.Clear();
+  if (!intern_pool_) {
+    // The payloads of the table were spilled.
+    intern_pool_ = absl::make_unique<InternPool>();
+  }
+
+  // The new diff replaces the terminating column with one that holds its
+  // matches, and is terminated by a column of its own.
+  auto column = absl::make_unique<MatchChainColumn>();
+  column->set_intern_pool(intern_pool_.get());
+  std::vector<std::pair<std::string, std::string>> diff_file_pairs;
+  std::vector<int64_t> num_rows;
+  {
+    StageTimer timer("parse_diff_results", &stats_);
+    NA_RETURN_IF_ERROR(ParseDiffColumns({diff_result}, {column.get()},
+                                        &diff_file_pairs, &num_rows));
+  }
+  const auto& diff_file_pair = diff_file_pairs[0];
+  const auto& prev = *match_chain_table_.back();
+  if (diff_file_pair.first != prev.filename()) {
+    return absl::FailedPreconditionError(absl::StrCat(
+        "Input files do not form a chain of diffs: ", diff_file_pair.first,
+        " is not the last binary of the chain"));
+  }
+  for (const auto& table_column : match_chain_table_) {
+    if (table_column->filename() == diff_file_pair.second) {
+      return absl::FailedPreconditionError(absl::StrCat(
+          "Input files do not form a chain of diffs: ", diff_file_pair.second,
+          " is part of more than one diff as secondary binary or of a cycle"));
+    }
+  }
+  auto next = absl::make_unique<MatchChainColumn>();
+  next->set_intern_pool(intern_pool_.get());
+  next->set_filename(diff_file_pair.second);
+  next->set_diff_directory(column->diff_directory());
+  next->FinishChain(column.get());
+  column->Compact();
+  next->Compact();
+  {
+    StageTimer timer("load_column_data", &stats_);
+    NA_RETURN_IF_ERROR(LoadColumnData({column.get(), next.get()}));
+  }
+
+  {
+    StageTimer timer("build_id_chains", &stats_);
+    ExtendIds(prev, column.get(), next.get());
+    column->BuildIdIndices();
+    next->BuildIdIndices();
+  }
+  match_chain_table_.back() = std::move(column);
+  match_chain_table_.push_back(std::move(next));
+  diff_rows_.resize(match_chain_table_.size() - 2);
+  diff_rows_.push_back(num_rows[0]);
+  diff_results_.push_back(diff_result);
+  table_diff_results_.push_back(diff_result);
+  // Generate() reuses the extended table.
+  loaded_table_key_ = MatchChainTableKey(
+      table_diff_results_, loaded_table_definition_, load_disassembly_,
+      function_prevalence_index_ != nullptr);
+
+  // From here on, the state is only consistent with the candidates narrowed.
+  candidates_computed_ = false;
+  const std::vector<MatchChainColumn*> new_columns = {
+      match_chain_table_[match_chain_table_.size() - 2].get(),
+      match_chain_table_.back().get()};
+  CommonSubsequenceStats lcs_stats;
+  {
+    StageTimer timer("function_candidates", &stats_);
+    NarrowFunctionCandidates(new_columns, candidate_pruning_,
+                             &func_candidate_ids_, thread_pool_.get(),
+                             &lcs_stats);
+  }
+  SetCommonSubsequenceStats(lcs_stats, stats_.mutable_function_candidates());
+  if (func_candidate_ids_.empty()) {
+    return absl::FailedPreconditionError("No function candidates found");
+  }
+  {
+    StageTimer timer("function_weights", &stats_);
+    NA_RETURN_IF_ERROR(SetFunctionWeights(func_candidate_ids_));
+  }
+  {
+    StageTimer timer("basic_block_candidates", &stats_);
+    NarrowBasicBlockCandidates(new_columns, candidate_pruning_,
+                               func_candidate_ids_, &bb_common_ids_,
+                               thread_pool_.get(), &lcs_stats);
+  }
+  SetCommonSubsequenceStats(lcs_stats,
+                            stats_.mutable_basic_block_candidates());
+  bb_candidate_ids_ = bb_common_ids_;
+  {
+    StageTimer timer("filter_overlaps", &stats_);
+    FilterBasicBlockOverlaps(match_chain_table_, &bb_candidate_ids_,
+                             thread_pool_.get());
+  }
+  absl::PrintF("Narrowed to %d function and %d basic block candidates\n",
+               func_candidate_ids_.size(), bb_candidate_ids_.size());
+  if (bb_candidate_ids_.empty()) {
+    return absl::FailedPreconditionError("No basic block candidates found");
+  }
+  candidates_computed_ = true;
+  if (rss_target_ > 0) {
+    ReduceMemoryUse();
+  }
+  FinishStats();
+  return absl::OkStatus();
+}
+
+void AvSignatureGenerator::ReduceMemoryUse() {
+  // If the resident set size is unknown, assume that it is above the target.
+  auto above_target = [this] {
+    const int64_t rss = CurrentRssBytes();
+    return rss == 0 || rss > rss_target_;
+  };
+  if (!above_target()) {
+    return;
+  }
+  if (!table_pruned_) {
+    StageTimer timer("prune_table", &stats_);
+    PruneMatchChainTable(bb_candidate_ids_, &match_chain_table_,
+                         thread_pool_.get());
+    table_pruned_ = true;
+    absl::PrintF("Pruned match chain table to %d basic blocks per column\n",
+                 match_chain_table_[0]->basic_blocks_by_address().size());
+  }
+  if (spill_file_ || !above_target()) {
+    return;
+  }
+  std::string directory = spill_directory_;
+  if (directory.empty()) {
+    const char* tmpdir = getenv("TMPDIR");
+    directory = tmpdir && *tmpdir ? tmpdir : "/tmp";
+  }
+  StageTimer timer("spill_payloads", &stats_);
+  auto spill_file_or =
+      SpillInstructionPayloads(directory, &match_chain_table_);
+  if (!spill_file_or.ok()) {
+    absl::PrintF("Failed to spill instruction data: %s\n",
+                 spill_file_or.status().message());
+    return;
+  }
+  spill_file_ = std::move(spill_file_or).ValueOrDie();
+  // Nothing references the pools anymore.
+  cached_columns_.clear();
+  intern_pool_.reset();
+  absl::PrintF("  Spilled %d bytes of instruction data to %s\n",
+               spill_file_->data().size(), directory);
+}
+
+absl::Status AvSignatureGenerator::ConstructSignature(Signature* signature) {
+  if (!signature) {
+    return absl::InvalidArgumentError("Need non-null signature object");
+  }
+  if (!candidates_computed_) {
+    return absl::FailedPreconditionError("Need to compute candidates first");
+  }
+  const auto& signature_definition = signature->definition();
 
   absl::PrintF("Constructing regular expression\n");
+  StageTimer timer("construct_signature", &stats_);
   NA_ASSIGN_OR_RETURN(
       auto raw_signature,
       GenericSignatureFromMatches(match_chain_table_, bb_candidate_ids_,
                                   signature_definition.disable_nibble_masking(),
-                                  signature_definition.min_piece_length()));
+                                  signature_definition.min_piece_length(),
+                                  thread_pool_.get()));
+  if (spill_file_) {
+    // The payloads are paged in again if the signature is reconstructed.
+    spill_file_->DropPages();
+  }
 
   signature->clear_clam_av_signature();
   signature->clear_yara_signature();
@@ -280,4 +1163,171 @@ absl::Status AvSignatureGenerator::Generate(Signature* signature) {
   return absl::OkStatus();
 }
 
+absl::Status AvSignatureGenerator::Generate(Signature* signature) {
+  if (!signature) {
+    return absl::InvalidArgumentError("Need non-null signature object");
+  }
+  UpdateThreadPool();
+  stats_.Clear();
+  absl::Status status = LoadMatchChainTable(signature->definition());
+  if (status.ok()) {
+    status = ComputeCandidates();
+  }
+  if (status.ok()) {
+    status = ConstructSignature(signature);
+  }
+  FinishStats();
+  return status;
+}
+
+void AvSignatureGenerator::FinishStats() {
+  for (int i = 0; i < match_chain_table_.size(); ++i) {
+    const auto& column = *match_chain_table_[i];
+    auto* column_stats = stats_.add_column();
+    column_stats->set_filename(column.filename());
+    if (i < diff_rows_.size()) {
+      column_stats->set_num_diff_rows(diff_rows_[i]);
+    }
+    column_stats->set_num_functions(column.functions_by_address().size());
+    column_stats->set_num_basic_blocks(column.basic_blocks_by_address().size());
+    column_stats->set_num_instructions(
+        column.instructions_by_address().size());
+  }
+  stats_.set_peak_rss_bytes(PeakRssBytes());
+}
+
+absl::Status AvSignatureGenerator::GenerateSignatures(
+    absl::Span<const SignatureRequest> requests, Signatures* signatures,
+    std::vector<absl::Status>* request_statuses) {
+  if (!signatures) {
+    return absl::InvalidArgumentError("Need non-null signature database");
+  }
+  std::vector<absl::Status> statuses(requests.size());
+  // The chain of each request, after item selection.
+  std::vector<std::vector<std::string>> request_diff_results(requests.size());
+  for (int i = 0; i < requests.size(); ++i) {
+    if (requests[i].diff_results.empty()) {
+      statuses[i] =
+          absl::InvalidArgumentError("Need diff results for each request");
+      continue;
+    }
+    statuses[i] = SelectDiffResults(requests[i].definition,
+                                    requests[i].diff_results,
+                                    &request_diff_results[i]);
+  }
+  UpdateThreadPool();
+
+  // Requests that share a table are generated by the same generator. The
+  // columns that the tables of several groups share are loaded only once.
+  struct TableGroup {
+    AvSignatureGenerator generator;
+    SignatureDefinition table_definition;
+    std::vector<int> request_indices;
+    std::vector<std::string> column_keys;
+  };
+  ColumnBatch column_batch;
+  std::vector<std::unique_ptr<TableGroup>> groups;
+  absl::flat_hash_map<std::string, TableGroup*> group_by_key;
+  for (int i = 0; i < requests.size(); ++i) {
+    if (!statuses[i].ok()) {
+      continue;
+    }
+    const auto& request = requests[i];
+    auto& group = group_by_key[MatchChainTableKey(
+        request_diff_results[i], request.definition, load_disassembly_,
+        function_prevalence_index_ != nullptr)];
+    if (group) {
+      group->request_indices.push_back(i);
+      continue;
+    }
+    groups.push_back(absl::make_unique<TableGroup>());
+    group = groups.back().get();
+    group->request_indices.push_back(i);
+    // The items are selected already.
+    group->table_definition = request.definition;
+    group->table_definition.set_item_selection(
+        SignatureDefinition::ITEMS_EXACT);
+    group->column_keys =
+        SharedColumnKeys(request_diff_results[i], group->table_definition);
+    for (const auto& key : group->column_keys) {
+      column_batch.AddUse(key);
+    }
+    auto& generator = group->generator;
+    generator.AddDiffResults(request_diff_results[i]);
+    generator.debug_match_chain_ = debug_match_chain_;
+    generator.load_disassembly_ = load_disassembly_;
+    generator.cache_directory_ = cache_directory_;
+    generator.column_cache_ = column_cache_;
+    generator.column_batch_ = &column_batch;
+    generator.function_prevalence_index_ = function_prevalence_index_;
+    generator.candidate_pruning_ = candidate_pruning_;
+    generator.rss_target_ = rss_target_;
+    generator.spill_directory_ = spill_directory_;
+    // Stages within a job use the same workers as the jobs themselves.
+    generator.num_threads_ = num_threads_;
+    generator.thread_pool_ = thread_pool_;
+  }
+
+  // Unless limited, run the jobs on the same pool as the stages within them.
+  std::unique_ptr<ThreadPool> job_pool;
+  ThreadPool* group_pool = thread_pool_.get();
+  if (num_jobs_ > 0 && num_jobs_ != num_threads_) {
+    if (num_jobs_ > 1) {
+      job_pool = absl::make_unique<ThreadPool>(num_jobs_);
+    }
+    group_pool = job_pool.get();
+  }
+  // Each job builds the table of its group and releases it when done, so at
+  // most one table per job is in memory at the same time. The shared columns
+  // stay in the batch until the last job that uses them is done.
+  std::vector<Signature> results(requests.size());
+  ParallelFor(groups.size(), group_pool,
+              [&groups, &requests, &results, &statuses,
+               &column_batch](int i) {
+                auto& group = *groups[i];
+                auto& generator = group.generator;
+                absl::Status status =
+                    generator.LoadMatchChainTable(group.table_definition);
+                if (status.ok()) {
+                  status = generator.ComputeCandidates();
+                }
+                for (const int request_index : group.request_indices) {
+                  if (!status.ok()) {
+                    statuses[request_index] = status;
+                    continue;
+                  }
+                  auto& signature = results[request_index];
+                  *signature.mutable_definition() =
+                      requests[request_index].definition;
+                  statuses[request_index] =
+                      generator.ConstructSignature(&signature);
+                }
+                generator.ResetTable();
+                for (const auto& key : group.column_keys) {
+                  column_batch.Release(key);
+                }
+              });
+  int64_t num_loaded_columns = 0;
+  for (const auto& group : groups) {
+    num_loaded_columns += group->generator.stats().num_loaded_columns();
+  }
+  stats_.Clear();
+  stats_.set_num_loaded_columns(num_loaded_columns);
+
+  if (!request_statuses) {
+    for (const auto& status : statuses) {
+      NA_RETURN_IF_ERROR(status);
+    }
+  }
+  for (int i = 0; i < results.size(); ++i) {
+    if (statuses[i].ok()) {
+      *signatures->add_signature() = std::move(results[i]);
+    }
+  }
+  if (request_statuses) {
+    *request_statuses = std::move(statuses);
+  }
+  return absl::OkStatus();
+}
+
 }  // namespace security::vxsig
@@ -21,26 +21,57 @@
 //  QCHECK_OK(siggen.Generate());
 //  // Format and print signature, write to file, etc.
 //  // Use the SignatureFormatter class for further processing.
+// The loaded match chain table and the computed candidates are kept between
+// calls to Generate(), so that only the stages that depend on changed
+// settings are run again.
 
 #ifndef VXSIG_SIGGEN_H_
 #define VXSIG_SIGGEN_H_
 
 #include <algorithm>
+#include <cstdint>
 #include <functional>
 #include <memory>
 #include <string>
 #include <utility>
 #include <vector>
 
+#include "absl/container/flat_hash_map.h"
 #include "absl/types/span.h"
 #include "absl/status/status.h"
+#include "absl/strings/string_view.h"
+#include "vxsig/candidates.h"
+#include "vxsig/column_cache.h"
+#include "vxsig/diff_result_reader.h"
+#include "vxsig/function_prevalence.h"
 #include "vxsig/generic_signature.h"
+#include "vxsig/intern_pool.h"
+#include "vxsig/mapped_file.h"
 #include "vxsig/match_chain_table.h"
+#include "vxsig/thread_pool.h"
 #include "vxsig/types.h"
 #include "vxsig/vxsig.pb.h"
 
 namespace security::vxsig {
 
+// A signature to generate as part of a batch, along with the BinDiff result
+// files that form its chain.
+struct SignatureRequest {
+  SignatureDefinition definition;
+  std::vector<std::string> diff_results;
+};
+
+// Parses a manifest of signatures to generate with
+// AvSignatureGenerator::GenerateSignatures(). Each line holds a detection name
+// followed by the BinDiff result files of its chain, separated by whitespace:
+//   Trojan_Sshd sshd.trojan1_vs_sshd.trojan2.BinDiff ...
+// Empty lines and lines starting with '#' are skipped. The definition of each
+// request is a copy of base_definition with the detection name replaced.
+// Detection names must be unique. Appends the requests in manifest order.
+absl::Status ParseSignatureManifest(absl::string_view manifest,
+                                    const SignatureDefinition& base_definition,
+                                    std::vector<SignatureRequest>* requests);
+
 // This class provides methods to conveniently create AV signatures from
 // BinDiff result files and associated BinExport files.
 // For the signature generation to work, the binaries that have been bindiffed
@@ -50,6 +81,15 @@ namespace security::vxsig {
 //   sshd.trojan1.BinExport  sshd.trojan2.BinExport  sshd.trojan3.BinExport
 // bindiffing in a chain gives
 //   sshd.trojan1_vs_sshd.trojan2.BinDiff  sshd.trojan2_vs_sshd.trojan3.BinDiff
+// More generally, the diffs may form a tree, like a star of one reference
+// binary diffed against all others:
+//   sshd.trojan1_vs_sshd.trojan2.BinDiff  sshd.trojan1_vs_sshd.trojan3.BinDiff
+// Each diff has to add its secondary binary to the tree, as the child of a
+// primary binary that is already part of it. The primary binary of the first
+// diff is the root. Trees are not stored in the on-disk cache.
+// With ITEMS_SIMILAR item selection, the order of the diff results does not
+// matter. Diffs below the minimum similarity are dropped, and the rest are
+// ordered by the similarities that BinDiff stored in them.
 class AvSignatureGenerator {
  public:
   AvSignatureGenerator() = default;
@@ -62,6 +102,93 @@ class AvSignatureGenerator {
     return *this;
   }
 
+  // Sets whether to load the instruction disassembly. The disassembly is only
+  // used to annotate the signature pieces, so not loading it saves memory and
+  // time. Defaults to true.
+  AvSignatureGenerator& set_load_disassembly(bool value) {
+    load_disassembly_ = value;
+    return *this;
+  }
+
+  // Sets a directory to cache loaded match chain tables in. If set, a table
+  // that was loaded from the same diff results and with the same function
+  // filter before is read from the cache, skipping the BinDiff and BinExport
+  // readers. The cache is invalidated if any of the input files change.
+  AvSignatureGenerator& set_cache_directory(absl::string_view directory) {
+    cache_directory_ = std::string(directory);
+    return *this;
+  }
+
+  // Sets an in-memory cache of loaded columns, which can be shared by
+  // generators running concurrently. If set, the table is built from copies
+  // of the cached columns, and columns that are missing from the cache are
+  // loaded and added to it. Takes precedence over the cache directory.
+  AvSignatureGenerator& set_column_cache(std::shared_ptr<ColumnCache> cache) {
+    column_cache_ = std::move(cache);
+    return *this;
+  }
+
+  // Sets the number of worker threads to use for the independent stages of
+  // the signature generation. A value of 1 (the default) runs everything on
+  // the calling thread.
+  AvSignatureGenerator& set_num_threads(int value) {
+    num_threads_ = std::max(value, 1);
+    return *this;
+  }
+
+  // Sets the number of jobs, i.e. tables, that GenerateSignatures() works on
+  // at the same time. As each job loads its own table, this bounds the memory
+  // used by tables, candidates and signatures under construction. The stages
+  // within a job use all worker threads. A value of 0 (the default) uses the
+  // number of worker threads.
+  AvSignatureGenerator& set_num_jobs(int value) {
+    num_jobs_ = std::max(value, 0);
+    return *this;
+  }
+
+  // Sets a target for the resident set size of the process in bytes. If
+  // non-zero, memory use is checked once the candidates are known. If it is
+  // above the target, the match chain table is pruned to the candidate basic
+  // blocks. If that is not enough, the remaining instruction payloads are
+  // moved to a memory-mapped file in the spill directory, so that they only
+  // need to be resident while the signature is constructed. A pruned table
+  // is loaded again if its candidates need to be recomputed. Defaults to 0.
+  AvSignatureGenerator& set_rss_target(int64_t bytes) {
+    rss_target_ = std::max<int64_t>(bytes, 0);
+    return *this;
+  }
+
+  // Sets the directory for the spill file used by set_rss_target(). Defaults
+  // to $TMPDIR, or /tmp if that is not set.
+  AvSignatureGenerator& set_spill_directory(absl::string_view directory) {
+    spill_directory_ = std::string(directory);
+    return *this;
+  }
+
+  // Sets an index of how common functions are in a corpus of unrelated
+  // binaries. If set, the basic blocks of function candidates are weighted by
+  // the number of corpus binaries that do not contain the function, so that
+  // weighted trimming prefers code that is specific to the input binaries.
+  AvSignatureGenerator& set_function_prevalence_index(
+      std::shared_ptr<const FunctionPrevalenceIndex> index) {
+    function_prevalence_index_ = std::move(index);
+    candidates_computed_ = false;
+    return *this;
+  }
+
+  // Sets limits on the function and basic block candidates, see
+  // CandidatePruning. Pruning shrinks the inputs of the candidate and
+  // signature construction stages. Defaults to no pruning.
+  AvSignatureGenerator& set_candidate_pruning(const CandidatePruning& pruning) {
+    candidate_pruning_ = pruning;
+    candidates_computed_ = false;
+    return *this;
+  }
+
+  // Discards the loaded match chain table and the computed candidates. Use
+  // this if the input files changed on disk and they should be read again.
+  void Reset();
+
   // Adds the matches of the BinDiff result files specified to the table. For
   // convenience, this method takes the same arguments as the main function. It
   // expects, however, that the argument zero has already been processed, like
@@ -83,40 +210,231 @@ class AvSignatureGenerator {
   // metadata and computes a generic regular expression suitable for formatting
   // to the requested output format. One of the methods from the AddDiffResult*
   // family of methods must have been called before calling this method.
+  // This runs all of the stages below, skipping those that are up to date.
   absl::Status Generate(Signature* signature);
 
+  // Generates one signature per request and stores them in request order in
+  // the specified signature database. Requests with the same chain and
+  // function filter share their table and candidates. Independent requests
+  // run concurrently as separate jobs, see set_num_jobs(). Each job builds its
+  // table when it starts and releases it when done. The columns of BinDiff
+  // results and BinExport files that several tables share are loaded only
+  // once per call, by the first job that needs them, and the other jobs copy
+  // them. A column is released once the last job that uses it is done. If a
+  // column cache is set, it is used as well, so that later calls can reuse
+  // the columns. The on-disk cache is not used. Does not use or change the
+  // table and candidates kept by Generate(). Afterwards, stats() only holds
+  // the number of loaded columns, summed over all jobs.
+  // If request_statuses is null, returns the error of the first failed
+  // request and leaves signatures unchanged. Otherwise, it receives the
+  // status of each request and only the signatures of the successful
+  // requests are stored.
+  absl::Status GenerateSignatures(
+      absl::Span<const SignatureRequest> requests, Signatures* signatures,
+      std::vector<absl::Status>* request_statuses = nullptr);
+
+  // Returns the statistics of the last call to Generate(), also if it failed.
+  // See GenerateSignatures() for the statistics of batches.
+  // Stages that were skipped because they were up to date are not listed.
+  const GenerationStats& stats() const { return stats_; }
+
+  // Stage 1: Fills the match chain table, either from the cache or by parsing
+  // the diff results and loading the column data. Does nothing if the table
+  // was already loaded for the same diff results, function filter and loading
+  // options.
+  absl::Status LoadMatchChainTable(const SignatureDefinition& definition);
+
+  // Stage 2: Computes the basic block candidates for the loaded table and
+  // removes overlapping ones. Does nothing if the candidates for the current
+  // table are already known.
+  absl::Status ComputeCandidates();
+
+  // Appends the matches of one more BinDiff result to the loaded table and
+  // narrows the computed candidates to the ones that the new binary shares,
+  // instead of computing them over all columns again. The primary binary of
+  // the diff must be the last binary of the chain. Requires the candidates
+  // to be computed and the diff results to form a chain. The diff result is
+  // added to the ones of the generator, so that Generate() reuses the
+  // extended table and the narrowed candidates. The narrowed candidates are
+  // common to all binaries, but they may be fewer than computing them from
+  // scratch would find.
+  absl::Status AppendDiffResult(const std::string& diff_result);
+
+  // Stage 3: Constructs the raw signature from the candidates, using the
+  // piece length and masking settings from the signature definition. This
+  // stage always runs.
+  absl::Status ConstructSignature(Signature* signature);
+
  private:
-  // Reads and parses the BinExport data for the BinDiff results in the match
-  // chain table.
-  absl::Status LoadColumnData();
+
+  // Reads and parses the BinExport data for the specified columns. Each column
+  // is loaded as a separate task.
+  absl::Status LoadColumnData(absl::Span<MatchChainColumn* const> columns);
+
+  // Parses the specified BinDiff result files into the respective columns and
+  // stores the filenames of the diffed binaries in diff_file_pairs. The files
+  // are parsed concurrently, one column per task. If num_rows is non-null, it
+  // receives the number of rows read from each file.
+  absl::Status ParseDiffColumns(
+      absl::Span<const std::string> files,
+      absl::Span<MatchChainColumn* const> columns,
+      std::vector<std::pair<std::string, std::string>>* diff_file_pairs,
+      std::vector<int64_t>* num_rows);
+
+  // Like Reset(), but keeps the metadata read by SelectDiffResults().
+  void ResetTable();
+
+  // Reads the metadata of the specified diff results and selects the ones to
+  // build the table from, see SelectSimilarDiffs(). Without ITEMS_SIMILAR
+  // item selection in the definition, all diff results are used as given.
+  // The metadata of each file is only read once, until the next Reset().
+  absl::Status SelectDiffResults(
+      const SignatureDefinition& definition,
+      absl::Span<const std::string> diff_results,
+      std::vector<std::string>* selected);
+
+  // Returns the keys of the shared columns that a table of the specified diff
+  // results may use. The first half holds the key of the column of each diff
+  // result, the second half the key of the column of its secondary binary,
+  // which is used if that binary has no children. Only the column of the
+  // first diff result depends on the function filter.
+  std::vector<std::string> SharedColumnKeys(
+      absl::Span<const std::string> diff_results,
+      const SignatureDefinition& definition) const;
+
+  // Fills the match chain table with copies of shared columns, which come
+  // from the column batch and the column cache. Loads the columns that
+  // neither of them holds yet.
+  absl::Status LoadMatchChainTableFromSharedColumns(
+      const SignatureDefinition& definition);
 
   // Parses BinDiff result files and adds matches to the table. Returns true on
-  // success.
+  // success. The diff results are parsed concurrently, one column per task.
   absl::Status ParseDiffResults();
 
-  // Placeholder function that should query the occurrence count of the
-  // specified function candidate ids and convert them into weights.
+  // Queries the function prevalence index for all of the specified function
+  // candidate ids at once and converts the counts into basic block weights.
+  // Does nothing if no index is set.
   absl::Status SetFunctionWeights(const IdentSequence& func_candidate_ids);
 
   // Computes a list of function and basic block candidates for the signature
   // generation. Function/basic block candidates are functions/basic blocks
   // that appear in all matched binaries in the same order.
-  absl::Status ComputeCandidates();
+  absl::Status ComputeCandidateIds();
+
+  // Prunes the table and spills the instruction payloads to disk if the
+  // process uses more memory than rss_target_. Failing to spill is not fatal,
+  // the payloads just stay in memory.
+  void ReduceMemoryUse();
+
+  // Creates, replaces or destroys the thread pool to match num_threads_.
+  void UpdateThreadPool();
+
+  // Adds the sizes of the columns of the loaded table and the peak memory use
+  // to stats_.
+  void FinishStats();
 
   // Filenames of the BinDiff result files to work on
   std::vector<std::string> diff_results_;
 
+  // The diff results that the loaded table is built from, in table order.
+  // Differs from diff_results_ if the items were selected by similarity.
+  std::vector<std::string> table_diff_results_;
+
+  // Pool for instruction bytes and disassembly that is shared by all columns
+  // of the match chain table. Declared before the table, as the columns
+  // reference it.
+  std::unique_ptr<InternPool> intern_pool_;
+
+  // Mapping of the file that the instruction payloads of the table were
+  // spilled to, if any. Declared before the table, as the payloads of its
+  // instructions point into it.
+  std::unique_ptr<MappedFile> spill_file_;
+
+  // Metadata of the diff results read by SelectDiffResults(), by filename.
+  absl::flat_hash_map<std::string, BinDiffSummary> diff_summaries_;
+
+  // Shared columns that the table was copied from. Declared before the table,
+  // as the copies reference the intern pools of the shared columns.
+  std::vector<std::shared_ptr<const CachedColumn>> cached_columns_;
+
   // Siggen's core data structure that holds all loaded function, basic block
   // and instruction matches
   MatchChainTable match_chain_table_;
 
+  // How the columns of the table are connected if the diff results form a
+  // tree. Empty for chains.
+  MatchChainTopology topology_;
+
+  // The cache key of the currently loaded match chain table. Empty if no
+  // table is loaded.
+  std::string loaded_table_key_;
+
+  // The definition that the loaded table was built for, used to update its
+  // key when the table is extended.
+  SignatureDefinition loaded_table_definition_;
+
+  // The function candidates that bb_candidate_ids_ was computed from.
+  IdentSequence func_candidate_ids_;
+
+  // The basic block candidates before overlaps were filtered. Filtering is
+  // repeated after narrowing these in AppendDiffResult(), as overlaps in
+  // earlier binaries may no longer matter.
+  IdentSequence bb_common_ids_;
+
   // A sequence of basic block ids that are to be considered for inclusion in
   // the final signature
   IdentSequence bb_candidate_ids_;
 
+  // Whether bb_candidate_ids_ holds the filtered candidates for the currently
+  // loaded table.
+  bool candidates_computed_ = false;
+
+  // Whether the table was pruned to the candidates in bb_candidate_ids_.
+  bool table_pruned_ = false;
+
   // Whether to output debug information about the internal state of the match
   // chain table.
   bool debug_match_chain_ = false;
+
+  // Whether to load the instruction disassembly.
+  bool load_disassembly_ = true;
+
+  // Directory for cached match chain tables. Caching is disabled if empty.
+  std::string cache_directory_;
+
+  // In-memory cache of loaded columns. Not used if null.
+  std::shared_ptr<ColumnCache> column_cache_;
+
+  // Columns shared with the other jobs of a GenerateSignatures() call. Only
+  // set for the generators of the jobs.
+  ColumnBatch* column_batch_ = nullptr;
+
+  // Memory-bounded mode, see set_rss_target(). Disabled if zero.
+  int64_t rss_target_ = 0;
+  std::string spill_directory_;
+
+  // Corpus index used to weight function candidates. May be null. Shared
+  // with the generators used by GenerateSignatures().
+  std::shared_ptr<const FunctionPrevalenceIndex> function_prevalence_index_;
+
+  CandidatePruning candidate_pruning_;
+
+  // Statistics of the last call to Generate().
+  GenerationStats stats_;
+
+  // Number of rows read from each diff result when the table was last
+  // parsed. Kept so that stats_ can report them if the table is reused.
+  std::vector<int64_t> diff_rows_;
+
+  // Number of worker threads and the pool that runs them. The pool is only
+  // created during Generate() if more than one thread was requested. It is
+  // shared with the generators of the jobs of GenerateSignatures().
+  int num_threads_ = 1;
+  std::shared_ptr<ThreadPool> thread_pool_;
+
+  // Tables worked on concurrently by GenerateSignatures(), see set_num_jobs().
+  int num_jobs_ = 0;
 };
 
 }  // namespace security::vxsig
@@ -0,0 +1,111 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// End-to-end benchmarks of the signature pipeline over the match chain in
+// vxsig/testdata: reading the BinDiff and BinExport files and generating a
+// signature from the whole chain.
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/base/internal/raw_logging.h"
+#include "absl/strings/str_cat.h"
+#include "benchmark/benchmark.h"
+#include "vxsig/benchmark_util.h"
+#include "vxsig/binexport_reader.h"
+#include "vxsig/diff_result_reader.h"
+#include "vxsig/siggen.h"
+#include "vxsig/vxsig.pb.h"
+
+namespace security::vxsig {
+namespace {
+
+constexpr const char* kBinaries[] = {
+    "1794a0afbfc38411dec87fa2660d6dd6515cf8d03cb32bb24a1d7a8e1ecf30fa",
+    "1b0a84953909816c1945c2153605c2ddeb3b138fb4c262c7262cd9689ed25f82",
+    "1d3949acb5eb175af3cbc5f448ece50669a44743faec91e3d574dad9596a9d83",
+};
+constexpr int kNumBinaries = sizeof(kBinaries) / sizeof(kBinaries[0]);
+
+// Returns the BinDiff files of the chain 1794a0... -> 1b0a84... -> 1d3949...
+std::vector<std::string> ChainDiffResults() {
+  std::vector<std::string> files;
+  for (int i = 0; i < kNumBinaries - 1; ++i) {
+    files.push_back(BenchmarkDataPath(
+        absl::StrCat(kBinaries[i], "_vs_", kBinaries[i + 1], ".BinDiff")));
+  }
+  return files;
+}
+
+void BM_ParseBinDiff(benchmark::State& state) {
+  const auto files = ChainDiffResults();
+  const std::string& filename = files[state.range(0)];
+  int64_t num_matches = 0;
+  const MatchReceiverCallback count_match =
+      [&num_matches](const MemoryAddressPair&) { ++num_matches; };
+  for (auto _ : state) {
+    std::pair<FileMetaData, FileMetaData> metadata;
+    const absl::Status status = ParseBinDiff(filename, count_match,
+                                             count_match, count_match,
+                                             &metadata);
+    ABSL_RAW_CHECK(status.ok(), std::string(status.message()).c_str());
+  }
+  state.SetItemsProcessed(num_matches);
+}
+
+void BM_ParseBinExport(benchmark::State& state) {
+  const std::string filename =
+      BenchmarkDataPath(absl::StrCat(kBinaries[state.range(0)], ".BinExport"));
+  int64_t num_instructions = 0;
+  for (auto _ : state) {
+    const absl::Status status = ParseBinExport(
+        filename,
+        [](const std::string&, MemoryAddress,
+           BinExport2::CallGraph::Vertex::Type, double) {},
+        [&num_instructions](MemoryAddress, MemoryAddress, const std::string&,
+                            const std::string&, const Immediates&) {
+          ++num_instructions;
+        });
+    ABSL_RAW_CHECK(status.ok(), std::string(status.message()).c_str());
+  }
+  state.SetItemsProcessed(num_instructions);
+}
+
+// Arguments: number of threads.
+void BM_Generate(benchmark::State& state) {
+  const auto files = ChainDiffResults();
+  for (auto _ : state) {
+    AvSignatureGenerator siggen;
+    siggen.set_num_threads(state.range(0));
+    siggen.AddDiffResults(files);
+    Signature signature;
+    const absl::Status status = siggen.Generate(&signature);
+    ABSL_RAW_CHECK(status.ok(), std::string(status.message()).c_str());
+    benchmark::DoNotOptimize(signature.raw_signature().piece_size());
+  }
+}
+
+BENCHMARK(BM_ParseBinDiff)->DenseRange(0, kNumBinaries - 2);
+BENCHMARK(BM_ParseBinExport)->DenseRange(0, kNumBinaries - 1);
+BENCHMARK(BM_Generate)
+    ->ArgName("threads")
+    ->Arg(1)
+    ->Arg(4)
+    ->Unit(benchmark::kMillisecond);
+
+}  // namespace
+}  // namespace security::vxsig
@@ -17,10 +17,14 @@
 
 #include <cstdint>
 #include <cstdio>
+#include <fstream>
 #include <iostream>
+#include <iterator>
 #include <limits>
 #include <memory>
 #include <string>
+#include <thread>  // NOLINT(build/c++11)
+#include <vector>
 
 #include "absl/base/internal/raw_logging.h"
 #include "absl/flags/flag.h"
@@ -29,8 +33,13 @@
 #include "absl/memory/memory.h"
 #include "absl/strings/numbers.h"
 #include "absl/strings/str_split.h"
+#include "google/protobuf/util/json_util.h"
+#include "vxsig/candidates.h"
+#include "vxsig/function_prevalence.h"
+#include "vxsig/goodware_index.h"
 #include "vxsig/siggen.h"
 #include "vxsig/signature_formatter.h"
+#include "vxsig/thread_pool.h"
 #include "vxsig/types.h"
 #include "vxsig/vxsig.pb.h"
 
@@ -48,12 +57,131 @@ ABSL_FLAG(std::string, function_whitelist, "",
           "consider for the signature. Mutually exclusive with "
           "function_blacklist.");
 ABSL_FLAG(std::string, function_blacklist, "", "Inverse of function_whitelist");
+ABSL_FLAG(bool, load_disassembly, true,
+          "Whether to annotate the signature with the disassembly of the "
+          "instructions it was generated from");
+ABSL_FLAG(std::string, cache_dir, "",
+          "Directory to cache loaded match chain tables in. Speeds up "
+          "repeated runs on the same inputs, for example with different "
+          "trimming settings.");
+ABSL_FLAG(std::string, function_prevalence_index, "",
+          "Function prevalence index of a goodware corpus, as written by "
+          "vxsig_prevalence_index. If set, functions that are common in the "
+          "corpus are less likely to be used for the signature.");
+ABSL_FLAG(std::string, goodware_index, "",
+          "Goodware n-gram index, as written by vxsig_goodware_index. If "
+          "set, signature pieces that likely occur in goodware are dropped.");
+ABSL_FLAG(std::string, stats_json, "",
+          "If set, writes timing, memory and size statistics of the "
+          "signature generation to this file, in JSON format");
+ABSL_FLAG(int64_t, rss_target_mb, 0,
+          "If set, limits memory use once the signature candidates are known "
+          "and the process uses more than this many MiB: drops everything "
+          "but the candidates and moves instruction data to a spill file");
+ABSL_FLAG(std::string, spill_dir, "",
+          "Directory for the spill file used by --rss_target_mb. Defaults to "
+          "$TMPDIR or /tmp.");
+ABSL_FLAG(int32_t, num_threads, std::thread::hardware_concurrency(),
+          "Number of worker threads to use for signature generation");
+ABSL_FLAG(int32_t, min_basic_block_bytes, 0,
+          "Leave basic blocks with fewer instruction bytes out of the "
+          "signature candidates");
+ABSL_FLAG(int32_t, max_function_candidates, 0,
+          "If set, only use this many function candidates, the ones with the "
+          "most matched instruction bytes");
+ABSL_FLAG(bool, skip_thunks, false,
+          "Leave functions that consist of a single instruction out of the "
+          "signature candidates");
+ABSL_FLAG(int32_t, num_variants, 1,
+          "Number of randomized variants of the signature to output. Needs "
+          "TRIM_RANDOM trimming. The signature is only generated once.");
+ABSL_FLAG(std::string, manifest, "",
+          "If set, generates one signature per line of this file instead of "
+          "a single signature from the command line. Each line holds a "
+          "detection name followed by the BinDiff files of its chain. The "
+          "signatures are written as one combined database.");
+ABSL_FLAG(int32_t, jobs, 0,
+          "Number of manifest signatures to generate at the same time. "
+          "Defaults to num_threads.");
 
 namespace security::vxsig {
 namespace {
 
-void SiggenMain(int argc, char* argv[]) {
-  ABSL_RAW_CHECK(argc >= 2, "Need at least one .BinDiff file");
+std::unique_ptr<SignatureFormatter> CreateFormatter() {
+  auto formatter = SignatureFormatter::Create(YARA);
+  const std::string goodware_filename = absl::GetFlag(FLAGS_goodware_index);
+  if (!goodware_filename.empty()) {
+    auto goodware_index_or = GoodwareIndex::Open(goodware_filename);
+    ABSL_RAW_CHECK(goodware_index_or.ok(),
+                   absl::StrCat("Failed to open goodware index: ",
+                                goodware_index_or.status().message())
+                       .c_str());
+    formatter->set_goodware_index(std::move(goodware_index_or).ValueOrDie());
+  }
+  return formatter;
+}
+
+// Generates all signatures of the manifest. The database holds the signatures
+// that were generated successfully, failed entries are reported on stderr.
+// Returns whether all entries succeeded.
+bool GenerateFromManifest(const std::string& manifest_filename,
+                          const SignatureDefinition& base_definition,
+                          AvSignatureGenerator* siggen) {
+  ABSL_RAW_CHECK(absl::GetFlag(FLAGS_num_variants) == 1,
+                 "num_variants is not supported with a manifest");
+  ABSL_RAW_CHECK(absl::GetFlag(FLAGS_stats_json).empty(),
+                 "stats_json is not supported with a manifest");
+  std::ifstream manifest_file(manifest_filename);
+  ABSL_RAW_CHECK(manifest_file.good(), "Failed to open manifest");
+  const std::string manifest{std::istreambuf_iterator<char>(manifest_file),
+                             std::istreambuf_iterator<char>()};
+  std::vector<SignatureRequest> requests;
+  absl::Status status =
+      ParseSignatureManifest(manifest, base_definition, &requests);
+  ABSL_RAW_CHECK(
+      status.ok(),
+      absl::StrCat("Failed to parse manifest: ", status.message()).c_str());
+
+  Signatures signatures;
+  std::vector<absl::Status> request_statuses;
+  siggen->set_num_jobs(absl::GetFlag(FLAGS_jobs));
+  status = siggen->GenerateSignatures(requests, &signatures, &request_statuses);
+  ABSL_RAW_CHECK(status.ok(), absl::StrCat("Failed to generate signatures: ",
+                                           status.message())
+                                  .c_str());
+  int num_failed = 0;
+  for (int i = 0; i < requests.size(); ++i) {
+    if (!request_statuses[i].ok()) {
+      ++num_failed;
+      fprintf(stderr, "Failed to generate signature %s: %s\n",
+              requests[i].definition.detection_name().c_str(),
+              std::string(request_statuses[i].message()).c_str());
+    }
+  }
+
+  std::string database;
+  status = CreateFormatter()->FormatDatabase(signatures, &database);
+  ABSL_RAW_CHECK(status.ok(), absl::StrCat("Failed to format signatures: ",
+                                           status.message())
+                                  .c_str());
+  std::cout << "----8<--------8<---- Signature ----8<--------8<----\n";
+  printf("%s\n", database.c_str());
+  std::cout << "---->8-------->8---- Signature ---->8-------->8----\n";
+  if (num_failed > 0) {
+    fprintf(stderr, "Failed to generate %d of %d signatures\n", num_failed,
+            static_cast<int>(requests.size()));
+    return false;
+  }
+  return true;
+}
+
+int SiggenMain(int argc, char* argv[]) {
+  const std::string manifest_filename = absl::GetFlag(FLAGS_manifest);
+  if (manifest_filename.empty()) {
+    ABSL_RAW_CHECK(argc >= 2, "Need at least one .BinDiff file");
+  } else {
+    ABSL_RAW_CHECK(argc == 1, "BinDiff files are read from the manifest");
+  }
 
   SignatureDefinition::SignatureTrimAlgorithm trim_algorithm;
   if (!SignatureDefinition::SignatureTrimAlgorithm_Parse(
@@ -97,8 +225,48 @@ void SiggenMain(int argc, char* argv[]) {
   }
 
   AvSignatureGenerator siggen;
+  siggen.set_num_threads(absl::GetFlag(FLAGS_num_threads))
+      .set_load_disassembly(absl::GetFlag(FLAGS_load_disassembly))
+      .set_cache_directory(absl::GetFlag(FLAGS_cache_dir))
+      .set_rss_target(absl::GetFlag(FLAGS_rss_target_mb) << 20)
+      .set_spill_directory(absl::GetFlag(FLAGS_spill_dir));
+  CandidatePruning pruning;
+  pruning.min_basic_block_bytes = absl::GetFlag(FLAGS_min_basic_block_bytes);
+  pruning.max_functions = absl::GetFlag(FLAGS_max_function_candidates);
+  pruning.skip_thunks = absl::GetFlag(FLAGS_skip_thunks);
+  siggen.set_candidate_pruning(pruning);
+  const std::string index_filename =
+      absl::GetFlag(FLAGS_function_prevalence_index);
+  if (!index_filename.empty()) {
+    auto index_or = MappedFunctionPrevalenceIndex::Open(index_filename);
+    ABSL_RAW_CHECK(index_or.ok(),
+                   absl::StrCat("Failed to open function prevalence index: ",
+                                index_or.status().message())
+                       .c_str());
+    siggen.set_function_prevalence_index(std::move(index_or).ValueOrDie());
+  }
+  if (!manifest_filename.empty()) {
+    return GenerateFromManifest(manifest_filename, signature_definition,
+                                &siggen)
+               ? EXIT_SUCCESS
+               : EXIT_FAILURE;
+  }
   siggen.AddDiffResultsFromCommandLineArguments(--argc, ++argv);
   absl::Status status(siggen.Generate(&signature));
+  const std::string stats_filename = absl::GetFlag(FLAGS_stats_json);
+  if (!stats_filename.empty()) {
+    std::string stats_json;
+    google::protobuf::util::JsonPrintOptions options;
+    options.add_whitespace = true;
+    options.preserve_proto_field_names = true;
+    ABSL_RAW_CHECK(google::protobuf::util::MessageToJsonString(
+                       siggen.stats(), &stats_json, options)
+                       .ok(),
+                   "Failed to convert statistics to JSON");
+    std::ofstream stats_file(stats_filename);
+    stats_file << stats_json;
+    ABSL_RAW_CHECK(stats_file.good(), "Failed to write statistics");
+  }
   ABSL_RAW_CHECK(
       status.ok(),
       absl::StrCat("Failed to generate signature: ", status.message()).c_str());
@@ -106,12 +274,29 @@ void SiggenMain(int argc, char* argv[]) {
   // Output the signature itself to stdout, so we can use redirected output
   // from this tool in scripts.
   std::cout << "----8<--------8<---- Signature ----8<--------8<----\n";
-  status = SignatureFormatter::Create(YARA)->Format(&signature);
-  ABSL_RAW_CHECK(
-      status.ok(),
-      absl::StrCat("Failed to format signature: ", status.message()).c_str());
-  printf("%s\n", signature.yara_signature().data().c_str());
+  auto formatter = CreateFormatter();
+  const int num_variants = absl::GetFlag(FLAGS_num_variants);
+  if (num_variants > 1) {
+    ThreadPool pool(absl::GetFlag(FLAGS_num_threads));
+    Signatures variants;
+    status = formatter->FormatVariants(signature, num_variants, &variants,
+                                       &pool);
+    ABSL_RAW_CHECK(status.ok(),
+                   absl::StrCat("Failed to format signature variants: ",
+                                status.message())
+                       .c_str());
+    for (const auto& variant : variants.signature()) {
+      printf("%s\n", variant.yara_signature().data().c_str());
+    }
+  } else {
+    status = formatter->Format(&signature);
+    ABSL_RAW_CHECK(
+        status.ok(),
+        absl::StrCat("Failed to format signature: ", status.message()).c_str());
+    printf("%s\n", signature.yara_signature().data().c_str());
+  }
   std::cout << "---->8-------->8---- Signature ---->8-------->8----\n";
+  return EXIT_SUCCESS;
 }
 
 }  // namespace
@@ -121,8 +306,8 @@ int main(int argc, char* argv[]) {
   absl::SetProgramUsageMessage(absl::StrCat(
       "Automatically generate byte-signature for sets of binaires.\n"
       "usage:\n",
-      argv[0], " [OPTION] BINDIFF..."));
+      argv[0], " [OPTION] BINDIFF...\n",
+      argv[0], " [OPTION] --manifest=FILE"));
   std::vector<char*> args = absl::ParseCommandLine(argc, argv);
-  security::vxsig::SiggenMain(args.size(), &args[0]);
-  return EXIT_SUCCESS;
+  return security::vxsig::SiggenMain(args.size(), &args[0]);
 }
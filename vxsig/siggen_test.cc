@@ -14,6 +14,10 @@
 
 #include "vxsig/siggen.h"
 
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
 #include <memory>
 
 #include "absl/memory/memory.h"
@@ -22,16 +26,26 @@
 #include "gtest/gtest.h"
 #include "third_party/zynamics/binexport/util/filesystem.h"
 #include "absl/status/status.h"
+#include "third_party/sqlite/sqlite3.h"
 #include "third_party/zynamics/binexport/util/status_matchers.h"
+#include "vxsig/column_cache.h"
+#include "vxsig/function_prevalence.h"
 #include "vxsig/generic_signature.h"
 #include "vxsig/signature_formatter.h"
 #include "vxsig/yara_signature_test_util.h"
 
 using not_absl::IsOk;
+using testing::AnyOf;
+using testing::Contains;
+using testing::ElementsAre;
+using testing::Eq;
+using testing::Gt;
 using testing::HasSubstr;
 using testing::IsEmpty;
 using testing::IsTrue;
+using testing::Lt;
 using testing::Not;
+using testing::SizeIs;
 using testing::StrEq;
 
 namespace security::vxsig {
@@ -39,11 +53,23 @@ namespace security::vxsig {
 class SiggenTest : public testing::Test {
  protected:
   void SetupDefaultSignature(AvSignatureGenerator* siggen);
+  std::vector<std::string> DefaultDiffResults();
+  // A single small diff that is quick to generate signatures from.
+  std::string SmallDiffResult();
+  // Two diffs that form a star: the small diff, and a copy of it whose
+  // secondary binary is a renamed copy of the original one. The copy has a
+  // lower similarity. The files are created in TEST_TMPDIR.
+  std::vector<std::string> StarDiffResults();
 
   Signature signature_;
 };
 
 void SiggenTest::SetupDefaultSignature(AvSignatureGenerator* siggen) {
+  siggen->AddDiffResults(DefaultDiffResults());
+  EXPECT_THAT(siggen->Generate(&signature_), IsOk());
+}
+
+std::vector<std::string> SiggenTest::DefaultDiffResults() {
   std::vector<std::string> files;
   for (
       const auto& diff_result : {
@@ -57,12 +83,65 @@ void SiggenTest::SetupDefaultSignature(AvSignatureGenerator* siggen) {
     const std::string file_name(JoinPath(getenv("TEST_SRCDIR"),
                                     "com_google_vxsig/vxsig/testdata/",
                                     diff_result));
-    ASSERT_THAT(FileExists(file_name), IsTrue());
+    EXPECT_THAT(FileExists(file_name), IsTrue());
     files.push_back(file_name);
   }
+  return files;
+}
 
-  siggen->AddDiffResults(files);
-  EXPECT_THAT(siggen->Generate(&signature_), IsOk());
+std::string SiggenTest::SmallDiffResult() {
+  const std::string file_name(JoinPath(
+      getenv("TEST_SRCDIR"),
+      "com_google_vxsig/vxsig/testdata/"
+      "592fb377afa9f93670a23159aa585e0eca908b97571ab3218e026fea3598cc16_vs_"
+      "65d25a86feb6d15527e398d7b5d043e7712b00e674bc6e8cf2a709a0c6f9b97b."
+      "BinDiff"));
+  EXPECT_THAT(FileExists(file_name), IsTrue());
+  return file_name;
+}
+
+std::vector<std::string> SiggenTest::StarDiffResults() {
+  constexpr char kPrimary[] =
+      "592fb377afa9f93670a23159aa585e0eca908b97571ab3218e026fea3598cc16";
+  constexpr char kSecondary[] =
+      "65d25a86feb6d15527e398d7b5d043e7712b00e674bc6e8cf2a709a0c6f9b97b";
+  const std::string secondary_copy = absl::StrCat(kSecondary, "-copy");
+  const std::string test_data =
+      JoinPath(getenv("TEST_SRCDIR"), "com_google_vxsig/vxsig/testdata");
+  const std::string directory = getenv("TEST_TMPDIR");
+  auto copy_file = [](const std::string& from, const std::string& to) {
+    std::ifstream in(from, std::ios::binary);
+    std::ofstream out(to, std::ios::binary | std::ios::trunc);
+    out << in.rdbuf();
+    EXPECT_THAT(out.good(), IsTrue()) << to;
+  };
+  const std::vector<std::string> diff_results = {
+      JoinPath(directory, absl::StrCat(kPrimary, "_vs_", kSecondary,
+                                       ".BinDiff")),
+      JoinPath(directory, absl::StrCat(kPrimary, "_vs_", secondary_copy,
+                                       ".BinDiff")),
+  };
+  for (const auto& binary : {kPrimary, kSecondary}) {
+    copy_file(JoinPath(test_data, absl::StrCat(binary, ".BinExport")),
+              JoinPath(directory, absl::StrCat(binary, ".BinExport")));
+  }
+  copy_file(JoinPath(test_data, absl::StrCat(kSecondary, ".BinExport")),
+            JoinPath(directory, absl::StrCat(secondary_copy, ".BinExport")));
+  copy_file(SmallDiffResult(), diff_results[0]);
+  copy_file(SmallDiffResult(), diff_results[1]);
+
+  sqlite3* db = nullptr;
+  EXPECT_THAT(sqlite3_open(diff_results[1].c_str(), &db), Eq(SQLITE_OK));
+  EXPECT_THAT(sqlite3_exec(db,
+                           absl::StrCat("UPDATE file SET filename = '",
+                                        secondary_copy,
+                                        "' WHERE id = 2; "
+                                        "UPDATE metadata SET similarity = 0.9;")
+                               .c_str(),
+                           nullptr, nullptr, nullptr),
+              Eq(SQLITE_OK));
+  sqlite3_close(db);
+  return diff_results;
 }
 
 TEST_F(SiggenTest, GenerateClamAVSignature) {
@@ -72,12 +151,13 @@ TEST_F(SiggenTest, GenerateClamAVSignature) {
   // changed should the algorithm change significantly.
   auto formatter(SignatureFormatter::Create(CLAMAV));
   constexpr char kExpectedSignature[] =
-      "test_malware:0:*:0d0083c404c707????????c747????????00c747????????00*"
-      "558bec56578bf1e8*2bc78bce5fd1f85052e8*8b49f83bce7d37*5650ff15????*"
-      "85c97406*41c645eb008d45eb894d103bc1732d*8b068a04038801eb4e*6a018d4d0ce8*"
-      "8b06894604ff15????*8d4dcc348b8845db8d45db50e8*8a014184c075f9*68????????"
-      "ff15????*fbff8bc885c9746e*f9ff8d85*f8ff85c00f8489010000*05008be55dc3*"
-      "720000595985c07431*6a0259cd29*578bfe2bf9*f4fdff59";
+      "test_malware:0:*:8bc38bde99f7fe8bf285d275f3*558bec56578bf1e8*2bc78bce5fd"
+      "1f85052e8*8b06b9????????2b48fc8b40f82bc20bc87d08*8b49f83bce7d37*81f9????"
+      "????7e19*85c97406*8b56088bd82bdf3bca753c*8b06894604ff15????*c745b4??????"
+      "??e8*8d4dcc348b8845db8d45db50e8*fcff83ec0c8bcc50ff7604ff36e8*f7c2???????"
+      "?7523*33d289550ceb0f*f9ff508bcbe8*ff76f48d8d????????e8*e9c7030000*ff7508"
+      "ff15????*8b4504a3{65-71}6a04586bc000c780*578bfe2bf9*8b450c33d26a50668954"
+      "41fe58eb9e";
   Signature signature(signature_);
   auto* definition = signature.mutable_definition();
   definition->set_detection_name("test_malware");
@@ -101,71 +181,373 @@ TEST_F(SiggenTest, GenerateYaraSignatureWithMetadata) {
   constexpr char kExpectedSignature[] =
       "rule test_malware {meta:vxsig_build = \"redacted\"vxsig_taskid = "
       "\"testtask\"rs1 = \"item0\"rs2 = \"item1\"rs3 = \"item3\"\nstrings:$ = "
-      "{0d0083c404c707????????c747????????00c747????????00// 0136655e: add "
-      "esp, b1 0x4\n// 01366561: mov ds:[edi], 0x0\n// 01366567: mov "
-      "ds:[edi+0x4], 0x0\n// 0136656e: mov ds:[edi+0x8], "
-      "0x0\n[-]558bec56578bf1e8// 00216c90: push ebp\n// 00216c91: mov ebp, "
-      "esp\n// 00216c93: push esi\n// 00216c94: push edi\n// 00216c95: mov "
-      "esi, ecx\n// 00216c97: call 0x218590\n[-]2bc78bce5fd1f85052e8// "
+      "{8bc38bde99f7fe8bf285d275f3// 00216258: mov eax, ebx\n// 0021625a: mov "
+      "ebx, esi\n// 0021625c: cdq\n// 0021625d: idiv esi\n// 0021625f: mov "
+      "esi, edx\n// 00216261: test edx, edx\n// 00216263: jnz "
+      "0x216258\n[-]558bec56578bf1e8// 00216c90: push ebp\n// 00216c91: mov "
+      "ebp, esp\n// 00216c93: push esi\n// 00216c94: push edi\n// 00216c95: "
+      "mov esi, ecx\n// 00216c97: call 0x218590\n[-]2bc78bce5fd1f85052e8// "
       "0021784e: sub eax, edi\n// 00217850: mov ecx, esi\n// 00217852: pop "
       "edi\n// 00217853: sar eax, b1 0x1\n// 00217855: push eax\n// 00217856: "
-      "push edx\n// 00217857: call 0x218a50\n[-]8b49f83bce7d37// 00218797: mov "
+      "push edx\n// 00217857: call "
+      "0x218a50\n[-]8b06b9????????2b48fc8b40f82bc20bc87d08// 0021855d: mov "
+      "eax, ds:[esi]\n// 0021855f: mov ecx, 0x1\n// 00218564: sub ecx, "
+      "ds:[eax+0xfffffffffffffffc]\n// 00218567: mov eax, "
+      "ds:[eax+0xfffffffffffffff8]\n// 0021856a: sub eax, edx\n// 0021856c: or "
+      "ecx, eax\n// 0021856e: jge 0x218578\n[-]8b49f83bce7d37// 00218797: mov "
       "ecx, ds:[ecx+0xfffffffffffffff8]\n// 0021879a: cmp ecx, esi\n// "
-      "0021879c: jge 0x2187d5\n[-]5650ff15????" /**/
-      "// 01369a65: push esi\n// "
-      "01369a66: push eax\n// 01369a67: call ds:[0x1470264]\n[-]85c97406// "
-      "0022def0: test ecx, ecx\n// 0022def2: jz "
-      "0x22defa\n[-]41c645eb008d45eb894d103bc1732d// 0022dfaa: inc ecx\n// "
-      "0022dfab: mov b1 ss:[ebp+0xffffffffffffffeb], b1 0x0\n// 0022dfaf: lea "
-      "eax, ss:[ebp+0xffffffffffffffeb]\n// 0022dfb2: mov ss:[ebp+0x10], "
-      "ecx\n// 0022dfb5: cmp eax, ecx\n// 0022dfb7: jnb "
-      "0x22dfe6\n[-]8b068a04038801eb4e// 0022e2dc: mov eax, ds:[esi]\n// "
-      "0022e2de: mov b1 al, b1 ds:[ebx+eax]\n// 0022e2e1: mov b1 ds:[ecx], b1 "
-      "al\n// 0022e2e3: jmp 0x22e333\n[-]6a018d4d0ce8// 00c10f28: push b1 "
-      "0x1\n// 00c10f2a: lea ecx, ss:[ebp+0xc]\n// 00c10f2d: call "
-      "0xbfbd10\n[-]8b06894604ff15????" /**/
-      "// 013827fb: mov eax, ds:[esi]\n// "
-      "013827fd: mov ds:[esi+0x4], eax\n// 01382800: call "
-      "ds:[0x1470250]\n[-]8d4dcc348b8845db8d45db50e8// 013a5333: lea ecx, "
+      "0021879c: jge 0x2187d5\n[-]81f9????????7e19// 0021880e: cmp ecx, "
+      "0x40000000\n// 00218814: jle 0x21882f\n[-]85c97406// 0022def0: test "
+      "ecx, ecx\n// 0022def2: jz 0x22defa\n[-]8b56088bd82bdf3bca753c// "
+      "0022e7b8: mov edx, ds:[esi+0x8]\n// 0022e7bb: mov ebx, eax\n// "
+      "0022e7bd: sub ebx, edi\n// 0022e7bf: cmp ecx, edx\n// 0022e7c1: jnz "
+      "0x22e7ff\n[-]8b06894604ff15????" /**/
+      "// 013827fb: mov eax, ds:[esi]\n// 013827fd: mov ds:[esi+0x4], eax\n// "
+      "01382800: call ds:[0x1470250]\n[-]c745b4????????e8// 00c340f5: mov "
+      "ss:[ebp+0xffffffffffffffb4], 0x0\n// 00c340fc: call "
+      "0xc3d2a0\n[-]8d4dcc348b8845db8d45db50e8// 013a5333: lea ecx, "
       "ss:[ebp+0xffffffffffffffcc]\n// 013a5336: xor b1 al, b1 0x8b\n// "
       "013a5338: mov b1 ss:[ebp+0xffffffffffffffdb], b1 al\n// 013a533b: lea "
       "eax, ss:[ebp+0xffffffffffffffdb]\n// 013a533e: push eax\n// 013a533f: "
-      "call 0x136e3c0\n[-]8a014184c075f9// 00255350: mov b1 al, b1 "
-      "ds:[ecx]\n// 00255352: inc ecx\n// 00255353: test b1 al, b1 al\n// "
-      "00255355: jnz 0x255350\n[-]68????????ff15????" /**/
-      "// 013a9c90: push "
-      "0x1f4\n// 013a9c95: call ds:[0x5401a8]\n[-]fbff8bc885c9746e// 013ae5ec: "
-      "mov ecx, eax\n// 013ae5ee: test ecx, ecx\n// 013ae5f0: jz "
-      "0x13ae660\n[-]f9ff8d85// 013ccc1b: lea eax, "
-      "ss:[ebp+0xfffffffffffffa78]\n[-]f8ff85c00f8489010000// 00c77583: test "
-      "eax, eax\n// 00c77585: jz 0xc77714\n[-]05008be55dc3// 013e7a45: mov "
-      "esp, ebp\n// 013e7a47: pop ebp\n// 013e7a48: "
-      "retn\n[-]720000595985c07431// 002e74b3: pop ecx\n// 002e74b4: pop "
-      "ecx\n// 002e74b5: test eax, eax\n// 002e74b7: jz "
-      "0x2e74ea\n[-]6a0259cd29// 002e7559: push b1 0x2\n// 002e755b: pop "
-      "ecx\n// 002e755c: int b1 0x29\n[-]578bfe2bf9// 002e93f1: push edi\n// "
-      "002e93f2: mov edi, esi\n// 002e93f4: sub edi, ecx\n[-]f4fdff59// "
-      "014596a8: pop ecx\n}condition:all of them}";
+      "call 0x136e3c0\n[-]fcff83ec0c8bcc50ff7604ff36e8// 013a795a: sub esp, b1 "
+      "0xc\n// 013a795d: mov ecx, esp\n// 013a795f: push eax\n// 013a7960: "
+      "push ds:[esi+0x4]\n// 013a7963: push ds:[esi]\n// 013a7965: call "
+      "0x1367fb0\n[-]f7c2????????7523// 0025ceb3: test edx, 0xffff0000\n// "
+      "0025ceb9: jnz 0x25cede\n[-]33d289550ceb0f// 0026d3d9: xor edx, edx\n// "
+      "0026d3db: mov ss:[ebp+0xc], edx\n// 0026d3de: jmp "
+      "0x26d3ef\n[-]f9ff508bcbe8// 013ccc31: push eax\n// 013ccc32: mov ecx, "
+      "ebx\n// 013ccc34: call 0x13b7920\n[-]ff76f48d8d????????e8// 00c775a1: "
+      "push ds:[esi+0xfffffffffffffff4]\n// 00c775a4: lea ecx, "
+      "ss:[ebp+0xfffffffffffffdcc]\n// 00c775aa: call "
+      "0xbf9510\n[-]e9c7030000// 002e7350: jmp 0x2e771c\n[-]ff7508ff15????" /**/
+      "// 014388db: push ss:[ebp+0x8]\n// 014388de: call "
+      "ds:[0x147036c]\n[-]8b4504a3// 014389ca: mov eax, ss:[ebp+0x4]\n// "
+      "014389cd: mov ds:[0x14962e0], eax\n[65-71]6a04586bc000c780// 01438a12: "
+      "push b1 0x4\n// 01438a14: pop eax\n// 01438a15: imul eax, eax, b1 "
+      "0x0\n// 01438a18: mov ds:[eax+0x14961ec], 0x2\n[-]578bfe2bf9// "
+      "002e93f1: push edi\n// 002e93f2: mov edi, esi\n// 002e93f4: sub edi, "
+      "ecx\n[-]8b450c33d26a5066895441fe58eb9e// 002e94b8: mov eax, "
+      "ss:[ebp+0xc]\n// 002e94bb: xor edx, edx\n// 002e94bd: push b1 0x50\n// "
+      "002e94bf: mov b2 ds:[ecx+eax*0x2], b2 dx\n// 002e94c4: pop eax\n// "
+      "002e94c5: jmp 0x2e9465\n}condition:all of them}";
 
   Signature signature(signature_);
   auto* definition = signature.mutable_definition();
   definition->set_detection_name("test_malware");
   definition->set_trim_algorithm(SignatureDefinition::TRIM_RANDOM);
   definition->set_trim_length(200);
+  // The build date changes with every build.
+  for (auto& meta : *definition->mutable_meta()) {
+    if (meta.key() == "vxsig_build") {
+      meta.set_string_value("redacted");
+    }
+  }
   EXPECT_THAT(formatter->Format(&signature), IsOk());
   EXPECT_THAT(MakeComparableYaraSignature(signature.yara_signature().data()),
               StrEq(kExpectedSignature));
 }
 
+TEST_F(SiggenTest, MultiThreadedGenerationMatchesSerial) {
+  AvSignatureGenerator serial_siggen;
+  SetupDefaultSignature(&serial_siggen);
+
+  const Signature serial_signature(signature_);
+
+  signature_.Clear();
+  AvSignatureGenerator siggen;
+  siggen.set_num_threads(4);
+  SetupDefaultSignature(&siggen);
+  EXPECT_THAT(signature_.raw_signature().SerializeAsString(),
+              StrEq(serial_signature.raw_signature().SerializeAsString()));
+}
+
+TEST_F(SiggenTest, CachedGenerationMatchesUncached) {
+  AvSignatureGenerator uncached_siggen;
+  SetupDefaultSignature(&uncached_siggen);
+  const Signature uncached_signature(signature_);
+
+  AvSignatureGenerator siggen;
+  siggen.set_cache_directory(getenv("TEST_TMPDIR"));
+  for (int i = 0; i < 2; ++i) {  // The second run reads from the cache
+    signature_.Clear();
+    SetupDefaultSignature(&siggen);
+    EXPECT_THAT(signature_.raw_signature().SerializeAsString(),
+                StrEq(uncached_signature.raw_signature().SerializeAsString()));
+  }
+}
+
+TEST_F(SiggenTest, ColumnCacheGenerationMatchesUncached) {
+  AvSignatureGenerator uncached_siggen;
+  SetupDefaultSignature(&uncached_siggen);
+  const Signature uncached_signature(signature_);
+
+  auto cache = std::make_shared<ColumnCache>(1 << 30);
+  // The second generator reuses all columns, the third one the first column
+  // of the chain.
+  for (int num_diffs : {2, 2, 1}) {
+    AvSignatureGenerator siggen;
+    siggen.set_column_cache(cache);
+    std::vector<std::string> diff_results = DefaultDiffResults();
+    diff_results.resize(num_diffs);
+    siggen.AddDiffResults(diff_results);
+    signature_.Clear();
+    ASSERT_THAT(siggen.Generate(&signature_), IsOk());
+    if (num_diffs == 2) {
+      EXPECT_THAT(
+          signature_.raw_signature().SerializeAsString(),
+          StrEq(uncached_signature.raw_signature().SerializeAsString()));
+    }
+  }
+  const auto stats = cache->stats();
+  EXPECT_THAT(stats.hits, Eq(4));
+  EXPECT_THAT(stats.misses, Eq(3 + 1));
+  EXPECT_THAT(stats.num_entries, Eq(4));
+}
+
+TEST_F(SiggenTest, MemoryBoundedGenerationMatchesUnbounded) {
+  AvSignatureGenerator unbounded_siggen;
+  SetupDefaultSignature(&unbounded_siggen);
+  const Signature unbounded_signature(signature_);
+
+  // Any process is above this target, so the table is pruned and spilled.
+  AvSignatureGenerator siggen;
+  siggen.set_rss_target(1).set_spill_directory(getenv("TEST_TMPDIR"));
+  signature_.Clear();
+  SetupDefaultSignature(&siggen);
+  EXPECT_THAT(signature_.raw_signature().SerializeAsString(),
+              StrEq(unbounded_signature.raw_signature().SerializeAsString()));
+  std::vector<std::string> stage_names;
+  for (const auto& stage : siggen.stats().stage()) {
+    stage_names.push_back(stage.name());
+  }
+  EXPECT_THAT(stage_names, Contains("prune_table"));
+  EXPECT_THAT(stage_names, Contains("spill_payloads"));
+
+  // Constructing the signature again pages the payloads back in.
+  ASSERT_THAT(siggen.Generate(&signature_), IsOk());
+  EXPECT_THAT(signature_.raw_signature().SerializeAsString(),
+              StrEq(unbounded_signature.raw_signature().SerializeAsString()));
+
+  // New candidates need the full table, which is loaded again.
+  siggen.set_function_prevalence_index(nullptr);
+  ASSERT_THAT(siggen.Generate(&signature_), IsOk());
+  EXPECT_THAT(signature_.raw_signature().SerializeAsString(),
+              StrEq(unbounded_signature.raw_signature().SerializeAsString()));
+  EXPECT_THAT(siggen.stats().stage(0).name(), StrEq("parse_diff_results"));
+}
+
+TEST_F(SiggenTest, RegenerateWithChangedSettings) {
+  AvSignatureGenerator siggen;
+  SetupDefaultSignature(&siggen);
+
+  // Only the last stage depends on these, the loaded table and the candidates
+  // are reused.
+  auto* definition = signature_.mutable_definition();
+  definition->set_min_piece_length(8);
+  definition->set_disable_nibble_masking(true);
+  ASSERT_THAT(siggen.Generate(&signature_), IsOk());
+  const Signature regenerated(signature_);
+
+  AvSignatureGenerator fresh_siggen;
+  signature_.clear_raw_signature();
+  SetupDefaultSignature(&fresh_siggen);
+  EXPECT_THAT(regenerated.raw_signature().SerializeAsString(),
+              StrEq(signature_.raw_signature().SerializeAsString()));
+}
+
+TEST_F(SiggenTest, GenerationStats) {
+  AvSignatureGenerator siggen;
+  SetupDefaultSignature(&siggen);
+  const auto& stats = siggen.stats();
+  std::vector<std::string> stage_names;
+  for (const auto& stage : stats.stage()) {
+    stage_names.push_back(stage.name());
+  }
+  EXPECT_THAT(stage_names,
+              ElementsAre("parse_diff_results", "load_column_data",
+                          "build_id_chains", "function_candidates",
+                          "function_weights", "basic_block_candidates",
+                          "filter_overlaps", "construct_signature"));
+  ASSERT_THAT(stats.column(), SizeIs(3));
+  EXPECT_THAT(stats.column(0).num_diff_rows(), Gt(0));
+  EXPECT_THAT(stats.column(2).num_diff_rows(), Eq(0));
+  for (const auto& column : stats.column()) {
+    EXPECT_THAT(column.num_functions(), Gt(0));
+    EXPECT_THAT(column.num_basic_blocks(), Gt(0));
+    EXPECT_THAT(column.num_instructions(), Gt(0));
+  }
+  EXPECT_THAT(stats.function_candidates().num_sequences(), Eq(3));
+  EXPECT_THAT(stats.basic_block_candidates().output_size(), Gt(0));
+  EXPECT_THAT(stats.peak_rss_bytes(), Gt(0));
+
+  // Stages that are up to date are skipped and not listed.
+  ASSERT_THAT(siggen.Generate(&signature_), IsOk());
+  ASSERT_THAT(siggen.stats().stage(), SizeIs(1));
+  EXPECT_THAT(siggen.stats().stage(0).name(), StrEq("construct_signature"));
+  EXPECT_THAT(siggen.stats().column(), SizeIs(3));
+}
+
+TEST_F(SiggenTest, GenerateSignaturesMatchesSingleGeneration) {
+  // The default chain, a variant of it and a sub-chain.
+  std::vector<SignatureRequest> requests(3);
+  requests[0].diff_results = DefaultDiffResults();
+  requests[1].definition.set_variant(1);
+  requests[1].definition.set_min_piece_length(8);
+  requests[1].diff_results = requests[0].diff_results;
+  requests[2].diff_results.push_back(requests[0].diff_results[0]);
+
+  AvSignatureGenerator siggen;
+  siggen.set_num_threads(2);
+  Signatures signatures;
+  ASSERT_THAT(siggen.GenerateSignatures(requests, &signatures), IsOk());
+  ASSERT_THAT(signatures.signature_size(), Eq(requests.size()));
+
+  for (int i = 0; i < requests.size(); ++i) {
+    AvSignatureGenerator single_siggen;
+    single_siggen.AddDiffResults(requests[i].diff_results);
+    Signature signature;
+    *signature.mutable_definition() = requests[i].definition;
+    ASSERT_THAT(single_siggen.Generate(&signature), IsOk());
+    EXPECT_THAT(signatures.signature(i).definition().variant(),
+                Eq(requests[i].definition.variant()));
+    EXPECT_THAT(signatures.signature(i).raw_signature().SerializeAsString(),
+                StrEq(signature.raw_signature().SerializeAsString()));
+  }
+}
+
+TEST_F(SiggenTest, GenerateSignaturesWithJobLimit) {
+  // Two tables, and a request that fails.
+  std::vector<SignatureRequest> requests(3);
+  requests[0].diff_results.push_back(SmallDiffResult());
+  requests[1].definition.set_min_piece_length(8);
+  requests[1].diff_results = requests[0].diff_results;
+  requests[2].diff_results.push_back(
+      JoinPath(getenv("TEST_TMPDIR"), "missing.BinDiff"));
+
+  AvSignatureGenerator siggen;
+  siggen.set_num_threads(2);
+  Signatures signatures;
+  EXPECT_THAT(siggen.GenerateSignatures(requests, &signatures), Not(IsOk()));
+  EXPECT_THAT(signatures.signature_size(), Eq(0));
+
+  std::vector<absl::Status> statuses;
+  ASSERT_THAT(siggen.GenerateSignatures(requests, &signatures, &statuses),
+              IsOk());
+  ASSERT_THAT(statuses, SizeIs(3));
+  EXPECT_THAT(statuses[0], IsOk());
+  EXPECT_THAT(statuses[1], IsOk());
+  EXPECT_THAT(statuses[2], Not(IsOk()));
+  ASSERT_THAT(signatures.signature_size(), Eq(2));
+  EXPECT_THAT(signatures.signature(1).definition().min_piece_length(), Eq(8));
+
+  AvSignatureGenerator limited_siggen;
+  limited_siggen.set_num_threads(2).set_num_jobs(1);
+  Signatures limited_signatures;
+  ASSERT_THAT(limited_siggen.GenerateSignatures(requests, &limited_signatures,
+                                                &statuses),
+              IsOk());
+  EXPECT_THAT(limited_signatures.SerializeAsString(),
+              StrEq(signatures.SerializeAsString()));
+}
+
+TEST(SignatureManifestTest, ParseSignatureManifest) {
+  SignatureDefinition base_definition;
+  base_definition.set_trim_length(100);
+  std::vector<SignatureRequest> requests;
+  ASSERT_THAT(ParseSignatureManifest("# Comment\n"
+                                     "\n"
+                                     "First a.BinDiff b.BinDiff\n"
+                                     "  Second\ta.BinDiff  \n",
+                                     base_definition, &requests),
+              IsOk());
+  ASSERT_THAT(requests, SizeIs(2));
+  EXPECT_THAT(requests[0].definition.detection_name(), StrEq("First"));
+  EXPECT_THAT(requests[0].definition.trim_length(), Eq(100));
+  EXPECT_THAT(requests[0].diff_results,
+              ElementsAre("a.BinDiff", "b.BinDiff"));
+  EXPECT_THAT(requests[1].definition.detection_name(), StrEq("Second"));
+  EXPECT_THAT(requests[1].diff_results, ElementsAre("a.BinDiff"));
+
+  requests.clear();
+  EXPECT_THAT(ParseSignatureManifest("NoDiffs\n", base_definition, &requests),
+              Not(IsOk()));
+  EXPECT_THAT(ParseSignatureManifest("Same a.BinDiff\nSame b.BinDiff\n",
+                                     base_definition, &requests),
+              Not(IsOk()));
+}
+
+// Pretends that each function occurs in the same number of binaries.
+class FixedPrevalenceIndex : public FunctionPrevalenceIndex {
+ public:
+  FixedPrevalenceIndex(uint32_t num_binaries, uint32_t count)
+      : num_binaries_(num_binaries), count_(count) {}
+
+  uint32_t num_binaries() const override { return num_binaries_; }
+
+  void Lookup(absl::Span<const uint64_t> /*hashes*/,
+              absl::Span<uint32_t> counts) const override {
+    std::fill(counts.begin(), counts.end(), count_);
+  }
+
+ private:
+  uint32_t num_binaries_;
+  uint32_t count_;
+};
+
+TEST_F(SiggenTest, FunctionPrevalenceWeights) {
+  AvSignatureGenerator siggen;
+  siggen.set_function_prevalence_index(
+      std::make_shared<FixedPrevalenceIndex>(10, 3));
+  SetupDefaultSignature(&siggen);
+  int num_weighted = 0;
+  for (const auto& piece : signature_.raw_signature().piece()) {
+    // Masked pieces are penalized with a weight of zero.
+    EXPECT_THAT(piece.weight(), AnyOf(Eq(0), Eq(10 - 3)));
+    num_weighted += piece.weight() != 0;
+  }
+  EXPECT_THAT(num_weighted, Gt(0));
+
+  // Changing the index recomputes the weights.
+  siggen.set_function_prevalence_index(
+      std::make_shared<FixedPrevalenceIndex>(10, 10));
+  ASSERT_THAT(siggen.Generate(&signature_), IsOk());
+  for (const auto& piece : signature_.raw_signature().piece()) {
+    EXPECT_THAT(piece.weight(), Eq(0));
+  }
+}
+
+TEST_F(SiggenTest, CandidatePruning) {
+  AvSignatureGenerator siggen;
+  SetupDefaultSignature(&siggen);
+  const GenerationStats full_stats = siggen.stats();
+
+  CandidatePruning pruning;
+  pruning.min_basic_block_bytes = 8;
+  pruning.max_functions = 10;
+  pruning.skip_thunks = true;
+  siggen.set_candidate_pruning(pruning);
+  Signature signature;
+  signature.mutable_definition()->set_min_piece_length(8);
+  ASSERT_THAT(siggen.Generate(&signature), IsOk());
+  const auto& stats = siggen.stats();
+  EXPECT_THAT(stats.basic_block_candidates().total_input_size(),
+              Lt(full_stats.basic_block_candidates().total_input_size() / 2));
+  EXPECT_THAT(stats.basic_block_candidates().output_size(), Gt(0));
+  EXPECT_THAT(GetSignatureSize(signature),
+              Lt(GetSignatureSize(signature_)));
+}
+
+TEST_F(SiggenTest, StagesNeedPreviousStages) {
+  AvSignatureGenerator siggen;
+  EXPECT_THAT(siggen.LoadMatchChainTable(signature_.definition()),
+              Not(IsOk()));
+  EXPECT_THAT(siggen.ComputeCandidates(), Not(IsOk()));
+  EXPECT_THAT(siggen.ConstructSignature(&signature_), Not(IsOk()));
+}
+
 TEST_F(SiggenTest, EmptyRawSignaturePieces) {
   AvSignatureGenerator siggen;
-  const std::string file_name(JoinPath(
-      getenv("TEST_SRCDIR"),
-      "com_google_vxsig/vxsig/testdata/"
-      "592fb377afa9f93670a23159aa585e0eca908b97571ab3218e026fea3598cc16_vs_"
-      "65d25a86feb6d15527e398d7b5d043e7712b00e674bc6e8cf2a709a0c6f9b97b."
-      "BinDiff"));
-  ASSERT_THAT(FileExists(file_name), IsTrue());
+  const std::string file_name = SmallDiffResult();
   siggen.AddDiffResults(std::vector<std::string>(1 /* size */, file_name));
   Signature signature;
   ASSERT_THAT(siggen.Generate(&signature), IsOk());
@@ -195,4 +577,142 @@ TEST_F(SiggenTest, NotADiffChain) {
               HasSubstr("Input files do not form a chain of diffs"));
 }
 
+TEST_F(SiggenTest, StarOfDiffsInAllLoadPaths) {
+  const std::vector<std::string> diff_results = StarDiffResults();
+  AvSignatureGenerator siggen;
+  siggen.AddDiffResults(diff_results);
+  Signature signature;
+  ASSERT_THAT(siggen.Generate(&signature), IsOk());
+  EXPECT_THAT(signature.raw_signature().piece(), Not(IsEmpty()));
+  const std::string expected = signature.raw_signature().SerializeAsString();
+
+  auto cache = std::make_shared<ColumnCache>(/*memory_budget=*/1 << 30);
+  for (int i = 0; i < 2; ++i) {
+    // The second run reuses the cached columns.
+    AvSignatureGenerator cached_siggen;
+    cached_siggen.set_column_cache(cache);
+    cached_siggen.AddDiffResults(diff_results);
+    Signature cached_signature;
+    ASSERT_THAT(cached_siggen.Generate(&cached_signature), IsOk());
+    EXPECT_THAT(cached_signature.raw_signature().SerializeAsString(),
+                StrEq(expected));
+  }
+
+  std::vector<SignatureRequest> requests(2);
+  requests[0].diff_results = diff_results;
+  requests[1].diff_results = {diff_results[1]};
+  for (const bool use_cache : {false, true}) {
+    AvSignatureGenerator batch_siggen;
+    batch_siggen.set_num_threads(2);
+    if (use_cache) {
+      batch_siggen.set_column_cache(cache);
+    }
+    Signatures signatures;
+    ASSERT_THAT(batch_siggen.GenerateSignatures(requests, &signatures), IsOk());
+    ASSERT_THAT(signatures.signature_size(), Eq(2));
+    EXPECT_THAT(signatures.signature(0).raw_signature().SerializeAsString(),
+                StrEq(expected));
+  }
+}
+
+TEST_F(SiggenTest, GenerateSignaturesLoadsSharedColumnsOnce) {
+  // The star uses the columns of both diffs and of both secondary binaries.
+  // The other two tables only use columns of the star.
+  const std::vector<std::string> diff_results = StarDiffResults();
+  std::vector<SignatureRequest> requests(3);
+  requests[0].diff_results = diff_results;
+  requests[1].diff_results = {diff_results[0]};
+  requests[2].diff_results = {diff_results[1]};
+
+  auto cache = std::make_shared<ColumnCache>(/*memory_budget=*/1 << 30);
+  AvSignatureGenerator siggen;
+  siggen.set_num_threads(4).set_num_jobs(3).set_column_cache(cache);
+  Signatures signatures;
+  ASSERT_THAT(siggen.GenerateSignatures(requests, &signatures), IsOk());
+  EXPECT_THAT(signatures.signature_size(), Eq(3));
+  EXPECT_THAT(siggen.stats().num_loaded_columns(), Eq(4));
+
+  // All columns are in the cache now.
+  ASSERT_THAT(siggen.GenerateSignatures(requests, &signatures), IsOk());
+  EXPECT_THAT(siggen.stats().num_loaded_columns(), Eq(0));
+}
+
+TEST_F(SiggenTest, DiffsWithSharedSecondaryBinary) {
+  // Both diffs add the same binary to the tree.
+  const std::string diff_result = DefaultDiffResults()[0];
+  AvSignatureGenerator siggen;
+  siggen.AddDiffResults({diff_result, diff_result});
+  Signature signature;
+  EXPECT_THAT(siggen.Generate(&signature).ToString(),
+              HasSubstr("is part of more than one diff"));
+}
+
+TEST_F(SiggenTest, SimilarItemSelection) {
+  const std::vector<std::string> star = StarDiffResults();
+  AvSignatureGenerator exact_siggen;
+  exact_siggen.AddDiffResults(star);
+  Signature exact_signature;
+  ASSERT_THAT(exact_siggen.Generate(&exact_signature), IsOk());
+
+  // The selection orders the diffs by similarity.
+  AvSignatureGenerator siggen;
+  siggen.AddDiffResults({star[1], star[0]});
+  Signature signature;
+  signature.mutable_definition()->set_item_selection(
+      SignatureDefinition::ITEMS_SIMILAR);
+  ASSERT_THAT(siggen.Generate(&signature), IsOk());
+  EXPECT_THAT(signature.raw_signature().SerializeAsString(),
+              StrEq(exact_signature.raw_signature().SerializeAsString()));
+  EXPECT_THAT(siggen.stats().stage(0).name(), StrEq("select_items"));
+
+  // The metadata is not read again to find that the table is up to date.
+  const std::string moved = absl::StrCat(star[1], ".moved");
+  ASSERT_THAT(std::rename(star[1].c_str(), moved.c_str()), Eq(0));
+  EXPECT_THAT(siggen.Generate(&signature), IsOk());
+  ASSERT_THAT(std::rename(moved.c_str(), star[1].c_str()), Eq(0));
+
+  // The copy has a similarity of 0.9 and is dropped.
+  signature.mutable_definition()->set_items_min_similarity(0.92);
+  ASSERT_THAT(siggen.Generate(&signature), IsOk());
+  AvSignatureGenerator first_siggen;
+  first_siggen.AddDiffResults({star[0]});
+  Signature first_signature;
+  ASSERT_THAT(first_siggen.Generate(&first_signature), IsOk());
+  EXPECT_THAT(signature.raw_signature().SerializeAsString(),
+              StrEq(first_signature.raw_signature().SerializeAsString()));
+
+  signature.mutable_definition()->set_items_min_similarity(0.99);
+  EXPECT_THAT(siggen.Generate(&signature).ToString(),
+              HasSubstr("No diff results with a similarity of at least"));
+}
+
+TEST_F(SiggenTest, AppendDiffResult) {
+  AvSignatureGenerator full_siggen;
+  SetupDefaultSignature(&full_siggen);
+  const Signature full_signature(signature_);
+
+  const std::vector<std::string> diff_results = DefaultDiffResults();
+  AvSignatureGenerator siggen;
+  EXPECT_THAT(siggen.AppendDiffResult(diff_results[1]).ToString(),
+              HasSubstr("Need to compute candidates first"));
+  siggen.AddDiffResults({diff_results[0]});
+  Signature signature;
+  ASSERT_THAT(siggen.Generate(&signature), IsOk());
+
+  // Only the first binary of the new diff is part of the chain.
+  EXPECT_THAT(siggen.AppendDiffResult(diff_results[0]).ToString(),
+              HasSubstr("is not the last binary of the chain"));
+
+  ASSERT_THAT(siggen.AppendDiffResult(diff_results[1]), IsOk());
+  EXPECT_THAT(siggen.stats().column(), SizeIs(3));
+  // The extended table and narrowed candidates are reused.
+  ASSERT_THAT(siggen.Generate(&signature), IsOk());
+  ASSERT_THAT(siggen.stats().stage(), SizeIs(1));
+  EXPECT_THAT(siggen.stats().stage(0).name(), StrEq("construct_signature"));
+  // Narrowing the candidates may lose a few of them compared to computing
+  // them from scratch.
+  EXPECT_THAT(GetSignatureSize(signature),
+              Gt(GetSignatureSize(full_signature) * 9 / 10));
+}
+
 }  // namespace security::vxsig
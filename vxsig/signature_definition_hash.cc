@@ -14,7 +14,8 @@
 
 #include "vxsig/signature_definition_hash.h"
 
-#include "absl/hash/hash.h"
+#include "absl/hash/internal/city.h"
+#include "absl/strings/str_cat.h"
 #include "absl/strings/str_format.h"
 #include "absl/strings/string_view.h"
 
@@ -31,67 +32,65 @@ void StringAppendShortenedHexInt(std::string* result, IntT value) {
   absl::StrAppendFormat(result, "%04x", static_cast<size_t>(value) % 0x10000);
 }
 
+SignatureDefinition MakeDefinition(absl::string_view group, int32_t variant) {
+  SignatureDefinition sig_def;
+  sig_def.clear_signature_group();
+  sig_def.add_signature_group(std::string(group));
+  sig_def.set_variant(variant);
+  return sig_def;
+}
+
 }  // namespace
 
 SignatureDefinitionHasher::SignatureDefinitionHasher(
     const SignatureDefinition& sig_def)
-    : sig_def_(sig_def) {}
-
-SignatureDefinitionHasher::SignatureDefinitionHasher(absl::string_view group,
-                                                     int32_t variant)
-    : SignatureDefinitionHasher(SignatureDefinition()) {
-  sig_def_.clear_signature_group();
-  sig_def_.add_signature_group(std::string(group));
-  sig_def_.set_variant(variant);
-}
-
-std::string SignatureDefinitionHasher::GetSignatureIdPrefixUpToGroup() const {
-  std::string result(kSignatureItemPrefix);
-  std::string group(
-      sig_def_.signature_group_size() > 0 ? sig_def_.signature_group(0) : "");
+    : prefix_up_to_group_(kSignatureItemPrefix) {
+  const absl::string_view group =
+      sig_def.signature_group_size() > 0 ? sig_def.signature_group(0) : "";
   StringAppendShortenedHexInt(
-      &result, absl::hash_internal::CityHash64(group.c_str(), group.size()));
-  return result;
-}
+      &prefix_up_to_group_,
+      absl::hash_internal::CityHash64(group.data(), group.size()));
 
-size_t SignatureDefinitionHasher::GetItemIdsHash() const {
-  size_t result = 0;
-  for (const auto& item_id : sig_def_.item_id()) {
-    result ^= absl::hash_internal::CityHash64(item_id.c_str(), item_id.size());
+  for (const auto& item_id : sig_def.item_id()) {
+    item_ids_hash_ ^=
+        absl::hash_internal::CityHash64(item_id.data(), item_id.size());
   }
-  return result;
-}
-
-std::string SignatureDefinitionHasher::GetSignatureIdPrefixUpToItemIdsHash()
-    const {
-  std::string result(GetSignatureIdPrefixUpToGroup());
-  StringAppendShortenedHexInt(&result, GetItemIdsHash());
-  return result;
-}
+  prefix_up_to_item_ids_hash_ = prefix_up_to_group_;
+  StringAppendShortenedHexInt(&prefix_up_to_item_ids_hash_, item_ids_hash_);
 
-std::string SignatureDefinitionHasher::GetSignatureIdPrefixUpToVariant() const {
-  std::string result(GetSignatureIdPrefixUpToItemIdsHash());
-  StringAppendShortenedHexInt(&result, sig_def_.variant());
-  return result;
-}
+  prefix_up_to_variant_ = prefix_up_to_item_ids_hash_;
+  StringAppendShortenedHexInt(&prefix_up_to_variant_, sig_def.variant());
 
-std::string SignatureDefinitionHasher::GetSignatureIdPrefixUpToParamsHash()
-    const {
-  std::string result(GetSignatureIdPrefixUpToVariant());
-  SignatureDefinition def_copy(sig_def_);
-  def_copy.clear_unique_signature_id();
-  def_copy.clear_item_id();  // Those have been included in the hash already.
-  result.append("_");
-  std::string copy = def_copy.SerializeAsString();
+  // The parameters hash is over the serialized definition, which keeps the
+  // ids stable across releases.
+  SignatureDefinition params(sig_def);
+  params.clear_unique_signature_id();
+  params.clear_item_id();  // Those have been included in the hash already.
+  const std::string serialized = params.SerializeAsString();
+  prefix_up_to_params_hash_ = absl::StrCat(prefix_up_to_variant_, "_");
   StringAppendShortenedHexInt(
-      &result, absl::hash_internal::CityHash64(copy.c_str(), copy.size()));
-  return result;
+      &prefix_up_to_params_hash_,
+      absl::hash_internal::CityHash64(serialized.data(), serialized.size()));
 }
 
+SignatureDefinitionHasher::SignatureDefinitionHasher(absl::string_view group,
+                                                     int32_t variant)
+    : SignatureDefinitionHasher(MakeDefinition(group, variant)) {}
+
 std::string SignatureDefinitionHasher::GetSignatureId(int32_t rand) const {
-  std::string result(GetSignatureIdPrefixUpToParamsHash());
+  std::string result(prefix_up_to_params_hash_);
   StringAppendShortenedHexInt(&result, rand);
   return result;
 }
 
+std::vector<std::string> SignatureDefinitionHasher::GetSignatureIds(
+    absl::Span<const int32_t> rands) const {
+  std::vector<std::string> result;
+  result.reserve(rands.size());
+  for (const int32_t rand : rands) {
+    result.push_back(GetSignatureId(rand));
+  }
+  return result;
+}
+
 }  // namespace security::vxsig
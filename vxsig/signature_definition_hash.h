@@ -18,8 +18,10 @@
 #include <cstddef>
 #include <cstdint>
 #include <string>
+#include <vector>
 
 #include "absl/strings/string_view.h"
+#include "absl/types/span.h"
 #include "vxsig/vxsig.pb.h"
 
 namespace security::vxsig {
@@ -40,6 +42,8 @@ namespace security::vxsig {
 // This way, a query for related signatures from a signature group is a
 // prefix query. Same goes for a query for variants of a signature for the
 // purposes of distributing randomized signatures.
+// All hashes are computed once on construction, so that generating many ids
+// from the same definition is cheap.
 class SignatureDefinitionHasher {
  public:
   explicit SignatureDefinitionHasher(const SignatureDefinition& sig_def);
@@ -51,17 +55,33 @@ class SignatureDefinitionHasher {
   SignatureDefinitionHasher& operator=(const SignatureDefinitionHasher&) =
       delete;
 
-  std::string GetSignatureIdPrefixUpToGroup() const;
+  const std::string& GetSignatureIdPrefixUpToGroup() const {
+    return prefix_up_to_group_;
+  }
 
-  size_t GetItemIdsHash() const;
+  size_t GetItemIdsHash() const { return item_ids_hash_; }
 
-  std::string GetSignatureIdPrefixUpToItemIdsHash() const;
-  std::string GetSignatureIdPrefixUpToVariant() const;
-  std::string GetSignatureIdPrefixUpToParamsHash() const;
+  const std::string& GetSignatureIdPrefixUpToItemIdsHash() const {
+    return prefix_up_to_item_ids_hash_;
+  }
+  const std::string& GetSignatureIdPrefixUpToVariant() const {
+    return prefix_up_to_variant_;
+  }
+  const std::string& GetSignatureIdPrefixUpToParamsHash() const {
+    return prefix_up_to_params_hash_;
+  }
   std::string GetSignatureId(int32_t rand) const;
 
+  // Returns the signature ids for all of the specified random ids, in order.
+  std::vector<std::string> GetSignatureIds(
+      absl::Span<const int32_t> rands) const;
+
  private:
-  SignatureDefinition sig_def_;
+  size_t item_ids_hash_ = 0;
+  std::string prefix_up_to_group_;
+  std::string prefix_up_to_item_ids_hash_;
+  std::string prefix_up_to_variant_;
+  std::string prefix_up_to_params_hash_;
 };
 
 }  // namespace security::vxsig
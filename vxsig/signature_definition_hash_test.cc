@@ -17,7 +17,9 @@
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 
+using testing::ElementsAre;
 using testing::Eq;
+using testing::IsEmpty;
 
 namespace security::vxsig {
 
@@ -68,4 +70,22 @@ TEST_F(SignatureDefinitionHashTest, ValidSignatureDefinition) {
   EXPECT_THAT(hasher.GetSignatureId(0), Eq("sig_63ad6eaa162e_07510000"));
 }
 
+TEST_F(SignatureDefinitionHashTest, GetSignatureIds) {
+  const SignatureDefinitionHasher hasher(sig_def_);
+  const int32_t rands[] = {0, 0x1234, -1};
+  EXPECT_THAT(hasher.GetSignatureIds(rands),
+              ElementsAre("sig_63ad6eaa162e_07510000",
+                          "sig_63ad6eaa162e_07511234",
+                          "sig_63ad6eaa162e_0751ffff"));
+  EXPECT_THAT(hasher.GetSignatureIds({}), IsEmpty());
+}
+
+TEST_F(SignatureDefinitionHashTest, GroupAndVariant) {
+  SignatureDefinition sig_def;
+  sig_def.add_signature_group("tag");
+  sig_def.set_variant(5678);
+  EXPECT_THAT(SignatureDefinitionHasher("tag", 5678).GetSignatureId(42),
+              Eq(SignatureDefinitionHasher(sig_def).GetSignatureId(42)));
+}
+
 }  // namespace security::vxsig
@@ -15,17 +15,38 @@
 #include "vxsig/signature_formatter.h"
 
 #include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
 #include <random>
+#include <string>
+#include <utility>
+#include <vector>
 
+#include "absl/hash/internal/city.h"
 #include "absl/memory/memory.h"
 #include "absl/strings/str_cat.h"
 #include "absl/strings/string_view.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
 #include "third_party/zynamics/binexport/util/status_macros.h"
 #include "vxsig/clamav_signature_formatter.h"
 #include "vxsig/generic_signature.h"
+#include "vxsig/signature_definition_hash.h"
 #include "vxsig/yara_signature_formatter.h"
 
 namespace security::vxsig {
+namespace {
+
+// Number of signatures that FormatDatabase() formats into one buffer if run
+// on a thread pool.
+constexpr int kSignaturesPerBatch = 64;
+
+// Number of batches per thread that are formatted before they are appended
+// to the sink.
+constexpr int kBatchesPerThread = 4;
+
+}  // namespace
 
 std::unique_ptr<SignatureFormatter> SignatureFormatter::Create(
     SignatureType type) {
@@ -44,85 +65,178 @@ absl::Status SignatureFormatter::Format(Signature* signature) const {
   if (!signature) {
     return absl::InvalidArgumentError("Signature must not be nullptr");
   }
-  return DoFormat(signature);
+  return DoFormat(signature->raw_signature(), signature);
+}
+
+absl::Status SignatureFormatter::FormatPacked(const PackedRawSignature& packed,
+                                              Signature* signature) const {
+  if (!signature) {
+    return absl::InvalidArgumentError("Signature must not be nullptr");
+  }
+  const auto& definition = signature->definition();
+  const auto algorithm = definition.trim_algorithm();
+  const bool weighted =
+      algorithm == SignatureDefinition::TRIM_WEIGHTED ||
+      algorithm == SignatureDefinition::TRIM_WEIGHTED_GREEDY;
+  UnpackRawSignature(packed, definition.min_piece_length(),
+                     /*skip_zero_weight=*/weighted,
+                     signature->mutable_raw_signature());
+  const absl::Status status = DoFormat(signature->raw_signature(), signature);
+  signature->clear_raw_signature();
+  return status;
 }
 
 absl::Status SignatureFormatter::FormatDatabase(
     const Signatures& signatures, std::string* database) const {
-  return DoFormatDatabase(signatures, ABSL_DIE_IF_NULL(database));
+  ABSL_DIE_IF_NULL(database)->clear();
+  StringSignatureSink sink(database);
+  return FormatDatabase(signatures, &sink);
 }
 
-namespace {
+absl::Status SignatureFormatter::FormatDatabase(const Signatures& signatures,
+                                                SignatureSink* sink,
+                                                ThreadPool* pool) const {
+  ABSL_DIE_IF_NULL(sink);
+  const int num_signatures = signatures.signature_size();
+  if (!pool || pool->num_threads() < 2 ||
+      num_signatures <= kSignaturesPerBatch) {
+    // Reused for all signatures.
+    std::string entry;
+    for (const auto& signature : signatures.signature()) {
+      NA_RETURN_IF_ERROR(DoFormatDatabaseEntry(signature, &entry));
+      NA_RETURN_IF_ERROR(sink->Append(entry));
+    }
+    return absl::OkStatus();
+  }
 
-absl::Status SolveKnapsack(const int64_t max_byte_len,
-                           const RawSignature& raw_signature,
-                           std::vector<int>* piece_indices) {
-  if (!piece_indices) {
-    return absl::InvalidArgumentError("Piece indices must be non-nullptr");
+  // Each batch is formatted into its own buffer. Only a bounded number of
+  // batches is in flight, so memory use does not grow with the database.
+  // The buffers are appended to the sink in order, which keeps the output
+  // identical to the serial case.
+  struct Batch {
+    std::string buffer;
+    absl::Status status;
+  };
+  std::vector<Batch> batches(kBatchesPerThread * pool->num_threads());
+  for (int begin = 0; begin < num_signatures;
+       begin += batches.size() * kSignaturesPerBatch) {
+    const int end = std::min<int>(
+        num_signatures, begin + batches.size() * kSignaturesPerBatch);
+    const int num_batches =
+        (end - begin + kSignaturesPerBatch - 1) / kSignaturesPerBatch;
+    ParallelFor(num_batches, pool, [&](int i) {
+      auto& batch = batches[i];
+      batch.buffer.clear();
+      batch.status = absl::OkStatus();
+      std::string entry;
+      const int batch_begin = begin + i * kSignaturesPerBatch;
+      const int batch_end = std::min(end, batch_begin + kSignaturesPerBatch);
+      for (int j = batch_begin; j < batch_end; ++j) {
+        batch.status = DoFormatDatabaseEntry(signatures.signature(j), &entry);
+        if (!batch.status.ok()) {
+          // Keep the entries before the failed signature.
+          break;
+        }
+        batch.buffer.append(entry);
+      }
+    });
+    for (int i = 0; i < num_batches; ++i) {
+      NA_RETURN_IF_ERROR(sink->Append(batches[i].buffer));
+      NA_RETURN_IF_ERROR(batches[i].status);
+    }
   }
-  // The code below is disabled for now, as piece weights need a function
-  // corpus.
-  // When enabling, include "ortools/linear_solver/linear_solver.h".
-#if 0
-  MPSolver solver("SolverSiggen", MPSolver::SCIP_MIXED_INTEGER_PROGRAMMING);
-  solver.SetSolverSpecificParametersAsString(
-      absl::StrCat("limits/memory = ", 8ULL << 30 /* 8 GiB */,
-                   "\nlimits/time = ", 1800 /* 30min */, "\n"));
-  solver.MutableObjective()->SetMaximization();
-  MPConstraint* contraint = solver.MakeRowConstraint(0.0, max_byte_len);
+  return absl::OkStatus();
+}
 
-  // Gather maximum weight and size values to scale later.
-  double max_weight = 0;
-  double max_size = 0;
-  for (const auto& piece : raw_signature.piece()) {
-    max_weight = std::max(static_cast<double>(piece.weight()), max_weight);
-    max_size = std::max(static_cast<double>(piece.bytes().size()), max_size);
+absl::Status SignatureFormatter::FormatVariants(const Signature& signature,
+                                                int num_variants,
+                                                Signatures* variants,
+                                                ThreadPool* pool) const {
+  ABSL_DIE_IF_NULL(variants)->clear_signature();
+  if (signature.definition().trim_algorithm() !=
+      SignatureDefinition::TRIM_RANDOM) {
+    return absl::InvalidArgumentError(
+        "Signature variants need TRIM_RANDOM trimming");
   }
+  if (num_variants <= 0) {
+    return absl::OkStatus();
+  }
+  // The random part of the signature ids is derived from the raw signature,
+  // so that the ids are stable across runs.
+  const std::string raw_signature =
+      signature.raw_signature().SerializeAsString();
+  const auto raw_signature_hash = static_cast<int32_t>(
+      absl::hash_internal::CityHash64(raw_signature.data(),
+                                      raw_signature.size()));
 
-  std::vector<MPVariable*> vars(piece_indices->size());
-  const double log_max_weight = log(max_weight);
-  for (int i = 0; i < vars.size(); ++i) {
-    const auto& piece = raw_signature.piece((*piece_indices)[i]);
-    auto& var = vars[i];
-    var = solver.MakeBoolVar(/*name=*/"");
-    double weight = piece.weight();
-    if (weight > 0) {
-      // Log scale the weight and map into a (0, 100] range. The "+ 1" ensures
-      // that we never end up with zero weights. The log scale is useful since
-      // we're ultimately dealing with function frequencies.
-      const double scaled_log_weight =
-          (1 + log(weight)) / (1 + log_max_weight) * 100;
-      // Scale the piece length into (0, 100] range. Since the pieces are not
-      // allowed to be empty, we cannot end up with a zero size.
-      const double scaled_size = piece.bytes().size() / max_size * 100;
-      // Set the weight used for solving the implicit Knapsack problem. By
-      // scaling down the per-piece weight and multiplying with the scaled
-      // per-piece length, we prefer including longer pieces in the final
-      // signature.
-      weight = scaled_log_weight * scaled_size;
-    }
-    solver.MutableObjective()->SetCoefficient(var, weight);
-    contraint->SetCoefficient(var, piece.bytes().size());
+  std::vector<Signature> results(num_variants);
+  NA_RETURN_IF_ERROR(ParallelForWithStatus(
+      num_variants, pool,
+      [this, &signature, &results, raw_signature_hash](int i) {
+        auto& variant = results[i];
+        auto& definition = *variant.mutable_definition();
+        definition = signature.definition();
+        definition.set_variant(signature.definition().variant() + i);
+        definition.set_unique_signature_id(
+            SignatureDefinitionHasher(definition)
+                .GetSignatureId(raw_signature_hash));
+        for (auto& meta : *definition.mutable_meta()) {
+          if (meta.key() == "vxsig_taskid") {
+            meta.set_string_value(definition.unique_signature_id());
+          }
+        }
+        return DoFormat(signature.raw_signature(), &variant);
+      }));
+  for (auto& variant : results) {
+    *variants->add_signature() = std::move(variant);
+  }
+  return absl::OkStatus();
+}
+
+not_absl::StatusOr<std::unique_ptr<FileSignatureSink>> FileSignatureSink::Open(
+    absl::string_view filename) {
+  auto sink = absl::WrapUnique(new FileSignatureSink());
+  sink->filename_ = std::string(filename);
+  sink->file_.open(sink->filename_,
+                   std::ios_base::binary | std::ios_base::trunc);
+  if (!sink->file_) {
+    return absl::NotFoundError(absl::StrCat("cannot open ", filename));
   }
-  const auto solver_result = solver.Solve();
-  if (solver_result != MPSolver::OPTIMAL) {
-    return absl::InternalError(
-        absl::StrCat("Solver failed with code: ", solver_result));
+  return sink;
+}
+
+absl::Status FileSignatureSink::Append(absl::string_view data) {
+  file_.write(data.data(), data.size());
+  if (!file_) {
+    return absl::InternalError(absl::StrCat("cannot write ", filename_));
   }
-  RawSignature result;
-  for (int i = 0; i < vars.size(); ++i) {
-    if (vars[i]->solution_value() == 0.0) {
-      (*piece_indices)[i] = -1;
-    }
+  return absl::OkStatus();
+}
+
+absl::Status FileSignatureSink::Close() {
+  file_.close();
+  if (!file_) {
+    return absl::InternalError(absl::StrCat("cannot write ", filename_));
   }
-  piece_indices->erase(
-      std::remove_if(piece_indices->begin(), piece_indices->end(),
-                     [](int i) { return i < 0; }),
-      piece_indices->end());
-#endif
   return absl::OkStatus();
 }
 
+namespace {
+
+// Lowercase hex digits of each byte value.
+struct HexTable {
+  constexpr HexTable() : digits() {
+    constexpr char kDigits[] = "0123456789abcdef";
+    for (int i = 0; i < 256; ++i) {
+      digits[i][0] = kDigits[i >> 4];
+      digits[i][1] = kDigits[i & 0xF];
+    }
+  }
+  char digits[256][2];
+};
+
+constexpr HexTable kHexTable;
+
 void TrimLast(const int64_t max_length, const RawSignature& raw_sig,
               std::vector<int>* piece_indices) {
   int current_length = 0;
@@ -138,6 +252,24 @@ void TrimLast(const int64_t max_length, const RawSignature& raw_sig,
   piece_indices->resize(j);
 }
 
+// Keeps pieces in the order given by piece_indices as long as they fit into
+// max_length bytes.
+void KeepFirstThatFit(const int64_t max_length, const RawSignature& raw_sig,
+                      std::vector<int>* piece_indices) {
+  std::vector<int> keep_indices;
+  int current_length = 0;
+  for (const auto& i : *piece_indices) {
+    int64_t new_length = current_length + raw_sig.piece(i).bytes().size();
+    if (new_length > max_length) {
+      // Don't give up yet, shorter pieces may follow.
+      continue;
+    }
+    keep_indices.push_back(i);
+    current_length = new_length;
+  }
+  piece_indices->swap(keep_indices);
+}
+
 void TrimLowWeight(const int64_t max_length, const RawSignature& raw_sig,
                    std::vector<int>* piece_indices) {
   std::sort(
@@ -151,29 +283,355 @@ void TrimLowWeight(const int64_t max_length, const RawSignature& raw_sig,
         }
         return compare > 0;
       });
+  KeepFirstThatFit(max_length, raw_sig, piece_indices);
+}
 
-  std::vector<int> keep_indices;
-  int current_length = 0;
-  for (const auto& i : *piece_indices) {
-    int64_t new_length = current_length + raw_sig.piece(i).bytes().size();
-    if (new_length > max_length) {
-      // Don't give up yet, shorter pieces may follow.
+// Time budget for solving the knapsack problem of TRIM_WEIGHTED with branch
+// and bound. Once it is used up, the best selection found so far is used.
+constexpr absl::Duration kKnapsackTimeBudget = absl::Seconds(10);
+
+// Maximum number of cells (pieces times byte budget) of the dynamic program
+// that solves the knapsack problem exactly. Larger instances are solved with
+// branch and bound instead.
+constexpr int64_t kMaxKnapsackTableCells = int64_t{1} << 26;
+
+// Maximum byte budget of the dynamic program, which keeps a row of values for
+// each budget from zero up to it.
+constexpr int64_t kMaxKnapsackTableCapacity = int64_t{1} << 20;
+
+// Computes the value of each piece for SolveKnapsack().
+std::vector<double> KnapsackValues(const RawSignature& raw_signature,
+                                   const std::vector<int>& piece_indices) {
+  // Gather maximum weight and size values to scale later.
+  double max_weight = 0;
+  double max_size = 0;
+  for (const auto& piece : raw_signature.piece()) {
+    max_weight = std::max(static_cast<double>(piece.weight()), max_weight);
+    max_size = std::max(static_cast<double>(piece.bytes().size()), max_size);
+  }
+
+  std::vector<double> values(piece_indices.size());
+  const double log_max_weight = log(max_weight);
+  for (int i = 0; i < values.size(); ++i) {
+    const auto& piece = raw_signature.piece(piece_indices[i]);
+    double weight = piece.weight();
+    if (weight > 0) {
+      // Log scale the weight and map into a (0, 100] range. The "+ 1" ensures
+      // that we never end up with zero weights. The log scale is useful since
+      // we're ultimately dealing with function frequencies.
+      const double scaled_log_weight =
+          (1 + log(weight)) / (1 + log_max_weight) * 100;
+      // Scale the piece length into (0, 100] range. Since the pieces are not
+      // allowed to be empty, we cannot end up with a zero size.
+      const double scaled_size = piece.bytes().size() / max_size * 100;
+      // Set the weight used for solving the implicit Knapsack problem. By
+      // scaling down the per-piece weight and multiplying with the scaled
+      // per-piece length, we prefer including longer pieces in the final
+      // signature.
+      weight = scaled_log_weight * scaled_size;
+    }
+    values[i] = weight;
+  }
+  return values;
+}
+
+// Solves the 0/1 knapsack problem with a dynamic program over the byte budget.
+// Returns the selected items.
+std::vector<bool> SolveKnapsackTable(const std::vector<double>& values,
+                                     const std::vector<int64_t>& sizes,
+                                     int64_t capacity) {
+  const int num_items = values.size();
+  const int64_t row_size = capacity + 1;
+  std::vector<double> best(row_size, 0);
+  std::vector<bool> take(num_items * row_size);
+  for (int i = 0; i < num_items; ++i) {
+    for (int64_t w = capacity; w >= sizes[i]; --w) {
+      const double value = best[w - sizes[i]] + values[i];
+      if (value > best[w]) {
+        best[w] = value;
+        take[i * row_size + w] = true;
+      }
+    }
+  }
+  std::vector<bool> selected(num_items);
+  int64_t w = capacity;
+  for (int i = num_items - 1; i >= 0; --i) {
+    if (take[i * row_size + w]) {
+      selected[i] = true;
+      w -= sizes[i];
+    }
+  }
+  return selected;
+}
+
+// Depth-first branch and bound for the 0/1 knapsack problem. The items are
+// visited in order of decreasing value density, so that the fractional
+// relaxation yields a tight upper bound.
+class KnapsackBranchAndBound {
+ public:
+  KnapsackBranchAndBound(const std::vector<double>& values,
+                         const std::vector<int64_t>& sizes, int64_t capacity,
+                         absl::Time deadline)
+      : values_(values),
+        sizes_(sizes),
+        capacity_(capacity),
+        deadline_(deadline),
+        order_(values.size()),
+        current_(values.size()) {
+    for (int i = 0; i < order_.size(); ++i) {
+      order_[i] = i;
+    }
+    std::sort(order_.begin(), order_.end(), [this](int a, int b) {
+      return values_[a] * sizes_[b] > values_[b] * sizes_[a];
+    });
+  }
+
+  // Improves on the initial selection until the search space is exhausted or
+  // the deadline has passed. Returns whether the result is optimal.
+  bool Solve(std::vector<bool>* selected) {
+    best_ = *selected;
+    best_value_ = 0;
+    for (int i = 0; i < best_.size(); ++i) {
+      if (best_[i]) {
+        best_value_ += values_[i];
+      }
+    }
+    Search(/*depth=*/0, capacity_, /*value=*/0);
+    selected->swap(best_);
+    return !timed_out_;
+  }
+
+ private:
+  // Upper bound for the value that can still be added by the items from
+  // depth on, allowing a fraction of the first item that does not fit.
+  double Bound(int depth, int64_t remaining) const {
+    double bound = 0;
+    for (; depth < order_.size(); ++depth) {
+      const int item = order_[depth];
+      if (sizes_[item] > remaining) {
+        return bound + values_[item] * remaining / sizes_[item];
+      }
+      remaining -= sizes_[item];
+      bound += values_[item];
+    }
+    return bound;
+  }
+
+  void Search(int depth, int64_t remaining, double value) {
+    if (timed_out_ || (++num_nodes_ % 4096 == 0 && absl::Now() > deadline_)) {
+      timed_out_ = true;
+      return;
+    }
+    if (value > best_value_) {
+      best_value_ = value;
+      best_ = current_;
+    }
+    if (depth == order_.size() ||
+        value + Bound(depth, remaining) <= best_value_) {
+      return;
+    }
+    const int item = order_[depth];
+    if (sizes_[item] <= remaining) {
+      current_[item] = true;
+      Search(depth + 1, remaining - sizes_[item], value + values_[item]);
+      current_[item] = false;
+    }
+    Search(depth + 1, remaining, value);
+  }
+
+  const std::vector<double>& values_;
+  const std::vector<int64_t>& sizes_;
+  const int64_t capacity_;
+  const absl::Time deadline_;
+  std::vector<int> order_;
+  std::vector<bool> current_;
+  std::vector<bool> best_;
+  double best_value_ = 0;
+  int64_t num_nodes_ = 0;
+  bool timed_out_ = false;
+};
+
+// Keeps the pieces with the highest total (scaled) weight that fit into
+// max_byte_len bytes. Small instances are solved exactly with a dynamic
+// program. Larger ones use branch and bound, starting from the selection of
+// TrimLowWeight() and keeping the best selection found within
+// kKnapsackTimeBudget.
+absl::Status SolveKnapsack(const int64_t max_byte_len,
+                           const RawSignature& raw_signature,
+                           std::vector<int>* piece_indices) {
+  if (!piece_indices) {
+    return absl::InvalidArgumentError("Piece indices must be non-nullptr");
+  }
+  std::vector<int64_t> sizes(piece_indices->size());
+  int64_t total_size = 0;
+  for (int i = 0; i < sizes.size(); ++i) {
+    sizes[i] = raw_signature.piece((*piece_indices)[i]).bytes().size();
+    total_size += sizes[i];
+  }
+  if (total_size <= max_byte_len) {
+    return absl::OkStatus();  // Everything fits
+  }
+  const std::vector<double> values =
+      KnapsackValues(raw_signature, *piece_indices);
+
+  std::vector<bool> selected;
+  if (max_byte_len <= kMaxKnapsackTableCapacity &&
+      static_cast<double>(sizes.size()) * (max_byte_len + 1) <=
+          kMaxKnapsackTableCells) {
+    selected = SolveKnapsackTable(values, sizes, max_byte_len);
+  } else {
+    std::vector<int> greedy_indices = *piece_indices;
+    TrimLowWeight(max_byte_len, raw_signature, &greedy_indices);
+    std::sort(greedy_indices.begin(), greedy_indices.end());
+    selected.resize(sizes.size());
+    for (int i = 0; i < sizes.size(); ++i) {
+      selected[i] = std::binary_search(greedy_indices.begin(),
+                                       greedy_indices.end(),
+                                       (*piece_indices)[i]);
+    }
+    KnapsackBranchAndBound(values, sizes, max_byte_len,
+                           absl::Now() + kKnapsackTimeBudget)
+        .Solve(&selected);
+  }
+
+  int num_selected = 0;
+  for (int i = 0; i < selected.size(); ++i) {
+    if (selected[i]) {
+      (*piece_indices)[num_selected++] = (*piece_indices)[i];
+    }
+  }
+  piece_indices->resize(num_selected);
+  return absl::OkStatus();
+}
+
+// Size of the atoms that Yara extracts from its strings for its Aho-Corasick
+// prefilter. ClamAV uses similarly short prefixes for its trie.
+constexpr int kAtomSize = 4;
+
+// Returns whether byte is very common in executables, like padding and fill
+// bytes. Atoms made of such bytes match almost everywhere.
+bool IsCommonByte(uint8_t byte) {
+  switch (byte) {
+    case 0x00:
+    case 0x20:
+    case 0x90:
+    case 0xCC:
+    case 0xFF:
+      return true;
+    default:
+      return false;
+  }
+}
+
+// Rates how selective the atom of up to kAtomSize bytes starting at offset
+// into bytes is. This follows the heuristic that Yara uses to choose its
+// atoms: masked bytes are penalized, common bytes count less than other
+// bytes, and each distinct byte adds a small bonus.
+int AtomQuality(absl::string_view bytes, const std::vector<bool>& masked,
+                int offset) {
+  const int end = std::min<int>(offset + kAtomSize, bytes.size());
+  int quality = 0;
+  uint8_t distinct[kAtomSize];
+  int num_distinct = 0;
+  for (int i = offset; i < end; ++i) {
+    if (masked[i]) {
+      quality -= 10;
       continue;
     }
-    keep_indices.push_back(i);
-    current_length = new_length;
+    const auto byte = static_cast<uint8_t>(bytes[i]);
+    quality += IsCommonByte(byte) ? 12 : 20;
+    if (std::find(distinct, distinct + num_distinct, byte) ==
+        distinct + num_distinct) {
+      distinct[num_distinct++] = byte;
+    }
   }
-  piece_indices->swap(keep_indices);
+  return quality + 2 * num_distinct;
+}
+
+// Scores a signature piece by how cheap it is for a scanner to look for. The
+// score combines the quality of the best atom and of the leading atom of the
+// piece, adds the byte entropy and penalizes masked first or last bytes, as
+// these weaken the atoms at the piece boundaries.
+double ScanCostScore(const RawSignature::Piece& piece) {
+  const absl::string_view bytes = piece.bytes();
+  std::vector<bool> masked(bytes.size());
+  for (const int nibble : piece.masked_nibble()) {
+    if (nibble / 2 < masked.size()) {
+      masked[nibble / 2] = true;
+    }
+  }
+
+  int best_quality = std::numeric_limits<int>::min();
+  for (int i = 0; i + kAtomSize <= bytes.size() || i == 0; ++i) {
+    best_quality = std::max(best_quality, AtomQuality(bytes, masked, i));
+  }
+  const int leading_quality = AtomQuality(bytes, masked, 0);
+
+  int counts[256] = {};
+  int num_unmasked = 0;
+  for (int i = 0; i < bytes.size(); ++i) {
+    if (!masked[i]) {
+      ++counts[static_cast<uint8_t>(bytes[i])];
+      ++num_unmasked;
+    }
+  }
+  double entropy = 0;
+  for (const int count : counts) {
+    if (count > 0) {
+      const double p = static_cast<double>(count) / num_unmasked;
+      entropy -= p * std::log2(p);
+    }
+  }
+
+  double score = best_quality + leading_quality / 2.0 + 4 * entropy;
+  if (!masked.empty()) {
+    score -= (masked.front() ? 10 : 0) + (masked.back() ? 10 : 0);
+  }
+  return score;
+}
+
+void TrimScanCost(const int64_t max_length, const RawSignature& raw_sig,
+                  std::vector<int>* piece_indices) {
+  std::vector<double> scores(raw_sig.piece_size());
+  for (const int i : *piece_indices) {
+    scores[i] = ScanCostScore(raw_sig.piece(i));
+  }
+  std::stable_sort(piece_indices->begin(), piece_indices->end(),
+                   [&raw_sig, &scores](int a, int b) {
+                     if (scores[a] != scores[b]) {
+                       return scores[a] > scores[b];
+                     }
+                     // Prefer longer pieces.
+                     return raw_sig.piece(a).bytes().size() >
+                            raw_sig.piece(b).bytes().size();
+                   });
+  KeepFirstThatFit(max_length, raw_sig, piece_indices);
 }
 
 }  // namespace
 
 absl::Status GetRelevantSignatureSubset(const Signature& input,
-                                            int engine_min_piece_len,
-                                            RawSignature* output) {
+                                        int engine_min_piece_len,
+                                        RawSignature* output) {
+  return GetRelevantSignatureSubset(input, engine_min_piece_len,
+                                    /*goodware_index=*/nullptr, output);
+}
+
+absl::Status GetRelevantSignatureSubset(const Signature& input,
+                                        int engine_min_piece_len,
+                                        const GoodwareIndex* goodware_index,
+                                        RawSignature* output) {
+  return GetRelevantSignatureSubset(input.definition(), input.raw_signature(),
+                                    engine_min_piece_len, goodware_index,
+                                    output);
+}
+
+absl::Status GetRelevantSignatureSubset(const SignatureDefinition& definition,
+                                        const RawSignature& raw_sig,
+                                        int engine_min_piece_len,
+                                        const GoodwareIndex* goodware_index,
+                                        RawSignature* output) {
   CHECK(output);
-  const auto& raw_sig = input.raw_signature();
-  const auto& definition = input.definition();
 
   // Gather all signature pieces of a minimum length.
   const int min_piece_len =
@@ -188,9 +646,15 @@ absl::Status GetRelevantSignatureSubset(const Signature& input,
         piece.weight() == 0) {
       continue;
     }
-    if (piece.bytes().size() >= min_piece_len) {
-      piece_indices.push_back(i);
+    if (piece.bytes().size() < min_piece_len) {
+      continue;
+    }
+    if (goodware_index && goodware_index->MayContainPiece(piece)) {
+      // Likely false positive. The wildcards around it are widened to cover
+      // its bytes below.
+      continue;
     }
+    piece_indices.push_back(i);
   }
 
   int max_length = definition.trim_length();
@@ -226,6 +690,9 @@ absl::Status GetRelevantSignatureSubset(const Signature& input,
     case SignatureDefinition::TRIM_WEIGHTED_GREEDY:
       TrimLowWeight(max_length, raw_sig, &piece_indices);
       break;
+    case SignatureDefinition::TRIM_SCAN_COST:
+      TrimScanCost(max_length, raw_sig, &piece_indices);
+      break;
     default:
       return absl::InvalidArgumentError(
           "Unknown signature trimming algorithm");
@@ -237,10 +704,56 @@ absl::Status GetRelevantSignatureSubset(const Signature& input,
   }
 
   std::sort(piece_indices.begin(), piece_indices.end());
-  for (const auto& i : piece_indices) {
-    *output->add_piece() = raw_sig.piece(i);
-  }
+  CopySignaturePieces(raw_sig, piece_indices, output);
   return absl::OkStatus();
 }
 
+void CopySignaturePieces(const RawSignature& raw_sig,
+                         absl::Span<const int> piece_indices,
+                         RawSignature* output) {
+  for (int i = 0; i < piece_indices.size(); ++i) {
+    auto* piece = output->add_piece();
+    *piece = raw_sig.piece(piece_indices[i]);
+    if (i + 1 == piece_indices.size()) {
+      break;
+    }
+    // The wildcard after a piece also covers the pieces that were left out.
+    int64_t min_qualifier = piece->min_qualifier();
+    int64_t max_qualifier = piece->max_qualifier();
+    for (int j = piece_indices[i] + 1; j < piece_indices[i + 1]; ++j) {
+      const auto& skipped = raw_sig.piece(j);
+      min_qualifier += skipped.bytes().size() + skipped.min_qualifier();
+      max_qualifier = max_qualifier < 0 || skipped.max_qualifier() < 0
+                          ? -1
+                          : max_qualifier + skipped.bytes().size() +
+                                skipped.max_qualifier();
+    }
+    if (min_qualifier != piece->min_qualifier()) {
+      piece->set_min_qualifier(min_qualifier);
+    }
+    if (max_qualifier != piece->max_qualifier()) {
+      piece->set_max_qualifier(max_qualifier);
+    }
+  }
+}
+
+void AppendMaskedHex(absl::string_view bytes,
+                     absl::Span<const int32_t> masked_nibbles,
+                     std::string* output) {
+  const size_t start = output->size();
+  output->resize(start + 2 * bytes.size());
+  char* hex = &(*output)[start];
+  for (const char byte : bytes) {
+    const char* digits = kHexTable.digits[static_cast<uint8_t>(byte)];
+    *hex++ = digits[0];
+    *hex++ = digits[1];
+  }
+  for (const int32_t masked_nibble : masked_nibbles) {
+    if (masked_nibble >= 0 &&
+        static_cast<size_t>(masked_nibble) < 2 * bytes.size()) {
+      (*output)[start + masked_nibble] = '?';
+    }
+  }
+}
+
 }  // namespace security::vxsig
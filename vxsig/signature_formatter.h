@@ -18,17 +18,68 @@
 #ifndef VXSIG_SIGNATURE_FORMATTER_H_
 #define VXSIG_SIGNATURE_FORMATTER_H_
 
+#include <cstdint>
+#include <fstream>
 #include <map>
 #include <memory>
 #include <string>
+#include <utility>
 
 #include "absl/strings/string_view.h"
 #include "absl/status/status.h"
+#include "absl/types/span.h"
+#include "third_party/zynamics/binexport/util/statusor.h"
+#include "vxsig/goodware_index.h"
+#include "vxsig/packed_signature.h"
+#include "vxsig/thread_pool.h"
 #include "vxsig/types.h"
 #include "vxsig/vxsig.pb.h"
 
 namespace security::vxsig {
 
+// Destination of formatted signature databases. Formatters append each
+// signature as soon as it is formatted, so that a database does not need to
+// be held in memory as a whole.
+class SignatureSink {
+ public:
+  virtual ~SignatureSink() = default;
+
+  virtual absl::Status Append(absl::string_view data) = 0;
+};
+
+// A SignatureSink that appends to a string.
+class StringSignatureSink : public SignatureSink {
+ public:
+  explicit StringSignatureSink(std::string* output) : output_(output) {}
+
+  absl::Status Append(absl::string_view data) override {
+    output_->append(data.data(), data.size());
+    return absl::OkStatus();
+  }
+
+ private:
+  std::string* output_;
+};
+
+// A SignatureSink that writes to a file, replacing its contents.
+class FileSignatureSink : public SignatureSink {
+ public:
+  static not_absl::StatusOr<std::unique_ptr<FileSignatureSink>> Open(
+      absl::string_view filename);
+
+  absl::Status Append(absl::string_view data) override;
+
+  // Flushes and closes the file. Write errors are only reported reliably by
+  // this method.
+  absl::Status Close();
+
+ private:
+  FileSignatureSink() = default;
+
+  std::string filename_;
+  std::ofstream file_;
+};
+
 // The SignatureFormatter class allows to convert raw signatures into a target
 // signature format. It follows the factory pattern to instantiate formatters
 // for specific formats.
@@ -49,28 +100,102 @@ class SignatureFormatter {
   // The content of "signature" is undefined at that point.
   absl::Status Format(Signature* signature) const;
 
+  // Like above, but takes the raw signature from its packed form instead of
+  // from signature. Only the pieces that trimming may keep are unpacked, which
+  // gives the same result as formatting the full raw signature. The
+  // raw_signature field of signature is cleared afterwards.
+  absl::Status FormatPacked(const PackedRawSignature& packed,
+                            Signature* signature) const;
+
   // Like above, but combine multiple signatures into one signature database of
-  // the target format.
+  // the target format. Replaces the contents of database. Signatures that
+  // already contain data for the target format are used as is.
   absl::Status FormatDatabase(const Signatures& signatures,
                                   std::string* database) const;
 
+  // Like above, but appends the database to sink, one signature at a time.
+  // If pool is non-null, the signatures are formatted on it concurrently in
+  // batches. The output is the same as without a pool. On error, the sink
+  // contains the entries of all signatures before the failed one.
+  absl::Status FormatDatabase(const Signatures& signatures,
+                              SignatureSink* sink,
+                              ThreadPool* pool = nullptr) const;
+
+  // Formats num_variants randomized variants of the specified signature,
+  // which must have been generated with TRIM_RANDOM trimming. All variants
+  // share its raw signature, so each one only costs a trim and its
+  // formatting. Variant i sets the variant field of the definition to the
+  // one of signature plus i, which seeds the trimming, and gets a unique
+  // signature id from SignatureDefinitionHasher. Replaces the contents of
+  // variants with the formatted variants in order. Variants only carry their
+  // definition and the formatted data, the raw signature is never copied. If
+  // pool is non-null, the variants are formatted on it concurrently.
+  absl::Status FormatVariants(const Signature& signature, int num_variants,
+                              Signatures* variants,
+                              ThreadPool* pool = nullptr) const;
+
+  // Sets an index of the n-grams of a goodware corpus. If set, signature
+  // pieces that likely occur in the corpus are dropped before trimming. The
+  // same index can be shared by any number of formatters.
+  void set_goodware_index(std::shared_ptr<const GoodwareIndex> index) {
+    goodware_index_ = std::move(index);
+  }
+
  protected:
   // Make constructor accessible from the deriving formatter classes.
   SignatureFormatter() = default;
 
+  const GoodwareIndex* goodware_index() const { return goodware_index_.get(); }
+
  private:
-  // These perform the actual formatting.
-  virtual absl::Status DoFormat(Signature* signature) const = 0;
-  virtual absl::Status DoFormatDatabase(const Signatures& signatures,
-                                            std::string* database) const = 0;
+  // These perform the actual formatting. DoFormat() reads the pieces from
+  // raw_signature instead of from signature, so that variants can share one
+  // raw signature.
+  virtual absl::Status DoFormat(const RawSignature& raw_signature,
+                                Signature* signature) const = 0;
+  // Replaces entry with the database entry for a single signature. Must be
+  // safe to call concurrently.
+  virtual absl::Status DoFormatDatabaseEntry(const Signature& signature,
+                                             std::string* entry) const = 0;
+
+  std::shared_ptr<const GoodwareIndex> goodware_index_;
 };
 
 // Checks the truncation strategy and fills the relevant signature subset into
-// an output RawSignature.
+// an output RawSignature. The wildcard qualifiers of the output pieces are
+// adjusted to also cover the pieces that were left out.
 absl::Status GetRelevantSignatureSubset(const Signature& input,
                                         int engine_min_piece_len,
                                         RawSignature* output);
 
+// Like above, but also drops the pieces that goodware_index reports as likely
+// false positives. The index may be null.
+absl::Status GetRelevantSignatureSubset(const Signature& input,
+                                        int engine_min_piece_len,
+                                        const GoodwareIndex* goodware_index,
+                                        RawSignature* output);
+
+// Like above, but takes the definition and the raw signature separately.
+absl::Status GetRelevantSignatureSubset(const SignatureDefinition& definition,
+                                        const RawSignature& raw_sig,
+                                        int engine_min_piece_len,
+                                        const GoodwareIndex* goodware_index,
+                                        RawSignature* output);
+
+// Appends the pieces of raw_sig at the specified indices, which must be
+// sorted, to output. Like above, the wildcard after each copied piece is
+// widened to cover the pieces up to the next copied one.
+void CopySignaturePieces(const RawSignature& raw_sig,
+                         absl::Span<const int> piece_indices,
+                         RawSignature* output);
+
+// Appends the lowercase hex encoding of bytes to output. Nibbles listed in
+// masked_nibbles, indexed like in RawSignature::Piece::masked_nibble, are
+// written as '?' instead. Masked nibbles outside of bytes are ignored.
+void AppendMaskedHex(absl::string_view bytes,
+                     absl::Span<const int32_t> masked_nibbles,
+                     std::string* output);
+
 }  // namespace security::vxsig
 
 #endif  // VXSIG_SIGNATURE_FORMATTER_H_
@@ -14,18 +14,28 @@
 
 #include "vxsig/signature_formatter.h"
 
+#include <cstdlib>
 #include <string>
 #include <vector>
 
+#include "absl/container/flat_hash_set.h"
+#include "absl/strings/str_cat.h"
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
+#include "third_party/zynamics/binexport/util/filesystem.h"
 #include "third_party/zynamics/binexport/util/status_matchers.h"
+#include "vxsig/goodware_index.h"
 #include "vxsig/signature_test_util.h"
+#include "vxsig/thread_pool.h"
 #include "vxsig/vxsig.pb.h"
 
 using not_absl::IsOk;
 using testing::Eq;
+using testing::HasSubstr;
+using testing::IsFalse;
 using testing::IsTrue;
+using testing::Ne;
+using testing::SizeIs;
 
 namespace security::vxsig {
 namespace {
@@ -51,6 +61,32 @@ TEST_F(SignatureFormatterTest, EmptyPiece) {
   EXPECT_FALSE(status.ok());
 }
 
+TEST_F(SignatureFormatterTest, MergeQualifiersOfSkippedPieces) {
+  auto* raw_signature = signature_.mutable_raw_signature();
+  *raw_signature = *MakeRawSignature({"0011", "22", "3344", "55", "6677"});
+  for (int i = 0; i < 4; ++i) {
+    raw_signature->mutable_piece(i)->set_min_qualifier(i);
+    raw_signature->mutable_piece(i)->set_max_qualifier(i + 1);
+  }
+  // Leave the wildcard after the fourth piece unbounded.
+  raw_signature->mutable_piece(3)->clear_max_qualifier();
+  raw_signature_.Clear();
+  sig_def_->set_min_piece_length(4);
+  ASSERT_THAT(GetRelevantSignatureSubset(signature_, /*engine_min_piece_len=*/0,
+                                         &raw_signature_),
+              IsOk());
+  ASSERT_THAT(EquivRawSignature(raw_signature_,
+                                *MakeRawSignature({"0011", "3344", "6677"})),
+              IsTrue());
+  // 0 + 2 + 1 and 1 + 2 + 2 bytes.
+  EXPECT_THAT(raw_signature_.piece(0).min_qualifier(), Eq(3));
+  EXPECT_THAT(raw_signature_.piece(0).max_qualifier(), Eq(5));
+  // 2 + 2 + 3 bytes and unbounded.
+  EXPECT_THAT(raw_signature_.piece(1).min_qualifier(), Eq(7));
+  EXPECT_THAT(raw_signature_.piece(1).max_qualifier(), Eq(-1));
+  EXPECT_FALSE(raw_signature_.piece(2).has_max_qualifier());
+}
+
 TEST_F(SignatureFormatterTest, TrimFirst) {
   *signature_.mutable_raw_signature() =
       *MakeRawSignature({"00", "11", "22", "33", "44", "55", "66", "77"});
@@ -115,7 +151,79 @@ TEST_F(SignatureFormatterTest, TrimRandom) {
   }
 }
 
-TEST_F(SignatureFormatterTest, DISABLED_TrimWeighted) {
+TEST_F(SignatureFormatterTest, FormatVariants) {
+  *signature_.mutable_raw_signature() =
+      *MakeRawSignature({"00", "11", "22", "33", "44", "55", "66", "77"});
+  sig_def_->set_detection_name("test_malware");
+  sig_def_->set_min_piece_length(2);
+  sig_def_->set_trim_length(8);
+  auto formatter = SignatureFormatter::Create(SignatureType::CLAMAV);
+  Signatures variants;
+  EXPECT_THAT(formatter->FormatVariants(signature_, 3, &variants).message(),
+              HasSubstr("TRIM_RANDOM"));
+
+  sig_def_->set_trim_algorithm(SignatureDefinition::TRIM_RANDOM);
+  ThreadPool pool(2);
+  ASSERT_THAT(formatter->FormatVariants(signature_, 3, &variants, &pool),
+              IsOk());
+  ASSERT_THAT(variants.signature_size(), Eq(3));
+  absl::flat_hash_set<std::string> ids;
+  for (int i = 0; i < variants.signature_size(); ++i) {
+    const auto& variant = variants.signature(i);
+    EXPECT_THAT(variant.definition().variant(), Eq(5678 + i));
+    EXPECT_THAT(variant.has_raw_signature(), IsFalse());
+    ids.insert(variant.definition().unique_signature_id());
+
+    // Each variant is the same as formatting it on its own.
+    Signature expected(signature_);
+    expected.mutable_definition()->set_variant(5678 + i);
+    ASSERT_THAT(formatter->Format(&expected), IsOk());
+    EXPECT_THAT(variant.clam_av_signature().data(),
+                Eq(expected.clam_av_signature().data()));
+  }
+  EXPECT_THAT(ids, SizeIs(3));
+  EXPECT_THAT(variants.signature(0).clam_av_signature().data(),
+              Ne(variants.signature(1).clam_av_signature().data()));
+}
+
+TEST_F(SignatureFormatterTest, TrimScanCost) {
+  *signature_.mutable_raw_signature() = *MakeRawSignature(
+      {std::string(4, '\0'), "\x8b\x45\x0c\x33", "\xe8\x12\x34\x56",
+       "\x55\x8b\xec\x83"});
+  // Mask everything but the opcode of the call.
+  for (int nibble = 2; nibble < 8; ++nibble) {
+    signature_.mutable_raw_signature()->mutable_piece(2)->add_masked_nibble(
+        nibble);
+  }
+  raw_signature_.Clear();
+  sig_def_->set_trim_algorithm(SignatureDefinition::TRIM_SCAN_COST);
+  sig_def_->set_trim_length(8);
+  ASSERT_THAT(GetRelevantSignatureSubset(signature_, /*engine_min_piece_len=*/0,
+                                         &raw_signature_),
+              IsOk());
+  EXPECT_THAT(EquivRawSignature(raw_signature_,
+                                *MakeRawSignature({"\x8b\x45\x0c\x33",
+                                                   "\x55\x8b\xec\x83"})),
+              IsTrue());
+
+  // Common bytes still beat masked ones.
+  *signature_.mutable_raw_signature() =
+      *MakeRawSignature({"\xe8\x12\x34\x56", std::string(4, '\0')});
+  for (int nibble = 2; nibble < 8; ++nibble) {
+    signature_.mutable_raw_signature()->mutable_piece(0)->add_masked_nibble(
+        nibble);
+  }
+  raw_signature_.Clear();
+  sig_def_->set_trim_length(4);
+  ASSERT_THAT(GetRelevantSignatureSubset(signature_, /*engine_min_piece_len=*/0,
+                                         &raw_signature_),
+              IsOk());
+  EXPECT_THAT(EquivRawSignature(raw_signature_,
+                                *MakeRawSignature({std::string(4, '\0')})),
+              IsTrue());
+}
+
+TEST_F(SignatureFormatterTest, TrimWeighted) {
   auto& raw_signature = *signature_.mutable_raw_signature();
   raw_signature =
       *MakeRawSignature({"00", "11", "22", "33", "44", "55", "66", "77"});
@@ -138,6 +246,74 @@ TEST_F(SignatureFormatterTest, DISABLED_TrimWeighted) {
   EXPECT_THAT(EquivRawSignature(raw_signature_, *expected), IsTrue());
 }
 
+TEST_F(SignatureFormatterTest, TrimWeightedPrefersBestCombination) {
+  auto& raw_signature = *signature_.mutable_raw_signature();
+  // Greedily keeping the piece with the highest weight would leave no room for
+  // the other two.
+  raw_signature = *MakeRawSignature({"aaaaaa", "bbbb", "cccc"});
+  raw_signature.mutable_piece(0)->set_weight(100);
+  raw_signature.mutable_piece(1)->set_weight(90);
+  raw_signature.mutable_piece(2)->set_weight(90);
+
+  sig_def_->set_trim_algorithm(SignatureDefinition::TRIM_WEIGHTED);
+  sig_def_->set_trim_length(8);
+  ASSERT_THAT(GetRelevantSignatureSubset(signature_, /*engine_min_piece_len=*/0,
+                                         &raw_signature_),
+              IsOk());
+  EXPECT_THAT(
+      EquivRawSignature(raw_signature_, *MakeRawSignature({"bbbb", "cccc"})),
+      IsTrue());
+}
+
+TEST_F(SignatureFormatterTest, TrimWeightedManyPieces) {
+  // Same as above, but with enough filler pieces and bytes to not be solved
+  // by the dynamic program.
+  auto& raw_signature = *signature_.mutable_raw_signature();
+  raw_signature = *MakeRawSignature(
+      {std::string(40000, 'a'), std::string(30000, 'b'),
+       std::string(30000, 'c')});
+  raw_signature.mutable_piece(0)->set_weight(100);
+  raw_signature.mutable_piece(1)->set_weight(90);
+  raw_signature.mutable_piece(2)->set_weight(90);
+  for (int i = 0; i < 1200; ++i) {
+    auto* piece = raw_signature.add_piece();
+    piece->set_bytes("ffff");
+    piece->set_weight(1);
+  }
+
+  sig_def_->set_trim_algorithm(SignatureDefinition::TRIM_WEIGHTED);
+  sig_def_->set_trim_length(60000);
+  ASSERT_THAT(GetRelevantSignatureSubset(signature_, /*engine_min_piece_len=*/0,
+                                         &raw_signature_),
+              IsOk());
+  EXPECT_THAT(EquivRawSignature(raw_signature_,
+                                *MakeRawSignature({std::string(30000, 'b'),
+                                                   std::string(30000, 'c')})),
+              IsTrue());
+}
+
+TEST_F(SignatureFormatterTest, TrimWeightedLargeBudget) {
+  // Few pieces, but a byte budget too large for the rows of the dynamic
+  // program.
+  auto& raw_signature = *signature_.mutable_raw_signature();
+  raw_signature = *MakeRawSignature({std::string(2000000, 'a'),
+                                     std::string(1500000, 'b'),
+                                     std::string(1500000, 'c')});
+  raw_signature.mutable_piece(0)->set_weight(100);
+  raw_signature.mutable_piece(1)->set_weight(90);
+  raw_signature.mutable_piece(2)->set_weight(90);
+
+  sig_def_->set_trim_algorithm(SignatureDefinition::TRIM_WEIGHTED);
+  sig_def_->set_trim_length(3000000);
+  ASSERT_THAT(GetRelevantSignatureSubset(signature_, /*engine_min_piece_len=*/0,
+                                         &raw_signature_),
+              IsOk());
+  EXPECT_THAT(EquivRawSignature(raw_signature_,
+                                *MakeRawSignature({std::string(1500000, 'b'),
+                                                   std::string(1500000, 'c')})),
+              IsTrue());
+}
+
 TEST_F(SignatureFormatterTest, DISABLED_TrimWeightOrder) {
   auto& raw_signature = *signature_.mutable_raw_signature();
   raw_signature =
@@ -183,5 +359,100 @@ TEST_F(SignatureFormatterTest, DISABLED_TrimWeightOrderPreferLongerPieces) {
   EXPECT_THAT(EquivRawSignature(raw_signature_, *expected), IsTrue());
 }
 
+TEST_F(SignatureFormatterTest, DropPiecesFoundInGoodware) {
+  GoodwareIndexBuilder builder(/*expected_ngrams=*/100,
+                               /*false_positive_rate=*/1e-6);
+  builder.AddData("some goodware bytes");
+  const std::string filename =
+      JoinPath(getenv("TEST_TMPDIR"), "signature_formatter_goodware_index");
+  ASSERT_THAT(builder.Write(filename), IsOk());
+  auto goodware_index_or = GoodwareIndex::Open(filename);
+  ASSERT_THAT(goodware_index_or.status(), IsOk());
+
+  auto* raw_signature = signature_.mutable_raw_signature();
+  *raw_signature = *MakeRawSignature({"malware!", "goodware", "evilcode"});
+  raw_signature->mutable_piece(0)->set_min_qualifier(1);
+  raw_signature->mutable_piece(0)->set_max_qualifier(1);
+  raw_signature->mutable_piece(1)->set_min_qualifier(2);
+  raw_signature->mutable_piece(1)->set_max_qualifier(2);
+  sig_def_->set_trim_algorithm(SignatureDefinition::TRIM_NONE);
+  ASSERT_THAT(GetRelevantSignatureSubset(
+                  signature_, /*engine_min_piece_len=*/0,
+                  goodware_index_or.ValueOrDie().get(), &raw_signature_),
+              IsOk());
+  ASSERT_THAT(
+      EquivRawSignature(raw_signature_,
+                        *MakeRawSignature({"malware!", "evilcode"})),
+      IsTrue());
+  // The wildcard covers the dropped piece.
+  EXPECT_THAT(raw_signature_.piece(0).min_qualifier(), Eq(1 + 8 + 2));
+  EXPECT_THAT(raw_signature_.piece(0).max_qualifier(), Eq(1 + 8 + 2));
+}
+
+TEST(AppendMaskedHexTest, MasksNibblesInRange) {
+  std::string output = "prefix:";
+  AppendMaskedHex("\x12\xab\xff", {1, 2, 6, -1}, &output);
+  EXPECT_THAT(output, Eq("prefix:1??bff"));
+}
+
+TEST(StringSignatureSinkTest, Appends) {
+  std::string output;
+  StringSignatureSink sink(&output);
+  ASSERT_THAT(sink.Append("one"), IsOk());
+  ASSERT_THAT(sink.Append("two"), IsOk());
+  EXPECT_THAT(output, Eq("onetwo"));
+}
+
+// Returns a database with enough signatures to be formatted in several
+// batches.
+Signatures MakeLargeDatabase() {
+  Signatures signatures;
+  for (int i = 0; i < 1000; ++i) {
+    auto* signature = signatures.add_signature();
+    signature->mutable_definition()->set_detection_name(
+        absl::StrCat("sig", i));
+    signature->mutable_definition()->set_min_piece_length(2);
+    AddSignaturePieces({absl::StrCat(i, "ab"), absl::StrCat("cd", i)},
+                       signature->mutable_raw_signature());
+  }
+  return signatures;
+}
+
+TEST(FormatDatabaseTest, ParallelMatchesSerial) {
+  const Signatures signatures = MakeLargeDatabase();
+  ThreadPool pool(4);
+  for (const auto type : {SignatureType::CLAMAV, SignatureType::YARA}) {
+    auto formatter = SignatureFormatter::Create(type);
+    std::string expected;
+    ASSERT_THAT(formatter->FormatDatabase(signatures, &expected), IsOk());
+    std::string actual;
+    StringSignatureSink sink(&actual);
+    ASSERT_THAT(formatter->FormatDatabase(signatures, &sink, &pool), IsOk());
+    EXPECT_THAT(actual, Eq(expected));
+  }
+}
+
+TEST(FormatDatabaseTest, ParallelStopsAtFirstError) {
+  Signatures signatures = MakeLargeDatabase();
+  // Signatures without pieces cannot be formatted.
+  signatures.mutable_signature(500)->clear_raw_signature();
+  signatures.mutable_signature(700)->clear_raw_signature();
+  auto formatter = SignatureFormatter::Create(SignatureType::CLAMAV);
+
+  Signatures prefix;
+  prefix.mutable_signature()->CopyFrom(signatures.signature());
+  prefix.mutable_signature()->DeleteSubrange(500, 500);
+  std::string expected;
+  ASSERT_THAT(formatter->FormatDatabase(prefix, &expected), IsOk());
+
+  ThreadPool pool(4);
+  std::string actual;
+  StringSignatureSink sink(&actual);
+  EXPECT_THAT(
+      formatter->FormatDatabase(signatures, &sink, &pool).message(),
+      HasSubstr("No byte piece"));
+  EXPECT_THAT(actual, Eq(expected));
+}
+
 }  // namespace
 }  // namespace security::vxsig
@@ -24,6 +24,7 @@
 #include <cstddef>
 #include <functional>
 #include <iterator>
+#include <limits>
 #include <string>
 #include <utility>
 #include <vector>
@@ -39,72 +40,113 @@ template <typename OutputIteratorT>
 using WildcardInserter = std::function<void(
     size_t min_qualifier, size_t max_qualifier, OutputIteratorT result)>;
 
-// Builds a regular expression that matches the given common subsequence in each
-// of the specified sequences.
-template <typename IteratorT, typename NestedContT, typename OutputIteratorT>
-void RegexFromSubsequence(IteratorT first, IteratorT last,
+// Offsets of the elements of a common subsequence into each of the sequences
+// that it is common to: alignment[i][k] is the offset of the k-th element of
+// the common subsequence in the i-th sequence. The offsets into each sequence
+// are strictly increasing.
+using SubsequenceAlignment = std::vector<std::vector<size_t>>;
+
+// Finds the leftmost occurrence of the common subsequence given by first and
+// last in each of the specified sequences and stores the offsets of its
+// elements in alignment. This takes a single pass over each sequence. Returns
+// false if the common subsequence is not a subsequence of all of the
+// sequences.
+template <typename IteratorT, typename NestedContT>
+bool SubsequencePositions(IteratorT first, IteratorT last,
                           const NestedContT& sequences,
-                          WildcardInserter<OutputIteratorT> wildcard_inserter,
-                          OutputIteratorT result) {
-  using SequenceIterator = typename NestedContT::value_type::const_iterator;
-
-  // Initialize a vector with search start positions for each sequence.
-  std::vector<SequenceIterator> search_starts;
-  search_starts.reserve(sequences.size());
+                          SubsequenceAlignment* alignment) {
+  const size_t cs_size = std::distance(first, last);
+  alignment->clear();
+  alignment->reserve(sequences.size());
   for (const auto& sequence : sequences) {
-    search_starts.push_back(sequence.cbegin());
-  }
-
-  auto cs_it = first;  // Current position in common subsequence.
-  bool insert_wildcard = false;
-  bool defer_wildcard = false;
-  size_t cont_count = 0;
-  while (cs_it != last) {
-    // If we are to insert a wildcard, delay insertion until min_cont and
-    // max_cont are easily available.
-    if (insert_wildcard) {
-      defer_wildcard = true;
-      insert_wildcard = false;
+    alignment->emplace_back();
+    auto& positions = alignment->back();
+    positions.reserve(cs_size);
+    auto cs_it = first;
+    size_t offset = 0;
+    for (auto it = sequence.begin(); it != sequence.end() && cs_it != last;
+         ++it, ++offset) {
+      if (*it == *cs_it) {
+        positions.push_back(offset);
+        ++cs_it;
+      }
     }
-    // Set sensible defaults for minimum and maximum.
-    size_t min_cont = std::distance(last, first);
-    size_t max_cont = 0;
-    auto search_starts_it = search_starts.begin();
-    for (auto it = sequences.cbegin(); it != sequences.cend();
-         ++it, ++search_starts_it) {
-      SequenceIterator& cur_seq_index = *search_starts_it;
-
-      // Find position of current element in current sequence.
-      SequenceIterator search_start = cur_seq_index;
-      cur_seq_index = std::find(search_start, it->end(), *cs_it);
-
-      // All sequences must contain all elements from common subsequence in
-      // the same order.
-      CHECK(cur_seq_index != it->cend());
-
-      // Advance start position for current sequence so we don't look at the
-      // same element again in the next iteration.
-      ++cur_seq_index;
-
-      // Calculate minimum and maximum number of skipped elements.
-      cont_count = cur_seq_index - search_start;
-      min_cont = std::min(min_cont, cont_count - 1);
-      max_cont = std::max(max_cont, cont_count - 1);
+    if (cs_it != last) {
+      return false;
+    }
+  }
+  return true;
+}
 
-      // Check if elements in current sequence are continuous.
-      if (std::distance(cs_it, last) > 1) {
-        insert_wildcard = cont_count > 0 && cur_seq_index[0] != cs_it[1];
+namespace detail {
+
+// Implements RegexFromAlignment(). If last_sequence_only is true, whether to
+// insert a wildcard is decided by the gaps in the last sequence only, see
+// RegexFromSubsequence().
+template <typename IteratorT, typename OutputIteratorT>
+void RegexFromAlignment(IteratorT first, IteratorT last,
+                        const SubsequenceAlignment& alignment,
+                        bool last_sequence_only,
+                        WildcardInserter<OutputIteratorT> wildcard_inserter,
+                        OutputIteratorT result) {
+  size_t index = 0;
+  for (auto cs_it = first; cs_it != last; ++cs_it, ++index) {
+    if (index > 0) {
+      size_t min_gap = std::numeric_limits<size_t>::max();
+      size_t max_gap = 0;
+      size_t gap = 0;
+      for (const auto& positions : alignment) {
+        gap = positions[index] - positions[index - 1] - 1;
+        min_gap = std::min(min_gap, gap);
+        max_gap = std::max(max_gap, gap);
+      }
+      if ((last_sequence_only ? gap : max_gap) > 0) {
+        wildcard_inserter(min_gap, max_gap, result++);
       }
-    }
-    if (defer_wildcard) {
-      wildcard_inserter(min_cont, max_cont, result++);
-      defer_wildcard = false;
     }
     *result++ = *cs_it;
-    ++cs_it;
   }
 }
 
+}  // namespace detail
+
+// Builds a regular expression that matches the given common subsequence in each
+// of the sequences described by alignment. A wildcard is inserted in front of
+// each element that does not immediately follow the previous element in at
+// least one of the sequences. Its qualifiers are the minimum and the maximum
+// number of elements skipped over in any of the sequences. The gaps are
+// computed from the offsets directly, so this takes a single pass over the
+// common subsequence and the alignment.
+template <typename IteratorT, typename OutputIteratorT>
+void RegexFromAlignment(IteratorT first, IteratorT last,
+                        const SubsequenceAlignment& alignment,
+                        WildcardInserter<OutputIteratorT> wildcard_inserter,
+                        OutputIteratorT result) {
+  detail::RegexFromAlignment(first, last, alignment,
+                             /*last_sequence_only=*/false,
+                             std::move(wildcard_inserter), result);
+}
+
+// Builds a regular expression that matches the given common subsequence in each
+// of the specified sequences. All sequences must contain all elements of the
+// common subsequence in the same order. Each element is aligned to its leftmost
+// occurrence, see SubsequencePositions().
+// Note: Unlike RegexFromAlignment(), this only inserts a wildcard if there is a
+//       gap in the last sequence, so the result may not match the other
+//       sequences. New code should use RegexFromAlignment().
+template <typename IteratorT, typename NestedContT, typename OutputIteratorT>
+void RegexFromSubsequence(IteratorT first, IteratorT last,
+                          const NestedContT& sequences,
+                          WildcardInserter<OutputIteratorT> wildcard_inserter,
+                          OutputIteratorT result) {
+  SubsequenceAlignment alignment;
+  CHECK(SubsequencePositions(first, last, sequences, &alignment))
+      << "Not a common subsequence";
+  detail::RegexFromAlignment(first, last, alignment,
+                             /*last_sequence_only=*/true,
+                             std::move(wildcard_inserter), result);
+}
+
 }  // namespace security::vxsig
 
 #endif  // VXSIG_SUBSEQUENCE_REGEX_H_
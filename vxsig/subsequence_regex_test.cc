@@ -20,10 +20,12 @@
 #include <vector>
 
 #include "absl/memory/memory.h"
+#include "absl/strings/str_cat.h"
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 
 using ::testing::AnyOf;
+using ::testing::ElementsAre;
 using ::testing::Eq;
 using ::testing::IsEmpty;
 
@@ -82,4 +84,41 @@ TEST(BuildRegexTest, InterspersedAtPos2SameLength) {
   EXPECT_THAT(result, Eq("a*bc"));
 }
 
+TEST(BuildRegexTest, SubsequencePositions) {
+  SubsequenceAlignment alignment;
+  std::string common("abc");
+  std::vector<std::string> seqs{"aBbc", "xaxbxcx"};
+  ASSERT_TRUE(
+      SubsequencePositions(common.begin(), common.end(), seqs, &alignment));
+  EXPECT_THAT(alignment, ElementsAre(ElementsAre(0, 2, 3),
+                                     ElementsAre(1, 3, 5)));
+
+  seqs.push_back("acb");
+  EXPECT_FALSE(
+      SubsequencePositions(common.begin(), common.end(), seqs, &alignment));
+}
+
+TEST(BuildRegexTest, RegexFromAlignment) {
+  std::string common("abcd");
+  const SubsequenceAlignment alignment{{0, 1, 2, 5}, {0, 3, 4, 5}};
+  std::string result;
+  RegexFromAlignment(
+      common.begin(), common.end(), alignment,
+      WildcardInserter<std::back_insert_iterator<std::string>>(
+          [](size_t min_qualifier, size_t max_qualifier,
+             std::back_insert_iterator<std::string> result) {
+            for (const char c :
+                 absl::StrCat("{", min_qualifier, "-", max_qualifier, "}")) {
+              *result++ = c;
+            }
+          }),
+      std::back_inserter(result));
+  EXPECT_THAT(result, Eq("a{0-2}bc{0-2}d"));
+
+  result.clear();
+  RegexFromAlignment(common.begin(), common.end(), alignment,
+                     StringWildcardInserter::get(), std::back_inserter(result));
+  EXPECT_THAT(result, Eq("a*bc*d"));
+}
+
 }  // namespace security::vxsig
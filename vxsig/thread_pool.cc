@@ -0,0 +1,151 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "vxsig/thread_pool.h"
+
+#include <algorithm>
+#include <memory>
+#include <utility>
+
+#include "absl/base/internal/raw_logging.h"
+
+namespace security::vxsig {
+
+ThreadPool::ThreadPool(int num_threads) {
+  ABSL_RAW_CHECK(num_threads > 0, "Need at least one thread");
+  threads_.reserve(num_threads);
+  for (int i = 0; i < num_threads; ++i) {
+    threads_.emplace_back(&ThreadPool::WorkLoop, this);
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    absl::MutexLock lock(&mutex_);
+    done_ = true;
+  }
+  for (auto& thread : threads_) {
+    thread.join();
+  }
+}
+
+void ThreadPool::Schedule(std::function<void()> work) {
+  ABSL_RAW_CHECK(work, "Need non-empty work item");
+  absl::MutexLock lock(&mutex_);
+  queue_.push_back(std::move(work));
+}
+
+void ThreadPool::WorkLoop() {
+  while (true) {
+    std::function<void()> work;
+    {
+      absl::MutexLock lock(&mutex_);
+      mutex_.Await(absl::Condition(
+          +[](ThreadPool* pool) ABSL_EXCLUSIVE_LOCKS_REQUIRED(pool->mutex_) {
+            return pool->done_ || !pool->queue_.empty();
+          },
+          this));
+      if (queue_.empty()) {
+        return;  // Done and no more work
+      }
+      work = std::move(queue_.front());
+      queue_.pop_front();
+    }
+    work();
+  }
+}
+
+namespace {
+
+// Shared state of a single ParallelFor() invocation. Helpers that only get to
+// run after all items have been claimed must not touch the (by then possibly
+// destroyed) work function, so they only look at this state, which is kept
+// alive by shared ownership.
+struct ParallelForState {
+  absl::Mutex mutex;
+  int next_item ABSL_GUARDED_BY(mutex) = 0;
+  int num_active ABSL_GUARDED_BY(mutex) = 0;
+};
+
+// Claims and runs items until none are left.
+void RunParallelForItems(int num_items, ParallelForState* state,
+                         const std::function<void(int)>& fn) {
+  {
+    absl::MutexLock lock(&state->mutex);
+    if (state->next_item >= num_items) {
+      return;
+    }
+    ++state->num_active;
+  }
+  while (true) {
+    int item;
+    {
+      absl::MutexLock lock(&state->mutex);
+      if (state->next_item >= num_items) {
+        --state->num_active;
+        return;
+      }
+      item = state->next_item++;
+    }
+    fn(item);
+  }
+}
+
+}  // namespace
+
+void ParallelFor(int num_items, ThreadPool* pool,
+                 const std::function<void(int)>& fn) {
+  if (num_items <= 0) {
+    return;
+  }
+  if (!pool || num_items == 1) {
+    for (int i = 0; i < num_items; ++i) {
+      fn(i);
+    }
+    return;
+  }
+
+  auto state = std::make_shared<ParallelForState>();
+  const int num_helpers = std::min(num_items - 1, pool->num_threads());
+  for (int i = 0; i < num_helpers; ++i) {
+    pool->Schedule([num_items, state, &fn]() {
+      RunParallelForItems(num_items, state.get(), fn);
+    });
+  }
+  RunParallelForItems(num_items, state.get(), fn);
+
+  // Wait for helpers that are still working on their last item.
+  absl::MutexLock lock(&state->mutex);
+  state->mutex.Await(absl::Condition(
+      +[](ParallelForState* state)
+           ABSL_EXCLUSIVE_LOCKS_REQUIRED(state->mutex) {
+             return state->num_active == 0;
+           },
+      state.get()));
+}
+
+absl::Status ParallelForWithStatus(
+    int num_items, ThreadPool* pool,
+    const std::function<absl::Status(int)>& fn) {
+  std::vector<absl::Status> statuses(std::max(num_items, 0));
+  ParallelFor(num_items, pool, [&statuses, &fn](int i) { statuses[i] = fn(i); });
+  for (const auto& status : statuses) {
+    if (!status.ok()) {
+      return status;
+    }
+  }
+  return absl::OkStatus();
+}
+
+}  // namespace security::vxsig
@@ -0,0 +1,77 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// A simple fixed-size thread pool and a parallel-for helper built on top of
+// it. This is used to parallelize the independent stages of the signature
+// generator, like loading the columns of a match chain table.
+
+#ifndef VXSIG_THREAD_POOL_H_
+#define VXSIG_THREAD_POOL_H_
+
+#include <deque>
+#include <functional>
+#include <thread>  // NOLINT(build/c++11)
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/status/status.h"
+#include "absl/synchronization/mutex.h"
+
+namespace security::vxsig {
+
+// A pool of worker threads that execute scheduled closures in FIFO order.
+// The destructor waits for all scheduled work to finish.
+class ThreadPool {
+ public:
+  explicit ThreadPool(int num_threads);
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  // Schedules the specified closure for execution on one of the worker
+  // threads.
+  void Schedule(std::function<void()> work);
+
+  int num_threads() const { return threads_.size(); }
+
+ private:
+  void WorkLoop();
+
+  absl::Mutex mutex_;
+  std::deque<std::function<void()>> queue_ ABSL_GUARDED_BY(mutex_);
+  bool done_ ABSL_GUARDED_BY(mutex_) = false;
+  std::vector<std::thread> threads_;
+};
+
+// Runs fn(i) for all i in [0, num_items). If pool is non-null, the items are
+// distributed over the pool's threads. The calling thread takes part in the
+// work and this function only returns once all items have been processed.
+// Since the caller never blocks on work that has not been started yet, it is
+// safe to call this function from within work running on the same pool.
+// If pool is nullptr, all items are processed in order on the calling thread.
+void ParallelFor(int num_items, ThreadPool* pool,
+                 const std::function<void(int)>& fn);
+
+// Like above, but for work items that can fail. Returns the status of the
+// failed item with the lowest index, so that error reporting is the same as
+// for a serial loop that stops at the first error. All items are run, even
+// if some of them fail.
+absl::Status ParallelForWithStatus(
+    int num_items, ThreadPool* pool,
+    const std::function<absl::Status(int)>& fn);
+
+}  // namespace security::vxsig
+
+#endif  // VXSIG_THREAD_POOL_H_
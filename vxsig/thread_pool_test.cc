@@ -0,0 +1,81 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "vxsig/thread_pool.h"
+
+#include <atomic>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+using testing::Each;
+using testing::Eq;
+
+namespace security::vxsig {
+namespace {
+
+TEST(ThreadPoolTest, RunsAllScheduledWork) {
+  std::atomic<int> counter(0);
+  {
+    ThreadPool pool(4);
+    for (int i = 0; i < 100; ++i) {
+      pool.Schedule([&counter]() { ++counter; });
+    }
+  }  // Destructor waits for all work to finish.
+  EXPECT_THAT(counter.load(), Eq(100));
+}
+
+TEST(ThreadPoolTest, ParallelForVisitsEachItemOnce) {
+  for (ThreadPool* pool : {static_cast<ThreadPool*>(nullptr),
+                           new ThreadPool(3)}) {
+    std::vector<int> visited(1000);
+    ParallelFor(visited.size(), pool, [&visited](int i) { ++visited[i]; });
+    EXPECT_THAT(visited, Each(Eq(1)));
+    delete pool;
+  }
+}
+
+TEST(ThreadPoolTest, NestedParallelFor) {
+  ThreadPool pool(2);
+  std::atomic<int> counter(0);
+  ParallelFor(8, &pool, [&pool, &counter](int) {
+    ParallelFor(8, &pool, [&counter](int) { ++counter; });
+  });
+  EXPECT_THAT(counter.load(), Eq(64));
+}
+
+TEST(ThreadPoolTest, ParallelForWithStatusReturnsFirstError) {
+  ThreadPool pool(4);
+  std::atomic<int> counter(0);
+  absl::Status status =
+      ParallelForWithStatus(20, &pool, [&counter](int i) -> absl::Status {
+        ++counter;
+        if (i == 7 || i == 13) {
+          return absl::InternalError(absl::StrCat("item ", i));
+        }
+        return absl::OkStatus();
+      });
+  EXPECT_THAT(status.message(), Eq("item 7"));
+  EXPECT_THAT(counter.load(), Eq(20));
+
+  EXPECT_TRUE(ParallelForWithStatus(20, &pool, [](int) {
+                return absl::OkStatus();
+              }).ok());
+}
+
+}  // namespace
+}  // namespace security::vxsig
@@ -16,18 +16,13 @@
 
 #include <algorithm>
 #include <cstddef>
+#include <cstring>
+#include <string>
 #include <vector>
 
 #include "absl/flags/flag.h"
-#include "absl/strings/ascii.h"
-#include "absl/strings/escaping.h"
-#include "absl/strings/numbers.h"
 #include "absl/strings/str_cat.h"
-#include "absl/strings/str_join.h"
-#include "absl/strings/str_replace.h"
-#include "absl/strings/str_split.h"
 #include "absl/strings/string_view.h"
-#include "absl/strings/substitute.h"
 #include "third_party/zynamics/binexport/util/status_macros.h"
 #include "vxsig/signature_formatter.h"
 #include "vxsig/vxsig.pb.h"
@@ -51,135 +46,153 @@ enum {
 
 static constexpr char kYaraHexWildcard[] = "[-]";
 
-std::string MakeValidIdentifier(absl::string_view identifier) {
-  return absl::StrReplaceAll(identifier.substr(0, kYaraMaxIdentLen),
-                             {{"-", "_"}});
+// Appends the jump that matches the bytes following piece, see
+// RawSignature::Piece.
+void AppendJump(const RawSignature::Piece& piece, std::string* output) {
+  if (piece.max_qualifier() < 0) {
+    // The minimum of unbounded wildcards is not rendered, which only makes
+    // them slightly more permissive.
+    output->append(kYaraHexWildcard);
+  } else if (piece.min_qualifier() == piece.max_qualifier()) {
+    absl::StrAppend(output, "[", piece.min_qualifier(), "]");
+  } else {
+    absl::StrAppend(output, "[", piece.min_qualifier(), "-",
+                    piece.max_qualifier(), "]");
+  }
+}
+
+// Appends identifier, shortened and with characters replaced as needed to
+// make it a valid Yara identifier.
+void AppendValidIdentifier(absl::string_view identifier, std::string* output) {
+  for (const char c : identifier.substr(0, kYaraMaxIdentLen)) {
+    output->push_back(c == '-' ? '_' : c);
+  }
 }
 
 }  // namespace
 
-absl::Status YaraSignatureFormatter::DoFormat(Signature* signature) const {
-  std::string* signature_data =
-      signature->mutable_yara_signature()->mutable_data();
-  // Avoid too many reallocations.
-  signature_data->clear();
-  signature_data->reserve(2 * signature->ByteSizeLong());
+absl::Status YaraSignatureFormatter::DoFormat(
+    const RawSignature& raw_signature, Signature* signature) const {
+  return FormatTo(signature->definition(), raw_signature,
+                  signature->mutable_yara_signature()->mutable_data());
+}
 
-  auto signature_definition = signature->definition();
+absl::Status YaraSignatureFormatter::FormatTo(
+    const SignatureDefinition& definition, const RawSignature& raw_signature,
+    std::string* output) const {
+  // Avoid too many reallocations.
+  output->clear();
+  output->reserve(2 *
+                  (definition.ByteSizeLong() + raw_signature.ByteSizeLong()));
 
   // Rule name and tags
-  std::string name = signature_definition.detection_name();
-  if (name.empty()) {
-    name = signature_definition.unique_signature_id();
+  output->append("rule ");
+  AppendValidIdentifier(definition.detection_name().empty()
+                            ? definition.unique_signature_id()
+                            : definition.detection_name(),
+                        output);
+  bool first = true;
+  for (const auto& tag : definition.tag()) {
+    output->append(first ? " : " : " ");
+    AppendValidIdentifier(tag, output);
+    first = false;
   }
-  absl::StrAppend(signature_data, "rule ", MakeValidIdentifier(name));
-  if (signature_definition.tag_size() > 0) {
-    bool first = true;
-    for (const auto& tag : signature_definition.tag()) {
-      absl::StrAppend(signature_data, first ? " : " : " ",
-                      MakeValidIdentifier(tag));
-      first = false;
-    }
-  }
-  absl::StrAppend(signature_data, " {\n");
+  output->append(" {\n");
 
-  if (signature_definition.meta_size() > 0) {
+  if (definition.meta_size() > 0) {
     // Metadata dictionary
-    absl::StrAppend(signature_data, "  meta:\n");
-    for (const auto& meta : signature_definition.meta()) {
-      std::string value;
+    output->append("  meta:\n");
+    for (const auto& meta : definition.meta()) {
+      if (meta.value_case() == SignatureDefinition::Meta::VALUE_NOT_SET) {
+        continue;
+      }
+      absl::StrAppend(output, "    ", meta.key(), " = ");
       switch (meta.value_case()) {
         case SignatureDefinition::Meta::kStringValue:
-          value = absl::StrCat("\"", MakeValidIdentifier(meta.string_value()),
-                               "\"");
+          output->push_back('"');
+          AppendValidIdentifier(meta.string_value(), output);
+          output->push_back('"');
           break;
         case SignatureDefinition::Meta::kIntValue:
-          value = std::to_string(meta.int_value());
+          absl::StrAppend(output, meta.int_value());
           break;
         case SignatureDefinition::Meta::kBoolValue:
-          value = meta.bool_value() ? "true" : "false";
+          output->append(meta.bool_value() ? "true" : "false");
           break;
         case SignatureDefinition::Meta::VALUE_NOT_SET:
-          continue;
+          break;
       }
-      absl::StrAppend(signature_data, "    ", meta.key(), " = ", value, "\n");
+      output->push_back('\n');
     }
   }
 
   // The actual regex signature.
-  absl::StrAppend(signature_data, "  strings:\n    $ = {\n");
+  output->append("  strings:\n    $ = {\n");
 
   RawSignature subset_regex;
-  NA_RETURN_IF_ERROR(
-      GetRelevantSignatureSubset(*signature, kYaraMinTokens, &subset_regex));
+  NA_RETURN_IF_ERROR(GetRelevantSignatureSubset(
+      definition, raw_signature, kYaraMinTokens, goodware_index(),
+      &subset_regex));
 
+  const bool debug_masking = absl::GetFlag(FLAGS_siggen_yara_debug_masking);
+  const bool debug_weights = absl::GetFlag(FLAGS_siggen_yara_debug_weights);
   int num_hex_string_tokens = 0;
   int max_copy_bytes = 0;
-  bool needs_wildcard = false;
+  const RawSignature::Piece* previous_piece = nullptr;
   for (const auto& piece : subset_regex.piece()) {
     if (num_hex_string_tokens > kYaraMaxHexStringTokens) {
       break;
     }
     // Append wildcard and hexadecimal signature piece.
     max_copy_bytes = kYaraMaxHexStringTokens - num_hex_string_tokens -
-                     (needs_wildcard ? 1 : 0);
+                     (previous_piece ? 1 : 0);
     if (max_copy_bytes < kYaraMinTokens) {
       // Break if the signature would become too long.
       break;
     }
 
-    absl::StrAppend(signature_data, "      ");
-    if (needs_wildcard) {
-      absl::StrAppend(signature_data, kYaraHexWildcard);
+    output->append("      ");
+    if (previous_piece) {
+      AppendJump(*previous_piece, output);
       ++num_hex_string_tokens;  // Current wildcard
     } else {
-      absl::StrAppend(signature_data,
-                      std::string(strlen(kYaraHexWildcard), ' '));
+      output->append(strlen(kYaraHexWildcard), ' ');
     }
 
-    const auto piece_bytes(piece.bytes().substr(0, max_copy_bytes));
-    int start_mask = signature_data->size();
-    absl::StrAppend(signature_data, absl::BytesToHexString(piece_bytes), "\n");
-    for (const auto& masked_nibble : piece.masked_nibble()) {
-      if (masked_nibble / 2 < max_copy_bytes) {
-        (*signature_data)[start_mask + masked_nibble] = '?';
-      }
-    }
-    if (absl::GetFlag(FLAGS_siggen_yara_debug_masking)) {
+    const auto piece_bytes =
+        absl::string_view(piece.bytes()).substr(0, max_copy_bytes);
+    AppendMaskedHex(piece_bytes, piece.masked_nibble(), output);
+    output->push_back('\n');
+    if (debug_masking) {
       // Align with masked hex bytes.
-      absl::StrAppend(signature_data, "      // ",
-                      absl::BytesToHexString(piece_bytes), "\n");
+      output->append("      // ");
+      AppendMaskedHex(piece_bytes, /*masked_nibbles=*/{}, output);
+      output->push_back('\n');
     }
-    if (absl::GetFlag(FLAGS_siggen_yara_debug_weights)) {
-      absl::StrAppend(signature_data, "         // Weight: ", piece.weight(),
-                      "\n");
+    if (debug_weights) {
+      absl::StrAppend(output, "         // Weight: ", piece.weight(), "\n");
     }
 
     for (const auto& disassembly : piece.origin_disassembly()) {
-      absl::StrAppend(signature_data, "         // ", disassembly, "\n");
+      absl::StrAppend(output, "         // ", disassembly, "\n");
     }
 
-    needs_wildcard = true;
+    previous_piece = &piece;
     num_hex_string_tokens += piece_bytes.size();
   }
 
-  absl::StrAppend(signature_data, "\n  }\n  condition:\n    all of them\n}\n");
+  output->append("\n  }\n  condition:\n    all of them\n}\n");
   return absl::OkStatus();
 }
 
-absl::Status YaraSignatureFormatter::DoFormatDatabase(
-    const Signatures& signatures, std::string* database) const {
-  database->clear();
-  Signature format_signature;
-  for (const auto& signature : signatures.signature()) {
-    const auto* signature_data = &signature.yara_signature().data();
-    Signature format_signature;
-    if (signature_data->empty()) {
-      format_signature = signature;
-      NA_RETURN_IF_ERROR(Format(&format_signature));
-      signature_data = &format_signature.yara_signature().data();
-    }
-    absl::StrAppend(database, *signature_data);
+absl::Status YaraSignatureFormatter::DoFormatDatabaseEntry(
+    const Signature& signature, std::string* entry) const {
+  const auto& signature_data = signature.yara_signature().data();
+  if (signature_data.empty()) {
+    NA_RETURN_IF_ERROR(
+        FormatTo(signature.definition(), signature.raw_signature(), entry));
+  } else {
+    entry->assign(signature_data);
   }
   return absl::OkStatus();
 }
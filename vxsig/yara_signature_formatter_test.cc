@@ -16,6 +16,7 @@
 #include <google/protobuf/text_format.h>
 
 #include <fstream>
+#include <iterator>
 #include <memory>
 
 #include "absl/strings/escaping.h"
@@ -83,6 +84,22 @@ TEST_F(YaraSignatureFormatterTest, TestStripSingleByte) {
                  "of them}"));
 }
 
+TEST_F(YaraSignatureFormatterTest, TestBoundedJumps) {
+  definition_->set_detection_name("test");
+  definition_->set_min_piece_length(2);
+  AddSignaturePieces({"12", "34", "56", "78"}, &signature_);
+  auto* raw_signature = signature_.mutable_raw_signature();
+  raw_signature->mutable_piece(0)->set_max_qualifier(3);
+  raw_signature->mutable_piece(1)->set_min_qualifier(2);
+  raw_signature->mutable_piece(1)->set_max_qualifier(2);
+  raw_signature->mutable_piece(2)->set_min_qualifier(1);
+  ASSERT_THAT(formatter_->Format(&signature_), IsOk());
+  EXPECT_THAT(
+      MakeComparableYaraSignature(signature_.yara_signature().data()),
+      Eq("rule test {\nstrings:$ = {3132[0-3]3334[2]3536[-]3738}condition:all "
+         "of them}"));
+}
+
 TEST_F(YaraSignatureFormatterTest, TestDatabaseSingleSignature) {
   Signatures signatures;
   auto* signature = signatures.add_signature();
@@ -118,6 +135,31 @@ TEST_F(YaraSignatureFormatterTest, TestDatabaseMultipleSignatures) {
          "rule two {\nstrings:$ = {3536[-]3738}condition:all of them}"));
 }
 
+TEST_F(YaraSignatureFormatterTest, TestDatabaseFileSink) {
+  Signatures signatures;
+  for (const char* name : {"one", "two"}) {
+    auto* signature = signatures.add_signature();
+    signature->mutable_definition()->set_detection_name(name);
+    signature->mutable_definition()->set_min_piece_length(2);
+    AddSignaturePieces({"12", "34"}, signature);
+  }
+  std::string expected;
+  ASSERT_THAT(formatter_->FormatDatabase(signatures, &expected), IsOk());
+
+  const std::string filename =
+      JoinPath(getenv("TEST_TMPDIR"), "yara_signature_formatter_db.yar");
+  {
+    auto sink_or = FileSignatureSink::Open(filename);
+    ASSERT_THAT(sink_or.status(), IsOk());
+    auto sink = std::move(sink_or).ValueOrDie();
+    ASSERT_THAT(formatter_->FormatDatabase(signatures, sink.get()), IsOk());
+    ASSERT_THAT(sink->Close(), IsOk());
+  }
+  std::ifstream file(filename, std::ios::binary);
+  EXPECT_THAT(std::string(std::istreambuf_iterator<char>(file), {}),
+              Eq(expected));
+}
+
 TEST_F(YaraSignatureFormatterTest, TestMaxHexStringTokensOnePiece) {
   Signatures signatures;
   {
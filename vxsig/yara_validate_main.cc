@@ -0,0 +1,107 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// A program that validates Yara rules, as emitted by vxsig, with libyara. It
+// compiles the rules, scans the samples the rules were generated from and
+// reports detections, compiler warnings and scan throughput. Exits with an
+// error if a rule does not compile, misses a sample or scans too slowly.
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "absl/base/internal/raw_logging.h"
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "absl/flags/usage.h"
+#include "absl/strings/str_cat.h"
+#include "absl/time/time.h"
+#include "vxsig/mapped_file.h"
+#include "vxsig/yara_validator.h"
+
+ABSL_FLAG(std::string, rules, "", "File with the Yara rules to validate");
+ABSL_FLAG(double, min_scan_mb_per_s, 0,
+          "Minimum scan throughput in MiB/s. Rules that scan slower fail "
+          "validation.");
+ABSL_FLAG(absl::Duration, scan_timeout, absl::Seconds(10),
+          "Timeout for scanning a single sample with a single rule");
+
+namespace security::vxsig {
+namespace {
+
+int ValidateMain(int argc, char* argv[]) {
+  ABSL_RAW_CHECK(argc >= 2, "Need at least one sample to scan");
+  const std::string rules_filename = absl::GetFlag(FLAGS_rules);
+  ABSL_RAW_CHECK(!rules_filename.empty(), "Need a rules file");
+
+  auto rules_or = MappedFile::Open(rules_filename);
+  ABSL_RAW_CHECK(rules_or.ok(), absl::StrCat("Failed to read rules: ",
+                                             rules_or.status().message())
+                                    .c_str());
+  auto validator_or = YaraValidator::Create();
+  ABSL_RAW_CHECK(validator_or.ok(),
+                 std::string(validator_or.status().message()).c_str());
+  auto validator = std::move(validator_or).ValueOrDie();
+  validator->set_scan_timeout(absl::GetFlag(FLAGS_scan_timeout));
+  for (int i = 1; i < argc; ++i) {
+    const absl::Status status = validator->AddSampleFile(argv[i]);
+    ABSL_RAW_CHECK(status.ok(), absl::StrCat("Failed to read sample: ",
+                                             status.message())
+                                    .c_str());
+  }
+
+  auto report_or = validator->Validate(rules_or.ValueOrDie()->data());
+  if (!report_or.ok()) {
+    fprintf(stderr, "%s\n", std::string(report_or.status().message()).c_str());
+    return EXIT_FAILURE;
+  }
+  const auto& report = report_or.ValueOrDie();
+  for (const auto& warning : report.warnings) {
+    printf("warning: %s\n", warning.c_str());
+  }
+  for (const auto& rule : report.rules) {
+    printf("%s: %d/%d samples, %d timed out, %.2f MiB/s\n",
+           rule.identifier.c_str(),
+           static_cast<int>(argc - 1 - rule.missed_samples.size() -
+                            rule.timed_out_samples.size()),
+           argc - 1, static_cast<int>(rule.timed_out_samples.size()),
+           rule.scan_mb_per_s());
+  }
+  printf("Scanned %lld bytes in %s (%.2f MiB/s)\n",
+         static_cast<long long>(report.bytes_scanned),  // NOLINT
+         absl::FormatDuration(report.scan_time).c_str(),
+         report.scan_mb_per_s());
+
+  const absl::Status status = CheckYaraValidationReport(
+      report, absl::GetFlag(FLAGS_min_scan_mb_per_s));
+  if (!status.ok()) {
+    fprintf(stderr, "%s\n", std::string(status.message()).c_str());
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
+
+}  // namespace
+}  // namespace security::vxsig
+
+int main(int argc, char* argv[]) {
+  absl::SetProgramUsageMessage(absl::StrCat(
+      "Validates Yara rules against the samples they should detect.\n"
+      "usage:\n",
+      argv[0], " --rules=FILE [OPTION] SAMPLE..."));
+  std::vector<char*> args = absl::ParseCommandLine(argc, argv);
+  return security::vxsig::ValidateMain(args.size(), &args[0]);
+}
@@ -0,0 +1,217 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "vxsig/yara_validator.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/memory/memory.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_join.h"
+#include "absl/time/clock.h"
+#include "third_party/zynamics/binexport/util/status_macros.h"
+#include "yara.h"
+
+namespace security::vxsig {
+namespace {
+
+struct CompilerMessages {
+  std::vector<std::string> errors;
+  std::vector<std::string> warnings;
+};
+
+void CompilerCallback(int error_level, const char* /* file_name */,
+                      int line_number, const YR_RULE* /* rule */,
+                      const char* message, void* user_data) {
+  auto* messages = static_cast<CompilerMessages*>(user_data);
+  (error_level == YARA_ERROR_LEVEL_ERROR ? messages->errors
+                                         : messages->warnings)
+      .push_back(absl::StrCat("line ", line_number, ": ", message));
+}
+
+// Rules that matched during a single scan.
+struct ScanMatches {
+  const absl::flat_hash_map<const YR_RULE*, int>* rule_indices;
+  std::vector<bool> matched;
+};
+
+int ScanCallback(YR_SCAN_CONTEXT* /* context */, int message,
+                 void* message_data, void* user_data) {
+  if (message == CALLBACK_MSG_RULE_MATCHING) {
+    auto* matches = static_cast<ScanMatches*>(user_data);
+    auto found =
+        matches->rule_indices->find(static_cast<const YR_RULE*>(message_data));
+    if (found != matches->rule_indices->end()) {
+      matches->matched[found->second] = true;
+    }
+  }
+  return CALLBACK_CONTINUE;
+}
+
+double MiBPerSecond(int64_t bytes, absl::Duration time) {
+  const double seconds = absl::ToDoubleSeconds(time);
+  if (seconds <= 0) {
+    return 0;
+  }
+  return bytes / (1024.0 * 1024.0) / seconds;
+}
+
+}  // namespace
+
+double YaraValidationReport::Rule::scan_mb_per_s() const {
+  return MiBPerSecond(bytes_scanned, scan_time);
+}
+
+double YaraValidationReport::scan_mb_per_s() const {
+  return MiBPerSecond(bytes_scanned, scan_time);
+}
+
+not_absl::StatusOr<std::unique_ptr<YaraValidator>> YaraValidator::Create() {
+  if (const int error = yr_initialize(); error != ERROR_SUCCESS) {
+    return absl::InternalError(
+        absl::StrCat("Failed to initialize libyara: ", error));
+  }
+  return absl::WrapUnique(new YaraValidator());
+}
+
+YaraValidator::~YaraValidator() { yr_finalize(); }
+
+absl::Status YaraValidator::AddSampleFile(absl::string_view filename) {
+  NA_ASSIGN_OR_RETURN(auto file, MappedFile::Open(filename));
+  Sample sample;
+  sample.name = std::string(filename);
+  sample.file = std::move(file);
+  samples_.push_back(std::move(sample));
+  return absl::OkStatus();
+}
+
+void YaraValidator::AddSample(absl::string_view name, std::string data) {
+  Sample sample;
+  sample.name = std::string(name);
+  sample.data = std::move(data);
+  samples_.push_back(std::move(sample));
+}
+
+not_absl::StatusOr<YaraValidationReport> YaraValidator::Validate(
+    absl::string_view rules) const {
+  YR_COMPILER* compiler = nullptr;
+  if (const int error = yr_compiler_create(&compiler);
+      error != ERROR_SUCCESS) {
+    return absl::InternalError(
+        absl::StrCat("Failed to create Yara compiler: ", error));
+  }
+  CompilerMessages messages;
+  yr_compiler_set_callback(compiler, &CompilerCallback, &messages);
+  // libyara expects a NUL-terminated string.
+  const std::string rules_string(rules);
+  const int num_errors = yr_compiler_add_string(
+      compiler, rules_string.c_str(), /*namespace_=*/nullptr);
+  YR_RULES* compiled_rules = nullptr;
+  int error = ERROR_SUCCESS;
+  if (num_errors == 0) {
+    error = yr_compiler_get_rules(compiler, &compiled_rules);
+  }
+  yr_compiler_destroy(compiler);
+  if (num_errors > 0) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("Failed to compile Yara rules: ",
+                     absl::StrJoin(messages.errors, "; ")));
+  }
+  if (error != ERROR_SUCCESS) {
+    return absl::InternalError(
+        absl::StrCat("Failed to get compiled Yara rules: ", error));
+  }
+
+  YaraValidationReport report;
+  report.warnings = std::move(messages.warnings);
+  absl::flat_hash_map<const YR_RULE*, int> rule_indices;
+  std::vector<YR_RULE*> rule_pointers;
+  YR_RULE* rule;
+  yr_rules_foreach(compiled_rules, rule) {
+    rule_indices.emplace(rule, report.rules.size());
+    rule_pointers.push_back(rule);
+    report.rules.push_back({rule->identifier, {}});
+  }
+
+  // Scan with one rule enabled at a time, so that the time of each scan
+  // belongs to a single rule.
+  for (YR_RULE* disabled : rule_pointers) {
+    yr_rule_disable(disabled);
+  }
+  const int timeout_seconds =
+      std::max<int64_t>(1, absl::ToInt64Seconds(scan_timeout_));
+  absl::Status status;
+  for (int i = 0; i < report.rules.size() && status.ok(); ++i) {
+    auto& report_rule = report.rules[i];
+    yr_rule_enable(rule_pointers[i]);
+    for (const auto& sample : samples_) {
+      ScanMatches matches{&rule_indices,
+                          std::vector<bool>(report.rules.size(), false)};
+      const absl::string_view contents = sample.contents();
+      const absl::Time start = absl::Now();
+      error = yr_rules_scan_mem(
+          compiled_rules, reinterpret_cast<const uint8_t*>(contents.data()),
+          contents.size(), SCAN_FLAGS_FAST_MODE, &ScanCallback, &matches,
+          timeout_seconds);
+      report_rule.scan_time += absl::Now() - start;
+      report_rule.bytes_scanned += contents.size();
+      if (error == ERROR_SCAN_TIMEOUT) {
+        report_rule.timed_out_samples.push_back(sample.name);
+        continue;
+      }
+      if (error != ERROR_SUCCESS) {
+        status = absl::InternalError(
+            absl::StrCat("Failed to scan ", sample.name, ": ", error));
+        break;
+      }
+      if (!matches.matched[i]) {
+        report_rule.missed_samples.push_back(sample.name);
+      }
+    }
+    yr_rule_disable(rule_pointers[i]);
+    report.scan_time += report_rule.scan_time;
+    report.bytes_scanned += report_rule.bytes_scanned;
+  }
+  yr_rules_destroy(compiled_rules);
+  NA_RETURN_IF_ERROR(status);
+  return report;
+}
+
+absl::Status CheckYaraValidationReport(const YaraValidationReport& report,
+                                       double min_scan_mb_per_s) {
+  for (const auto& rule : report.rules) {
+    if (!rule.timed_out_samples.empty()) {
+      return absl::DeadlineExceededError(
+          absl::StrCat("Rule ", rule.identifier, " timed out scanning ",
+                       absl::StrJoin(rule.timed_out_samples, ", ")));
+    }
+    if (!rule.missed_samples.empty()) {
+      return absl::FailedPreconditionError(
+          absl::StrCat("Rule ", rule.identifier, " does not match ",
+                       absl::StrJoin(rule.missed_samples, ", ")));
+    }
+    if (rule.bytes_scanned > 0 && rule.scan_mb_per_s() < min_scan_mb_per_s) {
+      return absl::FailedPreconditionError(absl::StrCat(
+          "Rule ", rule.identifier, " scans at ", rule.scan_mb_per_s(),
+          " MiB/s, need at least ", min_scan_mb_per_s, " MiB/s"));
+    }
+  }
+  return absl::OkStatus();
+}
+
+}  // namespace security::vxsig
@@ -0,0 +1,127 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// Validation of formatted Yara rules with libyara. Rules are compiled and
+// scanned against the binaries they were generated from, so that rules that
+// do not compile, miss their own samples or scan slowly are caught at
+// generation time.
+
+#ifndef VXSIG_YARA_VALIDATOR_H_
+#define VXSIG_YARA_VALIDATOR_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/strings/string_view.h"
+#include "absl/time/time.h"
+#include "third_party/zynamics/binexport/util/statusor.h"
+#include "vxsig/mapped_file.h"
+
+namespace security::vxsig {
+
+// Results of validating one compiled unit of Yara rules.
+struct YaraValidationReport {
+  struct Rule {
+    std::string identifier;
+
+    // Names of the samples that the rule did not match.
+    std::vector<std::string> missed_samples;
+
+    // Names of the samples whose scan with this rule timed out. These are
+    // not listed as missed.
+    std::vector<std::string> timed_out_samples;
+
+    // Size of the samples scanned with only this rule enabled and the time
+    // it took to scan them.
+    int64_t bytes_scanned = 0;
+    absl::Duration scan_time;
+
+    // Returns the scan throughput of this rule in MiB/s.
+    double scan_mb_per_s() const;
+  };
+
+  // Rules in the order in which they appear in the compiled unit.
+  std::vector<Rule> rules;
+
+  // Warnings issued by the Yara compiler. These include the warnings about
+  // strings with low quality atoms that slow down scanning.
+  std::vector<std::string> warnings;
+
+  // Totals over the scans of all rules.
+  int64_t bytes_scanned = 0;
+  absl::Duration scan_time;
+
+  // Returns the total scan throughput in MiB/s.
+  double scan_mb_per_s() const;
+};
+
+// Compiles Yara rules and scans a set of samples with them. Each instance
+// keeps libyara initialized for its lifetime.
+class YaraValidator {
+ public:
+  static not_absl::StatusOr<std::unique_ptr<YaraValidator>> Create();
+
+  YaraValidator(const YaraValidator&) = delete;
+  YaraValidator& operator=(const YaraValidator&) = delete;
+
+  ~YaraValidator();
+
+  // Adds a sample that all rules are expected to match.
+  absl::Status AddSampleFile(absl::string_view filename);
+
+  // Like above, but with the sample given in memory.
+  void AddSample(absl::string_view name, std::string data);
+
+  // Sets the timeout for scanning a single sample with a single rule.
+  YaraValidator& set_scan_timeout(absl::Duration timeout) {
+    scan_timeout_ = timeout;
+    return *this;
+  }
+
+  // Compiles the specified rules and scans all samples with each rule on its
+  // own, so that slow rules can be told apart. Returns an InvalidArgument
+  // error with the compiler messages if the rules do not compile.
+  not_absl::StatusOr<YaraValidationReport> Validate(
+      absl::string_view rules) const;
+
+ private:
+  struct Sample {
+    std::string name;
+    std::unique_ptr<MappedFile> file;  // Not set for in-memory samples
+    std::string data;
+
+    absl::string_view contents() const {
+      return file ? file->data() : absl::string_view(data);
+    }
+  };
+
+  YaraValidator() = default;
+
+  std::vector<Sample> samples_;
+  absl::Duration scan_timeout_ = absl::Seconds(10);
+};
+
+// Returns a FailedPrecondition error if any rule in report missed one of its
+// samples or scanned slower than min_scan_mb_per_s, and a DeadlineExceeded
+// error if scanning a sample with one of the rules timed out.
+absl::Status CheckYaraValidationReport(const YaraValidationReport& report,
+                                       double min_scan_mb_per_s);
+
+}  // namespace security::vxsig
+
+#endif  // VXSIG_YARA_VALIDATOR_H_
@@ -0,0 +1,123 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "vxsig/yara_validator.h"
+
+#include <memory>
+#include <utility>
+
+#include "absl/status/status.h"
+#include "absl/time/time.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "third_party/zynamics/binexport/util/status_matchers.h"
+
+using not_absl::IsOk;
+using testing::ElementsAre;
+using testing::Eq;
+using testing::HasSubstr;
+using testing::IsEmpty;
+using testing::Not;
+using testing::SizeIs;
+
+namespace security::vxsig {
+namespace {
+
+constexpr char kRules[] = R"(
+rule one {
+  strings:
+    $ = { 3132[-]3334 }
+  condition:
+    all of them
+}
+rule two {
+  strings:
+    $ = { 3536 }
+  condition:
+    all of them
+})";
+
+class YaraValidatorTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    auto validator_or = YaraValidator::Create();
+    ASSERT_THAT(validator_or.status(), IsOk());
+    validator_ = std::move(validator_or).ValueOrDie();
+  }
+
+  std::unique_ptr<YaraValidator> validator_;
+};
+
+TEST_F(YaraValidatorTest, ReportsMissedSamples) {
+  validator_->AddSample("both", "xx12yy34zz56");
+  validator_->AddSample("first", "12--34");
+  auto report_or = validator_->Validate(kRules);
+  ASSERT_THAT(report_or.status(), IsOk());
+  const auto& report = report_or.ValueOrDie();
+  ASSERT_THAT(report.rules, SizeIs(2));
+  EXPECT_THAT(report.rules[0].identifier, Eq("one"));
+  EXPECT_THAT(report.rules[0].missed_samples, IsEmpty());
+  EXPECT_THAT(report.rules[1].identifier, Eq("two"));
+  EXPECT_THAT(report.rules[1].missed_samples, ElementsAre("first"));
+  // Each rule scans all samples on its own.
+  EXPECT_THAT(report.rules[0].bytes_scanned, Eq(12 + 6));
+  EXPECT_THAT(report.rules[1].bytes_scanned, Eq(12 + 6));
+  EXPECT_THAT(report.bytes_scanned, Eq(2 * (12 + 6)));
+
+  EXPECT_THAT(CheckYaraValidationReport(report, /*min_scan_mb_per_s=*/0)
+                  .message(),
+              HasSubstr("two does not match first"));
+}
+
+TEST_F(YaraValidatorTest, CompilerErrors) {
+  EXPECT_THAT(validator_->Validate("rule { condition: }").status(),
+              Not(IsOk()));
+}
+
+TEST_F(YaraValidatorTest, SlowRulesFail) {
+  validator_->AddSample("sample", "12345678");
+  auto report_or = validator_->Validate(kRules);
+  ASSERT_THAT(report_or.status(), IsOk());
+  const auto& report = report_or.ValueOrDie();
+  EXPECT_THAT(CheckYaraValidationReport(report, /*min_scan_mb_per_s=*/0),
+              IsOk());
+  EXPECT_THAT(CheckYaraValidationReport(report, /*min_scan_mb_per_s=*/1e12),
+              Not(IsOk()));
+}
+
+TEST(CheckYaraValidationReportTest, TimeoutsFail) {
+  YaraValidationReport report;
+  report.rules.push_back({"slow", {}, {"sample"}});
+  const absl::Status status =
+      CheckYaraValidationReport(report, /*min_scan_mb_per_s=*/0);
+  EXPECT_THAT(status.code(), Eq(absl::StatusCode::kDeadlineExceeded));
+  EXPECT_THAT(status.message(), HasSubstr("slow timed out scanning sample"));
+}
+
+TEST(CheckYaraValidationReportTest, ChecksThroughputPerRule) {
+  YaraValidationReport report;
+  report.rules.push_back({"fast", {}, {}, 100 << 20, absl::Seconds(1)});
+  report.rules.push_back({"slow", {}, {}, 1 << 20, absl::Seconds(1)});
+  report.bytes_scanned = 101 << 20;
+  report.scan_time = absl::Seconds(2);
+  EXPECT_THAT(CheckYaraValidationReport(report, /*min_scan_mb_per_s=*/10)
+                  .message(),
+              HasSubstr("slow scans at 1 MiB/s"));
+  EXPECT_THAT(CheckYaraValidationReport(report, /*min_scan_mb_per_s=*/1),
+              IsOk());
+}
+
+}  // namespace
+}  // namespace security::vxsig